@@ -0,0 +1,96 @@
+/*
+ * Counts heap allocations made while filling the request/response maps of a
+ * typical request, with and without the per-request arena.
+ *
+ * g++ -std=c++11 -O2 -I ../ngx_http_hi_module/include arena_alloc.cpp -o arena_alloc
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include "request.hpp"
+#include "response.hpp"
+
+static size_t heap_allocations = 0;
+
+void* operator new(size_t size) {
+    ++heap_allocations;
+    void* p = malloc(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+struct block_t {
+    std::vector<char> data;
+    size_t used;
+};
+
+static void* block_alloc(void* data, size_t size) {
+    block_t* b = (block_t*) data;
+    size = (size + 15) & ~(size_t) 15;
+    if (b->used + size > b->data.size()) {
+        return NULL;
+    }
+    void* p = &b->data[b->used];
+    b->used += size;
+    return p;
+}
+
+static void fill(hi::request& req, hi::response& res) {
+    const char* headers[] = {"Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding", "Connection", "Cookie", "Referer"};
+    for (size_t i = 0; i < sizeof (headers) / sizeof (headers[0]); ++i) {
+        req.headers[headers[i]] = "value";
+    }
+    for (int i = 0; i < 8; ++i) {
+        req.form["k" + std::to_string(i)] = "v";
+        req.cookies["c" + std::to_string(i)] = "v";
+        req.session["s" + std::to_string(i)] = "v";
+    }
+    res.headers.insert(std::make_pair("Cache-Control", "no-cache"));
+    res.session.insert(std::make_pair("last", "now"));
+    res.content = "hello,world";
+    res.status = 200;
+}
+
+int main(int argc, char** argv) {
+    const int n = argc > 1 ? atoi(argv[1]) : 100000;
+    block_t block;
+    block.data.resize(64 * 1024);
+
+    size_t before = heap_allocations;
+    for (int i = 0; i < n; ++i) {
+        hi::request req;
+        hi::response res;
+        fill(req, res);
+    }
+    size_t heap = heap_allocations - before;
+
+    size_t arena_count = 0;
+    before = heap_allocations;
+    for (int i = 0; i < n; ++i) {
+        block.used = 0;
+        hi::arena arena(block_alloc, &block);
+        {
+            hi::request req(&arena);
+            hi::response res(&arena);
+            fill(req, res);
+        }
+        arena_count += arena.count;
+    }
+    size_t arena_heap = heap_allocations - before;
+
+    printf("{\"requests\":%d,\"heap_per_request\":%.1f,\"arena_heap_per_request\":%.1f,\"arena_per_request\":%.1f}\n",
+            n, (double) heap / n, (double) arena_heap / n, (double) arena_count / n);
+    return 0;
+}
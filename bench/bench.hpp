@@ -0,0 +1,152 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+/*
+ * A small subset of the Google Benchmark interface, enough for the
+ * microbenchmarks here without another dependency:
+ *
+ *     static void BM_x(bench::state& state) {
+ *         for (auto _ : state) { ... }
+ *     }
+ *     BENCHMARK(BM_x);
+ *     BENCHMARK_MAIN();
+ *
+ * Each benchmark is run with a growing iteration count until one run takes
+ * --min_time seconds; --json prints one object per benchmark instead of the
+ * table, so that runs on two commits can be diffed by a script. A first call
+ * with no iterations lets a benchmark build expensive data before timing.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+    template<typename T>
+    inline void do_not_optimize(T const& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    class state {
+    public:
+
+        /* marked unused so that "for (auto _ : state)" does not warn */
+        struct __attribute__((unused)) value_t {
+        };
+
+        class iterator {
+        public:
+
+            iterator(size_t n) : n(n) {
+            }
+
+            bool operator!=(const iterator&) const {
+                return this->n != 0;
+            }
+
+            void operator++() {
+                --this->n;
+            }
+
+            value_t operator*() const {
+                return value_t();
+            }
+        private:
+            size_t n;
+        };
+
+        state(size_t iterations) : iterations(iterations), items(0), bytes(0) {
+        }
+
+        iterator begin() {
+            return iterator(this->iterations);
+        }
+
+        iterator end() {
+            return iterator(0);
+        }
+
+        void set_items_processed(size_t n) {
+            this->items = n;
+        }
+
+        void set_bytes_processed(size_t n) {
+            this->bytes = n;
+        }
+
+        size_t iterations, items, bytes;
+    };
+
+    typedef void function_t(state&);
+
+    struct entry_t {
+        const char* name;
+        function_t* f;
+    };
+
+    inline std::vector<entry_t>& registry() {
+        static std::vector<entry_t> benchmarks;
+        return benchmarks;
+    }
+
+    inline int add(const char* name, function_t* f) {
+        registry().push_back({name, f});
+        return 0;
+    }
+
+    inline int run(int argc, char** argv) {
+        double min_time = 0.5;
+        bool json = false;
+        const char* filter = NULL;
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "--json") == 0) {
+                json = true;
+            } else if (strncmp(argv[i], "--min_time=", 11) == 0) {
+                min_time = atof(argv[i] + 11);
+            } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+                filter = argv[i] + 9;
+            }
+        }
+        if (!json) {
+            printf("%-40s %14s %14s %14s\n", "benchmark", "ns/op", "iterations", "MB/s");
+        }
+        for (auto& item : registry()) {
+            if (filter && !strstr(item.name, filter)) {
+                continue;
+            }
+            size_t n = 1;
+            double seconds = 0;
+            state s(0);
+            item.f(s);
+            while (true) {
+                s = state(n);
+                auto start = std::chrono::steady_clock::now();
+                item.f(s);
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (seconds >= min_time || n >= ((size_t) 1 << 40)) {
+                    break;
+                }
+                size_t next = seconds > 0 ? (size_t) (n * (min_time * 1.4 / seconds)) : n * 100;
+                n = next > n * 100 ? n * 100 : (next <= n ? n * 2 : next);
+            }
+            double ns = seconds * 1e9 / n, mbps = s.bytes ? s.bytes / seconds / 1e6 : 0;
+            if (json) {
+                printf("{\"benchmark\":\"%s\",\"ns_per_op\":%.2f,\"iterations\":%zu,\"items_per_second\":%.0f,\"mb_per_second\":%.2f}\n"
+                        , item.name, ns, n, s.items ? s.items / seconds : n / seconds, mbps);
+            } else {
+                printf("%-40s %14.2f %14zu %14.2f\n", item.name, ns, n, mbps);
+            }
+            fflush(stdout);
+        }
+        return 0;
+    }
+}
+
+#define BENCHMARK(f) static int bench_##f = bench::add(#f, f)
+#define BENCHMARK_MAIN() int main(int argc, char** argv) { return bench::run(argc, argv); }
+
+#endif /* BENCH_HPP */
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""
+Compares two result files written by run.sh or `micro --json`, matching runs by
+label and mode (or benchmark name), and prints the relative change.
+
+compare.py old.json new.json
+"""
+import json
+import sys
+
+
+def load(path):
+    runs = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith('{'):
+                run = json.loads(line)
+                key = run.get('benchmark') or '%s (%s)' % (run['label'], run['mode'])
+                runs[key] = run
+    return runs
+
+
+def metrics(run):
+    if 'benchmark' in run:
+        return [('ns/op', run['ns_per_op'], False)]
+    latency = run['latency_us']
+    return [('rps', run['rps'], True), ('p50', latency['p50'], False),
+            ('p99', latency['p99'], False), ('p999', latency['p999'], False)]
+
+
+def main(old_path, new_path):
+    old, new = load(old_path), load(new_path)
+    for key in new:
+        if key not in old:
+            continue
+        cells = []
+        for (name, before, higher_is_better), (_, after, _) in zip(metrics(old[key]), metrics(new[key])):
+            change = (after - before) / before * 100 if before else 0.0
+            better = change > 0 if higher_is_better else change < 0
+            cells.append('%s %.1f -> %.1f (%+.1f%%%s)' % (name, before, after, change, '' if abs(change) < 3 else (' better' if better else ' worse')))
+        print('%-28s %s' % (key, '  '.join(cells)))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.exit(__doc__.strip())
+    main(sys.argv[1], sys.argv[2])
@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# Static file over TLS: fetches a $SIZE file $COUNT times with curl over
+# HTTP/1.1 and HTTP/2 from nginx with "ssl_ktls on", checks every body against
+# the file and writes one JSON line per protocol to $OUT, in the format of
+# ./load so that ./compare.py can match the runs.
+#
+# NGINX=/usr/local/nginx/sbin/nginx [SIZE=16M COUNT=50 KTLS=on] ./ktls.sh
+#
+# /proc/net/tls_stat tells whether the kernel did the encryption; without the
+# tls module both protocols stay on SSL_write().
+
+set -e
+cd "$(dirname "$0")"
+
+NGINX=${NGINX:-/usr/local/nginx/sbin/nginx}
+PORT=${PORT:-18443}
+H2_PORT=${H2_PORT:-18444}
+SIZE=${SIZE:-16M}
+COUNT=${COUNT:-50}
+KTLS=${KTLS:-on}
+OUT=${OUT:-bench-ktls-$(git rev-parse --short HEAD 2>/dev/null || echo local).json}
+
+# nginx takes $NGINX for the list of inherited listening sockets
+export -n NGINX
+
+PREFIX=$(mktemp -d /tmp/hi-bench.XXXXXX)
+chmod 755 "$PREFIX"
+mkdir -p "$PREFIX/conf" "$PREFIX/logs" "$PREFIX/html"
+sed -e "s|@PREFIX@|$PREFIX|g" -e "s|@PORT@|$PORT|g" -e "s|@H2_PORT@|$H2_PORT|g" \
+    -e "s|@KTLS@|$KTLS|g" ktls.conf.in > "$PREFIX/conf/nginx.conf"
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+    -keyout "$PREFIX/conf/key.pem" -out "$PREFIX/conf/cert.pem" 2>/dev/null
+head -c "$SIZE" /dev/urandom > "$PREFIX/html/file.bin"
+SUM=$(sha256sum < "$PREFIX/html/file.bin")
+
+cleanup() {
+    [ -n "$NGINX_PID" ] && kill "$NGINX_PID" 2>/dev/null && wait "$NGINX_PID" 2>/dev/null
+    rm -rf "$PREFIX"
+}
+trap cleanup EXIT
+
+"$NGINX" -p "$PREFIX" -c conf/nginx.conf &
+NGINX_PID=$!
+
+for i in $(seq 50); do
+    curl -sk -o /dev/null "https://127.0.0.1:$PORT/" && break
+    sleep 0.1
+done
+
+tls_tx() {
+    awk '$1 == "TlsTxSw" { print $2 }' /proc/net/tls_stat 2>/dev/null || true
+}
+
+: > "$OUT"
+for proto in http1.1 http2; do
+    port=$PORT
+    [ $proto = http2 ] && port=$H2_PORT
+    url="https://127.0.0.1:$port/file.bin"
+    before=$(tls_tx)
+
+    for i in $(seq "$COUNT"); do
+        t=$(curl -skf --$proto -o "$PREFIX/out" -w '%{time_total}' "$url") || t=error
+        [ "$(sha256sum < "$PREFIX/out")" = "$SUM" ] || t=error
+        echo "$t"
+    done | python3 -c '
+import json, sys
+label, url = sys.argv[1:3]
+lines = sys.stdin.read().split()
+times = sorted(float(t) * 1e6 for t in lines if t != "error")
+pct = lambda p: times[min(len(times) - 1, int(p * len(times)))] if times else 0.0
+print(json.dumps({"label": label, "url": url, "mode": "closed", "connections": 1,
+                  "requests": len(times), "errors": len(lines) - len(times),
+                  "rps": len(times) / (sum(times) / 1e6) if times else 0.0,
+                  "latency_us": {"mean": sum(times) / len(times) if times else 0.0,
+                                 "p50": pct(0.5), "p99": pct(0.99),
+                                 "p999": pct(0.999), "max": times[-1] if times else 0.0}}))
+' "ktls $proto" "$url" | tee -a "$OUT"
+
+    after=$(tls_tx)
+    if [ -n "$before" ]; then
+        echo "$proto: $((after - before)) kTLS tx connections" >&2
+    fi
+done
+
+if [ ! -e /proc/net/tls_stat ]; then
+    echo "no /proc/net/tls_stat: kernel TLS is not available, SSL_write() was used" >&2
+fi
+echo "results in $OUT" >&2
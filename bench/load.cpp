@@ -0,0 +1,287 @@
+/*
+ * HTTP/1.1 keep-alive load generator for the end-to-end runs.
+ *
+ * Closed loop (default): every connection sends its next request as soon as
+ * the previous response is complete, measuring the throughput the server can
+ * sustain. Open loop (-r): requests are scheduled at a fixed total rate and
+ * latency is counted from the scheduled time, so a stalled server is not
+ * hidden by the generator backing off.
+ *
+ * load [-c connections] [-d seconds] [-w warmup] [-r rate] [-l label] [-H header]... http://host:port/path
+ *
+ * Prints one JSON object; latencies are in microseconds.
+ */
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct conn_t {
+    int fd = -1;
+    bool busy = false;
+    uint64_t start = 0;
+    std::string in;
+    std::deque<uint64_t> backlog;
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int open_conn(const struct sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr*) &addr, sizeof (addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static const char* find_header(const std::string& head, const char* name) {
+    size_t len = strlen(name), pos = 0;
+    while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+        pos += 2;
+        if (strncasecmp(head.c_str() + pos, name, len) == 0 && head[pos + len] == ':') {
+            return head.c_str() + pos + len + 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns the size of the first complete response in buf, or 0 when more
+ * data is needed.
+ */
+static size_t parse_response(const std::string& buf, int& status) {
+    size_t end = buf.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        return 0;
+    }
+    std::string head = buf.substr(0, end + 2);
+    status = head.size() > 12 ? atoi(head.c_str() + 9) : 0;
+    size_t body = end + 4;
+    const char* te = find_header(head, "Transfer-Encoding");
+    if (te && strstr(te, "chunked") && strstr(te, "chunked") < strstr(te, "\r\n")) {
+        size_t pos = body;
+        while (true) {
+            size_t eol = buf.find("\r\n", pos);
+            if (eol == std::string::npos) {
+                return 0;
+            }
+            size_t size = strtoul(buf.c_str() + pos, NULL, 16);
+            pos = eol + 2 + size + 2;
+            if (pos > buf.size()) {
+                return 0;
+            }
+            if (size == 0) {
+                return pos;
+            }
+        }
+    }
+    const char* cl = find_header(head, "Content-Length");
+    size_t total = body + (cl ? strtoul(cl, NULL, 10) : 0);
+    return total <= buf.size() ? total : 0;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: load [-c connections] [-d seconds] [-w warmup] [-r rate] [-l label] [-H header]... http://host:port/path\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    int connections = 50, opt;
+    double duration = 10, warmup = 1, rate = 0;
+    std::string label, headers;
+    while ((opt = getopt(argc, argv, "c:d:w:r:l:H:")) != -1) {
+        switch (opt) {
+            case 'c':connections = atoi(optarg);
+                break;
+            case 'd':duration = atof(optarg);
+                break;
+            case 'w':warmup = atof(optarg);
+                break;
+            case 'r':rate = atof(optarg);
+                break;
+            case 'l':label = optarg;
+                break;
+            case 'H':headers.append(optarg).append("\r\n");
+                break;
+            default:usage();
+        }
+    }
+    if (optind >= argc || strncmp(argv[optind], "http://", 7) != 0 || connections < 1) {
+        usage();
+    }
+    std::string url = argv[optind], host = url.substr(7), path = "/", port = "80";
+    size_t slash = host.find('/');
+    if (slash != std::string::npos) {
+        path = host.substr(slash);
+        host.erase(slash);
+    }
+    size_t colon = host.find(':');
+    if (colon != std::string::npos) {
+        port = host.substr(colon + 1);
+        host.erase(colon);
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof (hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", host.c_str());
+        return 1;
+    }
+    struct sockaddr_in addr = *(struct sockaddr_in*) res->ai_addr;
+    freeaddrinfo(res);
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nUser-Agent: hi-bench\r\n" + headers + "\r\n";
+
+    int ep = epoll_create1(0);
+    std::vector<conn_t> conns(connections);
+    for (int i = 0; i < connections; ++i) {
+        if ((conns[i].fd = open_conn(addr)) < 0) {
+            fprintf(stderr, "cannot connect to %s: %s\n", url.c_str(), strerror(errno));
+            return 1;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    }
+
+    std::vector<uint64_t> latencies;
+    uint64_t requests = 0, errors = 0, non_2xx = 0;
+    uint64_t begin = now_ns(), measure = begin + (uint64_t) (warmup * 1e9), finish = measure + (uint64_t) (duration * 1e9);
+    uint64_t interval = rate > 0 ? (uint64_t) (1e9 / rate) : 0, next = begin;
+    size_t rr = 0;
+
+    auto send_request = [&](conn_t & c, uint64_t start) {
+        c.busy = true;
+        c.start = start;
+        if (write(c.fd, request.data(), request.size()) != (ssize_t) request.size()) {
+            c.busy = false;
+            ++errors;
+        }
+    };
+    auto reconnect = [&](int i) {
+        conn_t& c = conns[i];
+        epoll_ctl(ep, EPOLL_CTL_DEL, c.fd, NULL);
+        close(c.fd);
+        c.in.clear();
+        c.busy = false;
+        if ((c.fd = open_conn(addr)) >= 0) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u32 = i;
+            epoll_ctl(ep, EPOLL_CTL_ADD, c.fd, &ev);
+        }
+    };
+    auto next_request = [&](int i) {
+        conn_t& c = conns[i];
+        if (c.fd < 0) {
+            return;
+        }
+        if (!interval) {
+            send_request(c, now_ns());
+        } else if (!c.backlog.empty()) {
+            uint64_t start = c.backlog.front();
+            c.backlog.pop_front();
+            send_request(c, start);
+        }
+    };
+
+    if (!interval) {
+        for (int i = 0; i < connections; ++i) {
+            next_request(i);
+        }
+    }
+    std::vector<struct epoll_event> events(connections);
+    char buf[64 * 1024];
+    uint64_t now;
+    while ((now = now_ns()) < finish) {
+        while (interval && next <= now) {
+            conn_t& c = conns[rr++ % connections];
+            if (c.fd >= 0 && !c.busy) {
+                send_request(c, next);
+            } else {
+                c.backlog.push_back(next);
+            }
+            next += interval;
+        }
+        int timeout = interval ? (int) std::min<uint64_t>((next - now) / 1000000, 100) : 100;
+        int n = epoll_wait(ep, events.data(), connections, timeout);
+        for (int k = 0; k < n; ++k) {
+            int i = events[k].data.u32;
+            conn_t& c = conns[i];
+            ssize_t got;
+            while ((got = read(c.fd, buf, sizeof (buf))) > 0) {
+                c.in.append(buf, got);
+            }
+            int status;
+            size_t used;
+            while ((used = parse_response(c.in, status)) > 0) {
+                c.in.erase(0, used);
+                uint64_t done = now_ns();
+                if (c.start >= measure && done < finish) {
+                    ++requests;
+                    latencies.push_back(done - c.start);
+                    if (status < 200 || status > 299) {
+                        ++non_2xx;
+                    }
+                }
+                c.busy = false;
+                next_request(i);
+            }
+            if (got == 0 || (got < 0 && errno != EAGAIN)) {
+                if (c.busy) {
+                    ++errors;
+                }
+                reconnect(i);
+                next_request(i);
+            }
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) -> double {
+        if (latencies.empty()) {
+            return 0;
+        }
+        size_t i = std::min(latencies.size() - 1, (size_t) (p * latencies.size()));
+        return latencies[i] / 1000.0;
+    };
+    double mean = 0;
+    for (uint64_t v : latencies) {
+        mean += v / 1000.0;
+    }
+    if (!latencies.empty()) {
+        mean /= latencies.size();
+    }
+    printf("{\"label\":\"%s\",\"url\":\"%s\",\"mode\":\"%s\",\"connections\":%d,\"rate\":%.0f,\"duration\":%.1f"
+            ",\"requests\":%lu,\"errors\":%lu,\"non_2xx\":%lu,\"rps\":%.1f"
+            ",\"latency_us\":{\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n"
+            , label.c_str(), url.c_str(), interval ? "open" : "closed", connections, rate, duration
+            , (unsigned long) requests, (unsigned long) errors, (unsigned long) non_2xx, requests / duration
+            , mean, percentile(0.50), percentile(0.99), percentile(0.999), latencies.empty() ? 0 : latencies.back() / 1000.0);
+    return 0;
+}
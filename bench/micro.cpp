@@ -0,0 +1,204 @@
+/*
+ * Microbenchmarks for the request hot paths of the hi module: query and
+ * cookie parsing, multipart bodies, the response cache, the header copy into
+ * the request maps, route matching and the runner wire format.
+ *
+ * make micro && ./micro [--json] [--min_time=0.5] [--filter=name]
+ */
+#include <string>
+#include <vector>
+#include "bench.hpp"
+#include "request.hpp"
+#include "response.hpp"
+#include "route.hpp"
+#include "lib/param.hpp"
+#include "lib/lrucache.hpp"
+#include "lib/router.hpp"
+#include "lib/runner.hpp"
+#include "lib/MPFDParser-1.1.1/Parser.h"
+
+struct block_t {
+    std::vector<char> data;
+    size_t used;
+};
+
+static void* block_alloc(void* data, size_t size) {
+    block_t* b = (block_t*) data;
+    size = (size + 15) & ~(size_t) 15;
+    if (b->used + size > b->data.size()) {
+        return NULL;
+    }
+    void* p = &b->data[b->used];
+    b->used += size;
+    return p;
+}
+
+static const char* QUERY = "id=1024&name=hi-nginx&page=3&size=20&sort=created_at&order=desc&q=hello+world&lang=en";
+static const char* COOKIE = "SESSIONID=5d41402abc4b2a76b9719d911017c592; theme=dark; lang=en; _ga=GA1.2.123456789.1500000000";
+
+static const char* HEADERS[][2] = {
+    {"Host", "localhost"},
+    {"User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/90.0 Safari/537.36"},
+    {"Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8"},
+    {"Accept-Language", "en-US,en;q=0.5"},
+    {"Accept-Encoding", "gzip, deflate, br"},
+    {"Connection", "keep-alive"},
+    {"Cookie", COOKIE},
+    {"Referer", "http://localhost/index.html"},
+    {"Cache-Control", "max-age=0"},
+    {"Upgrade-Insecure-Requests", "1"}
+};
+
+static void BM_parser_param_query(bench::state& state) {
+    std::string data(QUERY);
+    for (auto _ : state) {
+        hi::string_map form;
+        hi::parser_param(data, form);
+        bench::do_not_optimize(form);
+    }
+    state.set_bytes_processed(state.iterations * data.size());
+}
+BENCHMARK(BM_parser_param_query);
+
+static void BM_parser_param_cookie(bench::state& state) {
+    std::string data(COOKIE);
+    for (auto _ : state) {
+        hi::string_map cookies;
+        hi::parser_param(data, cookies, ';');
+        bench::do_not_optimize(cookies);
+    }
+    state.set_bytes_processed(state.iterations * data.size());
+}
+BENCHMARK(BM_parser_param_cookie);
+
+static std::string multipart_body(const std::string& boundary, size_t fields, size_t size) {
+    std::string body;
+    for (size_t i = 0; i < fields; ++i) {
+        body.append("--").append(boundary).append("\r\n")
+                .append("Content-Disposition: form-data; name=\"field").append(std::to_string(i)).append("\"\r\n\r\n")
+                .append(size, 'a' + i % 26).append("\r\n");
+    }
+    body.append("--").append(boundary).append("--\r\n");
+    return body;
+}
+
+static void BM_mpfd_parser(bench::state& state) {
+    std::string boundary = "----hiBenchBoundary7MA4YWxkTrZu0gW", body = multipart_body(boundary, 8, 512)
+            , content_type = "multipart/form-data; boundary=" + boundary;
+    for (auto _ : state) {
+        MPFD::Parser parser;
+        parser.SetUploadedFilesStorage(MPFD::Parser::StoreUploadedFilesInMemory);
+        parser.SetMaxCollectedDataLength(1024 * 1024);
+        parser.SetContentType(content_type);
+        parser.AcceptSomeData(body.data(), body.size());
+        bench::do_not_optimize(parser.GetFieldsMap().size());
+    }
+    state.set_bytes_processed(state.iterations * body.size());
+}
+BENCHMARK(BM_mpfd_parser);
+
+struct cache_ele_t {
+    int status = 200;
+    time_t t;
+    std::string content_type, content;
+};
+
+static void BM_lru_cache_hit(bench::state& state) {
+    hi::cache::lru_cache<std::string, cache_ele_t> cache(1024);
+    std::vector<std::string> keys;
+    cache_ele_t ele;
+    ele.content_type = "text/html;charset=UTF-8";
+    ele.content.assign(1024, 'x');
+    for (int i = 0; i < 1024; ++i) {
+        keys.push_back(std::to_string(i * 7919));
+        cache.put(keys.back(), ele);
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        const std::string& k = keys[i++ & 1023];
+        if (cache.exists(k)) {
+            bench::do_not_optimize(cache.get(k).content.size());
+        }
+    }
+}
+BENCHMARK(BM_lru_cache_hit);
+
+static void BM_lru_cache_churn(bench::state& state) {
+    hi::cache::lru_cache<std::string, cache_ele_t> cache(1024);
+    cache_ele_t ele;
+    ele.content.assign(1024, 'x');
+    size_t i = 0;
+    for (auto _ : state) {
+        cache.put(std::to_string(i++), ele);
+    }
+}
+BENCHMARK(BM_lru_cache_churn);
+
+static void BM_header_map_heap(bench::state& state) {
+    for (auto _ : state) {
+        hi::string_map headers;
+        for (auto& h : HEADERS) {
+            headers[h[0]] = std::string(h[1]);
+        }
+        bench::do_not_optimize(headers);
+    }
+}
+BENCHMARK(BM_header_map_heap);
+
+static void BM_header_map_arena(bench::state& state) {
+    block_t block;
+    block.data.resize(64 * 1024);
+    for (auto _ : state) {
+        block.used = 0;
+        hi::arena pool(block_alloc, &block);
+        hi::request req(&pool);
+        for (auto& h : HEADERS) {
+            req.headers[h[0]] = std::string(h[1]);
+        }
+        bench::do_not_optimize(req.headers);
+    }
+}
+BENCHMARK(BM_header_map_arena);
+
+static void noop(hi::request& req, hi::response& res) {
+}
+
+static void BM_router_match(bench::state& state) {
+    hi::router router("bench");
+    std::string err;
+    const char* patterns[] = {"/", "/api/users", "/api/users/:id", "/api/users/:id/orders", "/api/orders/:id", "/static/*path"};
+    for (const char* p : patterns) {
+        router.add("GET", p, noop, err);
+    }
+    std::string path = "/api/users/1024/orders", allow;
+    for (auto _ : state) {
+        hi::route_handler_t* handler = NULL;
+        hi::string_map captures;
+        bench::do_not_optimize(router.match("GET", path, handler, captures, allow));
+    }
+}
+BENCHMARK(BM_router_match);
+
+static void BM_runner_roundtrip(bench::state& state) {
+    hi::request req;
+    req.uri = "/api/users/1024";
+    req.method = "GET";
+    req.client = "127.0.0.1";
+    req.param = QUERY;
+    hi::parser_param(req.param, req.form);
+    for (auto& h : HEADERS) {
+        req.headers[h[0]] = std::string(h[1]);
+    }
+    std::string wire;
+    for (auto _ : state) {
+        wire.clear();
+        hi::runner::packer(wire).put(req);
+        hi::request out;
+        hi::runner::unpacker(wire).get(out);
+        bench::do_not_optimize(out);
+    }
+    state.set_bytes_processed(state.iterations * wire.size());
+}
+BENCHMARK(BM_runner_roundtrip);
+
+BENCHMARK_MAIN();
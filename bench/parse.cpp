@@ -0,0 +1,274 @@
+/*
+ * Request line and header parsing of the nginx core with the SIMD skips
+ * switched off, SSE4.2 only and AVX2 (as far as the CPU has them), and a
+ * differential fuzzer that feeds mutated requests in random chunks to the
+ * scalar and the SIMD parsers and fails on the first difference in return
+ * codes, states, offsets, hashes or lowercased names.
+ *
+ * Links the parser objects of a configured and built tree:
+ *
+ * make parse [NGX_OBJS=../objs] && ./parse [--json] [--min_time=0.5] [--filter=name]
+ * ./parse --fuzz=100000 [--seed=1]
+ */
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "bench.hpp"
+
+/* the parser only calls these on paths the benchmarks and the fuzzer skip */
+
+ngx_uint_t ngx_cacheline_size;
+
+void ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err, const char *fmt, ...) {
+}
+
+void* ngx_pnalloc(ngx_pool_t *pool, size_t size) {
+    return NULL;
+}
+
+ngx_int_t ngx_strncasecmp(u_char *s1, u_char *s2, size_t n) {
+    return strncasecmp((char*) s1, (char*) s2, n);
+}
+
+u_char* ngx_strlcasestrn(u_char *s1, u_char *last, u_char *s2, size_t n) {
+    return NULL;
+}
+
+void ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type) {
+}
+
+static const char* REQUEST =
+        "GET /api/v1/users/1024/orders/recent/items?page=3&size=20&sort=created_at&order=desc HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/90.0.4430.93 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: SESSIONID=5d41402abc4b2a76b9719d911017c592; theme=dark; lang=en; _ga=GA1.2.123456789.1500000000\r\n"
+        "Referer: https://www.example.com/api/v1/users/1024/orders?page=2&size=20\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "\r\n";
+
+static ngx_uint_t cpu_sse42, cpu_avx2;
+
+static void use(int level) {
+    ngx_cpu_sse42 = level >= 1 ? cpu_sse42 : 0;
+    ngx_cpu_avx2 = level >= 2 ? cpu_avx2 : 0;
+}
+
+static ngx_http_request_t* new_request() {
+    return (ngx_http_request_t*) calloc(1, sizeof (ngx_http_request_t));
+}
+
+static void parse_request_line(bench::state& state, int level) {
+    std::string data(REQUEST);
+    ngx_http_request_t* r = new_request();
+    ngx_buf_t b;
+    use(level);
+    for (auto _ : state) {
+        r->state = 0;
+        b.pos = (u_char*) &data[0];
+        b.last = b.pos + data.size();
+        bench::do_not_optimize(ngx_http_parse_request_line(r, &b));
+    }
+    state.set_bytes_processed(state.iterations * (data.find("\r\n") + 2));
+    free(r);
+}
+
+static void parse_header_lines(bench::state& state, int level) {
+    std::string data(REQUEST);
+    size_t start = data.find("\r\n") + 2;
+    ngx_http_request_t* r = new_request();
+    ngx_buf_t b;
+    use(level);
+    for (auto _ : state) {
+        r->state = 0;
+        b.pos = (u_char*) &data[start];
+        b.last = (u_char*) &data[0] + data.size();
+        while (ngx_http_parse_header_line(r, &b, 1) == NGX_OK) {
+        }
+        bench::do_not_optimize(r->header_hash);
+    }
+    state.set_bytes_processed(state.iterations * (data.size() - start));
+    free(r);
+}
+
+static void BM_request_line_scalar(bench::state& state) {
+    parse_request_line(state, 0);
+}
+BENCHMARK(BM_request_line_scalar);
+
+static void BM_request_line_sse42(bench::state& state) {
+    parse_request_line(state, 1);
+}
+BENCHMARK(BM_request_line_sse42);
+
+static void BM_request_line_avx2(bench::state& state) {
+    parse_request_line(state, 2);
+}
+BENCHMARK(BM_request_line_avx2);
+
+static void BM_header_lines_scalar(bench::state& state) {
+    parse_header_lines(state, 0);
+}
+BENCHMARK(BM_header_lines_scalar);
+
+static void BM_header_lines_sse42(bench::state& state) {
+    parse_header_lines(state, 1);
+}
+BENCHMARK(BM_header_lines_sse42);
+
+static void BM_header_lines_avx2(bench::state& state) {
+    parse_header_lines(state, 2);
+}
+BENCHMARK(BM_header_lines_avx2);
+
+/*
+ * Everything the rest of nginx reads after a parser call, with pointers as
+ * offsets into the input.
+ */
+static std::string trace(const std::string& data, const std::vector<size_t>& cuts, int level) {
+    std::vector<u_char> in(data.begin(), data.end());
+    u_char* base = in.data();
+    ngx_http_request_t* r = new_request();
+    ngx_buf_t b;
+    std::string out;
+    char line[512];
+    auto off = [base](u_char * p) -> long {
+        return p ? p - base : -1;
+    };
+
+    use(level);
+    b.pos = base;
+    size_t k = 0;
+    b.last = base + cuts[k];
+    bool headers = false;
+    while (true) {
+        ngx_int_t rc;
+        if (!headers) {
+            rc = ngx_http_parse_request_line(r, &b);
+            snprintf(line, sizeof (line), "R %ld pos=%ld state=%lu req=%ld,%ld method=%ld,%lu uri=%ld,%ld ext=%ld args=%ld"
+                    " schema=%ld,%ld host=%ld,%ld port=%ld,%ld proto=%ld http=%u.%u flags=%d%d%d%d\n"
+                    , (long) rc, off(b.pos), (unsigned long) r->state, off(r->request_start), off(r->request_end)
+                    , off(r->method_end), (unsigned long) r->method, off(r->uri_start), off(r->uri_end), off(r->uri_ext)
+                    , off(r->args_start), off(r->schema_start), off(r->schema_end), off(r->host_start), off(r->host_end)
+                    , off(r->port_start), off(r->port_end), off(r->http_protocol.data), r->http_major, r->http_minor
+                    , r->complex_uri, r->quoted_uri, r->plus_in_uri, r->space_in_uri);
+        } else {
+            rc = ngx_http_parse_header_line(r, &b, k & 1);
+            snprintf(line, sizeof (line), "H %ld pos=%ld state=%lu name=%ld,%ld value=%ld,%ld hash=%lu lc=%lu invalid=%d\n"
+                    , (long) rc, off(b.pos), (unsigned long) r->state, off(r->header_name_start), off(r->header_name_end)
+                    , off(r->header_start), off(r->header_end), (unsigned long) r->header_hash
+                    , (unsigned long) r->lowcase_index, r->invalid_header);
+        }
+        out.append(line);
+        if (headers && rc == NGX_OK) {
+            out.append((char*) r->lowcase_header, ngx_min(r->lowcase_index, NGX_HTTP_LC_HEADER_LEN)).append("\n");
+        }
+        if (rc == NGX_AGAIN) {
+            if (++k == cuts.size()) {
+                break;
+            }
+            b.last = base + cuts[k];
+        } else if (rc == NGX_OK && !headers) {
+            headers = true;
+        } else if (rc != NGX_OK) {
+            break;
+        }
+    }
+    free(r);
+    return out;
+}
+
+static int fuzz(unsigned long iterations, unsigned long seed) {
+    static const char special[] = {'\0', ' ', '\t', '\r', '\n', '%', '/', '?', '#', '.', '+', '\\', ':', '_', '-', 'H', '\x80', '\xff'};
+    std::mt19937 rng(seed);
+    std::string request(REQUEST);
+
+    /* every byte value in a long URI and header value run, at every lane */
+    for (int c = 0; c < 256; ++c) {
+        for (size_t at = 0; at < 64; ++at) {
+            std::string run(96, 'a'), data;
+            run[at] = (char) c;
+            data = "GET /" + run + " HTTP/1.1\r\nX-Run: " + run + "\r\n\r\n";
+            std::vector<size_t> cuts(1, data.size());
+            std::string scalar = trace(data, cuts, 0);
+            for (int level = 1; level <= 2; ++level) {
+                if (trace(data, cuts, level) != scalar) {
+                    fprintf(stderr, "mismatch for byte 0x%02x at %zu (level %d)\n", c, at, level);
+                    return 1;
+                }
+            }
+        }
+    }
+    for (unsigned long i = 0; i < iterations; ++i) {
+        std::string data = request;
+        if (i % 5 == 0) {
+            data.resize(rng() % data.size());
+        }
+        for (size_t n = rng() % 6; n > 0 && !data.empty(); --n) {
+            size_t at = rng() % data.size();
+            switch (rng() % 4) {
+                case 0:data[at] = special[rng() % sizeof (special)];
+                    break;
+                case 1:data[at] = (char) rng();
+                    break;
+                case 2:data.insert(at, std::string(rng() % 64, 'a' + rng() % 26));
+                    break;
+                default:data.erase(at, rng() % 16);
+            }
+        }
+        if (data.empty()) {
+            continue;
+        }
+        std::vector<size_t> cuts;
+        for (size_t n = rng() % 4; n > 0; --n) {
+            cuts.push_back(1 + rng() % data.size());
+        }
+        cuts.push_back(data.size());
+        std::sort(cuts.begin(), cuts.end());
+        std::string scalar = trace(data, cuts, 0);
+        for (int level = 1; level <= 2; ++level) {
+            if (trace(data, cuts, level) != scalar) {
+                fprintf(stderr, "mismatch at iteration %lu (seed %lu, level %d), input:\n", i, seed, level);
+                fwrite(data.data(), 1, data.size(), stderr);
+                fprintf(stderr, "\nscalar:\n%s\nsimd:\n%s", scalar.c_str(), trace(data, cuts, level).c_str());
+                return 1;
+            }
+        }
+    }
+    printf("%lu inputs, no differences (sse42=%lu avx2=%lu)\n", iterations, (unsigned long) cpu_sse42, (unsigned long) cpu_avx2);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    unsigned long iterations = 0, seed = 1;
+    ngx_cpuinfo();
+    cpu_sse42 = ngx_cpu_sse42;
+    cpu_avx2 = ngx_cpu_avx2;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--fuzz=", 7) == 0) {
+            iterations = strtoul(argv[i] + 7, NULL, 10);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = strtoul(argv[i] + 7, NULL, 10);
+        }
+    }
+    if (iterations) {
+        return fuzz(iterations, seed);
+    }
+    if (!cpu_avx2 || !cpu_sse42) {
+        fprintf(stderr, "note: sse42=%lu avx2=%lu, the missing levels run scalar\n", (unsigned long) cpu_sse42, (unsigned long) cpu_avx2);
+    }
+    return bench::run(argc, argv);
+}
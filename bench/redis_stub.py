@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""
+In-memory stand-in for the redis commands the hi module issues for sessions
+(HGETALL, HMSET, HSET, HDEL, EXISTS, TTL, EXPIRE, DEL) plus GET/SET/PING, so
+that the end-to-end runs do not depend on a redis installation. Expiry is
+accepted and ignored.
+
+redis_stub.py [port]
+"""
+import asyncio
+import sys
+
+DATA = {}
+
+
+async def read_command(reader):
+    line = await reader.readline()
+    if not line:
+        return None
+    if not line.startswith(b'*'):
+        return line.split()
+    args = []
+    for _ in range(int(line[1:])):
+        size = int((await reader.readline())[1:])
+        args.append((await reader.readexactly(size + 2))[:-2])
+    return args
+
+
+def bulk(value):
+    if value is None:
+        return b'$-1\r\n'
+    return b'$%d\r\n%s\r\n' % (len(value), value)
+
+
+def execute(args):
+    cmd = args[0].upper()
+    if cmd == b'PING':
+        return b'+PONG\r\n'
+    if cmd == b'GET':
+        value = DATA.get(args[1])
+        return bulk(value if isinstance(value, bytes) else None)
+    if cmd == b'SET':
+        DATA[args[1]] = args[2]
+        return b'+OK\r\n'
+    if cmd in (b'HMSET', b'HSET'):
+        fields = DATA.setdefault(args[1], {})
+        for i in range(2, len(args) - 1, 2):
+            fields[args[i]] = args[i + 1]
+        return b'+OK\r\n' if cmd == b'HMSET' else b':%d\r\n' % ((len(args) - 2) // 2)
+    if cmd == b'HDEL':
+        fields = DATA.get(args[1], {})
+        removed = sum(1 for k in args[2:] if fields.pop(k, None) is not None)
+        if not fields:
+            DATA.pop(args[1], None)
+        return b':%d\r\n' % removed
+    if cmd == b'EXISTS':
+        return b':%d\r\n' % sum(1 for k in args[1:] if k in DATA)
+    if cmd == b'TTL':
+        return b':%d\r\n' % (-1 if args[1] in DATA else -2)
+    if cmd == b'HGETALL':
+        fields = DATA.get(args[1], {})
+        out = [b'*%d\r\n' % (len(fields) * 2)]
+        for k, v in fields.items():
+            out.append(bulk(k))
+            out.append(bulk(v))
+        return b''.join(out)
+    if cmd == b'EXPIRE':
+        return b':%d\r\n' % (1 if args[1] in DATA else 0)
+    if cmd == b'DEL':
+        return b':%d\r\n' % sum(1 for k in args[1:] if DATA.pop(k, None) is not None)
+    return b'-ERR unknown command\r\n'
+
+
+async def serve(reader, writer):
+    try:
+        while True:
+            args = await read_command(reader)
+            if not args:
+                break
+            writer.write(execute(args))
+            await writer.drain()
+    except (ConnectionError, asyncio.IncompleteReadError):
+        pass
+    writer.close()
+
+
+async def main(port):
+    server = await asyncio.start_server(serve, '127.0.0.1', port)
+    async with server:
+        await server.serve_forever()
+
+
+if __name__ == '__main__':
+    asyncio.run(main(int(sys.argv[1]) if len(sys.argv) > 1 else 6379))
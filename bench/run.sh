@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# End-to-end run: starts nginx with the sample servlets and the redis stand-in
+# under a scratch prefix, drives every location with ./load and writes one JSON
+# line per run to $OUT, named after the current commit by default.
+#
+# NGINX=/usr/local/nginx/sbin/nginx [CONNECTIONS=50 DURATION=10 RATE=5000 TARGETS="cpp lua"] ./run.sh
+#
+# RATE adds an open-loop run at that many requests per second next to the
+# closed-loop one. Compare two commits with ./compare.py old.json new.json.
+
+set -e
+cd "$(dirname "$0")"
+
+NGINX=${NGINX:-/usr/local/nginx/sbin/nginx}
+PORT=${PORT:-18080}
+REDIS_PORT=${REDIS_PORT:-16379}
+CONNECTIONS=${CONNECTIONS:-50}
+DURATION=${DURATION:-10}
+RATE=${RATE:-}
+TARGETS=${TARGETS:-static cpp cpp/cache cpp/session lua python}
+OUT=${OUT:-bench-$(git rev-parse --short HEAD 2>/dev/null || echo local).json}
+
+# nginx takes $NGINX for the list of inherited listening sockets
+export -n NGINX
+
+make -s load servlets
+
+PREFIX=$(mktemp -d /tmp/hi-bench.XXXXXX)
+chmod 755 "$PREFIX"
+mkdir -p "$PREFIX/conf" "$PREFIX/logs" "$PREFIX/hi"
+cp servlets/*.so servlets/hello.lua servlets/hello.py "$PREFIX/hi/"
+sed -e "s|@PREFIX@|$PREFIX|g" -e "s|@PORT@|$PORT|g" -e "s|@REDIS_PORT@|$REDIS_PORT|g" nginx.conf.in > "$PREFIX/conf/nginx.conf"
+
+cleanup() {
+    [ -n "$NGINX_PID" ] && kill "$NGINX_PID" 2>/dev/null && wait "$NGINX_PID" 2>/dev/null
+    [ -n "$REDIS_PID" ] && kill "$REDIS_PID" 2>/dev/null
+    rm -rf "$PREFIX"
+}
+trap cleanup EXIT
+
+python3 redis_stub.py "$REDIS_PORT" &
+REDIS_PID=$!
+"$NGINX" -p "$PREFIX" -c conf/nginx.conf &
+NGINX_PID=$!
+
+for i in $(seq 50); do
+    curl -s -o /dev/null "http://127.0.0.1:$PORT/static" && break
+    sleep 0.1
+done
+
+: > "$OUT"
+for target in $TARGETS; do
+    url="http://127.0.0.1:$PORT/$target"
+    ./load -c "$CONNECTIONS" -d "$DURATION" -l "$target" -H "Cookie: SESSIONID=hi-bench" "$url" | tee -a "$OUT"
+    if [ -n "$RATE" ]; then
+        ./load -c "$CONNECTIONS" -d "$DURATION" -r "$RATE" -l "$target" -H "Cookie: SESSIONID=hi-bench" "$url" | tee -a "$OUT"
+    fi
+done
+echo "results in $OUT" >&2
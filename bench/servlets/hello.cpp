@@ -0,0 +1,21 @@
+#include "servlet.hpp"
+namespace hi{
+class hello : public servlet {
+    public:
+
+        void handler(request& req, response& res) {
+            res.headers.find("Content-Type")->second = "text/plain;charset=UTF-8";
+            res.content = "hello,world";
+            res.status = 200;
+        }
+
+    };
+}
+
+extern "C" hi::servlet* create() {
+    return new hi::hello();
+}
+
+extern "C" void destroy(hi::servlet* p) {
+    delete p;
+}
@@ -0,0 +1,3 @@
+hi_res.header('Content-Type', 'text/plain;charset=UTF-8')
+hi_res.content('hello,world')
+hi_res.status(200)
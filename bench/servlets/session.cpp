@@ -0,0 +1,28 @@
+#include <string>
+#include "servlet.hpp"
+namespace hi{
+class session : public servlet {
+    public:
+
+        void handler(request& req, response& res) {
+            int n = 0;
+            auto it = req.session.find("n");
+            if (it != req.session.end()) {
+                n = std::stoi(it->second);
+            }
+            res.session.insert(std::make_pair("n", std::to_string(n + 1)));
+            res.headers.find("Content-Type")->second = "text/plain;charset=UTF-8";
+            res.content = std::to_string(n);
+            res.status = 200;
+        }
+
+    };
+}
+
+extern "C" hi::servlet* create() {
+    return new hi::session();
+}
+
+extern "C" void destroy(hi::servlet* p) {
+    delete p;
+}
@@ -0,0 +1,232 @@
+/*
+ * Event timers in the rbtree and in the timing wheel ("timer_wheel on") at
+ * 100k and 1M pending timers: re-arming a timer, as every read and write on
+ * a keepalive or websocket connection does, and the expiry of a steady
+ * stream of timeouts. --check=N drives both with the same random operations
+ * and fails when they expire different timers or the wheel would sleep past
+ * the nearest timer.
+ *
+ * make timer [NGX_OBJS=../objs] && ./timer [--json] [--min_time=0.5] [--filter=name]
+ * ./timer --check=1000000 [--seed=1]
+ */
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "bench.hpp"
+
+volatile ngx_msec_t ngx_current_msec;
+
+static std::vector<ngx_event_t>* events;
+static std::mt19937 rng(1);
+static std::vector<size_t> expired;
+
+/* keepalive and websocket idle timeouts, 1..120 s */
+static ngx_msec_t timeout() {
+    return 1000 + rng() % 119000;
+}
+
+static void rearm(ngx_event_t* ev) {
+    ev->timedout = 0;
+    ngx_add_timer(ev, timeout());
+}
+
+static void record(ngx_event_t* ev) {
+    expired.push_back(ev - &(*events)[0]);
+}
+
+/* the timers are kept between the runs of a benchmark, only one set exists */
+static std::vector<ngx_event_t>& setup(size_t n, int wheel) {
+    static std::vector<ngx_event_t> evs;
+    static int current = -1;
+    if (evs.size() == n && current == wheel) {
+        return evs;
+    }
+    current = wheel;
+    ngx_current_msec = 1000000;
+    ngx_event_timer_wheel = wheel;
+    ngx_event_timer_init(NULL);
+    evs.assign(n, ngx_event_t());
+    events = &evs;
+    rng.seed(1);
+    for (auto& ev : evs) {
+        ev.handler = rearm;
+        ngx_add_timer(&ev, timeout());
+    }
+    return evs;
+}
+
+/* every operation moves a random timer by more than the lazy delay */
+static void rearm_timers(bench::state& state, size_t n, int wheel) {
+    std::vector<ngx_event_t>& evs = setup(n, wheel);
+    std::vector<uint32_t> order(1 << 16);
+    for (auto& i : order) {
+        i = rng() % n;
+    }
+    size_t k = 0;
+    for (auto _ : state) {
+        ngx_event_t* ev = &evs[order[k++ & 0xffff]];
+        ngx_add_timer(ev, ev->timer.key - ngx_current_msec > 60000 ? 1000 + k % 50000 : 70000 + k % 50000);
+    }
+    state.set_items_processed(state.iterations);
+}
+
+/* time moves 1 ms per iteration, the expired timers are armed again */
+static void expire_timers(bench::state& state, size_t n, int wheel) {
+    setup(n, wheel);
+    for (auto _ : state) {
+        ngx_current_msec++;
+        bench::do_not_optimize(ngx_event_find_timer());
+        ngx_event_expire_timers();
+    }
+    state.set_items_processed(state.iterations);
+}
+
+static void BM_rearm_rbtree_100k(bench::state& state) {
+    rearm_timers(state, 100000, 0);
+}
+BENCHMARK(BM_rearm_rbtree_100k);
+
+static void BM_rearm_wheel_100k(bench::state& state) {
+    rearm_timers(state, 100000, 1);
+}
+BENCHMARK(BM_rearm_wheel_100k);
+
+static void BM_rearm_rbtree_1m(bench::state& state) {
+    rearm_timers(state, 1000000, 0);
+}
+BENCHMARK(BM_rearm_rbtree_1m);
+
+static void BM_rearm_wheel_1m(bench::state& state) {
+    rearm_timers(state, 1000000, 1);
+}
+BENCHMARK(BM_rearm_wheel_1m);
+
+static void BM_expire_1ms_rbtree_100k(bench::state& state) {
+    expire_timers(state, 100000, 0);
+}
+BENCHMARK(BM_expire_1ms_rbtree_100k);
+
+static void BM_expire_1ms_wheel_100k(bench::state& state) {
+    expire_timers(state, 100000, 1);
+}
+BENCHMARK(BM_expire_1ms_wheel_100k);
+
+static void BM_expire_1ms_rbtree_1m(bench::state& state) {
+    expire_timers(state, 1000000, 0);
+}
+BENCHMARK(BM_expire_1ms_rbtree_1m);
+
+static void BM_expire_1ms_wheel_1m(bench::state& state) {
+    expire_timers(state, 1000000, 1);
+}
+BENCHMARK(BM_expire_1ms_wheel_1m);
+
+/*
+ * Both implementations are initialized once and kept side by side, the flag
+ * selects the one the timer calls go to.
+ */
+static int check(unsigned long steps, unsigned long seed) {
+    const size_t n = 4096;
+    std::vector<ngx_event_t> tree(n), wheel(n);
+    std::mt19937 ops(seed);
+    auto timeouts = [&ops]() -> ngx_msec_t {
+        switch (ops() % 4) {
+            case 0: return ops() % 64;
+            case 1: return ops() % 5000;
+            case 2: return ops() % 300000;
+            default: return ops() % 100000000;
+        }
+    };
+
+    ngx_current_msec = (ngx_msec_t) -1 - 100000;
+    ngx_event_timer_wheel = 1;
+    ngx_event_timer_init(NULL);
+    for (size_t i = 0; i < n; ++i) {
+        tree[i].handler = record;
+        wheel[i].handler = record;
+    }
+
+    for (unsigned long step = 0; step < steps; ++step) {
+        size_t i = ops() % n;
+        switch (ops() % 8) {
+            case 0: case 1: case 2: {
+                ngx_msec_t t = timeouts();
+                ngx_event_timer_wheel = 0;
+                ngx_add_timer(&tree[i], t);
+                ngx_event_timer_wheel = 1;
+                ngx_add_timer(&wheel[i], t);
+                break;
+            }
+            case 3:
+                ngx_event_timer_wheel = 0;
+                if (tree[i].timer_set) {
+                    ngx_del_timer(&tree[i]);
+                }
+                ngx_event_timer_wheel = 1;
+                if (wheel[i].timer_set) {
+                    ngx_del_timer(&wheel[i]);
+                }
+                break;
+            default: {
+                ngx_event_timer_wheel = 0;
+                ngx_msec_t exact = ngx_event_find_timer();
+                ngx_event_timer_wheel = 1;
+                ngx_msec_t bound = ngx_event_find_timer();
+                if ((exact == NGX_TIMER_INFINITE) != (bound == NGX_TIMER_INFINITE) || (exact != NGX_TIMER_INFINITE && bound > exact)) {
+                    fprintf(stderr, "step %lu: wheel sleeps %lu ms, nearest timer in %lu ms\n", step, (unsigned long) bound, (unsigned long) exact);
+                    return 1;
+                }
+                /* sleep as the event loop would, sometimes less */
+                ngx_msec_t sleep = bound == NGX_TIMER_INFINITE ? 1000 : ops() % 2 ? bound : ops() % (bound + 1);
+                ngx_current_msec += std::max<ngx_msec_t>(sleep, 1);
+                std::vector<size_t> a, b;
+                events = &tree;
+                expired.clear();
+                ngx_event_timer_wheel = 0;
+                ngx_event_expire_timers();
+                a.swap(expired);
+                events = &wheel;
+                ngx_event_timer_wheel = 1;
+                ngx_event_expire_timers();
+                b.swap(expired);
+                std::sort(a.begin(), a.end());
+                std::sort(b.begin(), b.end());
+                if (a != b) {
+                    fprintf(stderr, "step %lu: rbtree expired %zu timers, wheel %zu\n", step, a.size(), b.size());
+                    return 1;
+                }
+                for (size_t j = 0; j < n; ++j) {
+                    if (tree[j].timer_set != wheel[j].timer_set) {
+                        fprintf(stderr, "step %lu: timer %zu set in one only\n", step, j);
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    printf("%lu steps, no differences\n", steps);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    unsigned long steps = 0, seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--check=", 8) == 0) {
+            steps = strtoul(argv[i] + 8, NULL, 10);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = strtoul(argv[i] + 7, NULL, 10);
+        }
+    }
+    if (steps) {
+        return check(steps, seed);
+    }
+    return bench::run(argc, argv);
+}
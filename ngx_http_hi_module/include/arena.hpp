@@ -0,0 +1,92 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+
+namespace hi {
+
+    /*
+     * A bump allocator borrowed from the host: the hi module backs it with the
+     * request pool, so nothing allocated here is freed one by one.
+     */
+    class arena {
+    public:
+        typedef void* alloc_t(void* data, size_t size);
+
+        arena(alloc_t* alloc, void* data)
+        : count(0)
+        , bytes(0)
+        , alloc(alloc)
+        , data(data) {
+        }
+
+        virtual~arena() = default;
+
+        void* allocate(size_t size) {
+            ++this->count;
+            this->bytes += size;
+            return this->alloc(this->data, size);
+        }
+
+        size_t count, bytes;
+    private:
+        alloc_t* alloc;
+        void* data;
+    };
+
+    template <typename T>
+    class allocator {
+    public:
+        typedef T value_type;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        allocator(arena* pool = 0) noexcept : pool(pool) {
+        }
+
+        template <typename U>
+        allocator(const allocator<U>& other) noexcept : pool(other.pool) {
+        }
+
+        T* allocate(size_t n) {
+            if (this->pool) {
+                void* p = this->pool->allocate(n * sizeof (T));
+                if (p == 0) {
+                    throw std::bad_alloc();
+                }
+                return static_cast<T*> (p);
+            }
+            return static_cast<T*> (::operator new(n * sizeof (T)));
+        }
+
+        void deallocate(T* p, size_t) noexcept {
+            if (!this->pool) {
+                ::operator delete(p);
+            }
+        }
+
+        arena* pool;
+    };
+
+    template <typename T, typename U>
+    bool operator==(const allocator<T>& a, const allocator<U>& b) noexcept {
+        return a.pool == b.pool;
+    }
+
+    template <typename T, typename U>
+    bool operator!=(const allocator<T>& a, const allocator<U>& b) noexcept {
+        return a.pool != b.pool;
+    }
+
+    typedef std::unordered_map<std::string, std::string, std::hash<std::string>, std::equal_to<std::string>
+    , allocator<std::pair<const std::string, std::string>>> string_map;
+    typedef std::unordered_multimap<std::string, std::string, std::hash<std::string>, std::equal_to<std::string>
+    , allocator<std::pair<const std::string, std::string>>> string_multimap;
+}
+
+#endif /* ARENA_HPP */
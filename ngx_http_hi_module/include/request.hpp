@@ -2,27 +2,88 @@
 #define REQUEST_HPP
 
 #include <string>
-#include <unordered_map>
+#include <vector>
+#include <functional>
+#include "arena.hpp"
+#include "shared_dict.hpp"
 
 namespace hi {
 
+    class request;
+    class response;
+
+    struct subrequest_t {
+
+        subrequest_t(const std::string& uri, const std::string& args) :
+        uri(uri)
+        , args(args)
+        , status(0)
+        , content_type()
+        , content() {
+        }
+        std::string uri, args;
+        int status;
+        std::string content_type, content;
+    };
+
+    typedef std::function<void(request&, response&) > continuation_t;
+
     class request {
     public:
 
-        request() :
+        request(arena* pool = 0) :
         client()
         , user_agent()
         , method()
         , uri()
         , param()
-        , headers()
-        , form()
-        , cookies()
-        , session() {
+        , body(0)
+        , body_len(0)
+        , headers(string_map::allocator_type(pool))
+        , form(string_map::allocator_type(pool))
+        , cookies(string_map::allocator_type(pool))
+        , session(string_map::allocator_type(pool))
+        , captures(string_map::allocator_type(pool))
+        , subrequests()
+        , continuation()
+        , shared_dicts(0) {
         }
         virtual~request() = default;
+
+        /*
+         * Queue a subrequest to a proxy/memcached/redis2-style location. Queued
+         * subrequests run in parallel once the handler returns; their status,
+         * content type and body are filled in before the continuation runs.
+         */
+        void fetch(const std::string& uri, const std::string& args = std::string()) {
+            this->subrequests.push_back(subrequest_t(uri, args));
+        }
+
+        void then(const continuation_t& f) {
+            this->continuation = f;
+        }
+
+        /*
+         * The zone declared by "hi_shared_dict name size", or NULL.
+         */
+        shared_dict* dict(const std::string& name) const {
+            if (this->shared_dicts) {
+                auto it = this->shared_dicts->find(name);
+                if (it != this->shared_dicts->end()) {
+                    return it->second.get();
+                }
+            }
+            return 0;
+        }
+
         std::string client, user_agent, method, uri, param;
-        std::unordered_map<std::string, std::string> headers, form, cookies, session;
+        /* raw request body held by the host; empty when it went to a temp file */
+        const char* body;
+        size_t body_len;
+        string_map headers, form, cookies, session, captures;
+        std::vector<subrequest_t> subrequests;
+        continuation_t continuation;
+        const shared_dicts_t* shared_dicts;
     };
 }
 
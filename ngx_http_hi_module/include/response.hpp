@@ -2,26 +2,26 @@
 #define RESPONSE_HPP
 
 #include <string>
-#include <unordered_map>
+#include "arena.hpp"
 
 namespace hi {
 
     class response {
     public:
 
-        response() :
+        response(arena* pool = 0) :
         status(404)
         , content("<p style='text-align:center;margin:100px;'>404 Not Found</p>")
-        , headers()
-        , session() {
+        , headers(string_multimap::allocator_type(pool))
+        , session(string_map::allocator_type(pool)) {
             this->headers.insert(std::make_pair("Content-Type", "text/html;charset=UTF-8"));
         }
         virtual~response() = default;
 
         int status;
         std::string content;
-        std::unordered_multimap<std::string, std::string> headers;
-        std::unordered_map<std::string, std::string> session;
+        string_multimap headers;
+        string_map session;
     };
 }
 
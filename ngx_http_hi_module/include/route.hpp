@@ -0,0 +1,30 @@
+#ifndef ROUTE_HPP
+#define ROUTE_HPP
+
+#include "request.hpp"
+#include "response.hpp"
+
+namespace hi {
+
+    typedef void route_handler_t(request& req, response& res);
+
+    /*
+     * One entry of the table a route module exports through
+     *     extern "C" const hi::route_t* routes();
+     * The table ends with an entry whose pattern is NULL.
+     *
+     * method  : "GET", "POST", ... or "*" for any method.
+     * pattern : e.g. "/users/:id"; a ":name" segment captures one segment,
+     *           a final "*name" segment captures the rest of the path.
+     *           Captures are stored in request::captures.
+     */
+    struct route_t {
+        const char* method;
+        const char* pattern;
+        route_handler_t* handler;
+    };
+
+    typedef const route_t* routes_t();
+}
+
+#endif /* ROUTE_HPP */
@@ -0,0 +1,40 @@
+#ifndef SHARED_DICT_HPP
+#define SHARED_DICT_HPP
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+namespace hi {
+
+    /*
+     * A key/value zone declared with hi_shared_dict and shared by every
+     * worker. ttl is in seconds and 0 keeps an entry until it is evicted;
+     * a full zone makes room by dropping its least recently used entries.
+     */
+    class shared_dict {
+    public:
+        virtual~shared_dict() = default;
+
+        virtual bool get(const std::string& key, std::string& value) = 0;
+
+        virtual bool set(const std::string& key, const std::string& value, double ttl = 0) = 0;
+
+        /*
+         * Like set, but fails when the key is already there.
+         */
+        virtual bool add(const std::string& key, const std::string& value, double ttl = 0) = 0;
+
+        /*
+         * Adds delta to an integer value, a missing key counting as 0 and
+         * getting ttl. Fails when the value is not an integer.
+         */
+        virtual bool incr(const std::string& key, long long delta, long long& value, double ttl = 0) = 0;
+
+        virtual bool del(const std::string& key) = 0;
+    };
+
+    typedef std::unordered_map<std::string, std::shared_ptr<shared_dict>> shared_dicts_t;
+}
+
+#endif /* SHARED_DICT_HPP */
@@ -0,0 +1,73 @@
+#ifndef WEBSOCKET_HPP
+#define WEBSOCKET_HPP
+
+#include <cstdint>
+#include <string>
+#include "request.hpp"
+
+namespace hi {
+
+    /*
+     * One upgraded connection. It is owned by the host and stays valid from
+     * on_open until on_close returns.
+     */
+    class websocket_connection {
+    public:
+        websocket_connection() = default;
+        virtual~websocket_connection() = default;
+
+        /*
+         * Queues one message and writes as much as the socket takes. Returns
+         * false, dropping the message, when the connection is closing or more
+         * than hi_websocket_max_pending bytes are still waiting.
+         */
+        virtual bool send(const char* data, size_t len, bool binary = false) = 0;
+
+        bool send(const std::string& data, bool binary = false) {
+            return this->send(data.data(), data.size(), binary);
+        }
+
+        /* bytes queued and not yet written */
+        virtual size_t pending() const = 0;
+
+        virtual void close(uint16_t code = 1000) = 0;
+
+        virtual void subscribe(const std::string& channel) = 0;
+        virtual void unsubscribe(const std::string& channel) = 0;
+
+        /*
+         * Sends to every subscriber of channel in this worker, this connection
+         * included if it subscribed; the frame is built once for all of them.
+         * Returns how many subscribers accepted it.
+         */
+        virtual size_t publish(const std::string& channel, const char* data, size_t len, bool binary = false) = 0;
+
+        size_t publish(const std::string& channel, const std::string& data, bool binary = false) {
+            return this->publish(channel, data.data(), data.size(), binary);
+        }
+    };
+
+    /*
+     * A module loaded by hi_websocket exports create/destroy like a servlet;
+     * every connection gets its own instance, so it can keep its state in
+     * members. data passed to on_message points into the host's read buffer
+     * and is only valid during the call.
+     */
+    class websocket {
+    public:
+        websocket() = default;
+        virtual~websocket() = default;
+
+        virtual void on_open(request& req, websocket_connection& conn) {
+        }
+
+        virtual void on_message(websocket_connection& conn, const char* data, size_t len, bool binary) = 0;
+
+        virtual void on_close(websocket_connection& conn, uint16_t code) {
+        }
+        typedef websocket * create_t();
+        typedef void destroy_t(websocket *);
+    };
+}
+
+#endif /* WEBSOCKET_HPP */
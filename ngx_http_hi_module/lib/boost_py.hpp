@@ -19,6 +19,7 @@ namespace hi {
         boost_py() :
         main()
         , dict()
+        , req_obj()
         , res(0)
         , error_message("<p style='text-align:center;margin:100px;'>Server script error</p>") {
             Py_Initialize();
@@ -37,21 +38,37 @@ namespace hi {
                     .def("get_header", &hi::py_request::get_header)
                     .def("get_cookie", &hi::py_request::get_cookie)
                     .def("get_form", &hi::py_request::get_form)
-                    .def("get_session", &hi::py_request::get_session);
+                    .def("get_session", &hi::py_request::get_session)
+                    .add_property("headers", &boost_py::headers)
+                    .add_property("form", &boost_py::form)
+                    .add_property("cookies", &boost_py::cookies)
+                    .add_property("session", &boost_py::session)
+                    .add_property("body", &boost_py::body)
+                    .def("dict", &boost_py::dict_of);
+            this->dict["hi_shared_dict"] = boost::python::class_<hi::shared_dict, boost::noncopyable>("hi_shared_dict", boost::python::no_init)
+                    .def("get", &boost_py::dict_get)
+                    .def("set", &boost_py::dict_set, (boost::python::arg("self"), boost::python::arg("key"), boost::python::arg("value"), boost::python::arg("ttl") = 0.0))
+                    .def("add", &boost_py::dict_add, (boost::python::arg("self"), boost::python::arg("key"), boost::python::arg("value"), boost::python::arg("ttl") = 0.0))
+                    .def("incr", &boost_py::dict_incr, (boost::python::arg("self"), boost::python::arg("key"), boost::python::arg("delta") = 1, boost::python::arg("ttl") = 0.0))
+                    .def("delete", &hi::shared_dict::del);
             this->dict["hi_response"] = boost::python::class_<hi::py_response>("hi_response")
                     .def("status", &hi::py_response::status)
-                    .def("content", &hi::py_response::content)
+                    .def("content", &boost_py::content)
                     .def("header", &hi::py_response::header)
                     .def("session", &hi::py_response::session);
         }
 
         virtual~boost_py() {
+            this->req_obj = boost::python::object();
+            this->dict = boost::python::object();
+            this->main = boost::python::object();
             Py_Finalize();
             this->res = 0;
         }
 
         void set_req(py_request* req) {
-            this->dict["hi_req"] = boost::python::ptr(req);
+            this->req_obj = boost::python::object(boost::python::ptr(req));
+            this->dict["hi_req"] = this->req_obj;
         }
 
         void set_res(py_response* res) {
@@ -68,6 +85,7 @@ namespace hi {
                     this->res->status(500);
                     this->res->content(this->error_message);
                 }
+                this->release_body();
             }
         }
 
@@ -79,13 +97,148 @@ namespace hi {
                 this->res->status(500);
                 this->res->content(this->error_message);
             }
+            this->release_body();
         }
 
         void clear_error() {
             PyErr_Clear();
         }
     private:
-        boost::python::object main, dict;
+
+        /*
+         * Read-only mappings over the request maps, built on first use and
+         * kept in the instance dict of hi_req for the rest of the request.
+         */
+        template<typename map_t>
+        static boost::python::object mapping(boost::python::back_reference<const py_request&>& self, const char* name, const map_t& m) {
+            boost::python::object cache = self.source().attr("__dict__");
+            PyObject* found = PyDict_GetItemString(cache.ptr(), name);
+            if (found) {
+                return boost::python::object(boost::python::handle<>(boost::python::borrowed(found)));
+            }
+            boost::python::dict d;
+            for (auto& item : m) {
+                d[boost::python::str(item.first.data(), item.first.size())] = boost::python::str(item.second.data(), item.second.size());
+            }
+            boost::python::object proxy(boost::python::handle<>(PyDictProxy_New(d.ptr())));
+            cache[name] = proxy;
+            return proxy;
+        }
+
+        static boost::python::object headers(boost::python::back_reference<const py_request&> self) {
+            return mapping(self, "_hi_headers", self.get().get()->headers);
+        }
+
+        static boost::python::object form(boost::python::back_reference<const py_request&> self) {
+            return mapping(self, "_hi_form", self.get().get()->form);
+        }
+
+        static boost::python::object cookies(boost::python::back_reference<const py_request&> self) {
+            return mapping(self, "_hi_cookies", self.get().get()->cookies);
+        }
+
+        static boost::python::object session(boost::python::back_reference<const py_request&> self) {
+            return mapping(self, "_hi_session", self.get().get()->session);
+        }
+
+        /*
+         * A read-only view of the body in nginx memory; it is released when
+         * the script returns, so it must not be kept across requests.
+         */
+        static boost::python::object body(boost::python::back_reference<const py_request&> self) {
+            boost::python::object cache = self.source().attr("__dict__");
+            PyObject* found = PyDict_GetItemString(cache.ptr(), "_hi_body");
+            if (found) {
+                return boost::python::object(boost::python::handle<>(boost::python::borrowed(found)));
+            }
+            const request* req = self.get().get();
+            char* data = (char*) (req->body ? req->body : "");
+#if PY_MAJOR_VERSION >= 3
+            boost::python::object view(boost::python::handle<>(PyMemoryView_FromMemory(data, req->body_len, PyBUF_READ)));
+#else
+            boost::python::object view(boost::python::handle<>(PyBuffer_FromMemory(data, req->body_len)));
+#endif
+            cache["_hi_body"] = view;
+            return view;
+        }
+
+        /*
+         * Accepts str as before, and bytes, bytearray or any contiguous
+         * buffer, which are copied straight into the response.
+         */
+        static void content(py_response& self, boost::python::object data) {
+            response* res = self.get();
+            PyObject* o = data.ptr();
+            if (PyUnicode_Check(o)) {
+#if PY_MAJOR_VERSION >= 3
+                Py_ssize_t len;
+                const char* p = PyUnicode_AsUTF8AndSize(o, &len);
+                if (p == NULL) {
+                    boost::python::throw_error_already_set();
+                }
+                res->content.assign(p, len);
+#else
+                boost::python::object utf8(boost::python::handle<>(PyUnicode_AsUTF8String(o)));
+                res->content.assign(PyString_AS_STRING(utf8.ptr()), PyString_GET_SIZE(utf8.ptr()));
+#endif
+                return;
+            }
+            Py_buffer view;
+            if (PyObject_GetBuffer(o, &view, PyBUF_SIMPLE) != 0) {
+                boost::python::throw_error_already_set();
+            }
+            res->content.assign((const char*) view.buf, view.len);
+            PyBuffer_Release(&view);
+        }
+
+        /*
+         * hi_req.dict(name) returns the hi_shared_dict or None; get and incr
+         * return None where the C++ call fails.
+         */
+        static boost::python::object dict_of(const py_request& self, const std::string& name) {
+            hi::shared_dict* d = self.get()->dict(name);
+            return d ? boost::python::object(boost::python::ptr(d)) : boost::python::object();
+        }
+
+        static boost::python::object dict_get(hi::shared_dict& d, const std::string& key) {
+            std::string value;
+            return d.get(key, value) ? boost::python::str(value.data(), value.size()) : boost::python::object();
+        }
+
+        static bool dict_set(hi::shared_dict& d, const std::string& key, const std::string& value, double ttl) {
+            return d.set(key, value, ttl);
+        }
+
+        static bool dict_add(hi::shared_dict& d, const std::string& key, const std::string& value, double ttl) {
+            return d.add(key, value, ttl);
+        }
+
+        static boost::python::object dict_incr(hi::shared_dict& d, const std::string& key, long long delta, double ttl) {
+            long long value;
+            return d.incr(key, delta, value, ttl) ? boost::python::object(value) : boost::python::object();
+        }
+
+        void release_body() {
+#if PY_MAJOR_VERSION >= 3
+            PyObject* cache = PyObject_GetAttrString(this->req_obj.ptr(), "__dict__");
+            if (cache == NULL) {
+                PyErr_Clear();
+                return;
+            }
+            PyObject* view = PyDict_GetItemString(cache, "_hi_body");
+            if (view) {
+                PyObject* r = PyObject_CallMethod(view, (char*) "release", NULL);
+                if (r == NULL) {
+                    PyErr_Clear();
+                } else {
+                    Py_DECREF(r);
+                }
+            }
+            Py_DECREF(cache);
+#endif
+        }
+
+        boost::python::object main, dict, req_obj;
         py_response* res;
         std::string error_message;
     };
@@ -0,0 +1,222 @@
+#ifndef CACHE_SNAPSHOT_HPP
+#define CACHE_SNAPSHOT_HPP
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define SNAPSHOT_MAGIC "HICACHE1"
+
+namespace hi {
+    namespace cache {
+
+        /*
+         * On-disk image of one lru_cache: a header followed by packed records,
+         * most recently used first. The file is written once on worker exit and
+         * mapped read-only by the next generation of workers.
+         */
+        class snapshot {
+        private:
+
+            struct header_t {
+                char magic[8];
+                uint64_t fingerprint_len, count;
+            };
+
+            struct entry_t {
+                int64_t t;
+                int32_t status;
+                uint32_t key_len, content_type_len;
+                uint64_t content_len;
+            };
+
+        public:
+
+            struct record_t {
+                const char *key, *content_type, *content;
+                size_t key_len, content_type_len, content_len;
+                time_t t;
+                int status;
+            };
+
+            snapshot() : fingerprint(), addr(MAP_FAILED), size(0), records() {
+            }
+
+            virtual~snapshot() {
+                this->close();
+            }
+
+            bool open(const std::string& path, const std::string& fingerprint) {
+                this->close();
+                this->fingerprint = fingerprint;
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd == -1) {
+                    return false;
+                }
+                struct stat st;
+                if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof (header_t)) {
+                    ::close(fd);
+                    return false;
+                }
+                this->addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                ::close(fd);
+                if (this->addr == MAP_FAILED) {
+                    return false;
+                }
+                this->size = st.st_size;
+                if (!this->index()) {
+                    this->close();
+                    return false;
+                }
+                return true;
+            }
+
+            void close() {
+                if (this->addr != MAP_FAILED) {
+                    munmap(this->addr, this->size);
+                    this->addr = MAP_FAILED;
+                    this->size = 0;
+                }
+                this->records.clear();
+            }
+
+            bool is_open()const {
+                return this->addr != MAP_FAILED;
+            }
+
+            const std::vector<record_t>& get_records()const {
+                return this->records;
+            }
+
+            class writer {
+            public:
+
+                writer(const std::string& path, const std::string& fingerprint)
+                : path(path)
+                , temp(path + ".tmp")
+                , fp(fopen(this->temp.c_str(), "wb"))
+                , fingerprint_len(fingerprint.size())
+                , count(0)
+                , ok(fp != NULL) {
+                    header_t h;
+                    memset(&h, 0, sizeof (header_t));
+                    this->write(&h, sizeof (header_t));
+                    this->write(fingerprint.data(), fingerprint.size());
+                }
+
+                virtual~writer() {
+                    if (this->fp) {
+                        fclose(this->fp);
+                        unlink(this->temp.c_str());
+                    }
+                }
+
+                void put(const std::string& key, time_t t, int status, const std::string& content_type, const std::string& content) {
+                    entry_t e;
+                    e.t = t;
+                    e.status = status;
+                    e.key_len = key.size();
+                    e.content_type_len = content_type.size();
+                    e.content_len = content.size();
+                    this->write(&e, sizeof (entry_t));
+                    this->write(key.data(), key.size());
+                    this->write(content_type.data(), content_type.size());
+                    this->write(content.data(), content.size());
+                    ++this->count;
+                }
+
+                bool commit() {
+                    if (!this->ok) {
+                        return false;
+                    }
+                    header_t h;
+                    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof (h.magic));
+                    h.fingerprint_len = this->fingerprint_len;
+                    h.count = this->count;
+                    if (fseek(this->fp, 0, SEEK_SET) != 0) {
+                        return false;
+                    }
+                    this->write(&h, sizeof (header_t));
+                    if (fclose(this->fp) != 0) {
+                        this->fp = NULL;
+                        return false;
+                    }
+                    this->fp = NULL;
+                    return this->ok && rename(this->temp.c_str(), this->path.c_str()) == 0;
+                }
+
+            private:
+
+                void write(const void* data, size_t len) {
+                    if (this->ok && len > 0 && fwrite(data, 1, len, this->fp) != len) {
+                        this->ok = false;
+                    }
+                }
+
+                std::string path, temp;
+                FILE* fp;
+                uint64_t fingerprint_len, count;
+                bool ok;
+            };
+
+        private:
+
+            bool index() {
+                const char *p = (const char*) this->addr, *end = p + this->size;
+                header_t h;
+                memcpy(&h, p, sizeof (header_t));
+                p += sizeof (header_t);
+                if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof (h.magic)) != 0
+                        || h.fingerprint_len != this->fingerprint.size()
+                        || (size_t) (end - p) < h.fingerprint_len
+                        || memcmp(p, this->fingerprint.data(), h.fingerprint_len) != 0) {
+                    return false;
+                }
+                p += h.fingerprint_len;
+                this->records.reserve(std::min<uint64_t>(h.count, (end - p) / sizeof (entry_t)));
+                for (uint64_t i = 0; i < h.count; ++i) {
+                    entry_t e;
+                    if ((size_t) (end - p) < sizeof (entry_t)) {
+                        return false;
+                    }
+                    memcpy(&e, p, sizeof (entry_t));
+                    p += sizeof (entry_t);
+                    if ((uint64_t) (end - p) < (uint64_t) e.key_len + e.content_type_len + e.content_len) {
+                        return false;
+                    }
+                    record_t r;
+                    r.t = e.t;
+                    r.status = e.status;
+                    r.key = p;
+                    r.key_len = e.key_len;
+                    p += e.key_len;
+                    r.content_type = p;
+                    r.content_type_len = e.content_type_len;
+                    p += e.content_type_len;
+                    r.content = p;
+                    r.content_len = e.content_len;
+                    p += e.content_len;
+                    this->records.push_back(r);
+                }
+                return true;
+            }
+
+            std::string fingerprint;
+            void* addr;
+            size_t size;
+            std::vector<record_t> records;
+        };
+
+    } // namespace cache
+
+}//namespace hi
+
+#endif /* CACHE_SNAPSHOT_HPP */
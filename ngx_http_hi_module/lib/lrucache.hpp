@@ -34,6 +34,11 @@ namespace hi {
                 return this->_cache_.contains(key);
             }
 
+            template<typename F>
+            void walk(F& f) const {
+                this->_cache_.cwalk(f);
+            }
+
             virtual~lru_cache() {
 
             }
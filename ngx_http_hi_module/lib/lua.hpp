@@ -49,6 +49,7 @@ namespace hi {
         }
 
         void set_res(py_response* res) {
+            this->res = res;
             this->state["hi_res"] = res;
         }
 
@@ -68,7 +69,62 @@ namespace hi {
             }
         }
 
+        lua_State* get_state() {
+            return this->state.state();
+        }
+
+        /*
+         * Loads a chunk into a new coroutine anchored in the registry. The
+         * chunk runs with its own globals table holding hi_req and hi_res and
+         * falling back to _G, so suspended requests never see each other.
+         * Returns NULL with an empty err when the script file is missing.
+         */
+        lua_State* spawn(const std::string& chunk, bool is_file, py_request* req, py_response* res, int& ref, std::string& err) {
+            if (is_file && access(chunk.c_str(), F_OK) != 0) {
+                return NULL;
+            }
+            lua_State* L = this->state.state();
+            lua_State* co = lua_newthread(L);
+            ref = luaL_ref(L, LUA_REGISTRYINDEX);
+            int rc = is_file ? luaL_loadfile(co, chunk.c_str()) : luaL_loadbuffer(co, chunk.data(), chunk.size(), "hi_lua_content");
+            if (rc != 0) {
+                err = lua_tostring(co, -1) ? lua_tostring(co, -1) : "unknown error";
+                this->release(ref);
+                res->status(500);
+                res->content(this->error_message);
+                return NULL;
+            }
+            lua_createtable(co, 0, 2);
+            kaguya::util::push_args(co, req);
+            lua_setfield(co, -2, "hi_req");
+            kaguya::util::push_args(co, res);
+            lua_setfield(co, -2, "hi_res");
+            lua_createtable(co, 0, 1);
+            lua_pushvalue(co, LUA_GLOBALSINDEX);
+            lua_setfield(co, -2, "__index");
+            lua_setmetatable(co, -2);
+            lua_setfenv(co, -2);
+            return co;
+        }
 
+        /*
+         * Returns LUA_YIELD while the coroutine waits, 0 once it has finished,
+         * or a Lua error code with err set; on error the response becomes 500.
+         */
+        int resume(lua_State* co, int nargs, py_response* res, std::string& err) {
+            int rc = lua_resume(co, nargs);
+            if (rc != 0 && rc != LUA_YIELD) {
+                err = lua_tostring(co, -1) ? lua_tostring(co, -1) : "unknown error";
+                lua_settop(co, 0);
+                res->status(500);
+                res->content(this->error_message);
+            }
+            return rc;
+        }
+
+        void release(int ref) {
+            luaL_unref(this->state.state(), LUA_REGISTRYINDEX, ref);
+        }
 
     private:
         std::string error_message;
@@ -19,7 +19,8 @@ namespace hi {
         return std::string(it, rit.base());
     }
 
-    static void parser_param(const std::string& data, std::unordered_map<std::string, std::string>& result, char c = '&', char cc = '=') {
+    template<typename map_t>
+    static void parser_param(const std::string& data, map_t& result, char c = '&', char cc = '=') {
         if (data.empty())return;
         size_t start = 0, p, q;
         while (true) {
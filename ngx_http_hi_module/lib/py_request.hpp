@@ -22,6 +22,10 @@ namespace hi {
             this->req = req;
         }
 
+        const request* get()const {
+            return this->req;
+        }
+
         std::string uri()const {
             return this->req->uri;
         }
@@ -21,6 +21,10 @@ namespace hi {
             this->res = res;
         }
 
+        response* get()const {
+            return this->res;
+        }
+
         void status(int c) {
             this->res->status = c;
         }
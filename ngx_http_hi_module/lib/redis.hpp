@@ -14,7 +14,8 @@ namespace hi {
         redis() :
         content(0)
         , host()
-        , port(0) {
+        , port(0)
+        , pending(0) {
         }
 
         virtual~redis() {
@@ -35,6 +36,7 @@ namespace hi {
         void reconnect() {
             if (!this->is_connected()) {
                 redisFree(this->content);
+                this->pending = 0;
                 this->content = redisConnect(this->host.c_str(), this->port);
                 if (this->content && this->content->err == 0) {
                     redisEnableKeepAlive(this->content);
@@ -169,7 +171,8 @@ namespace hi {
             return result;
         }
 
-        void hgetall(const std::string& key, std::unordered_map<std::string, std::string>& kvlist) {
+        template<typename map_t>
+        void hgetall(const std::string& key, map_t& kvlist) {
             redisReply* reply = (redisReply*) redisCommand(this->content, "HGETALL %s ", key.c_str());
             std::string k, v;
             for (size_t i = 0; i < reply->elements; ++++i) {
@@ -214,7 +217,8 @@ namespace hi {
             return result;
         }
 
-        void hmset(const std::string& key, const std::unordered_map<std::string, std::string>& kvlist) {
+        template<typename map_t>
+        void hmset(const std::string& key, const map_t& kvlist) {
             std::string cmd("HMSET " + key + " ");
             for (const auto& item : kvlist) {
                 cmd.append(item.first + " " + item.second + " ");
@@ -298,6 +302,63 @@ namespace hi {
             return result;
         }
 
+        /*
+         * append_* only queue a command; flush() sends all of them in one
+         * write and drains their replies.
+         */
+        template<typename map_t>
+        void append_hmset(const std::string& key, const map_t& kvlist) {
+            std::vector<const char*> argv;
+            std::vector<size_t> argvlen;
+            argv.push_back("HMSET");
+            argvlen.push_back(5);
+            argv.push_back(key.data());
+            argvlen.push_back(key.size());
+            for (const auto& item : kvlist) {
+                argv.push_back(item.first.data());
+                argvlen.push_back(item.first.size());
+                argv.push_back(item.second.data());
+                argvlen.push_back(item.second.size());
+            }
+            if (redisAppendCommandArgv(this->content, argv.size(), argv.data(), argvlen.data()) == REDIS_OK) {
+                ++this->pending;
+            }
+        }
+
+        template<typename list_t>
+        void append_hdel(const std::string& key, const list_t& fields) {
+            std::vector<const char*> argv;
+            std::vector<size_t> argvlen;
+            argv.push_back("HDEL");
+            argvlen.push_back(4);
+            argv.push_back(key.data());
+            argvlen.push_back(key.size());
+            for (const auto& item : fields) {
+                argv.push_back(item.data());
+                argvlen.push_back(item.size());
+            }
+            if (redisAppendCommandArgv(this->content, argv.size(), argv.data(), argvlen.data()) == REDIS_OK) {
+                ++this->pending;
+            }
+        }
+
+        void append_expire(const std::string& key, long long expires) {
+            if (redisAppendCommand(this->content, "EXPIRE %b %lld", key.data(), key.size(), expires) == REDIS_OK) {
+                ++this->pending;
+            }
+        }
+
+        void flush() {
+            redisReply* reply;
+            for (; this->pending > 0; --this->pending) {
+                if (redisGetReply(this->content, (void**) &reply) != REDIS_OK) {
+                    this->pending = 0;
+                    break;
+                }
+                freeReplyObject(reply);
+            }
+        }
+
         void rename(const std::string& old_key, const std::string& new_key) {
             redisReply* reply = (redisReply*) redisCommand(this->content, "RENAME %s %s", old_key.c_str(), new_key.c_str());
             freeReplyObject(reply);
@@ -306,6 +367,7 @@ namespace hi {
         redisContext* content;
         std::string host;
         int port;
+        size_t pending;
     };
 }
 
@@ -0,0 +1,197 @@
+#ifndef ROUTER_HPP
+#define ROUTER_HPP
+
+#include <dlfcn.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "../include/route.hpp"
+
+namespace hi {
+
+    /*
+     * Segment trie built from the route table of one module. A lookup walks
+     * the path once; at every level a static segment is tried before a
+     * ":param", and a "*wildcard" is the last resort.
+     */
+    class router {
+    public:
+
+        router(const std::string& module) : module(module), dll_handle(NULL), root(std::make_shared<node_t>()) {
+        }
+
+        virtual~router() {
+            this->root.reset();
+            if (this->dll_handle) {
+                dlclose(this->dll_handle);
+            }
+        }
+
+        const std::string& get_module()const {
+            return this->module;
+        }
+
+        bool load(std::string& err) {
+            this->dll_handle = dlopen(this->module.c_str(), RTLD_LAZY);
+            if (!this->dll_handle) {
+                err = dlerror();
+                return false;
+            }
+            dlerror();
+            routes_t* routes = (routes_t*) dlsym(this->dll_handle, "routes");
+            const char* e = dlerror();
+            if (e) {
+                err = e;
+                return false;
+            }
+            for (const route_t* item = routes(); item && item->pattern; ++item) {
+                if (!item->method || !item->handler) {
+                    err = std::string("incomplete route ") + item->pattern;
+                    return false;
+                }
+                if (!this->add(item->method, item->pattern, item->handler, err)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool add(const std::string& method, const std::string& pattern, route_handler_t* handler, std::string& err) {
+            if (pattern.empty() || pattern[0] != '/') {
+                err = "route \"" + pattern + "\" must start with '/'";
+                return false;
+            }
+            node_t* n = this->root.get();
+            size_t pos = 0, end;
+            while ((pos = pattern.find_first_not_of('/', pos)) != std::string::npos) {
+                end = pattern.find('/', pos);
+                if (end == std::string::npos) {
+                    end = pattern.size();
+                }
+                std::string segment = pattern.substr(pos, end - pos);
+                if (segment[0] == ':' || segment[0] == '*') {
+                    bool wildcard = segment[0] == '*';
+                    std::string name = segment.substr(1);
+                    if (name.empty()) {
+                        err = "route \"" + pattern + "\" has an unnamed capture";
+                        return false;
+                    }
+                    if (wildcard && pattern.find_first_not_of('/', end) != std::string::npos) {
+                        err = "route \"" + pattern + "\" has a wildcard before its end";
+                        return false;
+                    }
+                    std::shared_ptr<node_t>& child = wildcard ? n->wildcard : n->param;
+                    if (!child) {
+                        child = std::make_shared<node_t>();
+                        child->name = name;
+                    } else if (child->name != name) {
+                        err = "route \"" + pattern + "\" renames capture \"" + child->name + "\"";
+                        return false;
+                    }
+                    n = child.get();
+                } else {
+                    std::shared_ptr<node_t>& child = n->children[segment];
+                    if (!child) {
+                        child = std::make_shared<node_t>();
+                    }
+                    n = child.get();
+                }
+                pos = end;
+            }
+            if (!n->handlers.insert(std::make_pair(method, handler)).second) {
+                err = "duplicate route " + method + " " + pattern;
+                return false;
+            }
+            return true;
+        }
+
+        /*
+         * Returns 200 and sets handler, 405 and sets allow, or 404.
+         */
+        template<typename map_t>
+        int match(const std::string& method, const std::string& path, route_handler_t*& handler, map_t& captures, std::string& allow) const {
+            std::vector<capture_t> found;
+            const node_t* n = this->find(this->root.get(), path, 0, found);
+            if (!n) {
+                return 404;
+            }
+            auto it = n->handlers.find(method);
+            if (it == n->handlers.end() && (it = n->handlers.find("*")) == n->handlers.end()) {
+                for (auto& item : n->handlers) {
+                    if (!allow.empty()) {
+                        allow.append(", ");
+                    }
+                    allow.append(item.first);
+                }
+                return 405;
+            }
+            handler = it->second;
+            for (auto& item : found) {
+                captures[*item.name] = path.substr(item.pos, item.len);
+            }
+            return 200;
+        }
+
+    private:
+
+        struct node_t {
+            std::unordered_map<std::string, std::shared_ptr<node_t>> children;
+            std::shared_ptr<node_t> param, wildcard;
+            std::string name;
+            std::unordered_map<std::string, route_handler_t*> handlers;
+        };
+
+        struct capture_t {
+            const std::string* name;
+            size_t pos, len;
+        };
+
+        const node_t* find(const node_t* n, const std::string& path, size_t pos, std::vector<capture_t>& found) const {
+            pos = path.find_first_not_of('/', pos);
+            if (pos == std::string::npos) {
+                if (!n->handlers.empty()) {
+                    return n;
+                }
+                if (n->wildcard) {
+                    found.push_back({&n->wildcard->name, path.size(), 0});
+                    return n->wildcard.get();
+                }
+                return NULL;
+            }
+            size_t end = path.find('/', pos);
+            if (end == std::string::npos) {
+                end = path.size();
+            }
+            if (!n->children.empty()) {
+                auto it = n->children.find(path.substr(pos, end - pos));
+                if (it != n->children.end()) {
+                    const node_t* m = this->find(it->second.get(), path, end, found);
+                    if (m) {
+                        return m;
+                    }
+                }
+            }
+            if (n->param) {
+                found.push_back({&n->param->name, pos, end - pos});
+                const node_t* m = this->find(n->param.get(), path, end, found);
+                if (m) {
+                    return m;
+                }
+                found.pop_back();
+            }
+            if (n->wildcard) {
+                found.push_back({&n->wildcard->name, pos, path.size() - pos});
+                return n->wildcard.get();
+            }
+            return NULL;
+        }
+
+        std::string module;
+        void* dll_handle;
+        std::shared_ptr<node_t> root;
+    };
+}
+
+#endif /* ROUTER_HPP */
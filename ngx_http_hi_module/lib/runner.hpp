@@ -0,0 +1,222 @@
+#ifndef RUNNER_HPP
+#define RUNNER_HPP
+
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <algorithm>
+
+#include "../include/request.hpp"
+#include "../include/response.hpp"
+
+namespace hi {
+    namespace runner {
+
+        /*
+         * Single-producer single-consumer byte ring placed in shared memory.
+         * Messages are length-prefixed and may wrap around the end of the
+         * buffer; the cursors only ever grow.
+         */
+        class ring {
+        private:
+
+            struct header_t {
+                volatile uint64_t head;
+                char pad0[64 - sizeof (uint64_t)];
+                volatile uint64_t tail;
+                char pad1[64 - sizeof (uint64_t)];
+            };
+
+        public:
+
+            static size_t size(size_t capacity) {
+                return sizeof (header_t) + capacity;
+            }
+
+            ring(void* addr, size_t capacity)
+            : header((header_t*) addr)
+            , data((char*) addr + sizeof (header_t))
+            , capacity(capacity) {
+            }
+
+            virtual~ring() = default;
+
+            void init() {
+                memset(this->header, 0, sizeof (header_t));
+            }
+
+            bool fits(size_t len)const {
+                return sizeof (uint32_t) + len <= this->capacity;
+            }
+
+            bool push(const std::string& msg) {
+                uint64_t head = __atomic_load_n(&this->header->head, __ATOMIC_ACQUIRE), tail = this->header->tail;
+                uint32_t len = msg.size();
+                if (sizeof (len) + len > this->capacity - (tail - head)) {
+                    return false;
+                }
+                this->copy_in(tail, &len, sizeof (len));
+                this->copy_in(tail + sizeof (len), msg.data(), len);
+                __atomic_store_n(&this->header->tail, tail + sizeof (len) + len, __ATOMIC_RELEASE);
+                return true;
+            }
+
+            bool pop(std::string& msg) {
+                uint64_t tail = __atomic_load_n(&this->header->tail, __ATOMIC_ACQUIRE), head = this->header->head;
+                if (head == tail) {
+                    return false;
+                }
+                uint32_t len;
+                this->copy_out(head, &len, sizeof (len));
+                msg.resize(len);
+                this->copy_out(head + sizeof (len), &msg[0], len);
+                __atomic_store_n(&this->header->head, head + sizeof (len) + len, __ATOMIC_RELEASE);
+                return true;
+            }
+
+        private:
+
+            void copy_in(uint64_t pos, const void* src, size_t len) {
+                size_t off = pos % this->capacity, n = std::min(len, this->capacity - off);
+                memcpy(this->data + off, src, n);
+                memcpy(this->data, (const char*) src + n, len - n);
+            }
+
+            void copy_out(uint64_t pos, void* dst, size_t len)const {
+                size_t off = pos % this->capacity, n = std::min(len, this->capacity - off);
+                memcpy(dst, this->data + off, n);
+                memcpy((char*) dst + n, this->data, len - n);
+            }
+
+            header_t* header;
+            char* data;
+            size_t capacity;
+        };
+
+        class packer {
+        public:
+
+            packer(std::string& out) : out(out) {
+            }
+
+            virtual~packer() = default;
+
+            packer& put(uint64_t v) {
+                this->out.append((const char*) &v, sizeof (v));
+                return *this;
+            }
+
+            packer& put(const std::string& s) {
+                this->put((uint64_t) s.size());
+                this->out.append(s);
+                return *this;
+            }
+
+            template<typename map_t>
+            packer& put_map(const map_t& m) {
+                this->put((uint64_t) m.size());
+                for (auto& item : m) {
+                    this->put(item.first).put(item.second);
+                }
+                return *this;
+            }
+
+            packer& put(const request& req) {
+                this->put(req.client).put(req.user_agent).put(req.method).put(req.uri).put(req.param);
+                this->put((uint64_t) req.body_len);
+                this->out.append(req.body ? req.body : "", req.body_len);
+                return this->put_map(req.headers).put_map(req.form).put_map(req.cookies).put_map(req.session).put_map(req.captures);
+            }
+
+            packer& put(const response& res) {
+                this->put((uint64_t) res.status).put(res.content);
+                return this->put_map(res.headers).put_map(res.session);
+            }
+
+        private:
+            std::string& out;
+        };
+
+        class unpacker {
+        public:
+
+            unpacker(const std::string& in) : p(in.data()), end(in.data() + in.size()) {
+            }
+
+            virtual~unpacker() = default;
+
+            bool get(uint64_t& v) {
+                if ((size_t) (this->end - this->p) < sizeof (v)) {
+                    return false;
+                }
+                memcpy(&v, this->p, sizeof (v));
+                this->p += sizeof (v);
+                return true;
+            }
+
+            bool get(std::string& s) {
+                uint64_t len;
+                if (!this->get(len) || (uint64_t) (this->end - this->p) < len) {
+                    return false;
+                }
+                s.assign(this->p, len);
+                this->p += len;
+                return true;
+            }
+
+            /*
+             * Points into the input instead of copying out of it.
+             */
+            bool get(const char*& data, size_t& len) {
+                uint64_t n;
+                if (!this->get(n) || (uint64_t) (this->end - this->p) < n) {
+                    return false;
+                }
+                data = this->p;
+                len = n;
+                this->p += n;
+                return true;
+            }
+
+            template<typename map_t>
+            bool get_map(map_t& m) {
+                uint64_t n;
+                if (!this->get(n)) {
+                    return false;
+                }
+                m.clear();
+                std::string k, v;
+                for (uint64_t i = 0; i < n; ++i) {
+                    if (!this->get(k) || !this->get(v)) {
+                        return false;
+                    }
+                    m.insert(std::make_pair(k, v));
+                }
+                return true;
+            }
+
+            bool get(request& req) {
+                return this->get(req.client) && this->get(req.user_agent) && this->get(req.method) && this->get(req.uri) && this->get(req.param)
+                        && this->get(req.body, req.body_len)
+                        && this->get_map(req.headers) && this->get_map(req.form) && this->get_map(req.cookies) && this->get_map(req.session)
+                        && this->get_map(req.captures);
+            }
+
+            bool get(response& res) {
+                uint64_t status;
+                if (!this->get(status)) {
+                    return false;
+                }
+                res.status = (int) status;
+                return this->get(res.content) && this->get_map(res.headers) && this->get_map(res.session);
+            }
+
+        private:
+            const char *p, *end;
+        };
+
+    } // namespace runner
+
+}//namespace hi
+
+#endif /* RUNNER_HPP */
@@ -3,6 +3,10 @@ extern "C" {
 #include <ngx_core.h>
 #include <ngx_http.h>
 #include <ngx_md5.h>
+#include <ngx_sha1.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 }
 
 #include <openssl/ssl.h>
@@ -14,16 +18,28 @@ extern "C" {
 #include <openssl/md5.h>
 #include <openssl/x509v3.h>
 
+#include <sys/eventfd.h>
+#include <poll.h>
+
 #include <vector>
 #include <memory>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
 #include "include/request.hpp"
 #include "include/response.hpp"
 #include "include/servlet.hpp"
+#include "include/route.hpp"
+#include "include/shared_dict.hpp"
+#include "include/websocket.hpp"
 
 
 
 #include "lib/module_class.hpp"
+#include "lib/router.hpp"
 #include "lib/lrucache.hpp"
+#include "lib/cache_snapshot.hpp"
+#include "lib/runner.hpp"
 #include "lib/param.hpp"
 #include "lib/redis.hpp"
 
@@ -50,6 +66,8 @@ extern "C" {
 #define form_urlencoded_type "application/x-www-form-urlencoded"
 #define form_urlencoded_type_len (sizeof(form_urlencoded_type) - 1)
 #define TEMP_DIRECTORY "temp"
+#define CACHE_DISK_HEADER_SIZE 1024
+#define SESSION_FLUSH_INTERVAL 1000
 
 struct cache_ele_t {
     int status = 200;
@@ -58,7 +76,43 @@ struct cache_ele_t {
 };
 
 static std::vector<std::shared_ptr<hi::module_class<hi::servlet>>> PLUGIN;
+static std::vector<std::shared_ptr<hi::router>> ROUTER;
+static std::vector<std::shared_ptr<hi::module_class<hi::websocket>>> WEBSOCKET;
+struct cache_snapshot_t {
+    std::string path, fingerprint;
+    ngx_int_t expires;
+    std::shared_ptr<hi::cache::snapshot> image;
+};
+
 static std::vector<std::shared_ptr<hi::cache::lru_cache<std::string, cache_ele_t>>> CACHE;
+static std::vector<cache_snapshot_t> CACHE_SNAPSHOT;
+
+struct session_pending_t {
+    std::unordered_map<std::string, std::string> fields;
+    std::unordered_set<std::string> removed;
+    ngx_int_t expires = 0;
+};
+
+/*
+ * A batch of pending sessions on its way to redis, over a connection of
+ * its own; with threads, only the task touches it while it is posted.
+ */
+struct session_flusher_t {
+    std::unordered_map<std::string, session_pending_t> batch;
+    std::shared_ptr<hi::redis> redis;
+    std::string host;
+    int port = 0;
+    size_t dropped = 0;
+};
+
+static std::unordered_map<std::string, session_pending_t> SESSION_PENDING;
+static session_flusher_t SESSION_FLUSHER;
+static ngx_event_t SESSION_FLUSH;
+#if (NGX_THREADS)
+static ngx_thread_task_t* SESSION_TASK = NULL;
+#endif
+static ngx_atomic_t* TIMER_SLOT = NULL;
+static std::vector<ngx_event_t> TIMER_EVENT;
 static std::shared_ptr<hi::redis> REDIS;
 static std::shared_ptr<hi::boost_py> PYTHON;
 static std::shared_ptr<hi::lua> LUA;
@@ -67,12 +121,278 @@ static std::shared_ptr<hi::cache::lru_cache<std::string, hi::java_servlet_t>> JA
 static bool JAVA_IS_READY = false;
 static std::shared_ptr<php::VM> PHP;
 
+extern ngx_module_t ngx_http_hi_module;
+
 enum application_t {
-    __cpp__, __python__, __lua__, __java__, __php__, __unkown__
+    __cpp__, __route__, __python__, __lua__, __java__, __php__, __websocket__, __unkown__
+};
+
+enum cache_status_t {
+    __no_cache__, __cache_miss__, __cache_hit__, __cache_expired__
+};
+
+enum session_store_t {
+    __redis_session__, __shm_session__, __shm_redis_session__
+};
+
+typedef struct {
+    ngx_array_t caches;
+    ngx_array_t dicts;
+    ngx_array_t timers;
+    ngx_shm_zone_t *timer_shm;
+    ngx_flag_t runner;
+    ngx_int_t runner_processes;
+    size_t runner_ring_size;
+#if (NGX_THREADS)
+    ngx_thread_pool_t *session_thread_pool;
+#endif
+} ngx_http_hi_main_conf_t;
+
+typedef struct {
+    ngx_str_node_t sn;
+    ngx_queue_t queue;
+    uint64_t expires;
+    size_t value_len;
+    u_char data[1];
+} ngx_http_hi_dict_node_t;
+
+typedef struct {
+    ngx_rbtree_t rbtree;
+    ngx_rbtree_node_t sentinel;
+    ngx_queue_t lru;
+} ngx_http_hi_dict_sh_t;
+
+typedef struct {
+    ngx_http_hi_dict_sh_t *sh;
+    ngx_slab_pool_t *shpool;
+} ngx_http_hi_dict_ctx_t;
+
+struct ngx_http_hi_dict_lock_t {
+
+    ngx_http_hi_dict_lock_t(ngx_slab_pool_t* shpool) : shpool(shpool) {
+        ngx_shmtx_lock(&this->shpool->mutex);
+    }
+
+    ~ngx_http_hi_dict_lock_t() {
+        ngx_shmtx_unlock(&this->shpool->mutex);
+    }
+    ngx_slab_pool_t *shpool;
+};
+
+/*
+ * hi::shared_dict over a slab zone: an rbtree keyed by crc32 and key for
+ * lookups, and a queue in recency order for eviction. Expired entries are
+ * dropped when they are looked up or reach the tail of the queue.
+ */
+class ngx_http_hi_shared_dict : public hi::shared_dict {
+public:
+
+    ngx_http_hi_shared_dict(ngx_shm_zone_t* zone) : ctx((ngx_http_hi_dict_ctx_t*) zone->data) {
+    }
+
+    virtual~ngx_http_hi_shared_dict() = default;
+
+    bool get(const std::string& key, std::string& value) {
+        ngx_http_hi_dict_lock_t lock(this->ctx->shpool);
+        ngx_http_hi_dict_node_t *node = this->lookup(key, now());
+        if (node == NULL) {
+            return false;
+        }
+        value.assign((char*) node->data + key.size(), node->value_len);
+        return true;
+    }
+
+    bool set(const std::string& key, const std::string& value, double ttl) {
+        uint64_t t = now();
+        ngx_http_hi_dict_lock_t lock(this->ctx->shpool);
+        return this->store(key, value.data(), value.size(), expires_at(ttl, t), false, t);
+    }
+
+    bool add(const std::string& key, const std::string& value, double ttl) {
+        uint64_t t = now();
+        ngx_http_hi_dict_lock_t lock(this->ctx->shpool);
+        return this->store(key, value.data(), value.size(), expires_at(ttl, t), true, t);
+    }
+
+    /*
+     * Like add, but when key is already there value gets the stored one,
+     * found under the same lock. Returns whether value was added.
+     */
+    bool add_or_get(const std::string& key, std::string& value, double ttl) {
+        uint64_t t = now();
+        ngx_http_hi_dict_lock_t lock(this->ctx->shpool);
+        ngx_http_hi_dict_node_t *node = this->lookup(key, t);
+        if (node) {
+            value.assign((char*) node->data + key.size(), node->value_len);
+            return false;
+        }
+        return this->store(key, value.data(), value.size(), expires_at(ttl, t), true, t);
+    }
+
+    bool incr(const std::string& key, long long delta, long long& value, double ttl) {
+        uint64_t t = now(), expires = expires_at(ttl, t);
+        ngx_http_hi_dict_lock_t lock(this->ctx->shpool);
+        ngx_http_hi_dict_node_t *node = this->lookup(key, t);
+        long long v = 0;
+        if (node) {
+            char buf[NGX_INT64_LEN + 2], *end;
+            if (node->value_len == 0 || node->value_len >= sizeof (buf)) {
+                return false;
+            }
+            ngx_memcpy(buf, node->data + key.size(), node->value_len);
+            buf[node->value_len] = '\0';
+            errno = 0;
+            v = strtoll(buf, &end, 10);
+            if (*end != '\0' || errno == ERANGE) {
+                return false;
+            }
+            expires = node->expires;
+        }
+        v += delta;
+        char out[NGX_INT64_LEN + 2];
+        size_t len = ngx_sprintf((u_char*) out, "%L", v) - (u_char*) out;
+        if (node && node->value_len == len) {
+            ngx_memcpy(node->data + key.size(), out, len);
+        } else if (!this->store(key, out, len, expires, false, t)) {
+            return false;
+        }
+        value = v;
+        return true;
+    }
+
+    /*
+     * Rewrites the value of key through f under one lock, so writers to
+     * different parts of it never lose each other's changes. A new key
+     * expires after ttl, an existing one keeps its expiry.
+     */
+    template<typename F>
+    bool update(const std::string& key, double ttl, F f) {
+        uint64_t t = now(), expires = expires_at(ttl, t);
+        ngx_http_hi_dict_lock_t lock(this->ctx->shpool);
+        ngx_http_hi_dict_node_t *node = this->lookup(key, t);
+        std::string value;
+        if (node) {
+            value.assign((char*) node->data + key.size(), node->value_len);
+            expires = node->expires;
+        }
+        f(value);
+        return this->store(key, value.data(), value.size(), expires, false, t);
+    }
+
+    bool del(const std::string& key) {
+        ngx_http_hi_dict_lock_t lock(this->ctx->shpool);
+        ngx_http_hi_dict_node_t *node = this->lookup(key, now());
+        if (node == NULL) {
+            return false;
+        }
+        this->remove(node);
+        return true;
+    }
+
+private:
+
+    static uint64_t now() {
+        struct timeval tv;
+        ngx_gettimeofday(&tv);
+        return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+
+    static uint64_t expires_at(double ttl, uint64_t now) {
+        return ttl > 0 ? now + (uint64_t) (ttl * 1000) : 0;
+    }
+
+    ngx_http_hi_dict_node_t* lookup(const std::string& key, uint64_t now) {
+        ngx_str_t name;
+        name.data = (u_char*) key.data();
+        name.len = key.size();
+        ngx_http_hi_dict_node_t *node = (ngx_http_hi_dict_node_t*) ngx_str_rbtree_lookup(&this->ctx->sh->rbtree, &name, ngx_crc32_short(name.data, name.len));
+        if (node == NULL) {
+            return NULL;
+        }
+        if (node->expires && node->expires <= now) {
+            this->remove(node);
+            return NULL;
+        }
+        ngx_queue_remove(&node->queue);
+        ngx_queue_insert_head(&this->ctx->sh->lru, &node->queue);
+        return node;
+    }
+
+    bool store(const std::string& key, const char* value, size_t len, uint64_t expires, bool only_new, uint64_t now) {
+        ngx_http_hi_dict_node_t *node = this->lookup(key, now);
+        if (node) {
+            if (only_new) {
+                return false;
+            }
+            this->remove(node);
+        }
+        for (int i = 0; i < 2 && !ngx_queue_empty(&this->ctx->sh->lru); ++i) {
+            node = ngx_queue_data(ngx_queue_last(&this->ctx->sh->lru), ngx_http_hi_dict_node_t, queue);
+            if (node->expires == 0 || node->expires > now) {
+                break;
+            }
+            this->remove(node);
+        }
+        size_t size = offsetof(ngx_http_hi_dict_node_t, data) + key.size() + len;
+        void *p = ngx_slab_alloc_locked(this->ctx->shpool, size);
+        while (p == NULL && !ngx_queue_empty(&this->ctx->sh->lru)) {
+            this->remove(ngx_queue_data(ngx_queue_last(&this->ctx->sh->lru), ngx_http_hi_dict_node_t, queue));
+            p = ngx_slab_alloc_locked(this->ctx->shpool, size);
+        }
+        if (p == NULL) {
+            return false;
+        }
+        node = (ngx_http_hi_dict_node_t*) p;
+        node->sn.node.key = ngx_crc32_short((u_char*) key.data(), key.size());
+        node->sn.str.data = node->data;
+        node->sn.str.len = key.size();
+        node->expires = expires;
+        node->value_len = len;
+        ngx_memcpy(node->data, key.data(), key.size());
+        ngx_memcpy(node->data + key.size(), value, len);
+        ngx_rbtree_insert(&this->ctx->sh->rbtree, &node->sn.node);
+        ngx_queue_insert_head(&this->ctx->sh->lru, &node->queue);
+        return true;
+    }
+
+    void remove(ngx_http_hi_dict_node_t* node) {
+        ngx_queue_remove(&node->queue);
+        ngx_rbtree_delete(&this->ctx->sh->rbtree, &node->sn.node);
+        ngx_slab_free_locked(this->ctx->shpool, node);
+    }
+
+    ngx_http_hi_dict_ctx_t *ctx;
 };
 
+static hi::shared_dicts_t SHARED_DICT;
+
+typedef struct {
+    ngx_pid_t pid;
+    int event;
+} ngx_http_hi_runner_slot_t;
+
+/*
+ * Head of the runner shared memory: worker slots, runner slots, then a
+ * request ring and a response ring per worker. Worker w is served by
+ * runner w % runners, so every ring has one producer and one consumer.
+ */
+typedef struct {
+    ngx_pid_t master;
+    ngx_atomic_t retired;
+    ngx_uint_t workers, runners;
+    size_t ring_size;
+} ngx_http_hi_runner_shm_t;
+
+static ngx_http_hi_runner_shm_t* RUNNER = NULL;
+static ngx_connection_t* RUNNER_CONNECTION = NULL;
+static bool CACHE_SNAPSHOT_SAVED = false;
+static std::unordered_map<uint64_t, ngx_http_request_t*> RUNNER_PENDING;
+static uint64_t RUNNER_SEQ = 0;
+static volatile sig_atomic_t RUNNER_QUIT = 0;
+
 typedef struct {
     ngx_str_t module_path
+    , route_path
     , redis_host
     , python_script
     , python_content
@@ -81,26 +401,401 @@ typedef struct {
     , java_classpath
     , java_options
     , java_servlet
-    , php_script;
+    , php_script
+    , cache_snapshot
+    , cache_disk
+    , session_zone
+    , timer_uri
+    , timer_zone
+    , websocket_path;
     ngx_int_t redis_port
     , module_index
+    , websocket_index
+    , route_index
     , cache_expires
     , session_expires
     , cache_index
     , java_servlet_cache_expires
     , java_version;
     size_t cache_size
-    , java_servlet_cache_size;
+    , cache_disk_min_size
+    , java_servlet_cache_size
+    , websocket_max_message
+    , websocket_max_pending;
+    ngx_uint_t session_store;
     ngx_flag_t need_headers
     , need_cache
     , need_cookies
-    , need_session;
+    , need_session
+    , runner;
+    ngx_msec_t runner_timeout
+    , timer_interval;
     application_t app_type;
+#if (NGX_HTTP_CACHE)
+    ngx_http_file_cache_t *disk_cache;
+#endif
 } ngx_http_hi_loc_conf_t;
 
+static void* arena_alloc(void* pool, size_t size);
+
+struct ngx_http_hi_lua_co_t;
+struct ngx_http_hi_ws_t;
+
+struct ngx_http_hi_ctx_t {
+
+    ngx_http_hi_ctx_t(ngx_pool_t* pool) :
+    arena(arena_alloc, pool)
+    , req(&arena)
+    , res(&arena)
+    , session_id()
+    , cache_k()
+    , disk_hit(false)
+    , pending(0)
+    , fired(0)
+    , runner_id(0)
+    , runner_timer()
+    , lua(NULL)
+    , ws(NULL)
+    , cache_status(cache_status_t::__no_cache__)
+    , started(0)
+    , servlet_started(0)
+    , parse_time(0)
+    , session_time(0)
+    , servlet_time(0) {
+    }
+    hi::arena arena;
+    hi::request req;
+    hi::response res;
+    std::string session_id;
+    std::shared_ptr<std::string> cache_k;
+    bool disk_hit;
+    ngx_uint_t pending;
+    size_t fired;
+    uint64_t runner_id;
+    ngx_event_t runner_timer;
+    ngx_http_hi_lua_co_t *lua;
+    ngx_http_hi_ws_t *ws;
+    cache_status_t cache_status;
+    /* monotonic microseconds, for the $hi_*_time variables */
+    uint64_t started, servlet_started, parse_time, session_time, servlet_time;
+};
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static std::unordered_map<std::string, std::unordered_set<ngx_http_hi_ws_t*>> WEBSOCKET_CHANNEL;
+static u_char WEBSOCKET_BUFFER[64 * 1024];
+
+/*
+ * Host side of a hi_websocket connection. Frames are queued as shared
+ * strings, so a publish builds one frame for all of its subscribers; an
+ * idle connection holds no buffers at all.
+ */
+struct ngx_http_hi_ws_t : public hi::websocket_connection {
+    typedef std::shared_ptr<const std::string> frame_t;
+
+    ngx_http_hi_ws_t(ngx_http_request_t* r, ngx_http_hi_loc_conf_t* conf, const std::shared_ptr<hi::websocket>& servlet)
+    : r(r)
+    , conf(conf)
+    , servlet(servlet)
+    , out()
+    , pong()
+    , offset(0)
+    , queued(0)
+    , channels()
+    , partial()
+    , message()
+    , opcode(0)
+    , code(1006)
+    , closing(false)
+    , closed(false)
+    , notified(false) {
+    }
+
+    virtual~ngx_http_hi_ws_t() {
+        for (auto& channel : this->channels) {
+            auto it = WEBSOCKET_CHANNEL.find(channel);
+            if (it != WEBSOCKET_CHANNEL.end()) {
+                it->second.erase(this);
+                if (it->second.empty()) {
+                    WEBSOCKET_CHANNEL.erase(it);
+                }
+            }
+        }
+    }
+
+    bool send(const char* data, size_t len, bool binary) {
+        return this->push(frame(binary ? 0x2 : 0x1, data, len), false);
+    }
+
+    size_t pending() const {
+        return this->queued;
+    }
+
+    void close(uint16_t code) {
+        if (this->closing || this->closed) {
+            return;
+        }
+        char payload[2] = {(char) (code >> 8), (char) (code & 0xff)};
+        this->push(frame(0x8, payload, sizeof (payload)), true);
+        this->closing = true;
+        this->code = code;
+        ngx_post_event(this->r->connection->read, &ngx_posted_events);
+    }
+
+    /*
+     * A client that pings faster than it reads gets only the answer to its
+     * latest ping, which goes out at the next frame boundary.
+     */
+    void ping(const char* data, size_t len) {
+        if (this->closing || this->closed) {
+            return;
+        }
+        this->pong = frame(0xA, data, len);
+        this->flush();
+    }
+
+    void subscribe(const std::string& channel) {
+        if (this->channels.insert(channel).second) {
+            WEBSOCKET_CHANNEL[channel].insert(this);
+        }
+    }
+
+    void unsubscribe(const std::string& channel) {
+        if (this->channels.erase(channel)) {
+            auto it = WEBSOCKET_CHANNEL.find(channel);
+            it->second.erase(this);
+            if (it->second.empty()) {
+                WEBSOCKET_CHANNEL.erase(it);
+            }
+        }
+    }
+
+    size_t publish(const std::string& channel, const char* data, size_t len, bool binary) {
+        auto it = WEBSOCKET_CHANNEL.find(channel);
+        if (it == WEBSOCKET_CHANNEL.end()) {
+            return 0;
+        }
+        frame_t f = frame(binary ? 0x2 : 0x1, data, len);
+        size_t n = 0;
+        for (ngx_http_hi_ws_t *ws : it->second) {
+            if (ws->push(f, false)) {
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    static frame_t frame(int opcode, const char* data, size_t len) {
+        std::shared_ptr<std::string> f = std::make_shared<std::string>();
+        f->reserve(len + 10);
+        f->push_back((char) (0x80 | opcode));
+        if (len < 126) {
+            f->push_back((char) len);
+        } else if (len <= 0xffff) {
+            f->push_back((char) 126);
+            f->push_back((char) (len >> 8));
+            f->push_back((char) (len & 0xff));
+        } else {
+            f->push_back((char) 127);
+            for (int i = 7; i >= 0; --i) {
+                f->push_back((char) (((uint64_t) len >> (i * 8)) & 0xff));
+            }
+        }
+        f->append(data, len);
+        return f;
+    }
+
+    bool push(const frame_t& f, bool control) {
+        if (this->closing || this->closed || (!control && this->queued + f->size() > this->conf->websocket_max_pending)) {
+            return false;
+        }
+        this->out.push_back(f);
+        this->queued += f->size();
+        this->flush();
+        return true;
+    }
+
+    /*
+     * Never finalizes the request itself, since it may run in the middle
+     * of a publish; errors post the read event, whose handler does.
+     */
+    void flush() {
+        ngx_connection_t *c = this->r->connection;
+        if (this->closed) {
+            return;
+        }
+        if (this->r->out || c->buffered) {
+            if (ngx_http_output_filter(this->r, NULL) == NGX_ERROR) {
+                this->fail();
+                return;
+            }
+            if (this->r->out || c->buffered) {
+                if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                    this->fail();
+                }
+                return;
+            }
+        }
+        while (!this->out.empty() || this->pong) {
+            if (this->offset == 0 && this->pong) {
+                this->out.push_front(this->pong);
+                this->queued += this->pong->size();
+                this->pong.reset();
+            }
+            const std::string& f = *this->out.front();
+            ssize_t n = c->send(c, (u_char*) f.data() + this->offset, f.size() - this->offset);
+            if (n == NGX_ERROR) {
+                this->fail();
+                return;
+            }
+            if (n == NGX_AGAIN) {
+                if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                    this->fail();
+                }
+                return;
+            }
+            this->offset += n;
+            this->queued -= n;
+            if (this->offset == f.size()) {
+                this->out.pop_front();
+                this->offset = 0;
+            }
+        }
+    }
+
+    void fail() {
+        this->closed = true;
+        ngx_post_event(this->r->connection->read, &ngx_posted_events);
+    }
+
+    bool finished() const {
+        return this->closed || (this->closing && this->out.empty());
+    }
+
+    void notify() {
+        if (!this->notified) {
+            this->notified = true;
+            this->closed = true;
+            this->servlet->on_close(*this, this->code);
+        }
+    }
+
+    ngx_http_request_t *r;
+    ngx_http_hi_loc_conf_t *conf;
+    std::shared_ptr<hi::websocket> servlet;
+    std::deque<frame_t> out;
+    frame_t pong;
+    size_t offset, queued;
+    std::unordered_set<std::string> channels;
+    /* an incomplete frame, and the fragments of an unfinished message */
+    std::string partial, message;
+    int opcode;
+    uint16_t code;
+    bool closing, closed, notified;
+};
+
+enum lua_socket_op_t {
+    __none__, __connect__, __send__, __receive__
+};
+
+struct ngx_http_hi_lua_socket_t;
+
+/*
+ * The Lua chunk of one request, suspended in a coroutine. armed is set by a
+ * hi.* primitive right before it yields, waiting while a timer or a socket
+ * rather than a subrequest owns the next resume.
+ */
+struct ngx_http_hi_lua_co_t {
+
+    ngx_http_hi_lua_co_t(ngx_http_request_t* r) :
+    r(r)
+    , thread(NULL)
+    , ref(LUA_NOREF)
+    , req()
+    , res()
+    , armed(false)
+    , waiting(false)
+    , sleep()
+    , sockets(NULL) {
+    }
+    ngx_http_request_t *r;
+    lua_State *thread;
+    int ref;
+    hi::py_request req;
+    hi::py_response res;
+    bool armed, waiting;
+    ngx_event_t sleep;
+    ngx_http_hi_lua_socket_t *sockets;
+};
+
+/*
+ * Userdata behind hi.tcp(). While connected it is linked into the sockets
+ * of the coroutine that opened it, which closes it when the request ends.
+ */
+struct ngx_http_hi_lua_socket_t {
+
+    ngx_http_hi_lua_socket_t() :
+    co(NULL)
+    , pc()
+    , timeout(60000)
+    , op(lua_socket_op_t::__none__)
+    , out()
+    , in()
+    , result()
+    , sent(0)
+    , want(0)
+    , err(NULL)
+    , prev(NULL)
+    , next(NULL) {
+    }
+    ngx_http_hi_lua_co_t *co;
+    ngx_peer_connection_t pc;
+    ngx_msec_t timeout;
+    lua_socket_op_t op;
+    std::string out, in, result;
+    size_t sent;
+    ssize_t want;
+    const char *err;
+    ngx_http_hi_lua_socket_t *prev, *next;
+};
+
+#define LUA_SOCKET_METATABLE "hi.tcp"
+#define LUA_DICT_METATABLE "hi.shared_dict"
+#define LUA_RECEIVE_LINE -1
+#define LUA_RECEIVE_ALL -2
+#define NGX_HI_FFI_EXPORT __attribute__((visibility("default"), used))
+
+static std::unordered_map<lua_State*, ngx_http_hi_lua_co_t*> LUA_COROUTINE;
+
+typedef struct {
+    ngx_http_hi_ctx_t *ctx;
+    size_t index;
+    ngx_flag_t done;
+} ngx_http_hi_subrequest_t;
+
+struct servlet_continuation_t {
+    std::shared_ptr<hi::servlet> servlet;
+    hi::continuation_t next;
+
+    void operator()(hi::request& req, hi::response& res) {
+        hi::continuation_t f = std::move(this->next);
+        f(req, res);
+        if (req.continuation) {
+            req.continuation = servlet_continuation_t{this->servlet, std::move(req.continuation)};
+        }
+    }
+};
+
 
 static ngx_int_t clean_up(ngx_conf_t *cf);
+static ngx_int_t ngx_http_hi_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_hi_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data);
+static uint64_t monotonic_usec();
+static ngx_int_t ngx_http_hi_init_process(ngx_cycle_t *cycle);
+static void ngx_http_hi_exit_process(ngx_cycle_t *cycle);
 static char *ngx_http_hi_conf_init(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static void * ngx_http_hi_create_main_conf(ngx_conf_t *cf);
+static char * ngx_http_hi_init_main_conf(ngx_conf_t *cf, void *conf);
 static void * ngx_http_hi_create_loc_conf(ngx_conf_t *cf);
 static char * ngx_http_hi_merge_loc_conf(ngx_conf_t* cf, void* parent, void* child);
 
@@ -108,22 +803,120 @@ static char * ngx_http_hi_merge_loc_conf(ngx_conf_t* cf, void* parent, void* chi
 static ngx_int_t ngx_http_hi_handler(ngx_http_request_t *r);
 static void ngx_http_hi_body_handler(ngx_http_request_t* r);
 static ngx_int_t ngx_http_hi_normal_handler(ngx_http_request_t *r);
-
-
-static void get_input_headers(ngx_http_request_t* r, std::unordered_map<std::string, std::string>& input_headers);
-static void set_output_headers(ngx_http_request_t* r, std::unordered_multimap<std::string, std::string>& output_headers);
+static ngx_http_hi_ctx_t* ngx_http_hi_create_ctx(ngx_http_request_t* r);
+static void ngx_http_hi_cleanup_ctx(void* data);
+static ngx_int_t ngx_http_hi_continue(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx);
+static void ngx_http_hi_subrequest_launch(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx);
+static ngx_int_t ngx_http_hi_subrequest_done(ngx_http_request_t* r, void* data, ngx_int_t rc);
+static void ngx_http_hi_subrequest_resume(ngx_http_request_t* r);
+static void ngx_http_hi_store(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx);
+static bool session_redis(ngx_http_hi_loc_conf_t * conf);
+static ngx_http_hi_shared_dict* session_zone(ngx_http_hi_loc_conf_t * conf);
+static void session_load(ngx_http_hi_loc_conf_t * conf, const std::string& id, hi::string_map& session);
+static void session_save(ngx_http_hi_loc_conf_t * conf, const std::string& id, const hi::string_map& before, const hi::string_map& after);
+template<typename map_t>
+static void session_write_behind(ngx_http_hi_loc_conf_t * conf, const std::string& id, const map_t& fields, const std::vector<std::string>& removed, ngx_int_t expires);
+static void session_flush(session_flusher_t& flusher);
+static void session_flush_report(ngx_log_t* log);
+static void ngx_http_hi_session_flush(ngx_event_t* ev);
+#if (NGX_THREADS)
+static void ngx_http_hi_session_flush_thread(void* data, ngx_log_t* log);
+static void ngx_http_hi_session_flush_done(ngx_event_t* ev);
+#endif
+static ngx_int_t ngx_http_hi_send_response(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx);
+static void ngx_http_hi_dispatch(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res);
+static ngx_table_elt_t* find_input_header(ngx_http_request_t* r, const char* name, size_t len);
+static ngx_int_t ngx_http_hi_websocket_handler(ngx_http_request_t* r, ngx_http_hi_loc_conf_t * conf);
+static void ngx_http_hi_websocket_read(ngx_http_request_t* r);
+static void ngx_http_hi_websocket_write(ngx_http_request_t* r);
+static size_t websocket_parse(ngx_http_hi_ws_t* ws, u_char* p, size_t len);
+static void websocket_frame(ngx_http_hi_ws_t* ws, bool fin, int opcode, const char* payload, size_t size);
+
+static ngx_int_t ngx_http_hi_init_module(ngx_cycle_t *cycle);
+static char *ngx_http_hi_shared_dict_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_hi_session_store(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_hi_timer(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_hi_timer_init(ngx_shm_zone_t *shm_zone, void *data);
+static void ngx_http_hi_timer_handler(ngx_event_t* ev);
+static bool timer_cache_get(ngx_http_hi_loc_conf_t * conf, const std::string& uri, hi::response& res);
+static ngx_int_t ngx_http_hi_shared_dict_init(ngx_shm_zone_t *shm_zone, void *data);
+static void ngx_http_hi_runner_cleanup(void* data);
+static ngx_http_hi_runner_slot_t* runner_slot(ngx_uint_t index);
+static hi::runner::ring runner_ring(ngx_uint_t worker, ngx_uint_t response);
+static void runner_signal_handler(int signo);
+static void runner_process_init(ngx_cycle_t* cycle);
+static bool runner_retired();
+static void ngx_http_hi_runner_supervise(ngx_cycle_t* cycle);
+static void ngx_http_hi_runner_process(ngx_cycle_t* cycle, ngx_uint_t index);
+static ngx_int_t ngx_http_hi_runner_post(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx, ngx_http_hi_loc_conf_t * conf);
+static void ngx_http_hi_runner_event_handler(ngx_event_t* ev);
+static void ngx_http_hi_runner_timeout_handler(ngx_event_t* ev);
+
+
+static void get_input_headers(ngx_http_request_t* r, hi::string_map& input_headers);
+static void set_output_headers(ngx_http_request_t* r, hi::string_multimap& output_headers);
 static ngx_str_t get_input_body(ngx_http_request_t *r);
 
 static void ngx_http_hi_cpp_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res);
+static void ngx_http_hi_route_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res);
 static void ngx_http_hi_python_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res);
 static void ngx_http_hi_lua_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res);
+static ngx_int_t ngx_http_hi_lua_start(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx, ngx_http_hi_loc_conf_t * conf);
+static void ngx_http_hi_lua_resume(ngx_http_hi_lua_co_t* co, int nargs);
+static void ngx_http_hi_lua_wakeup(ngx_http_hi_lua_co_t* co, int nargs);
+static void ngx_http_hi_lua_release(ngx_http_hi_lua_co_t* co);
+static void ngx_http_hi_lua_sleep_handler(ngx_event_t* ev);
+static void ngx_http_hi_lua_socket_handler(ngx_event_t* ev);
 static void ngx_http_hi_java_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res);
 
 static void java_input_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res, jobject request_instance, jobject response_instance);
 static void java_output_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res, jobject request_instance, jobject response_instance);
 static bool java_init_handler(ngx_http_hi_loc_conf_t * conf);
+static void java_register_natives();
 
 static void ngx_http_hi_php_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res);
+static void php_register_functions();
+
+static std::string cache_snapshot_name(size_t index);
+static void cache_snapshot_restore(size_t index);
+static void cache_snapshot_dump(size_t index);
+static void cache_snapshot_dump_all();
+static void ngx_http_hi_save(ngx_cycle_t* cycle);
+
+#if (NGX_HTTP_CACHE)
+static ngx_int_t cache_disk_open(ngx_http_request_t* r, ngx_http_hi_loc_conf_t * conf, u_char* key);
+static ngx_int_t cache_disk_read(ngx_http_request_t* r, ngx_http_hi_loc_conf_t * conf, const std::string& key, cache_ele_t& cache_v);
+static void cache_disk_store(ngx_http_request_t* r, ngx_http_hi_loc_conf_t * conf, hi::response& res);
+#endif
+
+static hi::lua* lua_instance();
+static void lua_open_hi(lua_State* L);
+static void lua_push_fast(lua_State* L, hi::request* req, hi::response* res);
+static hi::string_map* ffi_map(hi::request* req, int map);
+static ngx_http_hi_lua_co_t* lua_current(lua_State* L);
+static int lua_fail(lua_State* L, const char* err);
+static int lua_hi_sleep(lua_State* L);
+static int lua_hi_subrequest(lua_State* L);
+static int lua_hi_tcp(lua_State* L);
+static int lua_socket_settimeout(lua_State* L);
+static int lua_socket_connect(lua_State* L);
+static int lua_socket_send(lua_State* L);
+static int lua_socket_receive(lua_State* L);
+static int lua_socket_close(lua_State* L);
+static int lua_socket_gc(lua_State* L);
+static int lua_socket_run(lua_State* L, ngx_http_hi_lua_socket_t* sock, lua_socket_op_t op);
+static ngx_int_t lua_socket_step(ngx_http_hi_lua_socket_t* sock);
+static int lua_socket_push(lua_State* L, ngx_http_hi_lua_socket_t* sock, ngx_int_t rc);
+static void lua_socket_shutdown(ngx_http_hi_lua_socket_t* sock);
+static int lua_hi_shared_dict(lua_State* L);
+static hi::shared_dict* shared_dict_of(const char* name, size_t len);
+static hi::shared_dict* lua_check_dict(lua_State* L);
+static int lua_dict_store(lua_State* L, bool only_new);
+static int lua_dict_get(lua_State* L);
+static int lua_dict_set(lua_State* L);
+static int lua_dict_add(lua_State* L);
+static int lua_dict_incr(lua_State* L);
+static int lua_dict_delete(lua_State* L);
 
 static std::string md5(const std::string& str);
 static std::string random_string(const std::string& s);
@@ -138,6 +931,38 @@ ngx_command_t ngx_http_hi_commands[] = {
         offsetof(ngx_http_hi_loc_conf_t, module_path),
         NULL
     },
+    {
+        ngx_string("hi_route"),
+        NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_http_hi_conf_init,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, route_path),
+        NULL
+    },
+    {
+        ngx_string("hi_websocket"),
+        NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_http_hi_conf_init,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, websocket_path),
+        NULL
+    },
+    {
+        ngx_string("hi_websocket_max_message"),
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_size_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, websocket_max_message),
+        NULL
+    },
+    {
+        ngx_string("hi_websocket_max_pending"),
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_size_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, websocket_max_pending),
+        NULL
+    },
     {
         ngx_string("hi_cache_size"),
         NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
@@ -154,6 +979,40 @@ ngx_command_t ngx_http_hi_commands[] = {
         offsetof(ngx_http_hi_loc_conf_t, cache_expires),
         NULL
     },
+    {
+        ngx_string("hi_cache_snapshot"),
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_str_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, cache_snapshot),
+        NULL
+    },
+#if (NGX_HTTP_CACHE)
+    {
+        ngx_string("hi_cache_path"),
+        NGX_HTTP_MAIN_CONF | NGX_CONF_2MORE,
+        ngx_http_file_cache_set_slot,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        offsetof(ngx_http_hi_main_conf_t, caches),
+        &ngx_http_hi_module
+    },
+    {
+        ngx_string("hi_cache_disk"),
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_str_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, cache_disk),
+        NULL
+    },
+    {
+        ngx_string("hi_cache_disk_min_size"),
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_size_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, cache_disk_min_size),
+        NULL
+    },
+#endif
     {
         ngx_string("hi_need_headers"),
         NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
@@ -210,6 +1069,62 @@ ngx_command_t ngx_http_hi_commands[] = {
         offsetof(ngx_http_hi_loc_conf_t, session_expires),
         NULL
     },
+    {
+        ngx_string("hi_session_store"),
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE12,
+        ngx_http_hi_session_store,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        0,
+        NULL
+    },
+    {
+        ngx_string("hi_timer"),
+        NGX_HTTP_LOC_CONF | NGX_CONF_TAKE12,
+        ngx_http_hi_timer,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        0,
+        NULL
+    },
+    {
+        ngx_string("hi_runner"),
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_flag_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, runner),
+        NULL
+    },
+    {
+        ngx_string("hi_runner_timeout"),
+        NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_SIF_CONF | NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_msec_slot,
+        NGX_HTTP_LOC_CONF_OFFSET,
+        offsetof(ngx_http_hi_loc_conf_t, runner_timeout),
+        NULL
+    },
+    {
+        ngx_string("hi_runner_processes"),
+        NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_num_slot,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        offsetof(ngx_http_hi_main_conf_t, runner_processes),
+        NULL
+    },
+    {
+        ngx_string("hi_runner_ring_size"),
+        NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE1,
+        ngx_conf_set_size_slot,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        offsetof(ngx_http_hi_main_conf_t, runner_ring_size),
+        NULL
+    },
+    {
+        ngx_string("hi_shared_dict"),
+        NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE2,
+        ngx_http_hi_shared_dict_zone,
+        NGX_HTTP_MAIN_CONF_OFFSET,
+        0,
+        NULL
+    },
     {
         ngx_string("hi_python_script"),
         NGX_HTTP_LOC_CONF | NGX_HTTP_LIF_CONF | NGX_CONF_TAKE1,
@@ -303,10 +1218,10 @@ ngx_command_t ngx_http_hi_commands[] = {
 
 
 ngx_http_module_t ngx_http_hi_module_ctx = {
-    clean_up, /* preconfiguration */
+    ngx_http_hi_add_variables, /* preconfiguration */
     NULL, /* postconfiguration */
-    NULL, /* create main configuration */
-    NULL, /* init main configuration */
+    ngx_http_hi_create_main_conf, /* create main configuration */
+    ngx_http_hi_init_main_conf, /* init main configuration */
 
     NULL, /* create server configuration */
     NULL, /* merge server configuration */
@@ -324,20 +1239,27 @@ ngx_module_t ngx_http_hi_module = {
     ngx_http_hi_commands, /* module directives */
     NGX_HTTP_MODULE, /* module type */
     NULL, /* init master */
-    NULL, /* init module */
-    NULL, /* init process */
+    ngx_http_hi_init_module, /* init module */
+    ngx_http_hi_init_process, /* init process */
     NULL, /* init thread */
     NULL, /* exit thread */
-    NULL, /* exit process */
+    ngx_http_hi_exit_process, /* exit process */
     NULL, /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
 static ngx_int_t clean_up(ngx_conf_t *cf) {
     PLUGIN.clear();
+    ROUTER.clear();
+    WEBSOCKET.clear();
     CACHE.clear();
+    CACHE_SNAPSHOT.clear();
+    SESSION_PENDING.clear();
+    TIMER_EVENT.clear();
+    SHARED_DICT.clear();
     REDIS.reset();
     PYTHON.reset();
+    LUA_COROUTINE.clear();
     LUA.reset();
     JAVA.reset();
     JAVA_SERVLET_CACHE.reset();
@@ -346,32 +1268,244 @@ static ngx_int_t clean_up(ngx_conf_t *cf) {
     return NGX_OK;
 }
 
-static char *ngx_http_hi_conf_init(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
-    ngx_http_core_loc_conf_t *clcf;
-    clcf = (ngx_http_core_loc_conf_t *) ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
-    clcf->handler = ngx_http_hi_handler;
-    ngx_conf_set_str_slot(cf, cmd, conf);
-    return NGX_CONF_OK;
+enum hi_variable_t {
+    __hi_cache_status__, __hi_app_type__, __hi_parse_time__, __hi_session_time__, __hi_servlet_time__
+};
+
+static ngx_http_variable_t ngx_http_hi_variables[] = {
+    { ngx_string("hi_cache_status"), NULL, ngx_http_hi_variable, hi_variable_t::__hi_cache_status__, NGX_HTTP_VAR_NOCACHEABLE, 0},
+    { ngx_string("hi_app_type"), NULL, ngx_http_hi_variable, hi_variable_t::__hi_app_type__, 0, 0},
+    { ngx_string("hi_parse_time"), NULL, ngx_http_hi_variable, hi_variable_t::__hi_parse_time__, NGX_HTTP_VAR_NOCACHEABLE, 0},
+    { ngx_string("hi_session_time"), NULL, ngx_http_hi_variable, hi_variable_t::__hi_session_time__, NGX_HTTP_VAR_NOCACHEABLE, 0},
+    { ngx_string("hi_servlet_time"), NULL, ngx_http_hi_variable, hi_variable_t::__hi_servlet_time__, NGX_HTTP_VAR_NOCACHEABLE, 0},
+    { ngx_null_string, NULL, NULL, 0, 0, 0}
+};
+
+static ngx_int_t ngx_http_hi_add_variables(ngx_conf_t *cf) {
+    for (ngx_http_variable_t *v = ngx_http_hi_variables; v->name.len; ++v) {
+        ngx_http_variable_t *var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+    return clean_up(cf);
 }
 
-static void * ngx_http_hi_create_loc_conf(ngx_conf_t *cf) {
-    ngx_http_hi_loc_conf_t *conf = (ngx_http_hi_loc_conf_t*) ngx_pcalloc(cf->pool, sizeof (ngx_http_hi_loc_conf_t));
-    if (conf) {
-        conf->module_path.len = 0;
-        conf->module_path.data = NULL;
-        conf->module_index = NGX_CONF_UNSET;
-        conf->redis_host.len = 0;
-        conf->redis_host.data = NULL;
-        conf->python_script.len = 0;
-        conf->python_script.data = NULL;
-        conf->python_content.len = 0;
-        conf->python_content.data = NULL;
-        conf->lua_script.len = 0;
-        conf->lua_script.data = NULL;
+/*
+ * Times are in seconds with microsecond resolution; the variables are not
+ * found for requests that never reached the hi handler.
+ */
+static ngx_int_t ngx_http_hi_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v, uintptr_t data) {
+    static const char *app_types[] = {"cpp", "route", "python", "lua", "java", "php", "websocket"};
+    static const char *cache_status[] = {"", "MISS", "HIT", "EXPIRED"};
+    ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) ngx_http_get_module_ctx(r, ngx_http_hi_module);
+    const char *str = NULL;
+    uint64_t usec = 0;
+    switch (data) {
+        case hi_variable_t::__hi_app_type__:
+        {
+            ngx_http_hi_loc_conf_t *conf = (ngx_http_hi_loc_conf_t *) ngx_http_get_module_loc_conf(r, ngx_http_hi_module);
+            if (conf->app_type != application_t::__unkown__) {
+                str = app_types[conf->app_type];
+            }
+            break;
+        }
+        case hi_variable_t::__hi_cache_status__:
+            if (ctx && ctx->cache_status != cache_status_t::__no_cache__) {
+                str = cache_status[ctx->cache_status];
+            }
+            break;
+        default:
+            if (ctx == NULL) {
+                break;
+            }
+            usec = data == hi_variable_t::__hi_parse_time__ ? ctx->parse_time
+                    : data == hi_variable_t::__hi_session_time__ ? ctx->session_time : ctx->servlet_time;
+            u_char *p = (u_char*) ngx_pnalloc(r->pool, NGX_INT64_LEN + 8);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+            v->len = ngx_sprintf(p, "%uL.%06uL", usec / 1000000, usec % 1000000) - p;
+            v->data = p;
+            v->valid = 1;
+            v->no_cacheable = 0;
+            v->not_found = 0;
+            return NGX_OK;
+    }
+    if (str == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+    v->len = ngx_strlen(str);
+    v->data = (u_char*) str;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    return NGX_OK;
+}
+
+static uint64_t monotonic_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static ngx_int_t ngx_http_hi_init_process(ngx_cycle_t *cycle) {
+    if (RUNNER) {
+        ngx_http_hi_runner_slot_t *slot = runner_slot(ngx_worker);
+        RUNNER->master = ngx_process == NGX_PROCESS_WORKER ? getppid() : ngx_pid;
+        slot->pid = ngx_pid;
+        RUNNER_CONNECTION = ngx_get_connection(slot->event, cycle->log);
+        if (RUNNER_CONNECTION == NULL) {
+            return NGX_ERROR;
+        }
+        RUNNER_CONNECTION->read->handler = ngx_http_hi_runner_event_handler;
+        RUNNER_CONNECTION->read->log = cycle->log;
+        if (ngx_handle_read_event(RUNNER_CONNECTION->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+    ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) ngx_http_cycle_get_module_main_conf(cycle, ngx_http_hi_module);
+#if (NGX_THREADS)
+    if (hmcf && hmcf->session_thread_pool) {
+        SESSION_TASK = ngx_thread_task_alloc(cycle->pool, 0);
+        if (SESSION_TASK == NULL) {
+            return NGX_ERROR;
+        }
+        SESSION_TASK->ctx = &SESSION_FLUSHER;
+        SESSION_TASK->handler = ngx_http_hi_session_flush_thread;
+        SESSION_TASK->event.handler = ngx_http_hi_session_flush_done;
+        SESSION_TASK->event.log = cycle->log;
+    }
+#endif
+    if (hmcf && hmcf->timers.nelts > 0 && TIMER_SLOT && (ngx_process == NGX_PROCESS_WORKER || ngx_process == NGX_PROCESS_SINGLE)) {
+        ngx_http_hi_loc_conf_t **timers = (ngx_http_hi_loc_conf_t**) hmcf->timers.elts;
+        TIMER_EVENT.assign(hmcf->timers.nelts, ngx_event_t());
+        for (ngx_uint_t i = 0; i < hmcf->timers.nelts; ++i) {
+            ngx_event_t *ev = &TIMER_EVENT[i];
+            ngx_memzero(ev, sizeof (ngx_event_t));
+            ev->handler = ngx_http_hi_timer_handler;
+            ev->data = timers[i];
+            ev->log = cycle->log;
+            ev->cancelable = 1;
+            ngx_add_timer(ev, 1);
+        }
+    }
+    if (ngx_process != NGX_PROCESS_WORKER && ngx_process != NGX_PROCESS_SINGLE) {
+        return NGX_OK;
+    }
+    /*
+     * on reload the master has the old workers write their images before
+     * the new workers are started, see ngx_http_hi_save()
+     */
+    for (size_t i = 0; i < CACHE_SNAPSHOT.size(); ++i) {
+        cache_snapshot_t& item = CACHE_SNAPSHOT[i];
+        if (!item.path.empty()) {
+            item.image = std::make_shared<hi::cache::snapshot>();
+            if (!item.image->open(cache_snapshot_name(i), item.fingerprint)) {
+                item.image.reset();
+            }
+        }
+    }
+    return NGX_OK;
+}
+
+static void ngx_http_hi_save(ngx_cycle_t* cycle) {
+    if (ngx_process == NGX_PROCESS_WORKER) {
+        cache_snapshot_dump_all();
+    }
+}
+
+static void ngx_http_hi_exit_process(ngx_cycle_t *cycle) {
+    /*
+     * the thread pools have finished their tasks by now, and what is
+     * left is sent from the worker
+     */
+    for (auto& item : SESSION_PENDING) {
+        SESSION_FLUSHER.batch[item.first] = std::move(item.second);
+    }
+    SESSION_PENDING.clear();
+    session_flush(SESSION_FLUSHER);
+    session_flush_report(cycle->log);
+    if (RUNNER_CONNECTION) {
+        ngx_close_connection(RUNNER_CONNECTION);
+        RUNNER_CONNECTION = NULL;
+    }
+    cache_snapshot_dump_all();
+}
+
+static char *ngx_http_hi_conf_init(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    ngx_http_core_loc_conf_t *clcf;
+    clcf = (ngx_http_core_loc_conf_t *) ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_hi_handler;
+    ngx_conf_set_str_slot(cf, cmd, conf);
+    return NGX_CONF_OK;
+}
+
+static void * ngx_http_hi_create_main_conf(ngx_conf_t *cf) {
+    ngx_http_hi_main_conf_t *conf = (ngx_http_hi_main_conf_t*) ngx_pcalloc(cf->pool, sizeof (ngx_http_hi_main_conf_t));
+    if (conf && ngx_array_init(&conf->caches, cf->pool, 4, sizeof (ngx_http_file_cache_t *)) == NGX_OK
+            && ngx_array_init(&conf->dicts, cf->pool, 4, sizeof (ngx_shm_zone_t *)) == NGX_OK
+            && ngx_array_init(&conf->timers, cf->pool, 4, sizeof (ngx_http_hi_loc_conf_t *)) == NGX_OK) {
+        conf->runner_processes = NGX_CONF_UNSET;
+        conf->runner_ring_size = NGX_CONF_UNSET_SIZE;
+        return conf;
+    }
+    return NULL;
+}
+
+static char * ngx_http_hi_init_main_conf(ngx_conf_t *cf, void *conf) {
+    ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) conf;
+    ngx_conf_init_value(hmcf->runner_processes, 2);
+    ngx_conf_init_size_value(hmcf->runner_ring_size, (size_t) 1024 * 1024);
+    if (hmcf->runner_processes < 1) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "hi_runner_processes must be at least 1");
+        return (char*) NGX_CONF_ERROR;
+    }
+    return NGX_CONF_OK;
+}
+
+static void * ngx_http_hi_create_loc_conf(ngx_conf_t *cf) {
+    ngx_http_hi_loc_conf_t *conf = (ngx_http_hi_loc_conf_t*) ngx_pcalloc(cf->pool, sizeof (ngx_http_hi_loc_conf_t));
+    if (conf) {
+        conf->module_path.len = 0;
+        conf->module_path.data = NULL;
+        conf->module_index = NGX_CONF_UNSET;
+        conf->route_path.len = 0;
+        conf->route_path.data = NULL;
+        conf->route_index = NGX_CONF_UNSET;
+        conf->websocket_path.len = 0;
+        conf->websocket_path.data = NULL;
+        conf->websocket_index = NGX_CONF_UNSET;
+        conf->websocket_max_message = NGX_CONF_UNSET_SIZE;
+        conf->websocket_max_pending = NGX_CONF_UNSET_SIZE;
+        conf->redis_host.len = 0;
+        conf->redis_host.data = NULL;
+        conf->python_script.len = 0;
+        conf->python_script.data = NULL;
+        conf->python_content.len = 0;
+        conf->python_content.data = NULL;
+        conf->lua_script.len = 0;
+        conf->lua_script.data = NULL;
         conf->lua_content.len = 0;
         conf->lua_content.data = NULL;
         conf->php_script.len = 0;
         conf->php_script.data = NULL;
+        conf->cache_snapshot.len = 0;
+        conf->cache_snapshot.data = NULL;
+        conf->cache_disk.len = 0;
+        conf->cache_disk.data = NULL;
+        conf->session_zone.len = 0;
+        conf->session_zone.data = NULL;
+        conf->timer_uri.len = 0;
+        conf->timer_uri.data = NULL;
+        conf->timer_zone.len = 0;
+        conf->timer_zone.data = NULL;
+        conf->timer_interval = 0;
+        conf->session_store = NGX_CONF_UNSET_UINT;
+        conf->cache_disk_min_size = NGX_CONF_UNSET_SIZE;
         conf->java_classpath.len = 0;
         conf->java_classpath.data = NULL;
         conf->java_servlet.len = 0;
@@ -388,6 +1522,8 @@ static void * ngx_http_hi_create_loc_conf(ngx_conf_t *cf) {
         conf->need_cache = NGX_CONF_UNSET;
         conf->need_cookies = NGX_CONF_UNSET;
         conf->need_session = NGX_CONF_UNSET;
+        conf->runner = NGX_CONF_UNSET;
+        conf->runner_timeout = NGX_CONF_UNSET_MSEC;
         conf->app_type = application_t::__unkown__;
         return conf;
     }
@@ -399,12 +1535,19 @@ static char * ngx_http_hi_merge_loc_conf(ngx_conf_t* cf, void* parent, void* chi
     ngx_http_hi_loc_conf_t * conf = (ngx_http_hi_loc_conf_t*) child;
 
     ngx_conf_merge_str_value(conf->module_path, prev->module_path, "");
+    ngx_conf_merge_str_value(conf->route_path, prev->route_path, "");
+    ngx_conf_merge_str_value(conf->websocket_path, prev->websocket_path, "");
+    ngx_conf_merge_size_value(conf->websocket_max_message, prev->websocket_max_message, (size_t) 1024 * 1024);
+    ngx_conf_merge_size_value(conf->websocket_max_pending, prev->websocket_max_pending, (size_t) 1024 * 1024);
     ngx_conf_merge_str_value(conf->redis_host, prev->redis_host, "");
     ngx_conf_merge_str_value(conf->python_script, prev->python_script, "");
     ngx_conf_merge_str_value(conf->python_content, prev->python_content, "");
     ngx_conf_merge_str_value(conf->lua_script, prev->lua_script, "");
     ngx_conf_merge_str_value(conf->lua_content, prev->lua_content, "");
     ngx_conf_merge_str_value(conf->php_script, prev->php_script, "");
+    ngx_conf_merge_str_value(conf->cache_snapshot, prev->cache_snapshot, "");
+    ngx_conf_merge_str_value(conf->cache_disk, prev->cache_disk, "off");
+    ngx_conf_merge_size_value(conf->cache_disk_min_size, prev->cache_disk_min_size, (size_t) 64 * 1024);
     ngx_conf_merge_str_value(conf->java_classpath, prev->java_classpath, "-Djava.class.path=.");
     ngx_conf_merge_str_value(conf->java_options, prev->java_options, "-server -d64 -Xmx1G -Xms1G -Xmn256m");
     ngx_conf_merge_str_value(conf->java_servlet, prev->java_servlet, "");
@@ -419,9 +1562,45 @@ static char * ngx_http_hi_merge_loc_conf(ngx_conf_t* cf, void* parent, void* chi
     ngx_conf_merge_value(conf->need_cache, prev->need_cache, (ngx_flag_t) 1);
     ngx_conf_merge_value(conf->need_cookies, prev->need_cookies, (ngx_flag_t) 0);
     ngx_conf_merge_value(conf->need_session, prev->need_session, (ngx_flag_t) 0);
+    ngx_conf_merge_value(conf->runner, prev->runner, (ngx_flag_t) 0);
+    ngx_conf_merge_msec_value(conf->runner_timeout, prev->runner_timeout, (ngx_msec_t) 60000);
+    ngx_conf_merge_uint_value(conf->session_store, prev->session_store, (ngx_uint_t) session_store_t::__redis_session__);
+    ngx_conf_merge_str_value(conf->session_zone, prev->session_zone, "session");
     if (conf->need_session == 1 && conf->need_cookies == 0) {
         conf->need_cookies = 1;
     }
+    if (conf->timer_zone.len > 0) {
+        ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) ngx_http_conf_get_module_main_conf(cf, ngx_http_hi_module);
+        ngx_shm_zone_t **zones = (ngx_shm_zone_t**) hmcf->dicts.elts;
+        ngx_uint_t i = 0;
+        while (i < hmcf->dicts.nelts && ngx_strcmp(zones[i]->shm.name.data, conf->timer_zone.data) != 0) {
+            ++i;
+        }
+        if (i == hmcf->dicts.nelts) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "hi_timer zone \"%V\" is not declared by hi_shared_dict", &conf->timer_zone);
+            return (char*) NGX_CONF_ERROR;
+        }
+    }
+    if (conf->need_session == 1 && conf->session_store != session_store_t::__redis_session__) {
+        ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) ngx_http_conf_get_module_main_conf(cf, ngx_http_hi_module);
+        ngx_shm_zone_t **zones = (ngx_shm_zone_t**) hmcf->dicts.elts;
+        ngx_uint_t i = 0;
+        while (i < hmcf->dicts.nelts && ngx_strcmp(zones[i]->shm.name.data, conf->session_zone.data) != 0) {
+            ++i;
+        }
+        if (i == hmcf->dicts.nelts) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "hi_session_store zone \"%V\" is not declared by hi_shared_dict", &conf->session_zone);
+            return (char*) NGX_CONF_ERROR;
+        }
+#if (NGX_THREADS)
+        if (conf->session_store == session_store_t::__shm_redis_session__ && hmcf->session_thread_pool == NULL) {
+            hmcf->session_thread_pool = ngx_thread_pool_add(cf, NULL);
+            if (hmcf->session_thread_pool == NULL) {
+                return (char*) NGX_CONF_ERROR;
+            }
+        }
+#endif
+    }
     if (conf->module_index == NGX_CONF_UNSET && conf->module_path.len > 0) {
 
         ngx_int_t index = NGX_CONF_UNSET;
@@ -441,6 +1620,38 @@ static char * ngx_http_hi_merge_loc_conf(ngx_conf_t* cf, void* parent, void* chi
         }
         conf->app_type = application_t::__cpp__;
     }
+    if (conf->route_index == NGX_CONF_UNSET && conf->route_path.len > 0) {
+        for (size_t i = 0; i < ROUTER.size(); ++i) {
+            if (ROUTER[i]->get_module() == (char*) conf->route_path.data) {
+                conf->route_index = i;
+                break;
+            }
+        }
+        if (conf->route_index == NGX_CONF_UNSET) {
+            std::shared_ptr<hi::router> router = std::make_shared<hi::router>((char*) conf->route_path.data);
+            std::string err;
+            if (!router->load(err)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "hi_route \"%V\": %s", &conf->route_path, err.c_str());
+                return (char*) NGX_CONF_ERROR;
+            }
+            ROUTER.push_back(router);
+            conf->route_index = ROUTER.size() - 1;
+        }
+        conf->app_type = application_t::__route__;
+    }
+    if (conf->websocket_index == NGX_CONF_UNSET && conf->websocket_path.len > 0) {
+        for (size_t i = 0; i < WEBSOCKET.size(); ++i) {
+            if (WEBSOCKET[i]->get_module() == (char*) conf->websocket_path.data) {
+                conf->websocket_index = i;
+                break;
+            }
+        }
+        if (conf->websocket_index == NGX_CONF_UNSET) {
+            WEBSOCKET.push_back(std::make_shared<hi::module_class < hi::websocket >> ((char*) conf->websocket_path.data));
+            conf->websocket_index = WEBSOCKET.size() - 1;
+        }
+        conf->app_type = application_t::__websocket__;
+    }
 
     if (conf->python_content.len > 0 || conf->python_script.len > 0) {
         conf->app_type = application_t::__python__;
@@ -453,6 +1664,7 @@ static char * ngx_http_hi_merge_loc_conf(ngx_conf_t* cf, void* parent, void* chi
         if (!PHP) {
             int argc = 1;
             char* argv[2] = {"", NULL};
+            php_register_functions();
             PHP = std::move(std::make_shared<php::VM>(argc, argv));
         }
     }
@@ -462,10 +1674,49 @@ static char * ngx_http_hi_merge_loc_conf(ngx_conf_t* cf, void* parent, void* chi
             JAVA_SERVLET_CACHE = std::make_shared<hi::cache::lru_cache < std::string, hi::java_servlet_t >> (conf->java_servlet_cache_size);
         }
     }
+    if (conf->runner == 1) {
+        switch (conf->app_type) {
+            case application_t::__python__:
+            case application_t::__lua__:
+            case application_t::__java__:
+            case application_t::__php__:
+                ((ngx_http_hi_main_conf_t*) ngx_http_conf_get_module_main_conf(cf, ngx_http_hi_module))->runner = 1;
+                break;
+            default:conf->runner = 0;
+                break;
+        }
+    }
+
+#if (NGX_HTTP_CACHE)
+    conf->disk_cache = NULL;
+    if (conf->need_cache == 1 && ngx_strcmp(conf->cache_disk.data, "off") != 0) {
+        ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) ngx_http_conf_get_module_main_conf(cf, ngx_http_hi_module);
+        ngx_http_file_cache_t **caches = (ngx_http_file_cache_t **) hmcf->caches.elts;
+        for (ngx_uint_t i = 0; i < hmcf->caches.nelts; ++i) {
+            ngx_str_t *name = &caches[i]->shm_zone->shm.name;
+            if (name->len == conf->cache_disk.len && ngx_strncmp(name->data, conf->cache_disk.data, name->len) == 0) {
+                conf->disk_cache = caches[i];
+                break;
+            }
+        }
+        if (conf->disk_cache == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "hi_cache_disk zone \"%V\" is unknown", &conf->cache_disk);
+            return (char*) NGX_CONF_ERROR;
+        }
+    }
+#endif
 
     if (conf->need_cache == 1 && conf->cache_index == NGX_CONF_UNSET) {
         CACHE.push_back(std::make_shared<hi::cache::lru_cache < std::string, cache_ele_t >> (conf->cache_size));
         conf->cache_index = CACHE.size() - 1;
+        cache_snapshot_t snapshot;
+        snapshot.path.assign((char*) conf->cache_snapshot.data, conf->cache_snapshot.len);
+        snapshot.expires = conf->cache_expires;
+        for (ngx_str_t* item :{&conf->module_path, &conf->route_path, &conf->python_script, &conf->python_content, &conf->lua_script
+                    , &conf->lua_content, &conf->java_servlet, &conf->php_script}) {
+            snapshot.fingerprint.append((char*) item->data, item->len).append("\n");
+        }
+        CACHE_SNAPSHOT.push_back(snapshot);
     }
 
 
@@ -473,6 +1724,10 @@ static char * ngx_http_hi_merge_loc_conf(ngx_conf_t* cf, void* parent, void* chi
 }
 
 static ngx_int_t ngx_http_hi_handler(ngx_http_request_t *r) {
+    ngx_http_hi_loc_conf_t * conf = (ngx_http_hi_loc_conf_t *) ngx_http_get_module_loc_conf(r, ngx_http_hi_module);
+    if (conf->app_type == application_t::__websocket__) {
+        return ngx_http_hi_websocket_handler(r, conf);
+    }
     if (r->headers_in.content_length_n > 0) {
         ngx_http_core_loc_conf_t *clcf = (ngx_http_core_loc_conf_t *) ngx_http_get_module_loc_conf(r, ngx_http_core_module);
         if (clcf->client_body_buffer_size < (size_t) clcf->client_max_body_size) {
@@ -502,15 +1757,26 @@ static ngx_int_t ngx_http_hi_normal_handler(ngx_http_request_t *r) {
         }
     }
 
-    hi::request ngx_request;
-    hi::response ngx_response;
-    std::string SESSION_ID_VALUE;
+    ngx_http_hi_ctx_t* ctx = ngx_http_hi_create_ctx(r);
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    hi::request& ngx_request = ctx->req;
+    hi::response& ngx_response = ctx->res;
+    std::string& SESSION_ID_VALUE = ctx->session_id;
+    std::shared_ptr<std::string>& cache_k = ctx->cache_k;
+    ngx_int_t rc;
+    ctx->started = monotonic_usec();
 
     ngx_request.uri.assign((char*) r->uri.data, r->uri.len);
+    ngx_request.shared_dicts = &SHARED_DICT;
     if (r->args.len > 0) {
         ngx_request.param.assign((char*) r->args.data, r->args.len);
     }
-    std::shared_ptr<std::string> cache_k;
+    if (conf->timer_zone.len > 0 && r->args.len == 0 && timer_cache_get(conf, ngx_request.uri, ngx_response)) {
+        ctx->cache_status = cache_status_t::__cache_hit__;
+        goto done;
+    }
     if (conf->need_cache == 1) {
         ngx_response.headers.insert(std::make_pair("Last-Modified", (char*) ngx_cached_http_time.data));
         cache_k = std::make_shared<std::string>(ngx_request.uri);
@@ -532,19 +1798,43 @@ static ngx_int_t ngx_http_hi_normal_handler(ngx_http_request_t *r) {
         ngx_hex_dump(p, md5_buf, sizeof (md5_buf));
 
         cache_k->assign((char*) p, 32);
+        ctx->cache_status = cache_status_t::__cache_miss__;
 
+        if (CACHE_SNAPSHOT[conf->cache_index].image) {
+            cache_snapshot_restore(conf->cache_index);
+        }
         if (CACHE[conf->cache_index]->exists(*cache_k)) {
             const cache_ele_t& cache_v = CACHE[conf->cache_index]->get(*cache_k);
             time_t now = time(NULL);
             if (difftime(now, cache_v.t) > conf->cache_expires) {
                 CACHE[conf->cache_index]->erase(*cache_k);
+                ctx->cache_status = cache_status_t::__cache_expired__;
             } else {
                 ngx_response.content = cache_v.content;
                 ngx_response.headers.find("Content-Type")->second = cache_v.content_type;
                 ngx_response.status = cache_v.status;
+                ctx->cache_status = cache_status_t::__cache_hit__;
                 goto done;
             }
         }
+#if (NGX_HTTP_CACHE)
+        if (conf->disk_cache && (rc = cache_disk_open(r, conf, p)) == NGX_OK) {
+            cache_ele_t cache_v;
+            switch (cache_disk_read(r, conf, *cache_k, cache_v)) {
+                case NGX_OK:ctx->disk_hit = true;
+                    /* fall through */
+                case NGX_DONE:
+                    ngx_response.content = cache_v.content;
+                    ngx_response.headers.find("Content-Type")->second = cache_v.content_type;
+                    ngx_response.status = cache_v.status;
+                    ctx->cache_status = cache_status_t::__cache_hit__;
+                    goto done;
+                default:break;
+            }
+        } else if (conf->disk_cache && rc == NGX_HTTP_CACHE_STALE) {
+            ctx->cache_status = cache_status_t::__cache_expired__;
+        }
+#endif
     }
     if (conf->need_headers == 1) {
         get_input_headers(r, ngx_request.headers);
@@ -560,6 +1850,10 @@ static ngx_int_t ngx_http_hi_normal_handler(ngx_http_request_t *r) {
     }
     if (r->headers_in.content_length_n > 0) {
         ngx_str_t body = get_input_body(r);
+        if (r->request_body && !r->request_body->temp_file) {
+            ngx_request.body = (const char*) body.data;
+            ngx_request.body_len = body.len;
+        }
         if (r->headers_in.content_type->value.len < form_urlencoded_type_len
                 || ngx_strncasecmp(r->headers_in.content_type->value.data, (u_char *) form_urlencoded_type,
                 form_urlencoded_type_len) != 0) {
@@ -605,14 +1899,13 @@ static ngx_int_t ngx_http_hi_normal_handler(ngx_http_request_t *r) {
             }
         }
     }
+    ctx->servlet_started = monotonic_usec();
+    ctx->parse_time = ctx->servlet_started - ctx->started;
     if (conf->need_session == 1 && ngx_request.cookies.find(SESSION_ID_NAME) != ngx_request.cookies.end()) {
-        if (!REDIS) {
-            REDIS = std::make_shared<hi::redis>();
-        }
-        if (!REDIS->is_connected() && conf->redis_host.len > 0 && conf->redis_port > 0) {
-            REDIS->connect((char*) conf->redis_host.data, (int) conf->redis_port);
-        }
-        if (REDIS->is_connected()) {
+        if (conf->session_store != session_store_t::__redis_session__) {
+            SESSION_ID_VALUE = ngx_request.cookies[SESSION_ID_NAME ];
+            session_load(conf, SESSION_ID_VALUE, ngx_request.session);
+        } else if (session_redis(conf)) {
             SESSION_ID_VALUE = ngx_request.cookies[SESSION_ID_NAME ];
             if (!REDIS->exists(SESSION_ID_VALUE)) {
                 REDIS->hset(SESSION_ID_VALUE, SESSION_ID_NAME, SESSION_ID_VALUE);
@@ -622,34 +1915,693 @@ static ngx_int_t ngx_http_hi_normal_handler(ngx_http_request_t *r) {
                 REDIS->hgetall(SESSION_ID_VALUE, ngx_request.session);
             }
         }
+        ctx->session_time = monotonic_usec() - ctx->servlet_started;
+        ctx->servlet_started += ctx->session_time;
+    }
+    if (conf->runner == 1) {
+        rc = ngx_http_hi_runner_post(r, ctx, conf);
+    } else if (conf->app_type == application_t::__lua__) {
+        rc = ngx_http_hi_lua_start(r, ctx, conf);
+    } else {
+        ngx_http_hi_dispatch(conf, ngx_request, ngx_response);
+        rc = ngx_http_hi_continue(r, ctx);
+    }
+    if (rc == NGX_DONE) {
+        r->main->count++;
+    }
+    return rc;
+
+done:
+    return ngx_http_hi_send_response(r, ctx);
+}
+
+static ngx_table_elt_t* find_input_header(ngx_http_request_t* r, const char* name, size_t len) {
+    ngx_list_part_t *part = &r->headers_in.headers.part;
+    ngx_table_elt_t *th = (ngx_table_elt_t*) part->elts;
+    for (ngx_uint_t i = 0; /* void */; i++) {
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            th = (ngx_table_elt_t*) part->elts;
+            i = 0;
+        }
+        if (th[i].key.len == len && ngx_strncasecmp(th[i].key.data, (u_char*) name, len) == 0) {
+            return &th[i];
+        }
+    }
+    return NULL;
+}
+
+static ngx_int_t ngx_http_hi_websocket_handler(ngx_http_request_t* r, ngx_http_hi_loc_conf_t * conf) {
+    ngx_table_elt_t *key = find_input_header(r, "Sec-WebSocket-Key", sizeof ("Sec-WebSocket-Key") - 1)
+            , *version = find_input_header(r, "Sec-WebSocket-Version", sizeof ("Sec-WebSocket-Version") - 1);
+    if (r != r->main || r->method != NGX_HTTP_GET || r->http_version < NGX_HTTP_VERSION_11
+            || r->headers_in.content_length_n > 0 || r->headers_in.chunked
+#if (NGX_HTTP_V2)
+            || r->stream
+#endif
+            || r->headers_in.upgrade == NULL || ngx_strcasecmp(r->headers_in.upgrade->value.data, (u_char*) "websocket") != 0
+            || key == NULL || key->value.len != 24) {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+    if (version == NULL || version->value.len != 2 || ngx_strncmp(version->value.data, "13", 2) != 0) {
+        ngx_table_elt_t *h = (ngx_table_elt_t*) ngx_list_push(&r->headers_out.headers);
+        if (h) {
+            h->hash = 1;
+            ngx_str_set(&h->key, "Sec-WebSocket-Version");
+            ngx_str_set(&h->value, "13");
+        }
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    ngx_http_hi_ctx_t* ctx = ngx_http_hi_create_ctx(r);
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    std::shared_ptr<hi::websocket> servlet = WEBSOCKET[conf->websocket_index]->make_obj();
+    if (!servlet) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    hi::request& req = ctx->req;
+    req.uri.assign((char*) r->uri.data, r->uri.len);
+    req.method.assign((char*) r->method_name.data, r->method_name.len);
+    req.client.assign((char*) r->connection->addr_text.data, r->connection->addr_text.len);
+    req.shared_dicts = &SHARED_DICT;
+    if (r->headers_in.user_agent) {
+        req.user_agent.assign((char*) r->headers_in.user_agent->value.data, r->headers_in.user_agent->value.len);
+    }
+    if (r->args.len > 0) {
+        req.param.assign((char*) r->args.data, r->args.len);
+        hi::parser_param(req.param, req.form);
+    }
+    get_input_headers(r, req.headers);
+    if (r->headers_in.cookies.nelts != 0) {
+        ngx_table_elt_t ** cookies = (ngx_table_elt_t **) r->headers_in.cookies.elts;
+        for (size_t i = 0; i < r->headers_in.cookies.nelts; ++i) {
+            hi::parser_param(std::string((char*) cookies[i]->value.data, cookies[i]->value.len), req.cookies, ';');
+        }
+    }
+
+    u_char hash[20], *accept = (u_char*) ngx_pnalloc(r->pool, ngx_base64_encoded_length(sizeof (hash)));
+    ngx_table_elt_t *upgrade = (ngx_table_elt_t*) ngx_list_push(&r->headers_out.headers)
+            , *h = (ngx_table_elt_t*) ngx_list_push(&r->headers_out.headers);
+    if (accept == NULL || upgrade == NULL || h == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    ngx_sha1_t sha1;
+    ngx_sha1_init(&sha1);
+    ngx_sha1_update(&sha1, key->value.data, key->value.len);
+    ngx_sha1_update(&sha1, WEBSOCKET_GUID, sizeof (WEBSOCKET_GUID) - 1);
+    ngx_sha1_final(hash, &sha1);
+    ngx_str_t src = {sizeof (hash), hash};
+    h->hash = 1;
+    ngx_str_set(&h->key, "Sec-WebSocket-Accept");
+    h->value.data = accept;
+    ngx_encode_base64(&h->value, &src);
+    upgrade->hash = 1;
+    ngx_str_set(&upgrade->key, "Upgrade");
+    ngx_str_set(&upgrade->value, "websocket");
+
+    r->headers_out.status = NGX_HTTP_SWITCHING_PROTOCOLS;
+    ngx_str_set(&r->headers_out.status_line, "101 Switching Protocols");
+    r->keepalive = 0;
+    ngx_int_t rc = ngx_http_send_header(r);
+    if (rc == NGX_ERROR || rc > NGX_OK) {
+        return rc;
+    }
+
+    ngx_connection_t *c = r->connection;
+    ngx_http_core_loc_conf_t *clcf = (ngx_http_core_loc_conf_t *) ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    if (clcf->tcp_nodelay && ngx_tcp_nodelay(c) != NGX_OK) {
+        return NGX_ERROR;
+    }
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+    // idle, so that a graceful shutdown closes it instead of waiting for it
+    c->idle = 1;
+    c->log->action = "serving websocket";
+    ngx_http_hi_ws_t *ws = new ngx_http_hi_ws_t(r, conf, servlet);
+    ctx->ws = ws;
+    r->read_event_handler = ngx_http_hi_websocket_read;
+    r->write_event_handler = ngx_http_hi_websocket_write;
+    r->main->count++;
+
+    if (ngx_http_send_special(r, NGX_HTTP_FLUSH) == NGX_ERROR) {
+        ws->closed = true;
+    } else {
+        servlet->on_open(req, *ws);
+    }
+    // a client may send its first frames right behind the handshake
+    if (r->header_in->pos < r->header_in->last) {
+        ws->partial.assign((char*) r->header_in->pos, r->header_in->last - r->header_in->pos);
+        r->header_in->pos = r->header_in->last;
+        ws->partial.erase(0, websocket_parse(ws, (u_char*) & ws->partial[0], ws->partial.size()));
+    }
+    ngx_post_event(c->read, &ngx_posted_events);
+    return NGX_DONE;
+}
+
+static void ngx_http_hi_websocket_read(ngx_http_request_t* r) {
+    ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) ngx_http_get_module_ctx(r, ngx_http_hi_module);
+    ngx_http_hi_ws_t *ws = ctx->ws;
+    ngx_connection_t *c = r->connection;
+    while (!ws->closing && !ws->closed) {
+        ssize_t n = c->recv(c, WEBSOCKET_BUFFER, sizeof (WEBSOCKET_BUFFER));
+        if (n == NGX_AGAIN) {
+            break;
+        }
+        if (n == 0 || n == NGX_ERROR) {
+            ws->closed = true;
+            break;
+        }
+        if (ws->partial.empty()) {
+            size_t used = websocket_parse(ws, WEBSOCKET_BUFFER, n);
+            if (used < (size_t) n) {
+                ws->partial.assign((char*) WEBSOCKET_BUFFER + used, n - used);
+            }
+        } else {
+            ws->partial.append((char*) WEBSOCKET_BUFFER, n);
+            ws->partial.erase(0, websocket_parse(ws, (u_char*) & ws->partial[0], ws->partial.size()));
+        }
+    }
+    if (ws->finished()) {
+        ws->notify();
+        ngx_http_finalize_request(r, NGX_HTTP_CLOSE);
+        return;
+    }
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ws->notify();
+        ngx_http_finalize_request(r, NGX_HTTP_CLOSE);
+    }
+}
+
+static void ngx_http_hi_websocket_write(ngx_http_request_t* r) {
+    ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) ngx_http_get_module_ctx(r, ngx_http_hi_module);
+    ngx_http_hi_ws_t *ws = ctx->ws;
+    ws->flush();
+    if (ws->finished()) {
+        ws->notify();
+        ngx_http_finalize_request(r, NGX_HTTP_CLOSE);
     }
+}
+
+/*
+ * Unmasks and dispatches every complete frame in p, in place, and returns
+ * how many bytes it consumed.
+ */
+static size_t websocket_parse(ngx_http_hi_ws_t* ws, u_char* p, size_t len) {
+    size_t used = 0;
+    while (!ws->closing && !ws->closed) {
+        u_char *h = p + used;
+        size_t avail = len - used, head = 2;
+        if (avail < head) {
+            break;
+        }
+        bool fin = h[0] & 0x80;
+        int opcode = h[0] & 0x0f;
+        uint64_t size = h[1] & 0x7f;
+        if (size == 126) {
+            if (avail < (head = 4)) {
+                break;
+            }
+            size = (h[2] << 8) | h[3];
+        } else if (size == 127) {
+            if (avail < (head = 10)) {
+                break;
+            }
+            size = 0;
+            for (int i = 2; i < 10; ++i) {
+                size = (size << 8) | h[i];
+            }
+        }
+        if (!(h[1] & 0x80) || (h[0] & 0x70) || ((opcode & 0x8) && (!fin || size > 125))) {
+            ws->close(1002);
+            break;
+        }
+        if (size > ws->conf->websocket_max_message || size + ws->message.size() > ws->conf->websocket_max_message) {
+            ws->close(1009);
+            break;
+        }
+        head += 4;
+        if (avail < head + size) {
+            break;
+        }
+        u_char *mask = h + head - 4, *payload = h + head;
+        for (uint64_t i = 0; i < size; ++i) {
+            payload[i] ^= mask[i & 3];
+        }
+        used += head + size;
+        websocket_frame(ws, fin, opcode, (char*) payload, size);
+    }
+    return used;
+}
+
+static void websocket_frame(ngx_http_hi_ws_t* ws, bool fin, int opcode, const char* payload, size_t size) {
+    switch (opcode) {
+        case 0x0:
+            if (ws->opcode == 0) {
+                ws->close(1002);
+                break;
+            }
+            ws->message.append(payload, size);
+            if (fin) {
+                std::string message;
+                message.swap(ws->message);
+                bool binary = ws->opcode == 0x2;
+                ws->opcode = 0;
+                ws->servlet->on_message(*ws, message.data(), message.size(), binary);
+            }
+            break;
+        case 0x1:
+        case 0x2:
+            if (ws->opcode != 0) {
+                ws->close(1002);
+            } else if (fin) {
+                ws->servlet->on_message(*ws, payload, size, opcode == 0x2);
+            } else {
+                ws->message.assign(payload, size);
+                ws->opcode = opcode;
+            }
+            break;
+        case 0x8:
+        {
+            uint16_t code = size >= 2 ? (((u_char) payload[0] << 8) | (u_char) payload[1]) : 1005;
+            ws->close(code == 1005 ? 1000 : code);
+            ws->code = code;
+            break;
+        }
+        case 0x9:
+            ws->ping(payload, size);
+            break;
+        case 0xA:
+            break;
+        default:
+            ws->close(1002);
+            break;
+    }
+}
+
+static ngx_http_hi_ctx_t* ngx_http_hi_create_ctx(ngx_http_request_t* r) {
+    ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+    void *p = ngx_palloc(r->pool, sizeof (ngx_http_hi_ctx_t));
+    if (p == NULL) {
+        return NULL;
+    }
+    ngx_http_hi_ctx_t *ctx = new(p) ngx_http_hi_ctx_t(r->pool);
+    cln->handler = ngx_http_hi_cleanup_ctx;
+    cln->data = ctx;
+    ngx_http_set_ctx(r, ctx, ngx_http_hi_module);
+    return ctx;
+}
+
+static void ngx_http_hi_cleanup_ctx(void* data) {
+    ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) data;
+    if (ctx->runner_timer.timer_set) {
+        ngx_del_timer(&ctx->runner_timer);
+    }
+    if (ctx->runner_id) {
+        RUNNER_PENDING.erase(ctx->runner_id);
+    }
+    if (ctx->lua) {
+        ngx_http_hi_lua_release(ctx->lua);
+        ctx->lua->~ngx_http_hi_lua_co_t();
+    }
+    if (ctx->ws) {
+        ctx->ws->notify();
+        delete ctx->ws;
+    }
+    ctx->~ngx_http_hi_ctx_t();
+}
+
+static void ngx_http_hi_dispatch(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res) {
     switch (conf->app_type) {
-        case application_t::__cpp__:ngx_http_hi_cpp_handler(conf, ngx_request, ngx_response);
+        case application_t::__cpp__:ngx_http_hi_cpp_handler(conf, req, res);
+            break;
+        case application_t::__route__:ngx_http_hi_route_handler(conf, req, res);
             break;
-        case application_t::__python__:ngx_http_hi_python_handler(conf, ngx_request, ngx_response);
+        case application_t::__python__:ngx_http_hi_python_handler(conf, req, res);
             break;
-        case application_t::__lua__:ngx_http_hi_lua_handler(conf, ngx_request, ngx_response);
+        case application_t::__lua__:ngx_http_hi_lua_handler(conf, req, res);
             break;
-        case application_t::__java__:ngx_http_hi_java_handler(conf, ngx_request, ngx_response);
+        case application_t::__java__:ngx_http_hi_java_handler(conf, req, res);
             break;
-        case application_t::__php__:ngx_http_hi_php_handler(conf, ngx_request, ngx_response);
+        case application_t::__php__:ngx_http_hi_php_handler(conf, req, res);
             break;
         default:break;
     }
+}
+
+static ngx_int_t ngx_http_hi_continue(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx) {
+    for (;;) {
+        if (ctx->lua && ctx->lua->waiting) {
+            return NGX_DONE;
+        }
+        if (ctx->fired < ctx->req.subrequests.size()) {
+            ngx_http_hi_subrequest_launch(r, ctx);
+            if (ctx->pending > 0) {
+                r->write_event_handler = ngx_http_hi_subrequest_resume;
+                return NGX_DONE;
+            }
+            continue;
+        }
+        if (!ctx->req.continuation) {
+            break;
+        }
+        hi::continuation_t f = std::move(ctx->req.continuation);
+        ctx->req.continuation = nullptr;
+        f(ctx->req, ctx->res);
+    }
+    ctx->servlet_time = monotonic_usec() - ctx->servlet_started;
+    ngx_http_hi_store(r, ctx);
+    return ngx_http_hi_send_response(r, ctx);
+}
+
+static void ngx_http_hi_subrequest_launch(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx) {
+    ngx_uint_t flags = NGX_HTTP_SUBREQUEST_IN_MEMORY | NGX_HTTP_SUBREQUEST_WAITED;
+    for (size_t i = ctx->fired; i < ctx->req.subrequests.size(); ++i) {
+        hi::subrequest_t& item = ctx->req.subrequests[i];
+        ngx_str_t uri, args;
+        ngx_http_request_t *sr;
+        ngx_http_post_subrequest_t *ps = (ngx_http_post_subrequest_t*) ngx_palloc(r->pool, sizeof (ngx_http_post_subrequest_t));
+        ngx_http_hi_subrequest_t *sub = (ngx_http_hi_subrequest_t*) ngx_palloc(r->pool, sizeof (ngx_http_hi_subrequest_t));
+        uri.len = item.uri.size();
+        uri.data = (u_char*) ngx_pnalloc(r->pool, uri.len);
+        args.len = item.args.size();
+        args.data = (u_char*) ngx_pnalloc(r->pool, args.len);
+        if (ps == NULL || sub == NULL || uri.data == NULL || args.data == NULL) {
+            item.status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+            continue;
+        }
+        ngx_memcpy(uri.data, item.uri.data(), uri.len);
+        ngx_memcpy(args.data, item.args.data(), args.len);
+        sub->ctx = ctx;
+        sub->index = i;
+        sub->done = 0;
+        ps->handler = ngx_http_hi_subrequest_done;
+        ps->data = sub;
+        if (ngx_http_subrequest(r, &uri, args.len > 0 ? &args : NULL, &sr, ps, flags) != NGX_OK) {
+            item.status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+            continue;
+        }
+        ++ctx->pending;
+    }
+    ctx->fired = ctx->req.subrequests.size();
+}
+
+static ngx_int_t ngx_http_hi_subrequest_done(ngx_http_request_t* r, void* data, ngx_int_t rc) {
+    ngx_http_hi_subrequest_t *sub = (ngx_http_hi_subrequest_t*) data;
+    if (sub->done) {
+        return rc;
+    }
+    sub->done = 1;
+    --sub->ctx->pending;
+    hi::subrequest_t& item = sub->ctx->req.subrequests[sub->index];
+    item.status = r->headers_out.status ? r->headers_out.status : NGX_HTTP_BAD_GATEWAY;
+    item.content_type.assign((char*) r->headers_out.content_type.data, r->headers_out.content_type.len);
+    if (r->upstream) {
+        item.content.assign((char*) r->upstream->buffer.pos, r->upstream->buffer.last - r->upstream->buffer.pos);
+    }
+    if (rc >= NGX_HTTP_SPECIAL_RESPONSE && rc != NGX_HTTP_REQUEST_TIME_OUT
+            && rc != NGX_HTTP_CLOSE && rc != NGX_HTTP_CLIENT_CLOSED_REQUEST) {
+        /* hand the error to the servlet instead of writing an error page into the main response */
+        item.status = rc;
+        return NGX_OK;
+    }
+    return rc;
+}
+
+static void ngx_http_hi_subrequest_resume(ngx_http_request_t* r) {
+    ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) ngx_http_get_module_ctx(r, ngx_http_hi_module);
+    if (ctx == NULL || ctx->pending > 0) {
+        return;
+    }
+    ngx_int_t rc = ngx_http_hi_continue(r, ctx);
+    if (rc != NGX_DONE) {
+        ngx_http_finalize_request(r, rc);
+    }
+}
+
+static void ngx_http_hi_store(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx) {
+    ngx_http_hi_loc_conf_t * conf = (ngx_http_hi_loc_conf_t *) ngx_http_get_module_loc_conf(r, ngx_http_hi_module);
+    hi::response& ngx_response = ctx->res;
+    std::shared_ptr<std::string>& cache_k = ctx->cache_k;
+    std::string& SESSION_ID_VALUE = ctx->session_id;
 
     if (ngx_response.status == 200 && conf->need_cache == 1 && conf->cache_expires > 0) {
-        cache_ele_t cache_v;
-        cache_v.content = ngx_response.content;
-        cache_v.content_type = ngx_response.headers.find("Content-Type")->second;
-        cache_v.status = ngx_response.status;
-        cache_v.t = time(NULL);
-        CACHE[conf->cache_index]->put(*cache_k, cache_v);
+        bool in_memory = true;
+#if (NGX_HTTP_CACHE)
+        if (conf->disk_cache) {
+            if (r->cache && r->cache->node) {
+                cache_disk_store(r, conf, ngx_response);
+            }
+            in_memory = ngx_response.content.size() < conf->cache_disk_min_size;
+        }
+#endif
+        if (in_memory) {
+            cache_ele_t cache_v;
+            cache_v.content = ngx_response.content;
+            cache_v.content_type = ngx_response.headers.find("Content-Type")->second;
+            cache_v.status = ngx_response.status;
+            cache_v.t = time(NULL);
+            CACHE[conf->cache_index]->put(*cache_k, cache_v);
+        }
     }
-    if (REDIS && REDIS->is_connected() && !SESSION_ID_VALUE.empty()) {
-        REDIS->hmset(SESSION_ID_VALUE, ngx_response.session);
+    if (!SESSION_ID_VALUE.empty()) {
+        uint64_t t = monotonic_usec();
+        session_save(conf, SESSION_ID_VALUE, ctx->req.session, ngx_response.session);
+        ctx->session_time += monotonic_usec() - t;
     }
+}
 
-done:
+static bool session_redis(ngx_http_hi_loc_conf_t * conf) {
+    if (!REDIS) {
+        REDIS = std::make_shared<hi::redis>();
+    }
+    if (!REDIS->is_connected() && conf->redis_host.len > 0 && conf->redis_port > 0) {
+        REDIS->connect((char*) conf->redis_host.data, (int) conf->redis_port);
+    }
+    return REDIS->is_connected();
+}
+
+static ngx_http_hi_shared_dict* session_zone(ngx_http_hi_loc_conf_t * conf) {
+    return static_cast<ngx_http_hi_shared_dict*> (shared_dict_of((char*) conf->session_zone.data, conf->session_zone.len));
+}
+
+/*
+ * A session lives in the zone as one packed map. With shm+redis a miss
+ * falls back to redis once, so sessions survive a restart of the host;
+ * the round trip is made outside the zone lock, and a session another
+ * worker stored meanwhile wins.
+ */
+static void session_load(ngx_http_hi_loc_conf_t * conf, const std::string& id, hi::string_map& session) {
+    ngx_http_hi_shared_dict* zone = session_zone(conf);
+    bool shm_redis = conf->session_store == session_store_t::__shm_redis_session__, fresh = true;
+    double ttl = conf->session_expires;
+    std::string value;
+    if (shm_redis) {
+        if (zone->get(id, value)) {
+            hi::runner::unpacker(value).get_map(session);
+            return;
+        }
+        if (session_redis(conf) && REDIS->exists(id)) {
+            REDIS->hgetall(id, session);
+            long long left = REDIS->ttl(id);
+            if (left > 0) {
+                ttl = left;
+            }
+            fresh = false;
+        }
+    }
+    if (fresh) {
+        session[SESSION_ID_NAME] = id;
+    }
+    value.clear();
+    hi::runner::packer(value).put_map(session);
+    if (!zone->add_or_get(id, value, ttl)) {
+        session.clear();
+        hi::runner::unpacker(value).get_map(session);
+        return;
+    }
+    if (fresh && shm_redis) {
+        session_write_behind(conf, id, session, {}, conf->session_expires);
+    }
+}
+
+/*
+ * Only fields the handler added or changed are written back. A field the
+ * handler sets to an empty value is removed from the session.
+ */
+static void session_save(ngx_http_hi_loc_conf_t * conf, const std::string& id, const hi::string_map& before, const hi::string_map& after) {
+    std::unordered_map<std::string, std::string> dirty;
+    std::vector<std::string> removed;
+    for (auto& item : after) {
+        auto it = before.find(item.first);
+        if (item.second.empty()) {
+            if (it != before.end()) {
+                removed.push_back(item.first);
+            }
+        } else if (it == before.end() || it->second != item.second) {
+            dirty[item.first] = item.second;
+        }
+    }
+    if (dirty.empty() && removed.empty()) {
+        return;
+    }
+    if (conf->session_store == session_store_t::__redis_session__) {
+        if (REDIS && REDIS->is_connected()) {
+            if (!dirty.empty()) {
+                REDIS->append_hmset(id, dirty);
+            }
+            if (!removed.empty()) {
+                REDIS->append_hdel(id, removed);
+            }
+            REDIS->flush();
+        }
+        return;
+    }
+    session_zone(conf)->update(id, conf->session_expires, [&dirty, &removed](std::string & value) {
+        std::unordered_map<std::string, std::string> session;
+        hi::runner::unpacker(value).get_map(session);
+        for (auto& item : dirty) {
+            session[item.first] = item.second;
+        }
+        for (auto& item : removed) {
+            session.erase(item);
+        }
+        std::string out;
+        hi::runner::packer(out).put_map(session);
+        value.swap(out);
+    });
+    if (conf->session_store == session_store_t::__shm_redis_session__) {
+        session_write_behind(conf, id, dirty, removed, 0);
+    }
+}
+
+template<typename map_t>
+static void session_write_behind(ngx_http_hi_loc_conf_t * conf, const std::string& id, const map_t& fields, const std::vector<std::string>& removed, ngx_int_t expires) {
+    if (SESSION_FLUSHER.host.empty()) {
+        SESSION_FLUSHER.host.assign((char*) conf->redis_host.data, conf->redis_host.len);
+        SESSION_FLUSHER.port = (int) conf->redis_port;
+    }
+    session_pending_t& item = SESSION_PENDING[id];
+    for (auto& i : fields) {
+        item.fields[i.first] = i.second;
+        item.removed.erase(i.first);
+    }
+    for (auto& i : removed) {
+        item.fields.erase(i);
+        item.removed.insert(i);
+    }
+    if (expires > 0) {
+        item.expires = expires;
+    }
+    if (!SESSION_FLUSH.timer_set) {
+        SESSION_FLUSH.handler = ngx_http_hi_session_flush;
+        SESSION_FLUSH.log = ngx_cycle->log;
+        SESSION_FLUSH.cancelable = 1;
+        ngx_add_timer(&SESSION_FLUSH, SESSION_FLUSH_INTERVAL);
+    }
+}
+
+/*
+ * Sends a batch of changed sessions in one pipelined round trip. It runs
+ * in a thread pool task when nginx has threads, and in the worker when it
+ * exits.
+ */
+static void session_flush(session_flusher_t& flusher) {
+    if (flusher.batch.empty()) {
+        return;
+    }
+    if (!flusher.redis) {
+        flusher.redis = std::make_shared<hi::redis>();
+        if (flusher.port > 0) {
+            flusher.redis->connect(flusher.host, flusher.port);
+        }
+    } else {
+        flusher.redis->reconnect();
+    }
+    if (!flusher.redis->is_connected()) {
+        flusher.dropped += flusher.batch.size();
+        flusher.batch.clear();
+        return;
+    }
+    for (auto& item : flusher.batch) {
+        if (!item.second.fields.empty()) {
+            flusher.redis->append_hmset(item.first, item.second.fields);
+        }
+        if (!item.second.removed.empty()) {
+            flusher.redis->append_hdel(item.first, item.second.removed);
+        }
+        if (item.second.expires > 0) {
+            flusher.redis->append_expire(item.first, item.second.expires);
+        }
+    }
+    flusher.batch.clear();
+    flusher.redis->flush();
+}
+
+static void session_flush_report(ngx_log_t* log) {
+    if (SESSION_FLUSHER.dropped > 0) {
+        ngx_log_error(NGX_LOG_ERR, log, 0, "hi_session_store dropped %uz sessions, redis is not connected", SESSION_FLUSHER.dropped);
+        SESSION_FLUSHER.dropped = 0;
+    }
+}
+
+/*
+ * Hands every session changed since the last tick to the flusher. With
+ * threads the worker never waits for redis: a tick that finds the task
+ * still busy leaves the sessions pending, and the task completion handler
+ * sets the timer again.
+ */
+static void ngx_http_hi_session_flush(ngx_event_t* ev) {
+    if (SESSION_PENDING.empty()) {
+        return;
+    }
+#if (NGX_THREADS)
+    if (SESSION_TASK) {
+        if (SESSION_TASK->event.active) {
+            return;
+        }
+        ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) ngx_http_cycle_get_module_main_conf(ngx_cycle, ngx_http_hi_module);
+        SESSION_FLUSHER.batch.swap(SESSION_PENDING);
+        if (ngx_thread_task_post(hmcf->session_thread_pool, SESSION_TASK) != NGX_OK) {
+            SESSION_FLUSHER.batch.swap(SESSION_PENDING);
+            ngx_add_timer(ev, SESSION_FLUSH_INTERVAL);
+        }
+        return;
+    }
+#endif
+    SESSION_FLUSHER.batch.swap(SESSION_PENDING);
+    session_flush(SESSION_FLUSHER);
+    session_flush_report(ev->log);
+}
+
+#if (NGX_THREADS)
+
+static void ngx_http_hi_session_flush_thread(void* data, ngx_log_t* log) {
+    session_flush(*(session_flusher_t*) data);
+}
+
+static void ngx_http_hi_session_flush_done(ngx_event_t* ev) {
+    session_flush_report(ev->log);
+    if (!SESSION_PENDING.empty() && !SESSION_FLUSH.timer_set) {
+        ngx_add_timer(&SESSION_FLUSH, SESSION_FLUSH_INTERVAL);
+    }
+}
+
+#endif
+
+static ngx_int_t ngx_http_hi_send_response(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx) {
+    hi::response& ngx_response = ctx->res;
     ngx_str_t response;
     response.data = (u_char*) ngx_response.content.c_str();
     response.len = ngx_response.content.size();
@@ -666,12 +2618,24 @@ done:
     buf->last = buf->pos + response.len;
     buf->memory = 1;
     buf->last_buf = 1;
+#if (NGX_HTTP_CACHE)
+    if (ctx->disk_hit) {
+        response.len = r->cache->length - r->cache->body_start;
+        buf->pos = buf->last = NULL;
+        buf->memory = 0;
+        buf->in_file = response.len > 0 ? 1 : 0;
+        buf->file = &r->cache->file;
+        buf->file_pos = r->cache->body_start;
+        buf->file_last = r->cache->length;
+    }
+#endif
 
     ngx_chain_t out;
     out.buf = buf;
     out.next = NULL;
 
     set_output_headers(r, ngx_response.headers);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "hi arena: %uz allocations, %uz bytes", ctx->arena.count, ctx->arena.bytes);
     r->headers_out.status = ngx_response.status;
     r->headers_out.content_length_n = response.len;
 
@@ -689,7 +2653,7 @@ static void ngx_http_hi_body_handler(ngx_http_request_t* r) {
     ngx_http_finalize_request(r, ngx_http_hi_normal_handler(r));
 }
 
-static void get_input_headers(ngx_http_request_t* r, std::unordered_map<std::string, std::string>& input_headers) {
+static void get_input_headers(ngx_http_request_t* r, hi::string_map& input_headers) {
     ngx_table_elt_t *th;
     ngx_list_part_t *part;
     part = &r->headers_in.headers.part;
@@ -708,7 +2672,7 @@ static void get_input_headers(ngx_http_request_t* r, std::unordered_map<std::str
     }
 }
 
-static void set_output_headers(ngx_http_request_t* r, std::unordered_multimap<std::string, std::string>& output_headers) {
+static void set_output_headers(ngx_http_request_t* r, hi::string_multimap& output_headers) {
     for (auto& item : output_headers) {
         ngx_table_elt_t * h = (ngx_table_elt_t *) ngx_list_push(&r->headers_out.headers);
         if (h) {
@@ -722,6 +2686,10 @@ static void set_output_headers(ngx_http_request_t* r, std::unordered_multimap<st
 
 }
 
+static void* arena_alloc(void* pool, size_t size) {
+    return ngx_palloc((ngx_pool_t*) pool, size);
+}
+
 static ngx_str_t get_input_body(ngx_http_request_t *r) {
     u_char *p;
     u_char *data;
@@ -774,10 +2742,28 @@ static void ngx_http_hi_cpp_handler(ngx_http_hi_loc_conf_t * conf, hi::request&
     std::shared_ptr<hi::servlet> view_instance = std::move(PLUGIN[conf->module_index]->make_obj());
     if (view_instance) {
         view_instance->handler(req, res);
+        if (req.continuation) {
+            // the servlet must outlive the subrequests its continuation waits for
+            req.continuation = servlet_continuation_t{view_instance, std::move(req.continuation)};
+        }
     }
 
 }
 
+static void ngx_http_hi_route_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res) {
+    hi::route_handler_t* handler = NULL;
+    std::string allow;
+    switch (ROUTER[conf->route_index]->match(req.method, req.uri, handler, req.captures, allow)) {
+        case 200:handler(req, res);
+            break;
+        case 405:res.status = 405;
+            res.content = "<p style='text-align:center;margin:100px;'>405 Method Not Allowed</p>";
+            res.headers.insert(std::make_pair("Allow", allow));
+            break;
+        default:break;
+    }
+}
+
 static void ngx_http_hi_python_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res) {
     hi::py_request py_req;
     hi::py_response py_res;
@@ -795,24 +2781,830 @@ static void ngx_http_hi_python_handler(ngx_http_hi_loc_conf_t * conf, hi::reques
             PYTHON->call_content((char*) conf->python_content.data);
         }
     }
-}
+}
+
+static void ngx_http_hi_lua_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res) {
+    hi::py_request py_req;
+    hi::py_response py_res;
+    py_req.init(&req);
+    py_res.init(&res);
+    if (lua_instance()) {
+        LUA->set_req(&py_req);
+        LUA->set_res(&py_res);
+        lua_push_fast(LUA->get_state(), &req, &res);
+        lua_setglobal(LUA->get_state(), "hi_fast");
+        if (conf->lua_script.len > 0) {
+            LUA->call_script(std::string((char*) conf->lua_script.data, conf->lua_script.len).append(req.uri));
+        } else if (conf->lua_content.len > 0) {
+            LUA->call_content((char*) conf->lua_content.data);
+        }
+    }
+}
+
+static ngx_int_t ngx_http_hi_lua_start(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx, ngx_http_hi_loc_conf_t * conf) {
+    void *p = ngx_palloc(r->pool, sizeof (ngx_http_hi_lua_co_t));
+    if (p == NULL || !lua_instance()) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+    ngx_http_hi_lua_co_t *co = new(p) ngx_http_hi_lua_co_t(r);
+    co->req.init(&ctx->req);
+    co->res.init(&ctx->res);
+    ctx->lua = co;
+    std::string err;
+    if (conf->lua_script.len > 0) {
+        co->thread = LUA->spawn(std::string((char*) conf->lua_script.data, conf->lua_script.len).append(ctx->req.uri), true, &co->req, &co->res, co->ref, err);
+    } else {
+        co->thread = LUA->spawn(std::string((char*) conf->lua_content.data, conf->lua_content.len), false, &co->req, &co->res, co->ref, err);
+    }
+    if (co->thread) {
+        lua_getfenv(co->thread, -1);
+        lua_push_fast(co->thread, &ctx->req, &ctx->res);
+        lua_setfield(co->thread, -2, "hi_fast");
+        lua_pop(co->thread, 1);
+        LUA_COROUTINE[co->thread] = co;
+        ngx_http_hi_lua_resume(co, 0);
+    } else if (!err.empty()) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "hi lua: %s", err.c_str());
+    }
+    return ngx_http_hi_continue(r, ctx);
+}
+
+static void ngx_http_hi_lua_resume(ngx_http_hi_lua_co_t* co, int nargs) {
+    std::string err;
+    co->armed = false;
+    int rc = LUA->resume(co->thread, nargs, &co->res, err);
+    if (rc == LUA_YIELD && co->armed) {
+        return;
+    }
+    if (rc == LUA_YIELD) {
+        ngx_log_error(NGX_LOG_ERR, co->r->connection->log, 0, "hi lua: coroutine yielded outside of a hi.* call");
+    } else if (rc != 0) {
+        ngx_log_error(NGX_LOG_ERR, co->r->connection->log, 0, "hi lua: %s", err.c_str());
+    }
+    ngx_http_hi_lua_release(co);
+}
+
+static void ngx_http_hi_lua_wakeup(ngx_http_hi_lua_co_t* co, int nargs) {
+    ngx_http_request_t *r = co->r;
+    ngx_connection_t *c = r->connection;
+    ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) ngx_http_get_module_ctx(r, ngx_http_hi_module);
+    co->waiting = false;
+    ngx_http_hi_lua_resume(co, nargs);
+    ngx_int_t rc = ngx_http_hi_continue(r, ctx);
+    if (rc != NGX_DONE) {
+        ngx_http_finalize_request(r, rc);
+    }
+    ngx_http_run_posted_requests(c);
+}
+
+static void ngx_http_hi_lua_release(ngx_http_hi_lua_co_t* co) {
+    if (co->sleep.timer_set) {
+        ngx_del_timer(&co->sleep);
+    }
+    while (co->sockets) {
+        lua_socket_shutdown(co->sockets);
+    }
+    if (co->thread) {
+        LUA_COROUTINE.erase(co->thread);
+        if (LUA) {
+            LUA->release(co->ref);
+        }
+        co->thread = NULL;
+    }
+    co->armed = co->waiting = false;
+}
+
+static void ngx_http_hi_lua_sleep_handler(ngx_event_t* ev) {
+    ngx_http_hi_lua_wakeup((ngx_http_hi_lua_co_t*) ev->data, 0);
+}
+
+static void ngx_http_hi_lua_socket_handler(ngx_event_t* ev) {
+    ngx_connection_t *c = (ngx_connection_t*) ev->data;
+    ngx_http_hi_lua_socket_t *sock = (ngx_http_hi_lua_socket_t*) c->data;
+    if (sock->op == lua_socket_op_t::__none__ || (bool) ev->write != (sock->op != lua_socket_op_t::__receive__)) {
+        return;
+    }
+    ngx_int_t rc;
+    if (ev->timedout) {
+        ev->timedout = 0;
+        sock->err = "timeout";
+        rc = NGX_DECLINED;
+    } else {
+        rc = lua_socket_step(sock);
+        if (rc == NGX_AGAIN) {
+            return;
+        }
+    }
+    if (ev->timer_set) {
+        ngx_del_timer(ev);
+    }
+    ngx_http_hi_lua_co_t *co = sock->co;
+    ngx_http_hi_lua_wakeup(co, lua_socket_push(co->thread, sock, rc));
+}
+
+static hi::lua* lua_instance() {
+    if (!LUA) {
+        LUA = std::make_shared<hi::lua>();
+        lua_open_hi(LUA->get_state());
+    }
+    return LUA.get();
+}
+
+/*
+ * hi.redis() speaks RESP over hi.tcp(), so it yields like any other socket.
+ * Unknown methods become commands: red:get(k) is red:command("get", k).
+ * Error replies come back as nil and the message, except inside arrays
+ * where they are false.
+ */
+static const char LUA_REDIS_PRELUDE[] =
+        "local hi = hi\n"
+        "local redis = {}\n"
+        "redis.__index = redis\n"
+        "setmetatable(redis, {__index = function(_, name)\n"
+        "    return function(self, ...) return self:command(name, ...) end\n"
+        "end})\n"
+        "function hi.redis()\n"
+        "    return setmetatable({sock = hi.tcp()}, redis)\n"
+        "end\n"
+        "function redis:settimeout(ms) return self.sock:settimeout(ms) end\n"
+        "function redis:connect(host, port) return self.sock:connect(host, port or 6379) end\n"
+        "function redis:close() return self.sock:close() end\n"
+        "local function read_reply(sock)\n"
+        "    local line, err = sock:receive('*l')\n"
+        "    if not line then return nil, err end\n"
+        "    local prefix, rest = line:sub(1, 1), line:sub(2)\n"
+        "    if prefix == '+' then return rest end\n"
+        "    if prefix == '-' then return false, rest end\n"
+        "    if prefix == ':' then return tonumber(rest) end\n"
+        "    local n = tonumber(rest)\n"
+        "    if prefix == '$' then\n"
+        "        if n < 0 then return hi.null end\n"
+        "        local data, err = sock:receive(n + 2)\n"
+        "        if not data then return nil, err end\n"
+        "        return data:sub(1, n)\n"
+        "    end\n"
+        "    if prefix == '*' then\n"
+        "        if n < 0 then return hi.null end\n"
+        "        local list = {}\n"
+        "        for i = 1, n do\n"
+        "            local v, err = read_reply(sock)\n"
+        "            if v == nil then return nil, err end\n"
+        "            list[i] = v\n"
+        "        end\n"
+        "        return list\n"
+        "    end\n"
+        "    return nil, 'bad reply: ' .. line\n"
+        "end\n"
+        "function redis:command(...)\n"
+        "    local args = {...}\n"
+        "    local buf = {'*' .. #args .. '\\r\\n'}\n"
+        "    for i = 1, #args do\n"
+        "        local s = tostring(args[i])\n"
+        "        buf[#buf + 1] = '$' .. #s .. '\\r\\n' .. s .. '\\r\\n'\n"
+        "    end\n"
+        "    local bytes, err = self.sock:send(table.concat(buf))\n"
+        "    if not bytes then return nil, err end\n"
+        "    local v, err = read_reply(self.sock)\n"
+        "    if v == false then return nil, err end\n"
+        "    return v, err\n"
+        "end\n";
+
+/*
+ * With LuaJIT, hi_fast reads the request through the hi_ffi_* C functions
+ * below: one lookup per key, nil when absent, and strings copied straight
+ * from request memory, so traces need not leave compiled code.
+ */
+static const char LUA_FFI_PRELUDE[] =
+        "local ok, ffi = pcall(require, 'ffi')\n"
+        "if not ok then return end\n"
+        "ffi.cdef[[\n"
+        "typedef struct { const char *data; size_t len; } hi_str_t;\n"
+        "int hi_ffi_req_field(void *req, int field, hi_str_t *out);\n"
+        "int hi_ffi_req_get(void *req, int map, const char *key, size_t key_len, hi_str_t *out);\n"
+        "size_t hi_ffi_req_items(void *req, int map, hi_str_t *out, size_t n);\n"
+        "void hi_ffi_res_status(void *res, int status);\n"
+        "void hi_ffi_res_content(void *res, const char *data, size_t len);\n"
+        "void hi_ffi_res_header(void *res, const char *key, size_t key_len, const char *value, size_t value_len);\n"
+        "void hi_ffi_res_session(void *res, const char *key, size_t key_len, const char *value, size_t value_len);\n"
+        "]]\n"
+        "local C, hi = ffi.C, hi\n"
+        "local out = ffi.new('hi_str_t[1]')\n"
+        "local fast = {}\n"
+        "fast.__index = fast\n"
+        "local function field(id)\n"
+        "    return function(self)\n"
+        "        C.hi_ffi_req_field(self.req, id, out)\n"
+        "        return ffi.string(out[0].data, out[0].len)\n"
+        "    end\n"
+        "end\n"
+        "local function getter(map)\n"
+        "    return function(self, key)\n"
+        "        if C.hi_ffi_req_get(self.req, map, key, #key, out) == 0 then return nil end\n"
+        "        return ffi.string(out[0].data, out[0].len)\n"
+        "    end\n"
+        "end\n"
+        "local function items(map)\n"
+        "    return function(self)\n"
+        "        local n = tonumber(C.hi_ffi_req_items(self.req, map, nil, 0))\n"
+        "        local t = {}\n"
+        "        if n == 0 then return t end\n"
+        "        local buf = ffi.new('hi_str_t[?]', 2 * n)\n"
+        "        C.hi_ffi_req_items(self.req, map, buf, n)\n"
+        "        for i = 0, 2 * n - 1, 2 do\n"
+        "            t[ffi.string(buf[i].data, buf[i].len)] = ffi.string(buf[i + 1].data, buf[i + 1].len)\n"
+        "        end\n"
+        "        return t\n"
+        "    end\n"
+        "end\n"
+        "fast.uri, fast.method, fast.client, fast.user_agent, fast.param = field(0), field(1), field(2), field(3), field(4)\n"
+        "fast.header, fast.form, fast.cookie, fast.session, fast.capture = getter(0), getter(1), getter(2), getter(3), getter(4)\n"
+        "fast.headers, fast.forms, fast.cookies, fast.sessions, fast.captures = items(0), items(1), items(2), items(3), items(4)\n"
+        "function fast:set_status(status) C.hi_ffi_res_status(self.res, status) end\n"
+        "function fast:set_content(data) C.hi_ffi_res_content(self.res, data, #data) end\n"
+        "function fast:set_header(key, value) C.hi_ffi_res_header(self.res, key, #key, value, #value) end\n"
+        "function fast:set_session(key, value) C.hi_ffi_res_session(self.res, key, #key, value, #value) end\n"
+        "function hi.ffi_bind(req, res)\n"
+        "    return setmetatable({req = ffi.cast('void*', req), res = ffi.cast('void*', res)}, fast)\n"
+        "end\n";
+
+static void lua_open_hi(lua_State* L) {
+    static const luaL_Reg hi_lib[] = {
+        {"sleep", lua_hi_sleep},
+        {"subrequest", lua_hi_subrequest},
+        {"tcp", lua_hi_tcp},
+        {"shared_dict", lua_hi_shared_dict},
+        {NULL, NULL}
+    };
+    static const luaL_Reg dict_lib[] = {
+        {"get", lua_dict_get},
+        {"set", lua_dict_set},
+        {"add", lua_dict_add},
+        {"incr", lua_dict_incr},
+        {"delete", lua_dict_delete},
+        {NULL, NULL}
+    };
+    static const luaL_Reg socket_lib[] = {
+        {"settimeout", lua_socket_settimeout},
+        {"connect", lua_socket_connect},
+        {"send", lua_socket_send},
+        {"receive", lua_socket_receive},
+        {"close", lua_socket_close},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(L, LUA_SOCKET_METATABLE);
+    lua_newtable(L);
+    luaL_register(L, NULL, socket_lib);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, lua_socket_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+    luaL_newmetatable(L, LUA_DICT_METATABLE);
+    lua_newtable(L);
+    luaL_register(L, NULL, dict_lib);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+    luaL_register(L, "hi", hi_lib);
+    lua_pushlightuserdata(L, NULL);
+    lua_setfield(L, -2, "null");
+    lua_pop(L, 1);
+    if (luaL_loadbuffer(L, LUA_REDIS_PRELUDE, sizeof (LUA_REDIS_PRELUDE) - 1, "hi.redis") != 0 || lua_pcall(L, 0, 0, 0) != 0) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "hi lua: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+    if (luaL_loadbuffer(L, LUA_FFI_PRELUDE, sizeof (LUA_FFI_PRELUDE) - 1, "hi.ffi") != 0 || lua_pcall(L, 0, 0, 0) != 0) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "hi lua: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+/*
+ * Pushes the hi_fast object of a request, or nil without LuaJIT FFI.
+ */
+static void lua_push_fast(lua_State* L, hi::request* req, hi::response* res) {
+    lua_getglobal(L, "hi");
+    lua_getfield(L, -1, "ffi_bind");
+    lua_remove(L, -2);
+    if (!lua_isfunction(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushnil(L);
+        return;
+    }
+    lua_pushlightuserdata(L, req);
+    lua_pushlightuserdata(L, res);
+    if (lua_pcall(L, 2, 1, 0) != 0) {
+        lua_pop(L, 1);
+        lua_pushnil(L);
+    }
+}
+
+static ngx_http_hi_lua_co_t* lua_current(lua_State* L) {
+    auto it = LUA_COROUTINE.find(L);
+    return it == LUA_COROUTINE.end() ? NULL : it->second;
+}
+
+static int lua_fail(lua_State* L, const char* err) {
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+}
+
+static int lua_hi_sleep(lua_State* L) {
+    lua_Number ms = luaL_checknumber(L, 1);
+    ngx_http_hi_lua_co_t *co = lua_current(L);
+    if (co == NULL) {
+        return lua_fail(L, "no request to suspend");
+    }
+    co->sleep.handler = ngx_http_hi_lua_sleep_handler;
+    co->sleep.data = co;
+    co->sleep.log = co->r->connection->log;
+    ngx_add_timer(&co->sleep, ms > 0 ? (ngx_msec_t) ms : 0);
+    co->armed = co->waiting = true;
+    return lua_yield(L, 0);
+}
+
+/*
+ * Resumes with the status, content type and body of the subrequest, which
+ * goes through the same machinery as hi::request::fetch.
+ */
+static int lua_hi_subrequest(lua_State* L) {
+    size_t uri_len, args_len;
+    const char *uri = luaL_checklstring(L, 1, &uri_len), *args = luaL_optlstring(L, 2, "", &args_len);
+    ngx_http_hi_lua_co_t *co = lua_current(L);
+    if (co == NULL) {
+        return lua_fail(L, "no request to suspend");
+    }
+    ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) ngx_http_get_module_ctx(co->r, ngx_http_hi_module);
+    size_t index = ctx->req.subrequests.size();
+    ctx->req.fetch(std::string(uri, uri_len), std::string(args, args_len));
+    ctx->req.then([co, index](hi::request& req, hi::response&) {
+        hi::subrequest_t& item = req.subrequests[index];
+        lua_pushinteger(co->thread, item.status);
+        lua_pushlstring(co->thread, item.content_type.data(), item.content_type.size());
+        lua_pushlstring(co->thread, item.content.data(), item.content.size());
+        ngx_http_hi_lua_resume(co, 3);
+    });
+    co->armed = true;
+    return lua_yield(L, 0);
+}
+
+static int lua_hi_tcp(lua_State* L) {
+    void *p = lua_newuserdata(L, sizeof (ngx_http_hi_lua_socket_t));
+    new(p) ngx_http_hi_lua_socket_t();
+    luaL_getmetatable(L, LUA_SOCKET_METATABLE);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int lua_socket_settimeout(lua_State* L) {
+    ngx_http_hi_lua_socket_t *sock = (ngx_http_hi_lua_socket_t*) luaL_checkudata(L, 1, LUA_SOCKET_METATABLE);
+    lua_Number ms = luaL_checknumber(L, 2);
+    sock->timeout = ms > 0 ? (ngx_msec_t) ms : 0;
+    return 0;
+}
+
+/*
+ * Names are resolved by ngx_parse_url, which blocks for anything but an
+ * address literal or a unix: path.
+ */
+static int lua_socket_connect(lua_State* L) {
+    ngx_http_hi_lua_socket_t *sock = (ngx_http_hi_lua_socket_t*) luaL_checkudata(L, 1, LUA_SOCKET_METATABLE);
+    size_t host_len;
+    const char *host = luaL_checklstring(L, 2, &host_len);
+    lua_Integer port = luaL_optinteger(L, 3, 0);
+    ngx_http_hi_lua_co_t *co = lua_current(L);
+    if (co == NULL) {
+        return lua_fail(L, "no request to suspend");
+    }
+    lua_socket_shutdown(sock);
+    ngx_url_t url;
+    ngx_memzero(&url, sizeof (ngx_url_t));
+    url.url.len = host_len;
+    url.url.data = (u_char*) ngx_pnalloc(co->r->pool, host_len);
+    if (url.url.data == NULL) {
+        return lua_fail(L, "no memory");
+    }
+    ngx_memcpy(url.url.data, host, host_len);
+    url.default_port = (in_port_t) port;
+    if (ngx_parse_url(co->r->pool, &url) != NGX_OK || url.naddrs == 0) {
+        return lua_fail(L, url.err ? url.err : "host not found");
+    }
+    ngx_memzero(&sock->pc, sizeof (ngx_peer_connection_t));
+    sock->pc.sockaddr = url.addrs[0].sockaddr;
+    sock->pc.socklen = url.addrs[0].socklen;
+    sock->pc.name = &url.addrs[0].name;
+    sock->pc.get = ngx_event_get_peer;
+    sock->pc.log = co->r->connection->log;
+    sock->pc.log_error = NGX_ERROR_ERR;
+    ngx_int_t rc = ngx_event_connect_peer(&sock->pc);
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        if (sock->pc.connection) {
+            ngx_close_connection(sock->pc.connection);
+            sock->pc.connection = NULL;
+        }
+        return lua_fail(L, "connect failed");
+    }
+    ngx_connection_t *c = sock->pc.connection;
+    c->data = sock;
+    c->read->handler = ngx_http_hi_lua_socket_handler;
+    c->write->handler = ngx_http_hi_lua_socket_handler;
+    c->read->log = c->log;
+    c->write->log = c->log;
+    sock->co = co;
+    sock->next = co->sockets;
+    if (co->sockets) {
+        co->sockets->prev = sock;
+    }
+    co->sockets = sock;
+    sock->in.clear();
+    if (rc == NGX_OK) {
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+    sock->op = lua_socket_op_t::__connect__;
+    ngx_add_timer(c->write, sock->timeout);
+    co->armed = co->waiting = true;
+    return lua_yield(L, 0);
+}
+
+static int lua_socket_send(lua_State* L) {
+    ngx_http_hi_lua_socket_t *sock = (ngx_http_hi_lua_socket_t*) luaL_checkudata(L, 1, LUA_SOCKET_METATABLE);
+    size_t len;
+    const char *data = luaL_checklstring(L, 2, &len);
+    sock->out.assign(data, len);
+    sock->sent = 0;
+    return lua_socket_run(L, sock, lua_socket_op_t::__send__);
+}
+
+/*
+ * receive(n) reads exactly n bytes, receive("*l") one line without its
+ * terminator and receive("*a") everything until the peer closes.
+ */
+static int lua_socket_receive(lua_State* L) {
+    ngx_http_hi_lua_socket_t *sock = (ngx_http_hi_lua_socket_t*) luaL_checkudata(L, 1, LUA_SOCKET_METATABLE);
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        sock->want = (ssize_t) lua_tointeger(L, 2);
+        luaL_argcheck(L, sock->want >= 0, 2, "negative size");
+    } else {
+        const char *pattern = luaL_optstring(L, 2, "*l");
+        if (ngx_strcmp(pattern, "*l") == 0) {
+            sock->want = LUA_RECEIVE_LINE;
+        } else if (ngx_strcmp(pattern, "*a") == 0) {
+            sock->want = LUA_RECEIVE_ALL;
+        } else {
+            return luaL_argerror(L, 2, "expected a size, \"*l\" or \"*a\"");
+        }
+    }
+    return lua_socket_run(L, sock, lua_socket_op_t::__receive__);
+}
+
+static int lua_socket_close(lua_State* L) {
+    ngx_http_hi_lua_socket_t *sock = (ngx_http_hi_lua_socket_t*) luaL_checkudata(L, 1, LUA_SOCKET_METATABLE);
+    if (sock->pc.connection == NULL) {
+        return lua_fail(L, "closed");
+    }
+    lua_socket_shutdown(sock);
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int lua_socket_gc(lua_State* L) {
+    ngx_http_hi_lua_socket_t *sock = (ngx_http_hi_lua_socket_t*) luaL_checkudata(L, 1, LUA_SOCKET_METATABLE);
+    lua_socket_shutdown(sock);
+    sock->~ngx_http_hi_lua_socket_t();
+    return 0;
+}
+
+static int lua_socket_run(lua_State* L, ngx_http_hi_lua_socket_t* sock, lua_socket_op_t op) {
+    ngx_http_hi_lua_co_t *co = lua_current(L);
+    if (co == NULL) {
+        return lua_fail(L, "no request to suspend");
+    }
+    if (sock->pc.connection == NULL) {
+        return lua_fail(L, "closed");
+    }
+    if (sock->co != co) {
+        return lua_fail(L, "socket belongs to another request");
+    }
+    if (sock->op != lua_socket_op_t::__none__) {
+        return lua_fail(L, "socket busy");
+    }
+    sock->op = op;
+    ngx_int_t rc = lua_socket_step(sock);
+    if (rc != NGX_AGAIN) {
+        return lua_socket_push(L, sock, rc);
+    }
+    ngx_connection_t *c = sock->pc.connection;
+    ngx_add_timer(op == lua_socket_op_t::__receive__ ? c->read : c->write, sock->timeout);
+    co->armed = co->waiting = true;
+    return lua_yield(L, 0);
+}
+
+/*
+ * Advances the pending operation as far as the socket allows without
+ * blocking: NGX_OK when it is complete, NGX_AGAIN to wait for the next
+ * event, NGX_ERROR with sock->err set otherwise.
+ */
+static ngx_int_t lua_socket_step(ngx_http_hi_lua_socket_t* sock) {
+    ngx_connection_t *c = sock->pc.connection;
+    switch (sock->op) {
+        case lua_socket_op_t::__connect__:
+        {
+            int err = 0;
+            socklen_t len = sizeof (int);
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+                err = ngx_socket_errno;
+            }
+            if (err) {
+                sock->err = "connect failed";
+                return NGX_ERROR;
+            }
+            return NGX_OK;
+        }
+        case lua_socket_op_t::__send__:
+            while (sock->sent < sock->out.size()) {
+                ssize_t n = c->send(c, (u_char*) sock->out.data() + sock->sent, sock->out.size() - sock->sent);
+                if (n == NGX_AGAIN) {
+                    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+                        sock->err = "send failed";
+                        return NGX_ERROR;
+                    }
+                    return NGX_AGAIN;
+                }
+                if (n == NGX_ERROR) {
+                    sock->err = "send failed";
+                    return NGX_ERROR;
+                }
+                sock->sent += n;
+            }
+            return NGX_OK;
+        case lua_socket_op_t::__receive__:
+            for (;;) {
+                if (sock->want >= 0 && sock->in.size() >= (size_t) sock->want) {
+                    sock->result = sock->in.substr(0, sock->want);
+                    sock->in.erase(0, sock->want);
+                    return NGX_OK;
+                }
+                if (sock->want == LUA_RECEIVE_LINE) {
+                    size_t pos = sock->in.find('\n');
+                    if (pos != std::string::npos) {
+                        sock->result = sock->in.substr(0, pos > 0 && sock->in[pos - 1] == '\r' ? pos - 1 : pos);
+                        sock->in.erase(0, pos + 1);
+                        return NGX_OK;
+                    }
+                }
+                u_char buf[4096];
+                ssize_t n = c->recv(c, buf, sizeof (buf));
+                if (n == NGX_AGAIN) {
+                    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                        sock->err = "receive failed";
+                        return NGX_ERROR;
+                    }
+                    return NGX_AGAIN;
+                }
+                if (n == 0 && sock->want == LUA_RECEIVE_ALL) {
+                    sock->result.swap(sock->in);
+                    sock->in.clear();
+                    return NGX_OK;
+                }
+                if (n == 0 || n == NGX_ERROR) {
+                    sock->err = n == 0 ? "closed" : "receive failed";
+                    return NGX_ERROR;
+                }
+                sock->in.append((char*) buf, n);
+            }
+        default:break;
+    }
+    return NGX_OK;
+}
+
+/*
+ * Pushes what the finished operation returns to Lua: true, the number of
+ * bytes sent or the data received on success, nil and an error otherwise,
+ * plus the partial data for a failed receive. Errors close the socket,
+ * except a send or receive timeout.
+ */
+static int lua_socket_push(lua_State* L, ngx_http_hi_lua_socket_t* sock, ngx_int_t rc) {
+    lua_socket_op_t op = sock->op;
+    sock->op = lua_socket_op_t::__none__;
+    if (rc == NGX_OK) {
+        switch (op) {
+            case lua_socket_op_t::__send__:lua_pushinteger(L, sock->sent);
+                break;
+            case lua_socket_op_t::__receive__:lua_pushlstring(L, sock->result.data(), sock->result.size());
+                sock->result.clear();
+                break;
+            default:lua_pushboolean(L, 1);
+                break;
+        }
+        return 1;
+    }
+    lua_pushnil(L);
+    lua_pushstring(L, sock->err);
+    if (rc != NGX_DECLINED || op == lua_socket_op_t::__connect__) {
+        lua_socket_shutdown(sock);
+    }
+    if (op == lua_socket_op_t::__receive__) {
+        lua_pushlstring(L, sock->in.data(), sock->in.size());
+        sock->in.clear();
+        return 3;
+    }
+    return 2;
+}
+
+static void lua_socket_shutdown(ngx_http_hi_lua_socket_t* sock) {
+    if (sock->pc.connection) {
+        ngx_close_connection(sock->pc.connection);
+        sock->pc.connection = NULL;
+    }
+    if (sock->co) {
+        if (sock->prev) {
+            sock->prev->next = sock->next;
+        } else {
+            sock->co->sockets = sock->next;
+        }
+        if (sock->next) {
+            sock->next->prev = sock->prev;
+        }
+        sock->co = NULL;
+        sock->prev = sock->next = NULL;
+    }
+    sock->op = lua_socket_op_t::__none__;
+}
+
+static hi::shared_dict* shared_dict_of(const char* name, size_t len) {
+    auto it = SHARED_DICT.find(std::string(name, len));
+    return it == SHARED_DICT.end() ? NULL : it->second.get();
+}
+
+/*
+ * hi.shared_dict(name) returns the zone or nil. Its methods work in the
+ * worker and under hi_runner alike since they never yield.
+ */
+static int lua_hi_shared_dict(lua_State* L) {
+    size_t len;
+    const char *name = luaL_checklstring(L, 1, &len);
+    hi::shared_dict *dict = shared_dict_of(name, len);
+    if (!dict) {
+        lua_pushnil(L);
+        return 1;
+    }
+    hi::shared_dict **p = (hi::shared_dict**) lua_newuserdata(L, sizeof (hi::shared_dict*));
+    *p = dict;
+    luaL_getmetatable(L, LUA_DICT_METATABLE);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static hi::shared_dict* lua_check_dict(lua_State* L) {
+    return *(hi::shared_dict**) luaL_checkudata(L, 1, LUA_DICT_METATABLE);
+}
+
+static int lua_dict_get(lua_State* L) {
+    hi::shared_dict *dict = lua_check_dict(L);
+    size_t len;
+    const char *key = luaL_checklstring(L, 2, &len);
+    std::string value;
+    if (!dict->get(std::string(key, len), value)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushlstring(L, value.data(), value.size());
+    return 1;
+}
+
+static int lua_dict_store(lua_State* L, bool only_new) {
+    hi::shared_dict *dict = lua_check_dict(L);
+    size_t key_len, value_len;
+    const char *key = luaL_checklstring(L, 2, &key_len), *value = luaL_checklstring(L, 3, &value_len);
+    lua_Number ttl = luaL_optnumber(L, 4, 0);
+    std::string k(key, key_len), v(value, value_len);
+    if (only_new ? !dict->add(k, v, ttl) : !dict->set(k, v, ttl)) {
+        return lua_fail(L, only_new ? "exists or no memory" : "no memory");
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int lua_dict_set(lua_State* L) {
+    return lua_dict_store(L, false);
+}
+
+static int lua_dict_add(lua_State* L) {
+    return lua_dict_store(L, true);
+}
+
+static int lua_dict_incr(lua_State* L) {
+    hi::shared_dict *dict = lua_check_dict(L);
+    size_t len;
+    const char *key = luaL_checklstring(L, 2, &len);
+    lua_Number delta = luaL_optnumber(L, 3, 1), ttl = luaL_optnumber(L, 4, 0);
+    long long value;
+    if (!dict->incr(std::string(key, len), (long long) delta, value, ttl)) {
+        return lua_fail(L, "not an integer or no memory");
+    }
+    lua_pushnumber(L, (lua_Number) value);
+    return 1;
+}
+
+static int lua_dict_delete(lua_State* L) {
+    hi::shared_dict *dict = lua_check_dict(L);
+    size_t len;
+    const char *key = luaL_checklstring(L, 2, &len);
+    lua_pushboolean(L, dict->del(std::string(key, len)));
+    return 1;
+}
+
+static hi::string_map* ffi_map(hi::request* req, int map) {
+    switch (map) {
+        case 0:return &req->headers;
+        case 1:return &req->form;
+        case 2:return &req->cookies;
+        case 3:return &req->session;
+        case 4:return &req->captures;
+        default:return NULL;
+    }
+}
+
+/*
+ * C ABI for LuaJIT FFI, exported from the nginx binary. Strings come back
+ * as pointer and length into the request and stay valid until it ends.
+ * Fields: 0 uri, 1 method, 2 client, 3 user_agent, 4 param.
+ * Maps: 0 headers, 1 form, 2 cookies, 3 session, 4 captures.
+ */
+extern "C" {
+
+    typedef struct {
+        const char *data;
+        size_t len;
+    } hi_str_t;
+
+    NGX_HI_FFI_EXPORT int hi_ffi_req_field(void* p, int field, hi_str_t* out) {
+        hi::request *req = (hi::request*) p;
+        const std::string* fields[] = {&req->uri, &req->method, &req->client, &req->user_agent, &req->param};
+        if (field < 0 || field >= (int) (sizeof (fields) / sizeof (fields[0]))) {
+            return 0;
+        }
+        out->data = fields[field]->data();
+        out->len = fields[field]->size();
+        return 1;
+    }
+
+    NGX_HI_FFI_EXPORT int hi_ffi_req_get(void* p, int map, const char* key, size_t key_len, hi_str_t* out) {
+        hi::string_map *m = ffi_map((hi::request*) p, map);
+        if (m == NULL) {
+            return 0;
+        }
+        /*
+         * std::unordered_map has no heterogeneous find before C++20, so the
+         * key is still copied, but into a buffer that keeps its capacity.
+         */
+        static std::string lookup;
+        lookup.assign(key, key_len);
+        auto it = m->find(lookup);
+        if (it == m->end()) {
+            return 0;
+        }
+        out->data = it->second.data();
+        out->len = it->second.size();
+        return 1;
+    }
 
-static void ngx_http_hi_lua_handler(ngx_http_hi_loc_conf_t * conf, hi::request& req, hi::response& res) {
-    hi::py_request py_req;
-    hi::py_response py_res;
-    py_req.init(&req);
-    py_res.init(&res);
-    if (!LUA) {
-        LUA = std::make_shared<hi::lua>();
-    }
-    if (LUA) {
-        LUA->set_req(&py_req);
-        LUA->set_res(&py_res);
-        if (conf->lua_script.len > 0) {
-            LUA->call_script(std::string((char*) conf->lua_script.data, conf->lua_script.len).append(req.uri));
-        } else if (conf->lua_content.len > 0) {
-            LUA->call_content((char*) conf->lua_content.data);
+    /*
+     * Fills out with up to n key/value pairs and returns the size of the map.
+     */
+    NGX_HI_FFI_EXPORT size_t hi_ffi_req_items(void* p, int map, hi_str_t* out, size_t n) {
+        hi::string_map *m = ffi_map((hi::request*) p, map);
+        if (m == NULL) {
+            return 0;
+        }
+        size_t i = 0;
+        for (auto& item : *m) {
+            if (i == n) {
+                break;
+            }
+            out[2 * i].data = item.first.data();
+            out[2 * i].len = item.first.size();
+            out[2 * i + 1].data = item.second.data();
+            out[2 * i + 1].len = item.second.size();
+            ++i;
         }
+        return m->size();
+    }
+
+    NGX_HI_FFI_EXPORT void hi_ffi_res_status(void* p, int status) {
+        ((hi::response*) p)->status = status;
+    }
+
+    NGX_HI_FFI_EXPORT void hi_ffi_res_content(void* p, const char* data, size_t len) {
+        ((hi::response*) p)->content.assign(data, len);
+    }
+
+    NGX_HI_FFI_EXPORT void hi_ffi_res_header(void* p, const char* key, size_t key_len, const char* value, size_t value_len) {
+        ((hi::response*) p)->headers.insert(std::make_pair(std::string(key, key_len), std::string(value, value_len)));
+    }
+
+    NGX_HI_FFI_EXPORT void hi_ffi_res_session(void* p, const char* key, size_t key_len, const char* value, size_t value_len) {
+        ((hi::response*) p)->session.insert(std::make_pair(std::string(key, key_len), std::string(value, value_len)));
     }
 }
 
@@ -1038,6 +3830,7 @@ static bool java_init_handler(ngx_http_hi_loc_conf_t * conf) {
 
                     JAVA->set = JAVA->env->FindClass("java/util/Set");
                     JAVA->set_iterator = JAVA->env->GetMethodID(JAVA->set, "iterator", "()Ljava/util/Iterator;");
+                    java_register_natives();
                     JAVA_IS_READY = true;
                 }
             }
@@ -1046,6 +3839,793 @@ static bool java_init_handler(ngx_http_hi_loc_conf_t * conf) {
     return JAVA_IS_READY;
 }
 
+static std::string java_string(JNIEnv* env, jstring s) {
+    std::string ret;
+    if (s) {
+        const char* p = env->GetStringUTFChars(s, NULL);
+        if (p) {
+            ret.assign(p);
+            env->ReleaseStringUTFChars(s, p);
+        }
+    }
+    return ret;
+}
+
+static hi::shared_dict* java_dict(JNIEnv* env, jstring name) {
+    std::string n = java_string(env, name);
+    return shared_dict_of(n.data(), n.size());
+}
+
+static jstring JNICALL java_dict_get(JNIEnv* env, jclass, jstring name, jstring key) {
+    hi::shared_dict* dict = java_dict(env, name);
+    std::string value;
+    if (!dict || !dict->get(java_string(env, key), value)) {
+        return NULL;
+    }
+    return env->NewStringUTF(value.c_str());
+}
+
+static jboolean JNICALL java_dict_set(JNIEnv* env, jclass, jstring name, jstring key, jstring value, jdouble ttl) {
+    hi::shared_dict* dict = java_dict(env, name);
+    return dict && dict->set(java_string(env, key), java_string(env, value), ttl) ? JNI_TRUE : JNI_FALSE;
+}
+
+static jboolean JNICALL java_dict_add(JNIEnv* env, jclass, jstring name, jstring key, jstring value, jdouble ttl) {
+    hi::shared_dict* dict = java_dict(env, name);
+    return dict && dict->add(java_string(env, key), java_string(env, value), ttl) ? JNI_TRUE : JNI_FALSE;
+}
+
+static jlong JNICALL java_dict_incr(JNIEnv* env, jclass, jstring name, jstring key, jlong delta, jdouble ttl) {
+    hi::shared_dict* dict = java_dict(env, name);
+    long long value = 0;
+    if (!dict || !dict->incr(java_string(env, key), delta, value, ttl)) {
+        jclass e = env->FindClass("java/lang/IllegalStateException");
+        if (e) {
+            env->ThrowNew(e, "no such dict, not an integer or no memory");
+        }
+        return 0;
+    }
+    return value;
+}
+
+static jboolean JNICALL java_dict_delete(JNIEnv* env, jclass, jstring name, jstring key) {
+    hi::shared_dict* dict = java_dict(env, name);
+    return dict && dict->del(java_string(env, key)) ? JNI_TRUE : JNI_FALSE;
+}
+
+/*
+ * Binds the static natives of hi.shared_dict when the class is on the
+ * classpath; servlets that do not use it need not ship it.
+ */
+static void java_register_natives() {
+    static JNINativeMethod methods[] = {
+        {(char*) "get", (char*) "(Ljava/lang/String;Ljava/lang/String;)Ljava/lang/String;", (void*) java_dict_get},
+        {(char*) "set", (char*) "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;D)Z", (void*) java_dict_set},
+        {(char*) "add", (char*) "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;D)Z", (void*) java_dict_add},
+        {(char*) "incr", (char*) "(Ljava/lang/String;Ljava/lang/String;JD)J", (void*) java_dict_incr},
+        {(char*) "delete", (char*) "(Ljava/lang/String;Ljava/lang/String;)Z", (void*) java_dict_delete}
+    };
+    jclass dict = JAVA->env->FindClass("hi/shared_dict");
+    if (dict == NULL || JAVA->env->RegisterNatives(dict, methods, sizeof (methods) / sizeof (methods[0])) != 0) {
+        JAVA->env->ExceptionClear();
+    }
+}
+
+static std::string cache_snapshot_name(size_t index) {
+    return fmt::format("{}.{}.{}", CACHE_SNAPSHOT[index].path, index, ngx_worker);
+}
+
+static void cache_snapshot_restore(size_t index) {
+    cache_snapshot_t& item = CACHE_SNAPSHOT[index];
+    const std::vector<hi::cache::snapshot::record_t>& records = item.image->get_records();
+    time_t now = time(NULL);
+    cache_ele_t cache_v;
+    for (auto i = records.rbegin(); i != records.rend(); ++i) {
+        if (difftime(now, i->t) > item.expires) {
+            continue;
+        }
+        std::string key(i->key, i->key_len);
+        if (CACHE[index]->exists(key) && CACHE[index]->get(key).t >= i->t) {
+            /* set by this worker after the image was written */
+            continue;
+        }
+        cache_v.status = i->status;
+        cache_v.t = i->t;
+        cache_v.content_type.assign(i->content_type, i->content_type_len);
+        cache_v.content.assign(i->content, i->content_len);
+        CACHE[index]->put(key, cache_v);
+    }
+    item.image.reset();
+}
+
+/*
+ * Once per worker: a worker that saved its images for a reload is being
+ * replaced, and writing them again on exit would overwrite the images of
+ * its successor with the same number.
+ */
+static void cache_snapshot_dump_all() {
+    if (CACHE_SNAPSHOT_SAVED) {
+        return;
+    }
+    CACHE_SNAPSHOT_SAVED = true;
+    for (size_t i = 0; i < CACHE_SNAPSHOT.size(); ++i) {
+        if (!CACHE_SNAPSHOT[i].path.empty()) {
+            cache_snapshot_dump(i);
+        }
+    }
+}
+
+static void cache_snapshot_dump(size_t index) {
+    cache_snapshot_t& item = CACHE_SNAPSHOT[index];
+    hi::cache::snapshot::writer writer(cache_snapshot_name(index), item.fingerprint);
+    if (item.image) {
+        cache_snapshot_restore(index);
+    }
+    time_t now = time(NULL);
+    auto dump = [&](const lru11::KeyValuePair<std::string, cache_ele_t>& node) {
+        if (difftime(now, node.value.t) <= item.expires) {
+            writer.put(node.key, node.value.t, node.value.status, node.value.content_type, node.value.content);
+        }
+    };
+    CACHE[index]->walk(dump);
+    if (!writer.commit()) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, ngx_errno, "hi cache snapshot \"%s\" not saved", item.path.c_str());
+    }
+}
+
+#if (NGX_HTTP_CACHE)
+
+static ngx_int_t cache_disk_open(ngx_http_request_t* r, ngx_http_hi_loc_conf_t * conf, u_char* key) {
+    ngx_http_core_loc_conf_t *clcf = (ngx_http_core_loc_conf_t *) ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    if (clcf->aio != NGX_HTTP_AIO_OFF) {
+        /* the disk tier is read synchronously from the content handler */
+        return NGX_DECLINED;
+    }
+    if (ngx_http_file_cache_new(r) != NGX_OK) {
+        return NGX_ERROR;
+    }
+    ngx_http_cache_t *c = r->cache;
+    ngx_str_t *k = (ngx_str_t*) ngx_array_push(&c->keys);
+    if (k == NULL) {
+        r->cache = NULL;
+        return NGX_ERROR;
+    }
+    k->data = key;
+    k->len = 32;
+    c->file_cache = conf->disk_cache;
+    c->body_start = CACHE_DISK_HEADER_SIZE;
+    c->min_uses = 1;
+    ngx_http_file_cache_create_key(r);
+
+    ngx_int_t rc = ngx_http_file_cache_open(r);
+    if (rc == NGX_ERROR || rc == NGX_AGAIN) {
+        r->cache = NULL;
+    }
+    return rc;
+}
+
+static ngx_int_t cache_disk_read(ngx_http_request_t* r, ngx_http_hi_loc_conf_t * conf, const std::string& key, cache_ele_t& cache_v) {
+    ngx_http_cache_t *c = r->cache;
+    u_char *p = c->buf->pos + c->header_start, *last = c->buf->pos + c->body_start, *lf;
+
+    /* the entry header is "<status>\n<content type>\n" */
+    if ((lf = ngx_strlchr(p, last, LF)) == NULL) {
+        return NGX_DECLINED;
+    }
+    ngx_int_t status = ngx_atoi(p, lf - p);
+    if (status == NGX_ERROR) {
+        return NGX_DECLINED;
+    }
+    p = lf + 1;
+    if ((lf = ngx_strlchr(p, last, LF)) == NULL) {
+        return NGX_DECLINED;
+    }
+    cache_v.status = status;
+    cache_v.content_type.assign((char*) p, lf - p);
+    cache_v.t = c->date;
+
+    size_t len = c->length - c->body_start;
+    if (len >= conf->cache_disk_min_size) {
+        return NGX_OK;
+    }
+
+    /* small entries are promoted into the memory tier */
+    cache_v.content.resize(len);
+    if (len > 0 && ngx_read_file(&c->file, (u_char*) & cache_v.content[0], len, c->body_start) != (ssize_t) len) {
+        return NGX_DECLINED;
+    }
+    CACHE[conf->cache_index]->put(key, cache_v);
+    return NGX_DONE;
+}
+
+static void cache_disk_store(ngx_http_request_t* r, ngx_http_hi_loc_conf_t * conf, hi::response& res) {
+    ngx_http_cache_t *c = r->cache;
+    std::string meta = fmt::format("{}\n{}\n", res.status, res.headers.find("Content-Type")->second);
+    if (c->header_start + meta.size() > CACHE_DISK_HEADER_SIZE) {
+        return;
+    }
+    c->body_start = c->header_start + meta.size();
+    c->date = ngx_time();
+    c->last_modified = c->date;
+    c->valid_sec = c->date + conf->cache_expires;
+
+    u_char *header = (u_char*) ngx_palloc(r->pool, c->body_start);
+    if (header == NULL || ngx_http_file_cache_set_header(r, header) != NGX_OK) {
+        return;
+    }
+    ngx_memcpy(header + c->header_start, meta.data(), meta.size());
+
+    ngx_temp_file_t *tf = (ngx_temp_file_t*) ngx_pcalloc(r->pool, sizeof (ngx_temp_file_t));
+    if (tf == NULL) {
+        return;
+    }
+    tf->file.fd = NGX_INVALID_FILE;
+    tf->file.log = r->connection->log;
+    tf->path = c->file_cache->path;
+    tf->pool = r->pool;
+    tf->persistent = 1;
+    tf->access = NGX_FILE_OWNER_ACCESS;
+    if (ngx_create_temp_file(&tf->file, tf->path, tf->pool, tf->persistent, tf->clean, tf->access) != NGX_OK) {
+        return;
+    }
+    if (ngx_write_file(&tf->file, header, c->body_start, 0) == NGX_ERROR
+            || ngx_write_file(&tf->file, (u_char*) res.content.data(), res.content.size(), c->body_start) == NGX_ERROR) {
+        ngx_delete_file(tf->file.name.data);
+        return;
+    }
+    ngx_http_file_cache_update(r, tf);
+}
+
+#endif
+
+static ngx_int_t ngx_http_hi_init_module(ngx_cycle_t *cycle) {
+    RUNNER = NULL;
+    if (ngx_test_config || ngx_process == NGX_PROCESS_SIGNALLER || cycle->conf_ctx[ngx_http_module.index] == NULL) {
+        return NGX_OK;
+    }
+    for (auto& item : CACHE_SNAPSHOT) {
+        if (!item.path.empty()) {
+            cycle->save_handler = ngx_http_hi_save;
+            break;
+        }
+    }
+    ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) ngx_http_cycle_get_module_main_conf(cycle, ngx_http_hi_module);
+    if (hmcf == NULL) {
+        return NGX_OK;
+    }
+    ngx_shm_zone_t **zones = (ngx_shm_zone_t**) hmcf->dicts.elts;
+    for (ngx_uint_t i = 0; i < hmcf->dicts.nelts; ++i) {
+        SHARED_DICT[std::string((char*) zones[i]->shm.name.data, zones[i]->shm.name.len)] = std::make_shared<ngx_http_hi_shared_dict>(zones[i]);
+    }
+    if (hmcf->runner != 1) {
+        return NGX_OK;
+    }
+    ngx_core_conf_t *ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+    ngx_uint_t workers = ccf->worker_processes > 0 ? ccf->worker_processes : 1, runners = hmcf->runner_processes;
+    size_t head = ngx_align(sizeof (ngx_http_hi_runner_shm_t) + (workers + runners) * sizeof (ngx_http_hi_runner_slot_t), 64)
+            , step = ngx_align(hi::runner::ring::size(hmcf->runner_ring_size), 64);
+
+    ngx_shm_t *shm = (ngx_shm_t*) ngx_pcalloc(cycle->pool, sizeof (ngx_shm_t));
+    ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(cycle->pool, 0);
+    if (shm == NULL || cln == NULL) {
+        return NGX_ERROR;
+    }
+    shm->size = head + 2 * workers * step;
+    shm->name.len = sizeof ("hi_runner") - 1;
+    shm->name.data = (u_char*) "hi_runner";
+    shm->log = cycle->log;
+    if (ngx_shm_alloc(shm) != NGX_OK) {
+        return NGX_ERROR;
+    }
+    cln->handler = ngx_http_hi_runner_cleanup;
+    cln->data = shm;
+
+    RUNNER = (ngx_http_hi_runner_shm_t*) shm->addr;
+    RUNNER->workers = workers;
+    RUNNER->runners = runners;
+    RUNNER->ring_size = hmcf->runner_ring_size;
+    for (ngx_uint_t i = 0; i < workers + runners; ++i) {
+        runner_slot(i)->event = -1;
+    }
+    for (ngx_uint_t i = 0; i < workers + runners; ++i) {
+        runner_slot(i)->event = eventfd(0, EFD_NONBLOCK);
+        if (runner_slot(i)->event == -1) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno, "eventfd() for hi runner failed");
+            return NGX_ERROR;
+        }
+    }
+    for (ngx_uint_t i = 0; i < workers; ++i) {
+        runner_ring(i, 0).init();
+        runner_ring(i, 1).init();
+    }
+
+    switch (fork()) {
+        case -1:
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno, "fork() hi runner supervisor failed");
+            return NGX_ERROR;
+        case 0:
+            ngx_http_hi_runner_supervise(cycle);
+            exit(0);
+        default:break;
+    }
+    return NGX_OK;
+}
+
+static char *ngx_http_hi_shared_dict_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) conf;
+    ngx_str_t *value = (ngx_str_t*) cf->args->elts;
+    ssize_t size = ngx_parse_size(&value[2]);
+    if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "hi_shared_dict \"%V\" size \"%V\" is invalid or too small", &value[1], &value[2]);
+        return (char*) NGX_CONF_ERROR;
+    }
+    ngx_http_hi_dict_ctx_t *ctx = (ngx_http_hi_dict_ctx_t*) ngx_pcalloc(cf->pool, sizeof (ngx_http_hi_dict_ctx_t));
+    if (ctx == NULL) {
+        return (char*) NGX_CONF_ERROR;
+    }
+    ngx_shm_zone_t *zone = ngx_shared_memory_add(cf, &value[1], size, &ngx_http_hi_module);
+    if (zone == NULL) {
+        return (char*) NGX_CONF_ERROR;
+    }
+    if (zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "duplicate hi_shared_dict \"%V\"", &value[1]);
+        return (char*) NGX_CONF_ERROR;
+    }
+    zone->init = ngx_http_hi_shared_dict_init;
+    zone->data = ctx;
+    ngx_shm_zone_t **item = (ngx_shm_zone_t**) ngx_array_push(&hmcf->dicts);
+    if (item == NULL) {
+        return (char*) NGX_CONF_ERROR;
+    }
+    *item = zone;
+    return NGX_CONF_OK;
+}
+
+static char *ngx_http_hi_session_store(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    ngx_http_hi_loc_conf_t *lcf = (ngx_http_hi_loc_conf_t*) conf;
+    ngx_str_t *value = (ngx_str_t*) cf->args->elts;
+    if (lcf->session_store != NGX_CONF_UNSET_UINT) {
+        return (char*) "is duplicate";
+    }
+    if (ngx_strcmp(value[1].data, "redis") == 0) {
+        lcf->session_store = session_store_t::__redis_session__;
+    } else if (ngx_strcmp(value[1].data, "shm") == 0) {
+        lcf->session_store = session_store_t::__shm_session__;
+    } else if (ngx_strcmp(value[1].data, "shm+redis") == 0) {
+        lcf->session_store = session_store_t::__shm_redis_session__;
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid hi_session_store \"%V\", it must be \"shm\", \"redis\" or \"shm+redis\"", &value[1]);
+        return (char*) NGX_CONF_ERROR;
+    }
+    if (cf->args->nelts == 3) {
+        lcf->session_zone = value[2];
+    }
+    return NGX_CONF_OK;
+}
+
+static char *ngx_http_hi_timer(ngx_conf_t *cf, ngx_command_t *cmd, void *conf) {
+    ngx_http_hi_loc_conf_t *lcf = (ngx_http_hi_loc_conf_t*) conf;
+    ngx_str_t *value = (ngx_str_t*) cf->args->elts;
+    if (lcf->timer_interval) {
+        return (char*) "is duplicate";
+    }
+    ngx_int_t interval = ngx_parse_time(&value[1], 0);
+    if (interval == NGX_ERROR || interval == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid hi_timer interval \"%V\"", &value[1]);
+        return (char*) NGX_CONF_ERROR;
+    }
+    ngx_http_core_loc_conf_t *clcf = (ngx_http_core_loc_conf_t *) ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+#if (NGX_PCRE)
+    if (clcf->regex) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "hi_timer cannot be used in a regex location");
+        return (char*) NGX_CONF_ERROR;
+    }
+#endif
+    lcf->timer_interval = (ngx_msec_t) interval;
+    lcf->timer_uri = clcf->name;
+    if (cf->args->nelts == 3) {
+        lcf->timer_zone = value[2];
+    }
+    ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) ngx_http_conf_get_module_main_conf(cf, ngx_http_hi_module);
+    if (hmcf->timer_shm == NULL) {
+        ngx_str_t name = ngx_string("hi_timer");
+        hmcf->timer_shm = ngx_shared_memory_add(cf, &name, 8 * ngx_pagesize, &ngx_http_hi_module);
+        if (hmcf->timer_shm == NULL) {
+            return (char*) NGX_CONF_ERROR;
+        }
+        hmcf->timer_shm->init = ngx_http_hi_timer_init;
+        hmcf->timer_shm->data = hmcf;
+    }
+    ngx_http_hi_loc_conf_t **item = (ngx_http_hi_loc_conf_t**) ngx_array_push(&hmcf->timers);
+    if (item == NULL) {
+        return (char*) NGX_CONF_ERROR;
+    }
+    *item = lcf;
+    return NGX_CONF_OK;
+}
+
+/*
+ * One next-run time per hi_timer, in milliseconds. A reload keeps the
+ * slots while the number of timers stays the same, since the old workers
+ * go on ticking on them until they exit; when it changes, the old slots
+ * are retired rather than freed, and released on the reload after.
+ */
+typedef struct {
+    ngx_uint_t n;
+    ngx_atomic_t *slot;
+    ngx_atomic_t *retired;
+} ngx_http_hi_timer_sh_t;
+
+static ngx_int_t ngx_http_hi_timer_init(ngx_shm_zone_t *shm_zone, void *data) {
+    ngx_http_hi_main_conf_t *hmcf = (ngx_http_hi_main_conf_t*) shm_zone->data;
+    ngx_slab_pool_t *shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    ngx_http_hi_timer_sh_t *sh = (ngx_http_hi_timer_sh_t*) shpool->data;
+    if (data && sh) {
+        if (sh->n == hmcf->timers.nelts) {
+            TIMER_SLOT = sh->slot;
+            return NGX_OK;
+        }
+        if (sh->retired) {
+            ngx_slab_free(shpool, (void*) sh->retired);
+        }
+        sh->retired = sh->slot;
+    } else {
+        sh = (ngx_http_hi_timer_sh_t*) ngx_slab_calloc(shpool, sizeof (ngx_http_hi_timer_sh_t));
+        if (sh == NULL) {
+            return NGX_ERROR;
+        }
+        shpool->data = sh;
+    }
+    TIMER_SLOT = (ngx_atomic_t*) ngx_slab_calloc(shpool, hmcf->timers.nelts * sizeof (ngx_atomic_t));
+    if (TIMER_SLOT == NULL) {
+        return NGX_ERROR;
+    }
+    sh->n = hmcf->timers.nelts;
+    sh->slot = TIMER_SLOT;
+    return NGX_OK;
+}
+
+/*
+ * Every worker ticks; the one whose compare-and-set moves the next-run
+ * time forward does the work, so a job runs once per interval however
+ * many workers there are.
+ */
+static void ngx_http_hi_timer_handler(ngx_event_t* ev) {
+    if (ngx_exiting || ngx_quit || ngx_terminate) {
+        return;
+    }
+    ngx_http_hi_loc_conf_t *conf = (ngx_http_hi_loc_conf_t*) ev->data;
+    ngx_add_timer(ev, conf->timer_interval);
+
+    ngx_time_t *tp = ngx_timeofday();
+    ngx_atomic_t *slot = &TIMER_SLOT[ev - &TIMER_EVENT[0]];
+    ngx_atomic_uint_t now = (ngx_atomic_uint_t) tp->sec * 1000 + tp->msec, next = *slot;
+    if (now < next || !ngx_atomic_cmp_set(slot, next, now + conf->timer_interval)) {
+        return;
+    }
+
+    hi::request req;
+    hi::response res;
+    req.method = "GET";
+    req.uri.assign((char*) conf->timer_uri.data, conf->timer_uri.len);
+    req.user_agent = "hi_timer";
+    req.shared_dicts = &SHARED_DICT;
+    ngx_http_hi_dispatch(conf, req, res);
+    if (!req.subrequests.empty() || req.continuation) {
+        ngx_log_error(NGX_LOG_WARN, ev->log, 0, "hi_timer \"%V\" ignores subrequests", &conf->timer_uri);
+    }
+    if (conf->timer_zone.len > 0 && res.status == 200) {
+        std::string value;
+        hi::runner::packer(value).put((uint64_t) res.status).put(res.headers.find("Content-Type")->second).put(res.content);
+        shared_dict_of((char*) conf->timer_zone.data, conf->timer_zone.len)->set(req.uri, value, 2 * conf->timer_interval / 1000.0);
+    }
+}
+
+static bool timer_cache_get(ngx_http_hi_loc_conf_t * conf, const std::string& uri, hi::response& res) {
+    std::string value, content_type;
+    uint64_t status;
+    if (uri.size() != conf->timer_uri.len || ngx_strncmp(uri.data(), conf->timer_uri.data, uri.size()) != 0
+            || !shared_dict_of((char*) conf->timer_zone.data, conf->timer_zone.len)->get(uri, value)) {
+        return false;
+    }
+    hi::runner::unpacker in(value);
+    if (!in.get(status) || !in.get(content_type) || !in.get(res.content)) {
+        return false;
+    }
+    res.status = (int) status;
+    res.headers.find("Content-Type")->second = content_type;
+    return true;
+}
+
+static ngx_int_t ngx_http_hi_shared_dict_init(ngx_shm_zone_t *shm_zone, void *data) {
+    ngx_http_hi_dict_ctx_t *octx = (ngx_http_hi_dict_ctx_t*) data, *ctx = (ngx_http_hi_dict_ctx_t*) shm_zone->data;
+    if (octx) {
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+        return NGX_OK;
+    }
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    if (shm_zone->shm.exists) {
+        ctx->sh = (ngx_http_hi_dict_sh_t*) ctx->shpool->data;
+        return NGX_OK;
+    }
+    ctx->sh = (ngx_http_hi_dict_sh_t*) ngx_slab_alloc(ctx->shpool, sizeof (ngx_http_hi_dict_sh_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+    ctx->shpool->data = ctx->sh;
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel, ngx_str_rbtree_insert_value);
+    ngx_queue_init(&ctx->sh->lru);
+    // eviction makes room on demand, a failed allocation is not worth a log line
+    ctx->shpool->log_nomem = 0;
+    size_t len = sizeof (" in hi_shared_dict \"\"") + shm_zone->shm.name.len;
+    ctx->shpool->log_ctx = (u_char*) ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+    ngx_sprintf(ctx->shpool->log_ctx, " in hi_shared_dict \"%V\"%Z", &shm_zone->shm.name);
+    return NGX_OK;
+}
+
+static void ngx_http_hi_runner_cleanup(void* data) {
+    ngx_shm_t *shm = (ngx_shm_t*) data;
+    ngx_http_hi_runner_shm_t *runner = (ngx_http_hi_runner_shm_t*) shm->addr;
+    ngx_http_hi_runner_slot_t *slot = (ngx_http_hi_runner_slot_t*) (runner + 1);
+    if (ngx_process == NGX_PROCESS_MASTER || ngx_process == NGX_PROCESS_SINGLE) {
+        // the runners of this generation leave once its last worker is gone
+        runner->retired = 1;
+    }
+    if (ngx_process == NGX_PROCESS_MASTER) {
+        for (ngx_uint_t i = 0; i < runner->workers + runner->runners; ++i) {
+            if (slot[i].event != -1) {
+                close(slot[i].event);
+            }
+        }
+    }
+    ngx_shm_free(shm);
+}
+
+static ngx_http_hi_runner_slot_t* runner_slot(ngx_uint_t index) {
+    return (ngx_http_hi_runner_slot_t*) (RUNNER + 1) + index;
+}
+
+static hi::runner::ring runner_ring(ngx_uint_t worker, ngx_uint_t response) {
+    size_t head = ngx_align(sizeof (ngx_http_hi_runner_shm_t) + (RUNNER->workers + RUNNER->runners) * sizeof (ngx_http_hi_runner_slot_t), 64)
+            , step = ngx_align(hi::runner::ring::size(RUNNER->ring_size), 64);
+    return hi::runner::ring((u_char*) RUNNER + head + (2 * worker + response) * step, RUNNER->ring_size);
+}
+
+static void runner_signal_handler(int signo) {
+    RUNNER_QUIT = 1;
+}
+
+static void runner_process_init(ngx_cycle_t* cycle) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigprocmask(SIG_SETMASK, &set, NULL);
+
+    struct sigaction sa;
+    ngx_memzero(&sa, sizeof (struct sigaction));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = runner_signal_handler;
+    for (int signo :{SIGQUIT, SIGTERM, SIGINT}) {
+        sigaction(signo, &sa, NULL);
+    }
+    sa.sa_handler = SIG_IGN;
+    for (int signo :{SIGHUP, SIGUSR1, SIGUSR2, SIGWINCH, SIGPIPE}) {
+        sigaction(signo, &sa, NULL);
+    }
+    sa.sa_handler = SIG_DFL;
+    for (int signo :{SIGCHLD, SIGALRM, SIGIO}) {
+        sigaction(signo, &sa, NULL);
+    }
+
+    ngx_listening_t *ls = (ngx_listening_t*) cycle->listening.elts;
+    for (ngx_uint_t i = 0; i < cycle->listening.nelts; ++i) {
+        if (ls[i].fd != (ngx_socket_t) - 1) {
+            close(ls[i].fd);
+        }
+    }
+
+    ngx_core_conf_t *ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+    if (geteuid() == 0) {
+        if (setgid(ccf->group) == -1 || initgroups(ccf->username, ccf->group) == -1 || setuid(ccf->user) == -1) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno, "hi runner failed to drop privileges");
+            exit(2);
+        }
+    }
+    if (ccf->working_directory.len && chdir((char *) ccf->working_directory.data) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, "chdir(\"%s\") failed", ccf->working_directory.data);
+        exit(2);
+    }
+}
+
+static bool runner_retired() {
+    if (RUNNER->master && kill(RUNNER->master, 0) == -1 && ngx_errno == NGX_ESRCH) {
+        return true;
+    }
+    if (!RUNNER->retired) {
+        return false;
+    }
+    for (ngx_uint_t i = 0; i < RUNNER->workers; ++i) {
+        ngx_pid_t pid = runner_slot(i)->pid;
+        if (pid && (kill(pid, 0) == 0 || ngx_errno != NGX_ESRCH)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void ngx_http_hi_runner_supervise(ngx_cycle_t* cycle) {
+    runner_process_init(cycle);
+    ngx_setproctitle((char*) "hi runner supervisor");
+    ngx_uint_t idle = 0;
+    for (;;) {
+        ngx_pid_t pid;
+        int status;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (ngx_uint_t i = 0; i < RUNNER->runners; ++i) {
+                ngx_http_hi_runner_slot_t *slot = runner_slot(RUNNER->workers + i);
+                if (slot->pid == pid) {
+                    slot->pid = 0;
+                    if (WIFSIGNALED(status)) {
+                        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0, "hi runner %P exited on signal %d", pid, WTERMSIG(status));
+                    } else {
+                        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "hi runner %P exited with code %d", pid, WEXITSTATUS(status));
+                    }
+                }
+            }
+        }
+        // give up if no worker ever showed up, e.g. nginx failed to start
+        if (RUNNER_QUIT || runner_retired() || (RUNNER->master == 0 && ++idle > 60)) {
+            break;
+        }
+        for (ngx_uint_t i = 0; i < RUNNER->runners; ++i) {
+            ngx_http_hi_runner_slot_t *slot = runner_slot(RUNNER->workers + i);
+            if (slot->pid) {
+                continue;
+            }
+            pid = fork();
+            if (pid == 0) {
+                ngx_http_hi_runner_process(cycle, i);
+                exit(0);
+            } else if (pid == -1) {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, "fork() hi runner failed");
+            } else {
+                slot->pid = pid;
+            }
+        }
+        ngx_msleep(1000);
+    }
+    for (ngx_uint_t i = 0; i < RUNNER->runners; ++i) {
+        if (runner_slot(RUNNER->workers + i)->pid) {
+            kill(runner_slot(RUNNER->workers + i)->pid, SIGQUIT);
+        }
+    }
+    while (waitpid(-1, NULL, 0) > 0) {
+    }
+}
+
+static void ngx_http_hi_runner_process(ngx_cycle_t* cycle, ngx_uint_t index) {
+    ngx_pid_t supervisor = getppid();
+    ngx_http_hi_runner_slot_t *self = runner_slot(RUNNER->workers + index);
+    std::string msg, reply;
+    ngx_setproctitle((char*) "hi runner");
+    while (!RUNNER_QUIT && getppid() == supervisor) {
+        struct pollfd pfd;
+        pfd.fd = self->event;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 1000) > 0) {
+            eventfd_t n;
+            eventfd_read(self->event, &n);
+        }
+        for (ngx_uint_t w = index; w < RUNNER->workers; w += RUNNER->runners) {
+            hi::runner::ring in = runner_ring(w, 0), out = runner_ring(w, 1);
+            ngx_http_hi_runner_slot_t *worker = runner_slot(w);
+            while (in.pop(msg)) {
+                hi::runner::unpacker u(msg);
+                uint64_t id, conf;
+                hi::request req;
+                hi::response res;
+                if (!u.get(id) || !u.get(conf) || !u.get(req) || !u.get(res)) {
+                    continue;
+                }
+                req.shared_dicts = &SHARED_DICT;
+                ngx_http_hi_dispatch((ngx_http_hi_loc_conf_t*) (uintptr_t) conf, req, res);
+                reply.clear();
+                hi::runner::packer(reply).put(id).put(res);
+                if (!out.fits(reply.size())) {
+                    ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "hi runner response for \"%s\" exceeds hi_runner_ring_size", req.uri.c_str());
+                    res.status = 500;
+                    res.content.clear();
+                    reply.clear();
+                    hi::runner::packer(reply).put(id).put(res);
+                }
+                while (!out.push(reply)) {
+                    if (RUNNER_QUIT || (kill(worker->pid, 0) == -1 && ngx_errno == NGX_ESRCH)) {
+                        break;
+                    }
+                    ngx_msleep(1);
+                }
+                eventfd_write(worker->event, 1);
+            }
+        }
+    }
+}
+
+static ngx_int_t ngx_http_hi_runner_post(ngx_http_request_t* r, ngx_http_hi_ctx_t* ctx, ngx_http_hi_loc_conf_t * conf) {
+    if (RUNNER == NULL) {
+        return NGX_HTTP_SERVICE_UNAVAILABLE;
+    }
+    uint64_t id = ((uint64_t) ngx_pid << 32) | (++RUNNER_SEQ & 0xffffffff);
+    std::string msg;
+    hi::runner::packer(msg).put(id).put((uint64_t) (uintptr_t) conf).put(ctx->req).put(ctx->res);
+    hi::runner::ring ring = runner_ring(ngx_worker, 0);
+    if (!ring.fits(msg.size())) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "hi runner request exceeds hi_runner_ring_size");
+        return NGX_HTTP_REQUEST_ENTITY_TOO_LARGE;
+    }
+    if (!ring.push(msg)) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0, "hi runner queue is full");
+        return NGX_HTTP_SERVICE_UNAVAILABLE;
+    }
+    eventfd_write(runner_slot(RUNNER->workers + ngx_worker % RUNNER->runners)->event, 1);
+    RUNNER_PENDING[id] = r;
+    ctx->runner_id = id;
+    ctx->runner_timer.handler = ngx_http_hi_runner_timeout_handler;
+    ctx->runner_timer.data = r;
+    ctx->runner_timer.log = r->connection->log;
+    ngx_add_timer(&ctx->runner_timer, conf->runner_timeout);
+    return NGX_DONE;
+}
+
+static void ngx_http_hi_runner_event_handler(ngx_event_t* ev) {
+    ngx_connection_t *c = (ngx_connection_t*) ev->data;
+    eventfd_t n;
+    eventfd_read(c->fd, &n);
+    hi::runner::ring ring = runner_ring(ngx_worker, 1);
+    std::string msg;
+    while (ring.pop(msg)) {
+        hi::runner::unpacker u(msg);
+        uint64_t id;
+        if (!u.get(id)) {
+            continue;
+        }
+        auto it = RUNNER_PENDING.find(id);
+        if (it == RUNNER_PENDING.end()) {
+            continue;
+        }
+        ngx_http_request_t *r = it->second;
+        ngx_connection_t *rc_connection = r->connection;
+        ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) ngx_http_get_module_ctx(r, ngx_http_hi_module);
+        RUNNER_PENDING.erase(it);
+        ctx->runner_id = 0;
+        if (ctx->runner_timer.timer_set) {
+            ngx_del_timer(&ctx->runner_timer);
+        }
+        ngx_int_t rc = u.get(ctx->res) ? ngx_http_hi_continue(r, ctx) : NGX_HTTP_BAD_GATEWAY;
+        if (rc != NGX_DONE) {
+            ngx_http_finalize_request(r, rc);
+        }
+        ngx_http_run_posted_requests(rc_connection);
+    }
+    if (ngx_handle_read_event(ev, 0) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0, "hi runner event handler failed");
+    }
+}
+
+static void ngx_http_hi_runner_timeout_handler(ngx_event_t* ev) {
+    ngx_http_request_t *r = (ngx_http_request_t*) ev->data;
+    ngx_connection_t *c = r->connection;
+    ngx_http_hi_ctx_t *ctx = (ngx_http_hi_ctx_t*) ngx_http_get_module_ctx(r, ngx_http_hi_module);
+    RUNNER_PENDING.erase(ctx->runner_id);
+    ctx->runner_id = 0;
+    ngx_log_error(NGX_LOG_ERR, c->log, 0, "hi runner timed out");
+    ngx_http_finalize_request(r, NGX_HTTP_GATEWAY_TIME_OUT);
+    ngx_http_run_posted_requests(c);
+}
+
 static std::string md5(const std::string& str) {
     unsigned char digest[16] = {0};
     MD5_CTX ctx;
@@ -1150,4 +4730,79 @@ static void ngx_http_hi_php_handler(ngx_http_hi_loc_conf_t * conf, hi::request&
             res.content = std::move(fmt::format("<p style='text-align:center;margin:100px;'>{}</p>", "PHP Throw Exception"));
             res.status = 500;}zend_end_try();
     }
+}
+
+static PHP_FUNCTION(hi_shared_dict_get) {
+    char *name, *key;
+    size_t name_len, key_len;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "ss", &name, &name_len, &key, &key_len) == FAILURE) {
+        return;
+    }
+    hi::shared_dict* dict = shared_dict_of(name, name_len);
+    std::string value;
+    if (dict && dict->get(std::string(key, key_len), value)) {
+        RETURN_STRINGL(value.data(), value.size());
+    }
+    RETURN_NULL();
+}
+
+static void php_dict_store(INTERNAL_FUNCTION_PARAMETERS, bool only_new) {
+    char *name, *key, *value;
+    size_t name_len, key_len, value_len;
+    double ttl = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "sss|d", &name, &name_len, &key, &key_len, &value, &value_len, &ttl) == FAILURE) {
+        return;
+    }
+    hi::shared_dict* dict = shared_dict_of(name, name_len);
+    std::string k(key, key_len), v(value, value_len);
+    RETURN_BOOL(dict && (only_new ? dict->add(k, v, ttl) : dict->set(k, v, ttl)));
+}
+
+static PHP_FUNCTION(hi_shared_dict_set) {
+    php_dict_store(INTERNAL_FUNCTION_PARAM_PASSTHRU, false);
+}
+
+static PHP_FUNCTION(hi_shared_dict_add) {
+    php_dict_store(INTERNAL_FUNCTION_PARAM_PASSTHRU, true);
+}
+
+static PHP_FUNCTION(hi_shared_dict_incr) {
+    char *name, *key;
+    size_t name_len, key_len;
+    zend_long delta = 1;
+    double ttl = 0;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "ss|ld", &name, &name_len, &key, &key_len, &delta, &ttl) == FAILURE) {
+        return;
+    }
+    hi::shared_dict* dict = shared_dict_of(name, name_len);
+    long long value;
+    if (dict && dict->incr(std::string(key, key_len), delta, value, ttl)) {
+        RETURN_LONG(value);
+    }
+    RETURN_NULL();
+}
+
+static PHP_FUNCTION(hi_shared_dict_delete) {
+    char *name, *key;
+    size_t name_len, key_len;
+    if (zend_parse_parameters(ZEND_NUM_ARGS(), "ss", &name, &name_len, &key, &key_len) == FAILURE) {
+        return;
+    }
+    hi::shared_dict* dict = shared_dict_of(name, name_len);
+    RETURN_BOOL(dict && dict->del(std::string(key, key_len)));
+}
+
+/*
+ * The embed SAPI registers these once, when the VM starts.
+ */
+static void php_register_functions() {
+    static const zend_function_entry functions[] = {
+        PHP_FE(hi_shared_dict_get, NULL)
+        PHP_FE(hi_shared_dict_set, NULL)
+        PHP_FE(hi_shared_dict_add, NULL)
+        PHP_FE(hi_shared_dict_incr, NULL)
+        PHP_FE(hi_shared_dict_delete, NULL)
+        PHP_FE_END
+    };
+    php_embed_module.additional_functions = functions;
 }
\ No newline at end of file
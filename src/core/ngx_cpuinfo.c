@@ -9,10 +9,15 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_sse42;
+ngx_uint_t  ngx_cpu_avx2;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
 static ngx_inline void ngx_cpuid(uint32_t i, uint32_t *buf);
+static ngx_inline void ngx_cpu_features(uint32_t max, uint32_t *cpu);
 
 
 #if ( __i386__ )
@@ -55,7 +60,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
         "cpuid"
 
-    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i) );
+    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i), "c" (0) );
 
     buf[0] = eax;
     buf[1] = ebx;
@@ -67,6 +72,46 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 #endif
 
 
+static ngx_inline void
+ngx_cpu_features(uint32_t max, uint32_t *cpu)
+{
+#if ( __amd64__ )
+    uint32_t  eax, edx, ext[4];
+#endif
+
+    /* SSE4.2 */
+
+    if (cpu[3] & (1 << 20)) {
+        ngx_cpu_sse42 = 1;
+    }
+
+#if ( __amd64__ )
+
+    /*
+     * AVX2 also needs OSXSAVE and the OS saving the XMM and YMM state;
+     * leaf 7 is only queried on amd64 where ngx_cpuid() clears %ecx
+     */
+
+    if (max < 7 || !(cpu[3] & (1 << 27))) {
+        return;
+    }
+
+    __asm__ ( "xgetbv" : "=a" (eax), "=d" (edx) : "c" (0) );
+
+    if ((eax & 6) != 6) {
+        return;
+    }
+
+    ngx_cpuid(7, ext);
+
+    if (ext[1] & (1 << 5)) {
+        ngx_cpu_avx2 = 1;
+    }
+
+#endif
+}
+
+
 /* auto detect the L2 cache line size of modern and widespread CPUs */
 
 void
@@ -91,6 +136,8 @@ ngx_cpuinfo(void)
 
     ngx_cpuid(1, cpu);
 
+    ngx_cpu_features(vbuf[0], cpu);
+
     if (ngx_strcmp(vendor, "GenuineIntel") == 0) {
 
         switch ((cpu[0] & 0xf00) >> 8) {
@@ -26,6 +26,8 @@ typedef struct ngx_shm_zone_s  ngx_shm_zone_t;
 
 typedef ngx_int_t (*ngx_shm_zone_init_pt) (ngx_shm_zone_t *zone, void *data);
 
+typedef void (*ngx_cycle_save_pt) (ngx_cycle_t *cycle);
+
 struct ngx_shm_zone_s {
     void                     *data;
     ngx_shm_t                 shm;
@@ -80,6 +82,12 @@ struct ngx_cycle_s {
     ngx_str_t                 prefix;
     ngx_str_t                 lock_file;
     ngx_str_t                 hostname;
+
+    /*
+     * if set in a new cycle, the running workers call the handler
+     * of their own cycle before the new workers are started
+     */
+    ngx_cycle_save_pt         save_handler;
 };
 
 
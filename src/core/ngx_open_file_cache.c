@@ -52,6 +52,32 @@ static ngx_cached_open_file_t *
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
 
+static ngx_int_t ngx_open_and_stat_shared_file(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of,
+    time_t *created, ngx_log_t *log);
+static ngx_int_t ngx_open_file_shared_lookup(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of,
+    time_t *created);
+static void ngx_open_file_shared_update(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of, ngx_log_t *log);
+static ngx_open_file_cache_node_t *ngx_open_file_shared_find(
+    ngx_open_file_cache_sh_t *sh, u_char *name, size_t len, uint32_t hash);
+static void ngx_open_file_shared_expire(ngx_open_file_cache_shared_t *shared,
+    time_t inactive, ngx_uint_t n);
+static void ngx_open_file_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+#if (NGX_HAVE_INOTIFY)
+static void ngx_open_file_shared_watch(ngx_open_file_cache_shared_t *shared,
+    ngx_str_t *name, ngx_log_t *log);
+static void ngx_open_file_inotify_handler(ngx_event_t *ev);
+static void ngx_open_file_shared_invalidate(
+    ngx_open_file_cache_shared_t *shared, u_char *name, size_t len,
+    ngx_uint_t prefix);
+static void ngx_open_file_shared_cleanup(void *data);
+#endif
+
 
 ngx_open_file_cache_t *
 ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
@@ -72,6 +98,7 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
     cache->current = 0;
     cache->max = max;
     cache->inactive = inactive;
+    cache->shared = NULL;
 
     cln = ngx_pool_cleanup_add(pool, 0);
     if (cln == NULL) {
@@ -144,10 +171,11 @@ ngx_int_t
 ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool)
 {
-    time_t                          now;
+    time_t                          now, created;
     uint32_t                        hash;
     ngx_int_t                       rc;
     ngx_file_info_t                 fi;
+    ngx_atomic_uint_t               generation;
     ngx_pool_cleanup_t             *cln;
     ngx_cached_open_file_t         *file;
     ngx_pool_cleanup_file_t        *clnf;
@@ -203,6 +231,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     }
 
     now = ngx_time();
+    created = now;
+    generation = cache->shared ? cache->shared->sh->generation : 0;
 
     hash = ngx_crc32_long(name->data, name->len);
 
@@ -218,7 +248,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             /* file was not used often enough to keep open */
 
-            rc = ngx_open_and_stat_file(name, of, pool->log);
+            rc = ngx_open_and_stat_shared_file(cache, name, hash, of,
+                                               &created, pool->log);
 
             if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
                 goto failed;
@@ -231,6 +262,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             || (file->event == NULL
                 && (of->uniq == 0 || of->uniq == file->uniq)
                 && now - file->created < of->valid
+                && file->generation == generation
 #if (NGX_HAVE_OPENAT)
                 && of->disable_symlinks == file->disable_symlinks
                 && of->disable_symlinks_from == file->disable_symlinks_from
@@ -286,7 +318,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         of->fd = file->fd;
         of->uniq = file->uniq;
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_and_stat_shared_file(cache, name, hash, of, &created,
+                                           pool->log);
 
         if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
             goto failed;
@@ -351,7 +384,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
-    rc = ngx_open_and_stat_file(name, of, pool->log);
+    rc = ngx_open_and_stat_shared_file(cache, name, hash, of, &created,
+                                       pool->log);
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
         goto failed;
@@ -421,7 +455,8 @@ update:
         }
     }
 
-    file->created = now;
+    file->created = created;
+    file->generation = generation;
 
 found:
 
@@ -1251,3 +1286,832 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+ngx_int_t
+ngx_open_file_cache_init_shared(ngx_conf_t *cf, ngx_open_file_cache_t *cache,
+    ngx_str_t *name, size_t size, void *tag)
+{
+    ngx_shm_zone_t                *shm_zone;
+    ngx_open_file_cache_shared_t  *shared;
+#if (NGX_HAVE_INOTIFY)
+    ngx_event_t                   *rev, *wev;
+    ngx_connection_t              *c;
+    ngx_pool_cleanup_t            *cln;
+#endif
+
+    shm_zone = ngx_shared_memory_add(cf, name, size, tag);
+    if (shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (shm_zone->data) {
+        cache->shared = shm_zone->data;
+        return NGX_OK;
+    }
+
+    shared = ngx_pcalloc(cf->pool, sizeof(ngx_open_file_cache_shared_t));
+    if (shared == NULL) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_HAVE_INOTIFY)
+
+    /* not in cycle->connections, as the epoll notification eventfd */
+
+    c = ngx_pcalloc(cf->pool, sizeof(ngx_connection_t));
+    rev = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+    wev = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
+
+    if (c == NULL || rev == NULL || wev == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->fd = (ngx_socket_t) -1;
+    c->data = shared;
+    c->read = rev;
+    c->write = wev;
+
+    rev->data = c;
+    rev->handler = ngx_open_file_inotify_handler;
+    wev->data = c;
+
+    shared->inotify = c;
+
+    ngx_rbtree_init(&shared->dirs, &shared->dirs_sentinel,
+                    ngx_str_rbtree_insert_value);
+    ngx_rbtree_init(&shared->watches, &shared->watches_sentinel,
+                    ngx_rbtree_insert_value);
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_open_file_shared_cleanup;
+    cln->data = shared;
+
+#endif
+
+    shm_zone->init = ngx_open_file_cache_init_zone;
+    shm_zone->data = shared;
+
+    cache->shared = shared;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_open_file_cache_shared_t  *oshared = data;
+
+    size_t                         len;
+    ngx_open_file_cache_shared_t  *shared;
+
+    shared = shm_zone->data;
+
+    if (oshared) {
+        shared->sh = oshared->sh;
+        shared->shpool = oshared->shpool;
+
+        return NGX_OK;
+    }
+
+    shared->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shared->sh = shared->shpool->data;
+
+        return NGX_OK;
+    }
+
+    shared->sh = ngx_slab_alloc(shared->shpool,
+                                sizeof(ngx_open_file_cache_sh_t));
+    if (shared->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shared->shpool->data = shared->sh;
+
+    ngx_rbtree_init(&shared->sh->rbtree, &shared->sh->sentinel,
+                    ngx_open_file_shared_rbtree_insert_value);
+
+    ngx_queue_init(&shared->sh->queue);
+
+    len = sizeof(" in open_file_cache zone \"\"") + shm_zone->shm.name.len;
+
+    shared->shpool->log_ctx = ngx_slab_alloc(shared->shpool, len);
+    if (shared->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shared->shpool->log_ctx, " in open_file_cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shared->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+/*
+ * a miss in the worker cache or its retest is first looked up in
+ * the shared zone, a system call is only made if the shared entry is
+ * missing, is older than "valid", or a new file handle is required
+ */
+
+static ngx_int_t
+ngx_open_and_stat_shared_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, time_t *created, ngx_log_t *log)
+{
+    ngx_int_t  rc;
+
+    if (cache->shared == NULL) {
+        return ngx_open_and_stat_file(name, of, log);
+    }
+
+    rc = ngx_open_file_shared_lookup(cache, name, hash, of, created);
+
+    if (rc != NGX_DECLINED) {
+        return rc;
+    }
+
+    rc = ngx_open_and_stat_file(name, of, log);
+
+    if (rc == NGX_OK || (of->err && of->errors)) {
+        ngx_open_file_shared_update(cache, name, hash, of, log);
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, time_t *created)
+{
+    time_t                         now;
+    ngx_int_t                      rc;
+    ngx_open_file_cache_node_t    *fn;
+    ngx_open_file_cache_shared_t  *shared;
+
+    shared = cache->shared;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    fn = ngx_open_file_shared_find(shared->sh, name->data, name->len, hash);
+
+    if (fn == NULL
+        || now - fn->created >= of->valid
+#if (NGX_HAVE_OPENAT)
+        || of->disable_symlinks != fn->disable_symlinks
+        || of->disable_symlinks_from != fn->disable_symlinks_from
+#endif
+       )
+    {
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    if (fn->err) {
+
+        if (!of->errors) {
+            rc = NGX_DECLINED;
+            goto done;
+        }
+
+        of->fd = NGX_INVALID_FILE;
+        of->err = fn->err;
+#if (NGX_HAVE_OPENAT)
+        of->failed = fn->disable_symlinks ? ngx_openat_file_n
+                                          : ngx_open_file_n;
+#else
+        of->failed = ngx_open_file_n;
+#endif
+
+        rc = NGX_ERROR;
+
+    } else if (fn->is_dir) {
+        of->fd = NGX_INVALID_FILE;
+
+        rc = NGX_OK;
+
+    } else if (of->fd != NGX_INVALID_FILE && of->uniq == fn->uniq) {
+
+        /* the file handle of the worker cache is still valid */
+
+        rc = NGX_OK;
+
+    } else {
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    if (rc == NGX_OK) {
+        of->uniq = fn->uniq;
+        of->mtime = fn->mtime;
+        of->size = fn->size;
+        of->fs_size = fn->fs_size;
+        of->is_dir = fn->is_dir;
+        of->is_file = fn->is_file;
+        of->is_link = fn->is_link;
+        of->is_exec = fn->is_exec;
+    }
+
+    *created = fn->created;
+
+    fn->accessed = now;
+
+    ngx_queue_remove(&fn->queue);
+    ngx_queue_insert_head(&shared->sh->queue, &fn->queue);
+
+done:
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return rc;
+}
+
+
+static void
+ngx_open_file_shared_update(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, ngx_log_t *log)
+{
+    size_t                         size;
+    time_t                         now;
+    ngx_open_file_cache_node_t    *fn;
+    ngx_open_file_cache_shared_t  *shared;
+
+    if (name->len > 65535) {
+        return;
+    }
+
+    shared = cache->shared;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    fn = ngx_open_file_shared_find(shared->sh, name->data, name->len, hash);
+
+    if (fn) {
+        ngx_queue_remove(&fn->queue);
+
+    } else {
+        ngx_open_file_shared_expire(shared, cache->inactive, 1);
+
+        size = offsetof(ngx_open_file_cache_node_t, name) + name->len;
+
+        fn = ngx_slab_alloc_locked(shared->shpool, size);
+
+        if (fn == NULL) {
+            ngx_open_file_shared_expire(shared, cache->inactive, 0);
+
+            fn = ngx_slab_alloc_locked(shared->shpool, size);
+            if (fn == NULL) {
+                ngx_shmtx_unlock(&shared->shpool->mutex);
+                return;
+            }
+        }
+
+        fn->node.key = hash;
+        fn->len = (u_short) name->len;
+        ngx_memcpy(fn->name, name->data, name->len);
+
+        ngx_rbtree_insert(&shared->sh->rbtree, &fn->node);
+    }
+
+    fn->created = now;
+    fn->accessed = now;
+
+    fn->err = of->err;
+#if (NGX_HAVE_OPENAT)
+    fn->disable_symlinks = of->disable_symlinks;
+    fn->disable_symlinks_from = of->disable_symlinks_from;
+#endif
+
+    if (of->err == 0) {
+        fn->uniq = of->uniq;
+        fn->mtime = of->mtime;
+        fn->size = of->size;
+        fn->fs_size = of->fs_size;
+        fn->is_dir = of->is_dir;
+        fn->is_file = of->is_file;
+        fn->is_link = of->is_link;
+        fn->is_exec = of->is_exec;
+    }
+
+    ngx_queue_insert_head(&shared->sh->queue, &fn->queue);
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+#if (NGX_HAVE_INOTIFY)
+    ngx_open_file_shared_watch(shared, name, log);
+#endif
+}
+
+
+static ngx_open_file_cache_node_t *
+ngx_open_file_shared_find(ngx_open_file_cache_sh_t *sh, u_char *name,
+    size_t len, uint32_t hash)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_open_file_cache_node_t  *fn;
+
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        fn = (ngx_open_file_cache_node_t *) node;
+
+        rc = ngx_memn2cmp(name, fn->name, len, (size_t) fn->len);
+
+        if (rc == 0) {
+            return fn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_open_file_shared_expire(ngx_open_file_cache_shared_t *shared,
+    time_t inactive, ngx_uint_t n)
+{
+    time_t                       now;
+    ngx_queue_t                 *q;
+    ngx_open_file_cache_node_t  *fn;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two inactive entries
+     * n == 0 deletes least recently used entry by force
+     *        and one or two inactive entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&shared->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&shared->sh->queue);
+
+        fn = ngx_queue_data(q, ngx_open_file_cache_node_t, queue);
+
+        if (n++ != 0 && now - fn->accessed <= inactive) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&shared->sh->rbtree, &fn->node);
+
+        ngx_slab_free_locked(shared->shpool, fn);
+    }
+}
+
+
+static void
+ngx_open_file_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_open_file_cache_node_t   *fn, *fnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            fn = (ngx_open_file_cache_node_t *) node;
+            fnt = (ngx_open_file_cache_node_t *) temp;
+
+            p = (ngx_memn2cmp(fn->name, fnt->name, fn->len, fnt->len) < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+#if (NGX_HAVE_INOTIFY)
+
+/*
+ * the worker that adds an entry to the shared zone watches the directory
+ * of the file and removes the entries of changed files from the zone;
+ * entries that cannot be watched still expire after "valid", as do the
+ * entries left in the zone by workers that exited on reload, since their
+ * watches are gone and new workers only watch directories they add to
+ *
+ * IN_MODIFY is not watched: every write() to a file growing in a watched
+ * directory would drop its entry, while the size and mtime a revalidation
+ * needs are final on IN_CLOSE_WRITE
+ */
+
+#define NGX_OPEN_FILE_INOTIFY_MASK                                            \
+    (IN_ATTRIB|IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_DELETE_SELF              \
+     |IN_MOVE_SELF|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR)
+
+
+static void
+ngx_open_file_shared_watch(ngx_open_file_cache_shared_t *shared,
+    ngx_str_t *name, ngx_log_t *log)
+{
+    int                           fd, wd;
+    u_char                       *p;
+    uint32_t                      hash;
+    ngx_err_t                     err;
+    ngx_str_t                     dir;
+    ngx_connection_t             *c;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_open_file_cache_watch_t  *w;
+
+    if (shared->no_watches || name->len < 2 || name->data[0] != '/') {
+        return;
+    }
+
+    c = shared->inotify;
+
+    dir.data = name->data;
+    dir.len = name->len;
+
+    if (dir.data[dir.len - 1] == '/') {
+        dir.len--;
+    }
+
+    /*
+     * the parent directory is watched; if it does not exist, the nearest
+     * existing one is, and its creation of subdirectories drops the entries
+     */
+
+    for ( ;; ) {
+
+        for (p = dir.data + dir.len - 1; *p != '/'; p--) { /* void */ }
+
+        dir.len = (p == dir.data) ? 1 : (size_t) (p - dir.data);
+
+        hash = ngx_crc32_long(dir.data, dir.len);
+
+        if (ngx_str_rbtree_lookup(&shared->dirs, &dir, hash)) {
+            return;
+        }
+
+        if (c->fd == (ngx_socket_t) -1) {
+
+            fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+            if (fd == -1) {
+                ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                              "inotify_init1() failed");
+                shared->no_watches = 1;
+                return;
+            }
+
+            c->fd = fd;
+            c->log = ngx_cycle->log;
+            c->read->log = ngx_cycle->log;
+            c->write->log = ngx_cycle->log;
+
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                (void) close(fd);
+                c->fd = (ngx_socket_t) -1;
+                shared->no_watches = 1;
+                return;
+            }
+        }
+
+        w = ngx_alloc(sizeof(ngx_open_file_cache_watch_t) + dir.len + 1, log);
+        if (w == NULL) {
+            return;
+        }
+
+        w->dir.str.len = dir.len;
+        w->dir.str.data = (u_char *) w + sizeof(ngx_open_file_cache_watch_t);
+        ngx_cpystrn(w->dir.str.data, dir.data, dir.len + 1);
+
+        wd = inotify_add_watch(c->fd, (char *) w->dir.str.data,
+                               NGX_OPEN_FILE_INOTIFY_MASK);
+
+        if (wd != -1) {
+            break;
+        }
+
+        err = ngx_errno;
+
+        ngx_free(w);
+
+        if ((err == NGX_ENOENT || err == NGX_ENOTDIR) && dir.len > 1) {
+            continue;
+        }
+
+        if (err == NGX_ENOSPC || err == NGX_ENOMEM) {
+            ngx_log_error(NGX_LOG_WARN, log, err,
+                          "inotify_add_watch(\"%V\") failed, changed files "
+                          "will only be seen after \"open_file_cache_valid\"",
+                          &dir);
+            shared->no_watches = 1;
+
+        } else {
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, err,
+                           "inotify_add_watch(\"%V\") failed", &dir);
+        }
+
+        return;
+    }
+
+    /* the same directory by another name */
+
+    node = shared->watches.root;
+    sentinel = shared->watches.sentinel;
+
+    while (node != sentinel) {
+
+        if ((ngx_rbtree_key_t) wd == node->key) {
+            ngx_free(w);
+            return;
+        }
+
+        node = ((ngx_rbtree_key_t) wd < node->key) ? node->left : node->right;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "open file cache watch: \"%V\" wd:%d", &dir, wd);
+
+    w->dir.node.key = hash;
+    w->wd.key = wd;
+
+    ngx_rbtree_insert(&shared->dirs, &w->dir.node);
+    ngx_rbtree_insert(&shared->watches, &w->wd);
+}
+
+
+static void
+ngx_open_file_inotify_handler(ngx_event_t *ev)
+{
+    u_char                         *p, *last, path[NGX_MAX_PATH];
+    size_t                          len;
+    ssize_t                         n;
+    ngx_err_t                       err;
+    ngx_str_t                      *dir;
+    ngx_connection_t               *c;
+    ngx_rbtree_node_t              *node, *sentinel;
+    struct inotify_event           *e, buf[256];
+    ngx_open_file_cache_watch_t    *w;
+    ngx_open_file_cache_shared_t   *shared;
+
+    c = ev->data;
+    shared = c->data;
+
+    for ( ;; ) {
+
+        n = read(c->fd, buf, sizeof(buf));
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                              "inotify read() failed");
+            }
+
+            break;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        p = (u_char *) buf;
+        last = p + n;
+
+        while (p < last) {
+
+            e = (struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW) {
+                ngx_log_error(NGX_LOG_INFO, ev->log, 0,
+                              "inotify queue overflow, "
+                              "open file cache zone flushed");
+                ngx_open_file_shared_invalidate(shared, NULL, 0, 1);
+                continue;
+            }
+
+            node = shared->watches.root;
+            sentinel = shared->watches.sentinel;
+
+            while (node != sentinel && (ngx_rbtree_key_t) e->wd != node->key)
+            {
+                node = ((ngx_rbtree_key_t) e->wd < node->key) ? node->left
+                                                               : node->right;
+            }
+
+            if (node == sentinel) {
+                continue;
+            }
+
+            w = (ngx_open_file_cache_watch_t *)
+                    ((u_char *) node - offsetof(ngx_open_file_cache_watch_t,
+                                                wd));
+            dir = &w->dir.str;
+
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "open file cache inotify: \"%V\" \"%s\" %xD",
+                           dir, e->len ? e->name : "", e->mask);
+
+            len = (dir->len == 1) ? 0 : dir->len;
+
+            if (len + 1 + (e->len ? ngx_strlen(e->name) : 0) + 1
+                > NGX_MAX_PATH)
+            {
+                ngx_open_file_shared_invalidate(shared, dir->data, len, 1);
+                continue;
+            }
+
+            ngx_memcpy(path, dir->data, len);
+            path[len++] = '/';
+
+            if (e->mask & (IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF)) {
+
+                /* the directory itself and everything below it */
+
+                ngx_open_file_shared_invalidate(shared, path, len, 1);
+                ngx_open_file_shared_invalidate(shared, dir->data, dir->len,
+                                                0);
+
+                if (e->mask & IN_MOVE_SELF) {
+                    (void) inotify_rm_watch(c->fd, e->wd);
+                }
+
+                if (e->mask & IN_IGNORED) {
+                    ngx_rbtree_delete(&shared->dirs, &w->dir.node);
+                    ngx_rbtree_delete(&shared->watches, &w->wd);
+                    ngx_free(w);
+                }
+
+                continue;
+            }
+
+            if (e->len == 0) {
+                continue;
+            }
+
+            len = ngx_cpystrn(path + len, (u_char *) e->name,
+                              NGX_MAX_PATH - len) - path;
+
+            ngx_open_file_shared_invalidate(shared, path, len, 0);
+
+            /* "name/" and, for a directory, everything below it */
+
+            path[len++] = '/';
+
+            ngx_open_file_shared_invalidate(shared, path, len,
+                                            e->mask & IN_ISDIR);
+        }
+    }
+
+    if (ngx_handle_read_event(ev, 0) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      "inotify events are not handled");
+    }
+}
+
+
+static void
+ngx_open_file_shared_invalidate(ngx_open_file_cache_shared_t *shared,
+    u_char *name, size_t len, ngx_uint_t prefix)
+{
+    ngx_uint_t                   removed;
+    ngx_queue_t                 *q, *next;
+    ngx_open_file_cache_node_t  *fn;
+
+    removed = 0;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    if (!prefix) {
+        fn = ngx_open_file_shared_find(shared->sh, name, len,
+                                       ngx_crc32_long(name, len));
+        if (fn) {
+            ngx_queue_remove(&fn->queue);
+            ngx_rbtree_delete(&shared->sh->rbtree, &fn->node);
+            ngx_slab_free_locked(shared->shpool, fn);
+
+            shared->sh->generation++;
+        }
+
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+        return;
+    }
+
+    for (q = ngx_queue_head(&shared->sh->queue);
+         q != ngx_queue_sentinel(&shared->sh->queue);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        fn = ngx_queue_data(q, ngx_open_file_cache_node_t, queue);
+
+        if (fn->len < len || ngx_memcmp(fn->name, name, len) != 0) {
+            continue;
+        }
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&shared->sh->rbtree, &fn->node);
+        ngx_slab_free_locked(shared->shpool, fn);
+
+        removed = 1;
+    }
+
+    if (removed) {
+        shared->sh->generation++;
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+}
+
+
+static void
+ngx_open_file_shared_cleanup(void *data)
+{
+    ngx_open_file_cache_shared_t  *shared = data;
+
+    ngx_connection_t             *c;
+    ngx_rbtree_node_t            *node;
+    ngx_open_file_cache_watch_t  *w;
+
+    c = shared->inotify;
+
+    if (c->fd == (ngx_socket_t) -1) {
+        return;
+    }
+
+    if (c->read->active) {
+        (void) ngx_del_event(c->read, NGX_READ_EVENT, NGX_CLOSE_EVENT);
+    }
+
+    if (close(c->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "inotify close() failed");
+    }
+
+    c->fd = (ngx_socket_t) -1;
+
+    while (shared->watches.root != shared->watches.sentinel) {
+        node = shared->watches.root;
+
+        w = (ngx_open_file_cache_watch_t *)
+                ((u_char *) node - offsetof(ngx_open_file_cache_watch_t, wd));
+
+        ngx_rbtree_delete(&shared->watches, &w->wd);
+        ngx_rbtree_delete(&shared->dirs, &w->dir.node);
+        ngx_free(w);
+    }
+}
+
+#endif
@@ -69,6 +69,8 @@ struct ngx_cached_open_file_s {
 
     uint32_t                 uses;
 
+    ngx_atomic_uint_t        generation;
+
 #if (NGX_HAVE_OPENAT)
     size_t                   disable_symlinks_from;
     unsigned                 disable_symlinks:2;
@@ -88,6 +90,75 @@ struct ngx_cached_open_file_s {
 };
 
 
+/*
+ * the shared part of the cache keeps stat() info and errors for all
+ * workers, file handles stay in the worker caches
+ */
+
+typedef struct {
+    ngx_rbtree_node_t        node;
+    ngx_queue_t              queue;
+
+    time_t                   created;
+    time_t                   accessed;
+
+    ngx_file_uniq_t          uniq;
+    time_t                   mtime;
+    off_t                    size;
+    off_t                    fs_size;
+    ngx_err_t                err;
+
+#if (NGX_HAVE_OPENAT)
+    size_t                   disable_symlinks_from;
+    unsigned                 disable_symlinks:2;
+#endif
+
+    unsigned                 is_dir:1;
+    unsigned                 is_file:1;
+    unsigned                 is_link:1;
+    unsigned                 is_exec:1;
+
+    u_short                  len;
+    u_char                   name[1];
+} ngx_open_file_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+    ngx_queue_t              queue;
+
+    /* changed when entries are removed, older worker entries revalidate */
+    ngx_atomic_t             generation;
+} ngx_open_file_cache_sh_t;
+
+
+typedef struct {
+    ngx_open_file_cache_sh_t  *sh;
+    ngx_slab_pool_t           *shpool;
+
+#if (NGX_HAVE_INOTIFY)
+    /* directories watched by this worker */
+    ngx_connection_t          *inotify;
+    ngx_rbtree_t               dirs;
+    ngx_rbtree_node_t          dirs_sentinel;
+    ngx_rbtree_t               watches;
+    ngx_rbtree_node_t          watches_sentinel;
+    ngx_uint_t                 no_watches;
+#endif
+} ngx_open_file_cache_shared_t;
+
+
+#if (NGX_HAVE_INOTIFY)
+
+typedef struct {
+    ngx_str_node_t           dir;     /* the key is a hash of the name */
+    ngx_rbtree_node_t        wd;      /* the key is the watch descriptor */
+} ngx_open_file_cache_watch_t;
+
+#endif
+
+
 typedef struct {
     ngx_rbtree_t             rbtree;
     ngx_rbtree_node_t        sentinel;
@@ -96,6 +167,8 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+    ngx_open_file_cache_shared_t  *shared;
 } ngx_open_file_cache_t;
 
 
@@ -122,6 +195,8 @@ typedef struct {
 
 ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
     ngx_uint_t max, time_t inactive);
+ngx_int_t ngx_open_file_cache_init_shared(ngx_conf_t *cf,
+    ngx_open_file_cache_t *cache, ngx_str_t *name, size_t size, void *tag);
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
 
@@ -0,0 +1,2526 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * Readiness is delivered by multishot IORING_OP_POLL_ADD requests, which
+ * are edge-triggered like the EPOLLET registrations of the epoll module,
+ * so the rest of nginx sees the same events and flags.  Poll changes are
+ * only queued as SQEs and the whole batch is submitted by the single
+ * io_uring_enter() that also waits for completions, replacing both the
+ * epoll_ctl() calls and epoll_wait() of an event loop iteration.
+ *
+ * On kernels with provided buffer rings the client connections do their
+ * I/O on the ring as well.  Listening sockets have a multishot accept,
+ * whose sockets are queued for ngx_event_accept().  Once a read drains
+ * a client socket, a multishot recv fills the ring buffers and c->recv()
+ * copies from them.  Sent data is copied to a connection buffer that is
+ * written by IORING_OP_SEND, and file data is read into it by
+ * IORING_OP_READ; until the buffer is written, NGX_IOURING_BUFFERED is set
+ * in c->buffered, which is waited for like the SSL buffer.
+ *
+ * The low bit of user_data carries the connection instance as in epoll,
+ * the next two bits the kind of the request; zero is the user_data of
+ * poll removals and cancellations, whose completions are ignored.
+ */
+
+#define NGX_IOURING_POLL          0
+#define NGX_IOURING_AIO           2
+#define NGX_IOURING_RECV          4
+#define NGX_IOURING_SEND          6
+#define NGX_IOURING_READ          7
+#define NGX_IOURING_KIND          6
+
+#define NGX_IOURING_FEATURES                                                  \
+    (IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG|IORING_FEAT_RSRC_TAGS)
+
+#define NGX_IOURING_NOBUF         0xffff
+
+/* the received buffers a connection may hold before its recv is cancelled */
+#define NGX_IOURING_RECV_BUFFERS  8
+
+#define NGX_IOURING_SEND_FREE     64
+#define NGX_IOURING_SEND_LINGER   60000
+
+
+typedef struct {
+    ngx_uint_t                 entries;
+    ngx_bufs_t                 buffers;
+    size_t                     send_buffer;
+} ngx_iouring_conf_t;
+
+
+typedef struct {
+    void                      *sq_ring;
+    size_t                     sq_ring_size;
+    uint32_t                  *sq_head;
+    uint32_t                  *sq_tail;
+    uint32_t                   sq_mask;
+    uint32_t                   sq_entries;
+    uint32_t                   tail;
+    struct io_uring_sqe       *sqes;
+    size_t                     sqes_size;
+
+    void                      *cq_ring;
+    size_t                     cq_ring_size;
+    uint32_t                  *cq_head;
+    uint32_t                  *cq_tail;
+    uint32_t                   cq_mask;
+    struct io_uring_cqe       *cqes;
+
+    uint32_t                   features;
+} ngx_iouring_t;
+
+
+typedef struct {
+    struct io_uring_buf_ring  *ring;
+    size_t                     ring_size;
+    u_char                    *start;
+    size_t                     size;
+    uint32_t                   mask;
+    uint16_t                   tail;
+    ngx_uint_t                 free;
+    uint32_t                  *len;
+    uint16_t                  *next;
+} ngx_iouring_bufs_t;
+
+
+typedef struct ngx_iouring_send_s  ngx_iouring_send_t;
+
+struct ngx_iouring_send_s {
+    ngx_connection_t          *connection;
+    ngx_iouring_send_t        *next;
+
+    u_char                    *pos;
+    u_char                    *last;
+    u_char                    *start;
+    u_char                    *end;
+
+    ngx_buf_t                 *file;
+    ssize_t                    read;
+    ngx_err_t                  error;
+
+    ngx_event_t                event;
+
+    unsigned                   sending:1;
+    unsigned                   reading:1;
+};
+
+
+typedef struct {
+    ngx_iouring_send_t        *send;
+
+    ngx_socket_t              *accepted;
+    ngx_uint_t                 first;
+    ngx_uint_t                 last;
+    ngx_uint_t                 nalloc;
+
+    uint32_t                   events;
+    ngx_err_t                  error;
+
+    uint32_t                   nbufs;
+    uint32_t                   offset;
+    uint16_t                   head;
+    uint16_t                   tail;
+
+    unsigned                   recv:1;
+    unsigned                   cancel:1;
+    unsigned                   closed:1;
+    unsigned                   eof:1;
+} ngx_iouring_conn_t;
+
+
+static ngx_int_t ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_iouring_setup(ngx_cycle_t *cycle, ngx_uint_t entries);
+static ngx_int_t ngx_iouring_io_init(ngx_cycle_t *cycle,
+    ngx_iouring_conf_t *iocf);
+static ngx_int_t ngx_iouring_buffers_init(ngx_cycle_t *cycle,
+    ngx_bufs_t *b);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_iouring_notify_init(ngx_log_t *log);
+static void ngx_iouring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_iouring_done(ngx_cycle_t *cycle);
+static struct io_uring_sqe *ngx_iouring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_iouring_submit(ngx_log_t *log);
+static ngx_int_t ngx_iouring_poll_add(ngx_connection_t *c, uint32_t events,
+    uint64_t data);
+static ngx_int_t ngx_iouring_poll_remove(ngx_log_t *log, uint64_t data);
+static ngx_int_t ngx_iouring_poll_set(ngx_connection_t *c, uint32_t prev,
+    uint32_t events);
+static uint32_t ngx_iouring_events(ngx_connection_t *c,
+    ngx_iouring_conn_t *st);
+static ngx_int_t ngx_iouring_cancel(ngx_log_t *log, uint64_t data);
+static ngx_int_t ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_iouring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_iouring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+static void ngx_iouring_close(ngx_connection_t *c, ngx_iouring_conn_t *st);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_iouring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_iouring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+static void ngx_iouring_event(ngx_cycle_t *cycle, uint64_t data, int32_t res,
+    uint32_t cflags, ngx_uint_t flags);
+
+static ngx_int_t ngx_iouring_recv_add(ngx_connection_t *c,
+    ngx_iouring_conn_t *st);
+static void ngx_iouring_recv_start(ngx_connection_t *c,
+    ngx_iouring_conn_t *st);
+static void ngx_iouring_recv_event(ngx_cycle_t *cycle, uint64_t data,
+    int32_t res, uint32_t cflags, ngx_uint_t flags);
+static void ngx_iouring_accepted(ngx_connection_t *c, ngx_iouring_conn_t *st,
+    ngx_socket_t s);
+static void ngx_iouring_accepted_close(ngx_iouring_conn_t *st);
+static void ngx_iouring_buffer_free(uint16_t bid);
+static size_t ngx_iouring_recv_copy(ngx_iouring_conn_t *st, u_char *buf,
+    size_t size);
+static ssize_t ngx_iouring_recv_state(ngx_connection_t *c,
+    ngx_iouring_conn_t *st);
+static void ngx_iouring_recv_ready(ngx_event_t *rev, ngx_iouring_conn_t *st);
+static ssize_t ngx_iouring_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_iouring_recv_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit);
+
+static ngx_iouring_send_t *ngx_iouring_send_get(ngx_connection_t *c,
+    ngx_iouring_conn_t *st);
+static void ngx_iouring_send_free(ngx_iouring_send_t *ss);
+static void ngx_iouring_send_close(ngx_iouring_send_t *ss);
+static void ngx_iouring_send_timeout(ngx_event_t *ev);
+static ngx_int_t ngx_iouring_send_start(ngx_iouring_send_t *ss);
+static void ngx_iouring_send_done(ngx_iouring_send_t *ss);
+static void ngx_iouring_send_event(ngx_iouring_send_t *ss, ngx_uint_t read,
+    int32_t res, ngx_uint_t flags);
+static ssize_t ngx_iouring_send(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ngx_chain_t *ngx_iouring_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+
+static void *ngx_iouring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+static int                  ring_fd = -1;
+static ngx_iouring_t        ring;
+
+static ngx_iouring_conn_t  *conns;
+static ngx_uint_t           nconns;
+static ngx_iouring_bufs_t   bufs;
+static ngx_uint_t           recv_multishot;
+static size_t               send_size;
+static ngx_iouring_send_t  *free_sends;
+static ngx_uint_t           nfree_sends;
+static ngx_os_io_t          ngx_iouring_io;
+
+#if (NGX_HAVE_EVENTFD)
+static int                  notify_fd = -1;
+static ngx_event_t          notify_event;
+static ngx_connection_t     notify_conn;
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+ngx_uint_t                  ngx_iouring_aio;
+#endif
+
+ngx_uint_t                  ngx_iouring_accept_events;
+
+extern ngx_module_t         ngx_epoll_module;
+
+static ngx_str_t      iouring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_iouring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, entries),
+      NULL },
+
+    { ngx_string("io_uring_buffers"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE2,
+      ngx_conf_set_bufs_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, buffers),
+      NULL },
+
+    { ngx_string("io_uring_send_buffer"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_iouring_conf_t, send_buffer),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_iouring_module_ctx = {
+    &iouring_name,
+    ngx_iouring_create_conf,             /* create configuration */
+    ngx_iouring_init_conf,               /* init configuration */
+
+    {
+        ngx_iouring_add_event,           /* add an event */
+        ngx_iouring_del_event,           /* delete an event */
+        ngx_iouring_add_event,           /* enable an event */
+        ngx_iouring_del_event,           /* disable an event */
+        ngx_iouring_add_connection,      /* add an connection */
+        ngx_iouring_del_connection,      /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_iouring_notify,              /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_iouring_process_events,      /* process the events */
+        ngx_iouring_init,                /* init the events */
+        ngx_iouring_done,                /* done the events */
+    }
+};
+
+ngx_module_t  ngx_iouring_module = {
+    NGX_MODULE_V1,
+    &ngx_iouring_module_ctx,             /* module context */
+    ngx_iouring_commands,                /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() as syscalls instead of
+ * using liburing, as the epoll module does for the native AIO calls.
+ */
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags, void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+
+static int
+io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+static ngx_int_t
+ngx_iouring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_int_t            rc;
+    ngx_event_module_t  *module;
+    ngx_iouring_conf_t  *iocf;
+
+    iocf = ngx_event_get_conf(cycle->conf_ctx, ngx_iouring_module);
+
+    if (ring_fd == -1) {
+        rc = ngx_iouring_setup(cycle, iocf->entries);
+
+        if (rc == NGX_DECLINED) {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                          "io_uring is not supported by the kernel, "
+                          "using epoll");
+
+            module = ngx_epoll_module.ctx;
+
+            return module->actions.init(cycle, timer);
+        }
+
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_iouring_notify_init(cycle->log) != NGX_OK) {
+            ngx_iouring_module_ctx.actions.notify = NULL;
+        }
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+        ngx_iouring_aio = 1;
+#endif
+
+#if (NGX_HAVE_EPOLLRDHUP)
+        /* POLLRDHUP is reported by io_uring poll on every kernel it needs */
+        ngx_use_epoll_rdhup = 1;
+#endif
+
+        if (ngx_iouring_io_init(cycle, iocf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_io = conns ? ngx_iouring_io : ngx_os_io;
+
+    ngx_event_actions = ngx_iouring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_setup(ngx_cycle_t *cycle, ngx_uint_t entries)
+{
+    int                     fd;
+    u_char                 *sq, *cq;
+    uint32_t                i, *array;
+    ngx_err_t               err;
+    struct io_uring_params  p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    /* multishot polls may complete many times per submission */
+
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+
+    fd = io_uring_setup(entries, &p);
+
+    if (fd == -1) {
+        err = ngx_errno;
+
+        if (err == NGX_ENOSYS || err == NGX_EPERM) {
+            return NGX_DECLINED;
+        }
+
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, err,
+                      "io_uring_setup(%ui) failed", entries);
+        return NGX_ERROR;
+    }
+
+    /* the features imply Linux 5.13, which has multishot poll */
+
+    if ((p.features & NGX_IOURING_FEATURES) != NGX_IOURING_FEATURES) {
+        (void) close(fd);
+        return NGX_DECLINED;
+    }
+
+    ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring.cq_ring_size = p.cq_off.cqes
+                        + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.sq_ring_size = ngx_max(ring.sq_ring_size, ring.cq_ring_size);
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    sq = mmap(NULL, ring.sq_ring_size, PROT_READ|PROT_WRITE,
+              MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+    if (sq == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        goto failed;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+
+    } else {
+        cq = mmap(NULL, ring.cq_ring_size, PROT_READ|PROT_WRITE,
+                  MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+        if (cq == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            (void) munmap(sq, ring.sq_ring_size);
+            goto failed;
+        }
+    }
+
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (ring.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        if (cq != sq) {
+            (void) munmap(cq, ring.cq_ring_size);
+        }
+        (void) munmap(sq, ring.sq_ring_size);
+        goto failed;
+    }
+
+    ring_fd = fd;
+
+    ring.sq_ring = sq;
+    ring.sq_head = (uint32_t *) (sq + p.sq_off.head);
+    ring.sq_tail = (uint32_t *) (sq + p.sq_off.tail);
+    ring.sq_mask = *(uint32_t *) (sq + p.sq_off.ring_mask);
+    ring.sq_entries = p.sq_entries;
+    ring.tail = *ring.sq_tail;
+
+    /* SQEs are always used in ring order, so the index array is fixed */
+
+    array = (uint32_t *) (sq + p.sq_off.array);
+
+    for (i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    ring.cq_ring = cq;
+    ring.cq_head = (uint32_t *) (cq + p.cq_off.head);
+    ring.cq_tail = (uint32_t *) (cq + p.cq_off.tail);
+    ring.cq_mask = *(uint32_t *) (cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    ring.features = p.features;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   fd, p.sq_entries, p.cq_entries);
+
+    return NGX_OK;
+
+failed:
+
+    (void) close(fd);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_iouring_io_init(ngx_cycle_t *cycle, ngx_iouring_conf_t *iocf)
+{
+    ngx_int_t  rc;
+
+    /*
+     * provided buffer rings imply Linux 5.19, which has multishot accept;
+     * multishot recv appeared in Linux 6.0 and is checked on first use
+     */
+
+    rc = ngx_iouring_buffers_init(cycle, &iocf->buffers);
+
+    if (rc == NGX_DECLINED) {
+        return NGX_OK;
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    conns = ngx_calloc(cycle->connection_n * sizeof(ngx_iouring_conn_t),
+                       cycle->log);
+    if (conns == NULL) {
+        return NGX_ERROR;
+    }
+
+    nconns = cycle->connection_n;
+    send_size = iocf->send_buffer;
+    recv_multishot = 1;
+
+    ngx_iouring_accept_events = 1;
+
+    ngx_iouring_io = ngx_os_io;
+    ngx_iouring_io.recv = ngx_iouring_recv;
+    ngx_iouring_io.recv_chain = ngx_iouring_recv_chain;
+    ngx_iouring_io.send = ngx_iouring_send;
+    ngx_iouring_io.send_chain = ngx_iouring_send_chain;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_buffers_init(ngx_cycle_t *cycle, ngx_bufs_t *b)
+{
+    u_char                   *p;
+    size_t                    size;
+    ngx_err_t                 err;
+    ngx_int_t                 bid;
+    struct io_uring_buf_reg   reg;
+
+    bufs.ring_size = ngx_align(b->num * sizeof(struct io_uring_buf),
+                               ngx_pagesize);
+
+    size = bufs.ring_size + b->num * b->size;
+
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+             -1, 0);
+
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(%uz) failed", size);
+        return NGX_ERROR;
+    }
+
+    bufs.len = ngx_alloc(b->num * (sizeof(uint32_t) + sizeof(uint16_t)),
+                         cycle->log);
+    if (bufs.len == NULL) {
+        (void) munmap(p, size);
+        return NGX_ERROR;
+    }
+
+    bufs.next = (uint16_t *) (bufs.len + b->num);
+
+    ngx_memzero(&reg, sizeof(struct io_uring_buf_reg));
+
+    reg.ring_addr = (uintptr_t) p;
+    reg.ring_entries = b->num;
+    reg.bgid = 0;
+
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        err = ngx_errno;
+
+        ngx_free(bufs.len);
+        (void) munmap(p, size);
+
+        if (err == NGX_EINVAL) {
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "io_uring provided buffers are not supported "
+                          "by the kernel, using readiness polls only");
+            return NGX_DECLINED;
+        }
+
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, err,
+                      "io_uring_register(IORING_REGISTER_PBUF_RING) failed");
+        return NGX_ERROR;
+    }
+
+    bufs.ring = (struct io_uring_buf_ring *) p;
+    bufs.start = p + bufs.ring_size;
+    bufs.size = b->size;
+    bufs.mask = b->num - 1;
+
+    for (bid = 0; bid < b->num; bid++) {
+        ngx_iouring_buffer_free((uint16_t) bid);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring buffers: %i %uz", b->num, b->size);
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_iouring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_iouring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.log = log;
+
+    if (ngx_iouring_poll_add(&notify_conn, EPOLLIN, (uintptr_t) &notify_conn)
+        != NGX_OK)
+    {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                            "eventfd close() failed");
+        }
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    if (++ev->index == NGX_MAX_UINT32_VALUE) {
+        ev->index = 0;
+
+        n = read(notify_fd, &count, sizeof(uint64_t));
+
+        err = ngx_errno;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+        if ((size_t) n != sizeof(uint64_t)) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() eventfd %d failed", notify_fd);
+        }
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_iouring_done(ngx_cycle_t *cycle)
+{
+    ngx_uint_t           i;
+    ngx_iouring_send_t  *ss;
+
+    if (ring_fd == -1) {
+        return;
+    }
+
+    /*
+     * closing the ring cancels the polls, accepts, receives and sends,
+     * and waits for the file reads
+     */
+
+    (void) munmap(ring.sqes, ring.sqes_size);
+
+    if (ring.cq_ring != ring.sq_ring) {
+        (void) munmap(ring.cq_ring, ring.cq_ring_size);
+    }
+
+    (void) munmap(ring.sq_ring, ring.sq_ring_size);
+
+    if (close(ring_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring_fd = -1;
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (close(notify_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "eventfd close() failed");
+    }
+
+    notify_fd = -1;
+
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+    ngx_iouring_aio = 0;
+#endif
+
+    ngx_iouring_accept_events = 0;
+
+    if (conns) {
+        for (i = 0; i < nconns; i++) {
+            if (conns[i].accepted) {
+                ngx_free(conns[i].accepted);
+            }
+        }
+
+        ngx_free(conns);
+        conns = NULL;
+    }
+
+    while (free_sends) {
+        ss = free_sends;
+        free_sends = ss->next;
+        ngx_free(ss);
+    }
+
+    nfree_sends = 0;
+
+    if (bufs.ring) {
+        (void) munmap(bufs.ring,
+                      bufs.ring_size + (bufs.mask + 1) * bufs.size);
+        ngx_free(bufs.len);
+        bufs.ring = NULL;
+    }
+}
+
+
+static struct io_uring_sqe *
+ngx_iouring_get_sqe(ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (ring.tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE)
+        == ring.sq_entries)
+    {
+        if (ngx_iouring_submit(log) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    sqe = &ring.sqes[ring.tail & ring.sq_mask];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    ring.tail++;
+    __atomic_store_n(ring.sq_tail, ring.tail, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+
+/*
+ * submits the queued SQEs right away, outside of the event loop wait
+ */
+
+static ngx_int_t
+ngx_iouring_submit(ngx_log_t *log)
+{
+    uint32_t  pending;
+
+    pending = ring.tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+    while (pending) {
+        if (io_uring_enter(ring_fd, pending, 0, 0, NULL, 0) == -1) {
+            if (ngx_errno == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "io_uring_enter() failed");
+            return NGX_ERROR;
+        }
+
+        pending = ring.tail
+                  - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_add(ngx_connection_t *c, uint32_t events, uint64_t data)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_remove(ngx_log_t *log, uint64_t data)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_poll_set(ngx_connection_t *c, uint32_t prev, uint32_t events)
+{
+    uint64_t  data;
+
+    if (events == prev) {
+        return NGX_OK;
+    }
+
+    data = (uintptr_t) c | c->read->instance;
+
+    if (prev && ngx_iouring_poll_remove(c->log, data) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * io_uring polls are edge-triggered already; EPOLLEXCLUSIVE is not
+     * passed, as older kernels refuse it for multishot polls
+     */
+
+    if (events && ngx_iouring_poll_add(c, events, data) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * the poll events of a connection: reads of an armed multishot recv or
+ * accept and the ring sends are reported by their own completions
+ */
+
+static uint32_t
+ngx_iouring_events(ngx_connection_t *c, ngx_iouring_conn_t *st)
+{
+    uint32_t  events;
+
+    events = 0;
+
+    if (c->read->active && (st == NULL || !st->recv || st->closed)) {
+        events = EPOLLIN|EPOLLRDHUP;
+    }
+
+    if (c->write && c->write->active
+        && (st == NULL || send_size == 0 || c->listening == NULL
+            || c->type != SOCK_STREAM
+#if (NGX_SSL)
+            || c->ssl
+#endif
+           ))
+    {
+        events |= EPOLLOUT;
+    }
+
+    return events;
+}
+
+
+static ngx_int_t
+ngx_iouring_cancel(ngx_log_t *log, uint64_t data)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_inline ngx_iouring_conn_t *
+ngx_iouring_conn(ngx_connection_t *c)
+{
+    if (conns == NULL
+        || c < ngx_cycle->connections
+        || c >= ngx_cycle->connections + nconns)
+    {
+        return NULL;
+    }
+
+    return &conns[c - ngx_cycle->connections];
+}
+
+
+/*
+ * the state of a client connection whose I/O may go through the ring
+ */
+
+static ngx_inline ngx_iouring_conn_t *
+ngx_iouring_client(ngx_connection_t *c)
+{
+    if (c->listening == NULL || c->type != SOCK_STREAM
+#if (NGX_SSL)
+        || c->ssl
+#endif
+       )
+    {
+        return NULL;
+    }
+
+    return ngx_iouring_conn(c);
+}
+
+
+static ngx_int_t
+ngx_iouring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t             prev, events;
+    ngx_connection_t    *c;
+    ngx_iouring_conn_t  *st;
+
+    c = ev->data;
+    st = ngx_iouring_conn(c);
+
+    prev = st ? st->events : ngx_iouring_events(c, NULL);
+
+    ev->active = 1;
+
+    if (ev->accept && st && ngx_iouring_accept_events
+        && c->type == SOCK_STREAM)
+    {
+        if (!st->recv && ngx_iouring_recv_add(c, st) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (st->first != st->last) {
+
+            /* the sockets accepted while the events were disabled */
+
+            ev->ready = 1;
+            ngx_post_event(ev, &ngx_posted_accept_events);
+        }
+    }
+
+    events = ngx_iouring_events(c, st);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d ev:%i poll:%08XD",
+                   c->fd, event, events);
+
+    if (ngx_iouring_poll_set(c, prev, events) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (st) {
+        st->events = events;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t             prev, events;
+    ngx_connection_t    *c;
+    ngx_iouring_conn_t  *st;
+
+    c = ev->data;
+    st = ngx_iouring_conn(c);
+
+    /*
+     * unlike epoll, a pending poll keeps the file open after close(),
+     * so it is always removed; polls queued for the descriptor are
+     * submitted first, before the number can be reused
+     */
+
+    if ((flags & NGX_CLOSE_EVENT)
+        && ngx_iouring_submit(ev->log) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    prev = st ? st->events : ngx_iouring_events(c, NULL);
+
+    ev->active = 0;
+
+    if (st) {
+        if ((flags & NGX_CLOSE_EVENT) || (ev->accept && ngx_exiting)) {
+
+            /* listening sockets are closed without other calls */
+
+            ngx_iouring_close(c, st);
+
+        } else if (ev->accept && st->recv && !st->cancel) {
+            if (ngx_iouring_cancel(ev->log, (uintptr_t) c | ev->instance
+                                            | NGX_IOURING_RECV)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            st->cancel = 1;
+        }
+    }
+
+    events = (flags & NGX_CLOSE_EVENT) ? 0 : ngx_iouring_events(c, st);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d ev:%i poll:%08XD",
+                   c->fd, event, events);
+
+    if (ngx_iouring_poll_set(c, prev, events) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (st) {
+        st->events = events;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_add_connection(ngx_connection_t *c)
+{
+    uint32_t             prev, events;
+    ngx_iouring_conn_t  *st;
+
+    st = ngx_iouring_conn(c);
+
+    prev = st ? st->events : ngx_iouring_events(c, NULL);
+
+    c->read->active = 1;
+    c->write->active = 1;
+
+    events = ngx_iouring_events(c, st);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring add connection: fd:%d ev:%08XD", c->fd, events);
+
+    if (ngx_iouring_poll_set(c, prev, events) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (st) {
+        st->events = events;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_iouring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    uint32_t             prev;
+    ngx_iouring_conn_t  *st;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring del connection: fd:%d", c->fd);
+
+    if ((flags & NGX_CLOSE_EVENT) && ngx_iouring_submit(c->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    st = ngx_iouring_conn(c);
+
+    prev = st ? st->events : ngx_iouring_events(c, NULL);
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    if (st && (flags & NGX_CLOSE_EVENT)) {
+        ngx_iouring_close(c, st);
+    }
+
+    if (ngx_iouring_poll_set(c, prev, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (st) {
+        st->events = 0;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * releases the ring state of a connection before its socket is closed;
+ * a multishot accept or recv holds the socket until it is cancelled, and
+ * its remaining completions must not reach the next connection
+ */
+
+static void
+ngx_iouring_close(ngx_connection_t *c, ngx_iouring_conn_t *st)
+{
+    uint16_t  bid;
+
+    if (st->recv && !st->closed) {
+        if (!st->cancel) {
+            (void) ngx_iouring_cancel(c->log, (uintptr_t) c
+                                              | c->read->instance
+                                              | NGX_IOURING_RECV);
+            st->cancel = 1;
+        }
+
+        st->closed = 1;
+    }
+
+    while (st->nbufs) {
+        bid = st->head;
+        st->head = bufs.next[bid];
+        st->nbufs--;
+
+        ngx_iouring_buffer_free(bid);
+    }
+
+    st->offset = 0;
+    st->error = 0;
+    st->eof = 0;
+
+    ngx_iouring_accepted_close(st);
+
+    if (st->send) {
+        ngx_iouring_send_close(st->send);
+        st->send = NULL;
+    }
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_iouring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_iouring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                             n;
+    uint32_t                        head, tail, pending, wait;
+    ngx_err_t                       err;
+    ngx_uint_t                      level;
+    struct timespec                 ts;
+    struct io_uring_cqe            *cqe;
+    struct io_uring_getevents_arg   arg;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uintptr_t) &ts;
+    }
+
+    pending = ring.tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    wait = (*ring.cq_head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE));
+
+    n = io_uring_enter(ring_fd, pending, wait,
+                       IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(struct io_uring_getevents_arg));
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err == ETIME) {
+        return NGX_OK;
+    }
+
+    if (err && err != NGX_EAGAIN && err != NGX_EBUSY) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    head = *ring.cq_head;
+    tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        cqe = &ring.cqes[head & ring.cq_mask];
+
+        ngx_iouring_event(cycle, cqe->user_data, cqe->res, cqe->flags, flags);
+
+        head++;
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_iouring_event(ngx_cycle_t *cycle, uint64_t data, int32_t res,
+    uint32_t cflags, ngx_uint_t flags)
+{
+    uint32_t             revents, events;
+    ngx_int_t            instance;
+    ngx_event_t         *rev, *wev;
+    ngx_queue_t         *queue;
+    ngx_connection_t    *c;
+    ngx_iouring_conn_t  *st;
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_aio_t     *aio;
+#endif
+
+    if (data == 0) {
+        return;
+    }
+
+    switch (data & NGX_IOURING_KIND) {
+
+#if (NGX_HAVE_FILE_AIO)
+
+    case NGX_IOURING_AIO:
+        rev = (ngx_event_t *) (uintptr_t) (data & ~(uint64_t) NGX_IOURING_AIO);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring aio event: %p res:%d", rev, res);
+
+        rev->complete = 1;
+        rev->active = 0;
+        rev->ready = 1;
+
+        aio = rev->data;
+        aio->res = res;
+
+        ngx_post_event(rev, &ngx_posted_events);
+
+        return;
+
+#endif
+
+    case NGX_IOURING_RECV:
+        ngx_iouring_recv_event(cycle, data, res, cflags, flags);
+        return;
+
+    case NGX_IOURING_SEND:
+        ngx_iouring_send_event((ngx_iouring_send_t *) (uintptr_t)
+                                   (data & ~(uint64_t) NGX_IOURING_READ),
+                               data & 1, res, flags);
+        return;
+    }
+
+    instance = data & 1;
+    c = (ngx_connection_t *) (uintptr_t) (data & ~(uint64_t) 1);
+
+    rev = c->read;
+    wev = c->write;
+
+    if (c->fd == -1 || rev->instance != instance
+        || !(rev->active || (wev && wev->active)))
+    {
+        /*
+         * the stale event from a file descriptor that was closed or
+         * deleted in this iteration; a poll still armed for it is
+         * removed again in case it was re-armed after the removal
+         */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: stale event %p", c);
+
+        if ((cflags & IORING_CQE_F_MORE) && res >= 0) {
+            (void) ngx_iouring_poll_remove(cycle->log, data);
+        }
+
+        return;
+    }
+
+    if (res == -ECANCELED) {
+        return;
+    }
+
+    if (res < 0) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                      "io_uring poll on fd:%d failed", c->fd);
+
+        revents = EPOLLERR;
+
+    } else {
+        revents = (uint32_t) res;
+
+        /* a multishot poll may end, e.g. on CQ overflow; arm it again */
+
+        if (!(cflags & IORING_CQE_F_MORE)) {
+            st = ngx_iouring_conn(c);
+            events = ngx_iouring_events(c, st);
+
+            if (events && ngx_iouring_poll_add(c, events, data) != NGX_OK) {
+                events = 0;
+            }
+
+            if (st) {
+                st->events = events;
+            }
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d ev:%04XD d:%p", c->fd, revents, data);
+
+    if (revents & (EPOLLERR|EPOLLHUP)) {
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring error on fd:%d ev:%04XD", c->fd, revents);
+
+        /*
+         * if the error events were returned, add EPOLLIN and EPOLLOUT
+         * to handle the events at least in one active handler
+         */
+
+        revents |= EPOLLIN|EPOLLOUT;
+    }
+
+    if ((revents & EPOLLIN) && rev->active) {
+
+#if (NGX_HAVE_EPOLLRDHUP)
+        if (revents & EPOLLRDHUP) {
+            rev->pending_eof = 1;
+        }
+
+        rev->available = 1;
+#endif
+
+        rev->ready = 1;
+
+        if (flags & NGX_POST_EVENTS) {
+            queue = rev->accept ? &ngx_posted_accept_events
+                                : &ngx_posted_events;
+
+            ngx_post_event(rev, queue);
+
+        } else {
+            rev->handler(rev);
+        }
+    }
+
+    if ((revents & EPOLLOUT) && wev && wev->active) {
+
+        if (c->fd == -1 || wev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            return;
+        }
+
+        wev->ready = 1;
+#if (NGX_THREADS)
+        wev->complete = 1;
+#endif
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(wev, &ngx_posted_events);
+
+        } else {
+            wev->handler(wev);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_iouring_recv_add(ngx_connection_t *c, ngx_iouring_conn_t *st)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (c->read->accept) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK;
+
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+    }
+
+    sqe->fd = c->fd;
+    sqe->user_data = (uintptr_t) c | c->read->instance | NGX_IOURING_RECV;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring %s", c->read->accept ? "accept" : "recv");
+
+    st->recv = 1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * once a read has drained the socket, the next data are received
+ * to the ring buffers instead of waiting for readiness
+ */
+
+static void
+ngx_iouring_recv_start(ngx_connection_t *c, ngx_iouring_conn_t *st)
+{
+    uint32_t  events;
+
+    if (st->recv || bufs.free == 0 || !recv_multishot) {
+        return;
+    }
+
+    if (ngx_iouring_recv_add(c, st) != NGX_OK) {
+        return;
+    }
+
+    events = ngx_iouring_events(c, st);
+
+    if (ngx_iouring_poll_set(c, st->events, events) == NGX_OK) {
+        st->events = events;
+    }
+}
+
+
+static void
+ngx_iouring_recv_event(ngx_cycle_t *cycle, uint64_t data, int32_t res,
+    uint32_t cflags, ngx_uint_t flags)
+{
+    uint32_t             events;
+    uint16_t             bid;
+    ngx_uint_t           last;
+    ngx_event_t         *rev;
+    ngx_connection_t    *c;
+    ngx_iouring_conn_t  *st;
+
+    c = (ngx_connection_t *) (uintptr_t)
+            (data & ~(uint64_t) (NGX_IOURING_KIND|1));
+
+    rev = c->read;
+    st = ngx_iouring_conn(c);
+
+    bid = NGX_IOURING_NOBUF;
+
+    if (cflags & IORING_CQE_F_BUFFER) {
+        bid = cflags >> IORING_CQE_BUFFER_SHIFT;
+        bufs.free--;
+    }
+
+    last = !(cflags & IORING_CQE_F_MORE);
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring recv event: %p res:%d buf:%d last:%ui",
+                   c, res, (int) bid, last);
+
+    if (st == NULL || st->closed || c->fd == -1
+        || rev->instance != (data & 1))
+    {
+        /* the completion for a closed socket */
+
+        if (bid != NGX_IOURING_NOBUF) {
+            ngx_iouring_buffer_free(bid);
+
+        } else if (res > 0) {
+            /* a socket accepted after the listening one was closed */
+            (void) ngx_close_socket(res);
+        }
+
+        if (st && st->closed && last) {
+            st->recv = 0;
+            st->cancel = 0;
+            st->closed = 0;
+        }
+
+        return;
+    }
+
+    if (rev->accept) {
+        if (res >= 0) {
+            ngx_iouring_accepted(c, st, res);
+
+        } else if (res == -EINVAL) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                          "io_uring multishot accept failed, using poll");
+
+            ngx_iouring_accept_events = 0;
+
+        } else if (res != -ECANCELED) {
+            st->error = -res;
+        }
+
+        if (last) {
+            st->recv = 0;
+            st->cancel = 0;
+
+            if (rev->active && ngx_iouring_accept_events
+                && (res >= 0 || res == -ECANCELED))
+            {
+                (void) ngx_iouring_recv_add(c, st);
+            }
+
+            events = ngx_iouring_events(c, st);
+
+            if (ngx_iouring_poll_set(c, st->events, events) == NGX_OK) {
+                st->events = events;
+            }
+        }
+
+        if (res == -ECANCELED || !rev->active) {
+            return;
+        }
+
+        rev->ready = 1;
+
+        if (flags & NGX_POST_EVENTS) {
+            ngx_post_event(rev, &ngx_posted_accept_events);
+
+        } else {
+            rev->handler(rev);
+        }
+
+        return;
+    }
+
+    if (bid != NGX_IOURING_NOBUF) {
+        if (res > 0) {
+            bufs.len[bid] = res;
+
+            if (st->nbufs) {
+                bufs.next[st->tail] = bid;
+
+            } else {
+                st->head = bid;
+            }
+
+            st->tail = bid;
+            st->nbufs++;
+
+            if (st->nbufs >= NGX_IOURING_RECV_BUFFERS
+                && st->recv && !st->cancel && !last)
+            {
+                /* the data are not read, leave the rest in the socket */
+
+                if (ngx_iouring_cancel(cycle->log, data) == NGX_OK) {
+                    st->cancel = 1;
+                }
+            }
+
+        } else {
+            ngx_iouring_buffer_free(bid);
+        }
+    }
+
+    if (res == 0) {
+        st->eof = 1;
+
+    } else if (res == -EINVAL && recv_multishot) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, -res,
+                      "io_uring multishot recv failed, using readiness");
+
+        recv_multishot = 0;
+
+    } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+        st->error = -res;
+    }
+
+    if (last) {
+        st->recv = 0;
+        st->cancel = 0;
+
+        events = ngx_iouring_events(c, st);
+
+        if (ngx_iouring_poll_set(c, st->events, events) == NGX_OK) {
+            st->events = events;
+        }
+    }
+
+    if (res == -ECANCELED) {
+        return;
+    }
+
+#if (NGX_HAVE_EPOLLRDHUP)
+    if (res == 0) {
+        rev->pending_eof = 1;
+    }
+
+    rev->available = 1;
+#endif
+
+    rev->ready = 1;
+
+    if (!rev->active) {
+        return;
+    }
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(rev, &ngx_posted_events);
+
+    } else {
+        rev->handler(rev);
+    }
+}
+
+
+static void
+ngx_iouring_accepted(ngx_connection_t *c, ngx_iouring_conn_t *st,
+    ngx_socket_t s)
+{
+    ngx_uint_t     n;
+    ngx_socket_t  *fds;
+
+    if (st->last == st->nalloc) {
+
+        if (st->first) {
+            ngx_memmove(st->accepted, &st->accepted[st->first],
+                        (st->last - st->first) * sizeof(ngx_socket_t));
+
+            st->last -= st->first;
+            st->first = 0;
+
+        } else {
+            n = st->nalloc ? 2 * st->nalloc : 16;
+
+            fds = ngx_alloc(n * sizeof(ngx_socket_t), c->log);
+            if (fds == NULL) {
+                (void) ngx_close_socket(s);
+                return;
+            }
+
+            if (st->accepted) {
+                ngx_memcpy(fds, st->accepted,
+                           st->last * sizeof(ngx_socket_t));
+                ngx_free(st->accepted);
+            }
+
+            st->accepted = fds;
+            st->nalloc = n;
+        }
+    }
+
+    st->accepted[st->last++] = s;
+}
+
+
+static void
+ngx_iouring_accepted_close(ngx_iouring_conn_t *st)
+{
+    while (st->first != st->last) {
+        if (ngx_close_socket(st->accepted[st->first]) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_socket_errno,
+                          ngx_close_socket_n " failed");
+        }
+
+        st->first++;
+    }
+
+    st->first = 0;
+    st->last = 0;
+}
+
+
+/*
+ * the accept() of ngx_event_accept(): returns the next socket accepted
+ * by the multishot accept of the listening socket
+ */
+
+ngx_socket_t
+ngx_iouring_accept(ngx_event_t *ev, struct sockaddr *sa, socklen_t *socklen)
+{
+    ngx_err_t            err;
+    ngx_socket_t         s;
+    ngx_connection_t    *lc;
+    ngx_iouring_conn_t  *st;
+
+    lc = ev->data;
+    st = ngx_iouring_conn(lc);
+
+    if (st == NULL) {
+        ngx_set_socket_errno(NGX_EAGAIN);
+        return (ngx_socket_t) -1;
+    }
+
+    if (st->first == st->last) {
+        err = st->error;
+
+        if (err == 0) {
+            ngx_set_socket_errno(NGX_EAGAIN);
+            return (ngx_socket_t) -1;
+        }
+
+        /* the multishot accept stopped on the error, arm it again */
+
+        st->error = 0;
+
+        if (!st->recv && ev->active
+            && ngx_iouring_recv_add(lc, st) == NGX_OK
+            && ngx_iouring_poll_set(lc, st->events,
+                                    ngx_iouring_events(lc, st))
+               == NGX_OK)
+        {
+            st->events = ngx_iouring_events(lc, st);
+        }
+
+        ngx_set_socket_errno(err);
+        return (ngx_socket_t) -1;
+    }
+
+    s = st->accepted[st->first++];
+
+    if (st->first == st->last) {
+        st->first = 0;
+        st->last = 0;
+
+    } else {
+        ev->available = 1;
+    }
+
+    if (getpeername(s, sa, socklen) == -1) {
+        err = ngx_socket_errno;
+
+        (void) ngx_close_socket(s);
+
+        ngx_set_socket_errno(err == NGX_ENOTCONN ? NGX_ECONNABORTED : err);
+        return (ngx_socket_t) -1;
+    }
+
+    return s;
+}
+
+
+static void
+ngx_iouring_buffer_free(uint16_t bid)
+{
+    struct io_uring_buf  *buf;
+
+    /* the fields are set one by one, as the first entry overlays the tail */
+
+    buf = &bufs.ring->bufs[bufs.tail & bufs.mask];
+
+    buf->addr = (uintptr_t) (bufs.start + (size_t) bid * bufs.size);
+    buf->len = bufs.size;
+    buf->bid = bid;
+
+    bufs.tail++;
+    __atomic_store_n(&bufs.ring->tail, bufs.tail, __ATOMIC_RELEASE);
+
+    bufs.free++;
+}
+
+
+static size_t
+ngx_iouring_recv_copy(ngx_iouring_conn_t *st, u_char *buf, size_t size)
+{
+    size_t    n, copied;
+    uint16_t  bid;
+
+    copied = 0;
+
+    while (st->nbufs && copied < size) {
+        bid = st->head;
+
+        n = ngx_min(bufs.len[bid] - st->offset, size - copied);
+
+        buf = ngx_cpymem(buf, bufs.start + (size_t) bid * bufs.size
+                              + st->offset, n);
+
+        copied += n;
+        st->offset += n;
+
+        if (st->offset == bufs.len[bid]) {
+            st->head = bufs.next[bid];
+            st->nbufs--;
+            st->offset = 0;
+
+            ngx_iouring_buffer_free(bid);
+        }
+    }
+
+    return copied;
+}
+
+
+/*
+ * the result of a read when no received data are left: the stored end
+ * of the stream, or NGX_DECLINED if the socket has to be read directly
+ */
+
+static ssize_t
+ngx_iouring_recv_state(ngx_connection_t *c, ngx_iouring_conn_t *st)
+{
+    ngx_event_t  *rev;
+
+    rev = c->read;
+
+    if (st->error) {
+        rev->ready = 0;
+        rev->error = 1;
+
+        ngx_connection_error(c, st->error, "recv() failed");
+        return NGX_ERROR;
+    }
+
+    if (st->eof) {
+        rev->ready = 0;
+        rev->eof = 1;
+
+        return 0;
+    }
+
+    if (st->recv && !st->closed) {
+        rev->ready = 0;
+        rev->available = 0;
+
+        return NGX_AGAIN;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_iouring_recv_ready(ngx_event_t *rev, ngx_iouring_conn_t *st)
+{
+    if (st->nbufs || st->eof || st->error) {
+        return;
+    }
+
+    if (st->recv && !st->closed) {
+        rev->ready = 0;
+        rev->available = 0;
+        return;
+    }
+
+    /* the recv was cancelled or ran out of buffers, more may be left */
+
+    rev->available = 1;
+}
+
+
+static ssize_t
+ngx_iouring_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ssize_t              n;
+    ngx_iouring_conn_t  *st;
+
+    st = ngx_iouring_client(c);
+
+    if (st == NULL || bufs.ring == NULL) {
+        return ngx_os_io.recv(c, buf, size);
+    }
+
+    if (st->nbufs) {
+        n = ngx_iouring_recv_copy(st, buf, size);
+
+        ngx_iouring_recv_ready(c->read, st);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "io_uring recv: fd:%d %z of %uz", c->fd, n, size);
+
+        return n;
+    }
+
+    n = ngx_iouring_recv_state(c, st);
+
+    if (n != NGX_DECLINED) {
+        return n;
+    }
+
+    n = ngx_os_io.recv(c, buf, size);
+
+    if (n == NGX_AGAIN || (n > 0 && (size_t) n < size)) {
+        ngx_iouring_recv_start(c, st);
+    }
+
+    return n;
+}
+
+
+static ssize_t
+ngx_iouring_recv_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    off_t                size, total;
+    ssize_t              n;
+    ngx_chain_t         *cl;
+    ngx_iouring_conn_t  *st;
+
+    st = ngx_iouring_client(c);
+
+    if (st == NULL || bufs.ring == NULL) {
+        return ngx_os_io.recv_chain(c, in, limit);
+    }
+
+    if (limit == 0 || limit > (off_t) NGX_MAX_SIZE_T_VALUE) {
+        limit = NGX_MAX_SIZE_T_VALUE;
+    }
+
+    total = 0;
+
+    if (st->nbufs == 0) {
+        n = ngx_iouring_recv_state(c, st);
+
+        if (n != NGX_DECLINED) {
+            return n;
+        }
+
+        for (cl = in; cl && total < limit; cl = cl->next) {
+            total += cl->buf->end - cl->buf->last;
+        }
+
+        n = ngx_os_io.recv_chain(c, in, limit);
+
+        if (n == NGX_AGAIN || (n > 0 && n < ngx_min(total, limit))) {
+            ngx_iouring_recv_start(c, st);
+        }
+
+        return n;
+    }
+
+    for (cl = in; cl && st->nbufs && total < limit; cl = cl->next) {
+        size = ngx_min(cl->buf->end - cl->buf->last, limit - total);
+        total += ngx_iouring_recv_copy(st, cl->buf->last, (size_t) size);
+    }
+
+    ngx_iouring_recv_ready(c->read, st);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv chain: fd:%d %O", c->fd, total);
+
+    return total;
+}
+
+
+static ngx_iouring_send_t *
+ngx_iouring_send_get(ngx_connection_t *c, ngx_iouring_conn_t *st)
+{
+    ngx_iouring_send_t  *ss;
+
+    if (st->send) {
+        return st->send;
+    }
+
+    ss = free_sends;
+
+    if (ss) {
+        free_sends = ss->next;
+        nfree_sends--;
+
+    } else {
+        ss = ngx_alloc(sizeof(ngx_iouring_send_t) + send_size, c->log);
+        if (ss == NULL) {
+            return NULL;
+        }
+
+        ngx_memzero(ss, sizeof(ngx_iouring_send_t));
+
+        ss->start = (u_char *) ss + sizeof(ngx_iouring_send_t);
+        ss->end = ss->start + send_size;
+
+        ss->event.handler = ngx_iouring_send_timeout;
+        ss->event.data = ss;
+        ss->event.log = ngx_cycle->log;
+        ss->event.cancelable = 1;
+    }
+
+    ss->connection = c;
+    ss->pos = ss->start;
+    ss->last = ss->start;
+    ss->file = NULL;
+    ss->read = 0;
+    ss->error = 0;
+
+    st->send = ss;
+
+    return ss;
+}
+
+
+static void
+ngx_iouring_send_free(ngx_iouring_send_t *ss)
+{
+    if (ss->event.timer_set) {
+        ngx_del_timer(&ss->event);
+    }
+
+    if (nfree_sends < NGX_IOURING_SEND_FREE) {
+        ss->next = free_sends;
+        free_sends = ss;
+        nfree_sends++;
+        return;
+    }
+
+    ngx_free(ss);
+}
+
+
+/*
+ * the send in flight is completed after close() like the data in the socket
+ * buffer, but it is cancelled if the peer does not read them for too long
+ */
+
+static void
+ngx_iouring_send_close(ngx_iouring_send_t *ss)
+{
+    if (!ss->sending && !ss->reading) {
+        ngx_iouring_send_free(ss);
+        return;
+    }
+
+    ss->connection = NULL;
+
+    ngx_add_timer(&ss->event, NGX_IOURING_SEND_LINGER);
+}
+
+
+static void
+ngx_iouring_send_timeout(ngx_event_t *ev)
+{
+    ngx_iouring_send_t  *ss;
+
+    ss = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring send timed out: %p", ss);
+
+    (void) ngx_iouring_cancel(ev->log, (uintptr_t) ss | NGX_IOURING_SEND);
+    (void) ngx_iouring_cancel(ev->log, (uintptr_t) ss | NGX_IOURING_READ);
+}
+
+
+static ngx_int_t
+ngx_iouring_send_start(ngx_iouring_send_t *ss)
+{
+    ngx_connection_t     *c;
+    struct io_uring_sqe  *sqe;
+
+    if (ss->sending || ss->pos == ss->last) {
+        return NGX_OK;
+    }
+
+    c = ss->connection;
+
+    sqe = ngx_iouring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (uintptr_t) ss->pos;
+    sqe->len = ss->last - ss->pos;
+    sqe->msg_flags = MSG_NOSIGNAL|MSG_WAITALL;
+    sqe->user_data = (uintptr_t) ss | NGX_IOURING_SEND;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring send: fd:%d %uz", c->fd, (size_t) sqe->len);
+
+    ss->sending = 1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * updates c->buffered after the buffer was changed and releases the buffer
+ * once it is written and no file read is left to account for
+ */
+
+static void
+ngx_iouring_send_done(ngx_iouring_send_t *ss)
+{
+    ngx_connection_t  *c;
+
+    c = ss->connection;
+
+    /* an error is kept buffered to be returned by the next call */
+
+    if (ss->pos < ss->last || ss->sending || ss->reading || ss->error) {
+        c->buffered |= NGX_IOURING_BUFFERED;
+        return;
+    }
+
+    ss->pos = ss->start;
+    ss->last = ss->start;
+
+    c->buffered &= ~NGX_IOURING_BUFFERED;
+
+    if (ss->file == NULL && ss->error == 0) {
+        ngx_iouring_conn(c)->send = NULL;
+        ngx_iouring_send_free(ss);
+    }
+}
+
+
+static void
+ngx_iouring_send_event(ngx_iouring_send_t *ss, ngx_uint_t read, int32_t res,
+    ngx_uint_t flags)
+{
+    ngx_event_t       *wev;
+    ngx_connection_t  *c;
+
+    c = ss->connection;
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                   "io_uring %s event: %p c:%p res:%d",
+                   read ? "read" : "send", ss, c, res);
+
+    if (read) {
+        ss->reading = 0;
+        ss->read = res;
+
+        if (res > 0 && c) {
+            ss->last += res;
+        }
+
+    } else {
+        ss->sending = 0;
+
+        if (res > 0) {
+            ss->pos += res;
+
+        } else if (res < 0) {
+            ss->error = -res;
+            ss->pos = ss->last;
+        }
+    }
+
+    if (c == NULL) {
+
+        /* a closed connection does not send the rest of the buffer */
+
+        if (!ss->sending && !ss->reading) {
+            ngx_iouring_send_free(ss);
+        }
+
+        return;
+    }
+
+    if (ss->error == 0 && ngx_iouring_send_start(ss) != NGX_OK) {
+        ss->error = ngx_errno;
+        ss->pos = ss->last;
+    }
+
+    ngx_iouring_send_done(ss);
+
+    wev = c->write;
+    wev->ready = 1;
+
+    if (!wev->active) {
+        return;
+    }
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(wev, &ngx_posted_events);
+
+    } else {
+        wev->handler(wev);
+    }
+}
+
+
+static ssize_t
+ngx_iouring_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t               n;
+    ngx_event_t         *wev;
+    ngx_iouring_conn_t  *st;
+    ngx_iouring_send_t  *ss;
+
+    st = ngx_iouring_client(c);
+
+    if (st == NULL || send_size == 0) {
+        return ngx_os_io.send(c, buf, size);
+    }
+
+    ss = ngx_iouring_send_get(c, st);
+    if (ss == NULL) {
+        return NGX_ERROR;
+    }
+
+    wev = c->write;
+
+    if (ss->error) {
+        wev->error = 1;
+        ngx_connection_error(c, ss->error, "send() failed");
+        return NGX_ERROR;
+    }
+
+    n = ss->reading ? 0 : ngx_min(size, (size_t) (ss->end - ss->last));
+
+    if (n < size) {
+        wev->ready = 0;
+
+        if (n == 0) {
+            return NGX_AGAIN;
+        }
+    }
+
+    ss->last = ngx_cpymem(ss->last, buf, n);
+    c->sent += n;
+
+    if (ngx_iouring_send_start(ss) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_iouring_send_done(ss);
+
+    return n;
+}
+
+
+/*
+ * copies the memory buffers of the chain and reads the file ones into
+ * the connection buffer; file data are reported as sent on the next call,
+ * after their read is completed, as the file must stay open till then
+ */
+
+static ngx_chain_t *
+ngx_iouring_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    off_t                 send, size;
+    ngx_buf_t            *b;
+    ngx_event_t          *wev;
+    ngx_iouring_conn_t   *st;
+    ngx_iouring_send_t   *ss;
+    struct io_uring_sqe  *sqe;
+
+    st = ngx_iouring_client(c);
+
+    if (st == NULL || send_size == 0) {
+        return ngx_os_io.send_chain(c, in, limit);
+    }
+
+    ss = ngx_iouring_send_get(c, st);
+    if (ss == NULL) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    wev = c->write;
+
+    if (ss->error) {
+        wev->error = 1;
+        ngx_connection_error(c, ss->error, "send() failed");
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (ss->reading) {
+        wev->ready = 0;
+        return in;
+    }
+
+    /* the same limit as in ngx_linux_sendfile_chain() */
+
+    if (limit == 0 || limit > (off_t) (NGX_MAX_SIZE_T_VALUE - ngx_pagesize)) {
+        limit = NGX_MAX_SIZE_T_VALUE - ngx_pagesize;
+    }
+
+    send = 0;
+
+    if (ss->file) {
+        b = ss->file;
+        ss->file = NULL;
+
+        if (ss->read == 0) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                          "file \"%s\" was truncated at %O",
+                          b->file->name.data, b->file_pos);
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (ss->read < 0) {
+            ngx_log_error(NGX_LOG_CRIT, c->log, -ss->read,
+                          "read() \"%s\" failed", b->file->name.data);
+            return NGX_CHAIN_ERROR;
+        }
+
+        send = ss->read;
+        c->sent += send;
+
+        in = ngx_chain_update_sent(in, send);
+    }
+
+    while (in && send < limit) {
+        b = in->buf;
+
+        if (ngx_buf_special(b) || ngx_buf_size(b) == 0) {
+            in = in->next;
+            continue;
+        }
+
+        size = ngx_min(ngx_buf_size(b), ss->end - ss->last);
+        size = ngx_min(size, limit - send);
+
+        if (size == 0) {
+            break;
+        }
+
+        if (ngx_buf_in_memory(b)) {
+            ss->last = ngx_cpymem(ss->last, b->pos, (size_t) size);
+
+            send += size;
+            c->sent += size;
+
+            in = ngx_chain_update_sent(in, size);
+
+            continue;
+        }
+
+        sqe = ngx_iouring_get_sqe(c->log);
+        if (sqe == NULL) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = b->file->fd;
+        sqe->addr = (uintptr_t) ss->last;
+        sqe->len = (uint32_t) size;
+        sqe->off = b->file_pos;
+        sqe->user_data = (uintptr_t) ss | NGX_IOURING_READ;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "io_uring read: \"%s\" %O@%O",
+                       b->file->name.data, size, b->file_pos);
+
+        ss->reading = 1;
+        ss->file = b;
+
+        break;
+    }
+
+    /* the data before a file read are sent together with the file data */
+
+    if (!ss->reading && ngx_iouring_send_start(ss) != NGX_OK) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    ngx_iouring_send_done(ss);
+
+    if (c->buffered & NGX_IOURING_BUFFERED) {
+        wev->ready = 0;
+    }
+
+    return in;
+}
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+/*
+ * queues a read for ngx_file_aio_read(); the completion is posted like
+ * a native AIO one, and page cache misses are served by the kernel
+ * io_uring workers instead of blocking the worker process
+ */
+
+ngx_int_t
+ngx_iouring_aio_read(ngx_event_aio_t *aio, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_iouring_get_sqe(aio->event.log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = aio->fd;
+    sqe->addr = (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uintptr_t) &aio->event | NGX_IOURING_AIO;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static void *
+ngx_iouring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_iouring_conf_t  *iocf;
+
+    iocf = ngx_palloc(cycle->pool, sizeof(ngx_iouring_conf_t));
+    if (iocf == NULL) {
+        return NULL;
+    }
+
+    iocf->entries = NGX_CONF_UNSET;
+    iocf->buffers.num = 0;
+    iocf->send_buffer = NGX_CONF_UNSET_SIZE;
+
+    return iocf;
+}
+
+
+static char *
+ngx_iouring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_iouring_conf_t *iocf = conf;
+
+    ngx_conf_init_uint_value(iocf->entries, 1024);
+
+    if (iocf->buffers.num == 0) {
+        iocf->buffers.num = 1024;
+        iocf->buffers.size = 4096;
+    }
+
+    if (iocf->buffers.num > 32768
+        || (iocf->buffers.num & (iocf->buffers.num - 1)))
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "the number of \"io_uring_buffers\" must be "
+                      "a power of two not greater than 32768");
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_init_size_value(iocf->send_buffer, 65536);
+
+    return NGX_CONF_OK;
+}
@@ -18,6 +18,13 @@ static void ngx_debug_accepted_connection(ngx_event_conf_t *ecf,
     ngx_connection_t *c);
 #endif
 
+#if (NGX_HAVE_IOURING)
+extern ngx_uint_t  ngx_iouring_accept_events;
+
+ngx_socket_t ngx_iouring_accept(ngx_event_t *ev, struct sockaddr *sa,
+    socklen_t *socklen);
+#endif
+
 
 void
 ngx_event_accept(ngx_event_t *ev)
@@ -60,7 +67,16 @@ ngx_event_accept(ngx_event_t *ev)
     do {
         socklen = sizeof(ngx_sockaddr_t);
 
-#if (NGX_HAVE_ACCEPT4)
+#if (NGX_HAVE_IOURING)
+        if (ngx_iouring_accept_events) {
+            s = ngx_iouring_accept(ev, &sa.sockaddr, &socklen);
+
+        } else if (use_accept4) {
+            s = accept4(lc->fd, &sa.sockaddr, &socklen, SOCK_NONBLOCK);
+        } else {
+            s = accept(lc->fd, &sa.sockaddr, &socklen);
+        }
+#elif (NGX_HAVE_ACCEPT4)
         if (use_accept4) {
             s = accept4(lc->fd, &sa.sockaddr, &socklen, SOCK_NONBLOCK);
         } else {
@@ -10,9 +10,47 @@
 #include <ngx_event.h>
 
 
+/*
+ * a hierarchical timing wheel, "timer_wheel on": NGX_TIMER_WHEEL_LEVELS
+ * levels of 64 slots, a slot of level n spans 64^n milliseconds; a timer is
+ * kept in the level its distance from the wheel time falls into, in the slot
+ * of the matching bits of its key, and moves down a level when the wheel
+ * time reaches the slot; the rbtree node of an event is reused, left and
+ * right link the slot list and parent points to the slot head
+ */
+
+#define NGX_TIMER_WHEEL_BITS     6
+#define NGX_TIMER_WHEEL_SIZE     (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK     (NGX_TIMER_WHEEL_SIZE - 1)
+#define NGX_TIMER_WHEEL_LEVELS   6
+
+/* the timers beyond about 795 days are moved down from the last level */
+
+#define NGX_TIMER_WHEEL_MAX                                                   \
+    (((ngx_msec_t) 1 << (NGX_TIMER_WHEEL_BITS * NGX_TIMER_WHEEL_LEVELS)) - 1)
+
+
+typedef struct {
+    ngx_msec_t          current;
+    ngx_uint_t          count;
+    uint64_t            bitmap[NGX_TIMER_WHEEL_LEVELS];
+    ngx_rbtree_node_t   slots[NGX_TIMER_WHEEL_LEVELS][NGX_TIMER_WHEEL_SIZE];
+} ngx_event_timer_wheel_t;
+
+
+static void ngx_event_timer_wheel_init(void);
+static ngx_msec_t ngx_event_timer_wheel_find(void);
+static void ngx_event_timer_wheel_expire(void);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t level);
+static ngx_uint_t ngx_event_timer_wheel_next(uint64_t bitmap, ngx_uint_t from);
+
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+ngx_uint_t                        ngx_event_timer_wheel;
+static ngx_event_timer_wheel_t    ngx_timer_wheel;
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -25,6 +63,10 @@ ngx_event_timer_init(ngx_log_t *log)
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_init();
+    }
+
     return NGX_OK;
 }
 
@@ -35,6 +77,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_find();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -56,6 +102,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_expire();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -99,8 +150,30 @@ ngx_event_expire_timers(void)
 ngx_int_t
 ngx_event_no_timers_left(void)
 {
+    ngx_uint_t          level, slot;
     ngx_event_t        *ev;
-    ngx_rbtree_node_t  *node, *root, *sentinel;
+    ngx_rbtree_node_t  *node, *root, *sentinel, *head;
+
+    if (ngx_event_timer_wheel) {
+
+        for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+            for (slot = 0; slot < NGX_TIMER_WHEEL_SIZE; slot++) {
+
+                head = &ngx_timer_wheel.slots[level][slot];
+
+                for (node = head->right; node != head; node = node->right) {
+                    ev = (ngx_event_t *)
+                             ((char *) node - offsetof(ngx_event_t, timer));
+
+                    if (!ev->cancelable) {
+                        return NGX_AGAIN;
+                    }
+                }
+            }
+        }
+
+        return NGX_OK;
+    }
 
     sentinel = ngx_event_timer_rbtree.sentinel;
     root = ngx_event_timer_rbtree.root;
@@ -124,3 +197,291 @@ ngx_event_no_timers_left(void)
 
     return NGX_OK;
 }
+
+
+static void
+ngx_event_timer_wheel_init(void)
+{
+    ngx_uint_t          level, slot;
+    ngx_rbtree_node_t  *head;
+
+    ngx_timer_wheel.current = ngx_current_msec;
+    ngx_timer_wheel.count = 0;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        ngx_timer_wheel.bitmap[level] = 0;
+
+        for (slot = 0; slot < NGX_TIMER_WHEEL_SIZE; slot++) {
+            head = &ngx_timer_wheel.slots[level][slot];
+            head->left = head;
+            head->right = head;
+        }
+    }
+}
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_msec_t          key, delta;
+    ngx_uint_t          level, slot;
+    ngx_rbtree_node_t  *head;
+
+    key = node->key;
+    delta = key - ngx_timer_wheel.current;
+
+    if ((ngx_msec_int_t) delta < 0) {
+
+        /* already expired, goes to the slot handled by the next expiry */
+
+        key = ngx_timer_wheel.current;
+        delta = 0;
+
+    } else if (delta > NGX_TIMER_WHEEL_MAX) {
+        key = ngx_timer_wheel.current + NGX_TIMER_WHEEL_MAX;
+        delta = NGX_TIMER_WHEEL_MAX;
+    }
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta < (ngx_msec_t) 1 << (NGX_TIMER_WHEEL_BITS * (level + 1))) {
+            break;
+        }
+    }
+
+    slot = (key >> (NGX_TIMER_WHEEL_BITS * level)) & NGX_TIMER_WHEEL_MASK;
+
+    head = &ngx_timer_wheel.slots[level][slot];
+
+    node->parent = head;
+    node->left = head->left;
+    node->right = head;
+    head->left->right = node;
+    head->left = node;
+
+    ngx_timer_wheel.bitmap[level] |= (uint64_t) 1 << slot;
+    ngx_timer_wheel.count++;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          n;
+    ngx_rbtree_node_t  *head;
+
+    head = node->parent;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    if (head->right == head) {
+        n = head - &ngx_timer_wheel.slots[0][0];
+
+        ngx_timer_wheel.bitmap[n / NGX_TIMER_WHEEL_SIZE] &=
+                          ~((uint64_t) 1 << (n % NGX_TIMER_WHEEL_SIZE));
+    }
+
+    ngx_timer_wheel.count--;
+}
+
+
+/*
+ * the time of the nearest non-empty slot; a slot above the first level
+ * is only a lower bound for its timers, so the next call after the slot
+ * is moved down gives a closer value
+ */
+
+static ngx_msec_t
+ngx_event_timer_wheel_find(void)
+{
+    ngx_msec_t      current, base, time, min;
+    ngx_uint_t      level, shift, index, slot;
+    ngx_msec_int_t  timer;
+
+    if (ngx_timer_wheel.count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    current = ngx_timer_wheel.current;
+    min = NGX_TIMER_INFINITE;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+
+        if (ngx_timer_wheel.bitmap[level] == 0) {
+            continue;
+        }
+
+        shift = NGX_TIMER_WHEEL_BITS * level;
+        index = (current >> shift) & NGX_TIMER_WHEEL_MASK;
+
+        /*
+         * the current slot of the first level may still get expired timers,
+         * the current slots of the others have already been moved down
+         */
+
+        if (level > 0) {
+            index = (index + 1) & NGX_TIMER_WHEEL_MASK;
+        }
+
+        slot = ngx_event_timer_wheel_next(ngx_timer_wheel.bitmap[level],
+                                          index);
+
+        base = current & ~(((ngx_msec_t) 1 << (shift + NGX_TIMER_WHEEL_BITS))
+                           - 1);
+        time = base + ((ngx_msec_t) slot << shift);
+
+        if ((ngx_msec_int_t) (time - current) < 0
+            || (level > 0 && time == current))
+        {
+            time += (ngx_msec_t) 1 << (shift + NGX_TIMER_WHEEL_BITS);
+        }
+
+        if (min == NGX_TIMER_INFINITE
+            || (ngx_msec_int_t) (time - min) < 0)
+        {
+            min = time;
+        }
+    }
+
+    timer = (ngx_msec_int_t) (min - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static void
+ngx_event_timer_wheel_expire(void)
+{
+    ngx_msec_t          next;
+    ngx_uint_t          index, level;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *head, *node;
+
+    if ((ngx_msec_int_t) (ngx_current_msec - ngx_timer_wheel.current) < 0) {
+        return;
+    }
+
+    for ( ;; ) {
+        index = ngx_timer_wheel.current & NGX_TIMER_WHEEL_MASK;
+
+        if (index == 0) {
+            for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+                ngx_event_timer_wheel_cascade(level);
+
+                if ((ngx_timer_wheel.current
+                     >> (NGX_TIMER_WHEEL_BITS * level))
+                    & NGX_TIMER_WHEEL_MASK)
+                {
+                    break;
+                }
+            }
+        }
+
+        head = &ngx_timer_wheel.slots[0][index];
+
+        /* the handlers may add already expired timers to the same slot */
+
+        while (head->right != head) {
+            node = head->right;
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_delete(node);
+
+#if (NGX_DEBUG)
+            ev->timer.left = NULL;
+            ev->timer.right = NULL;
+            ev->timer.parent = NULL;
+#endif
+
+            ev->timer_set = 0;
+
+            ev->timedout = 1;
+
+            ev->handler(ev);
+        }
+
+        if (ngx_timer_wheel.current == ngx_current_msec) {
+            return;
+        }
+
+        /* skip the empty slots up to the next one or to the next round */
+
+        if (index < NGX_TIMER_WHEEL_MASK
+            && (ngx_timer_wheel.bitmap[0] >> (index + 1)))
+        {
+            next = ngx_timer_wheel.current + 1
+                   + ngx_event_timer_wheel_next(
+                                   ngx_timer_wheel.bitmap[0] >> (index + 1), 0);
+
+        } else {
+            next = ngx_timer_wheel.current - index + NGX_TIMER_WHEEL_SIZE;
+        }
+
+        if ((ngx_msec_int_t) (next - ngx_current_msec) > 0) {
+            ngx_timer_wheel.current = ngx_current_msec;
+            return;
+        }
+
+        ngx_timer_wheel.current = next;
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t level)
+{
+    ngx_uint_t          slot;
+    ngx_rbtree_node_t  *head, *node, *next;
+
+    slot = (ngx_timer_wheel.current >> (NGX_TIMER_WHEEL_BITS * level))
+           & NGX_TIMER_WHEEL_MASK;
+
+    if (!(ngx_timer_wheel.bitmap[level] & ((uint64_t) 1 << slot))) {
+        return;
+    }
+
+    head = &ngx_timer_wheel.slots[level][slot];
+
+    node = head->right;
+
+    head->left->right = NULL;
+    head->left = head;
+    head->right = head;
+
+    ngx_timer_wheel.bitmap[level] &= ~((uint64_t) 1 << slot);
+
+    while (node) {
+        next = node->right;
+
+        ngx_timer_wheel.count--;
+        ngx_event_timer_wheel_insert(node);
+
+        node = next;
+    }
+}
+
+
+/* the offset of the first set bit at or after "from", wrapping around */
+
+static ngx_uint_t
+ngx_event_timer_wheel_next(uint64_t bitmap, ngx_uint_t from)
+{
+    static u_char  debruijn[64] = {
+        0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6
+    };
+
+    if (from) {
+        bitmap = (bitmap >> from) | (bitmap << (64 - from));
+    }
+
+    return (from + debruijn[((bitmap & -bitmap) * 0x03f79d71b4cb0a89ULL) >> 58])
+           & NGX_TIMER_WHEEL_MASK;
+}
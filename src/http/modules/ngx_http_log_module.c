@@ -44,6 +44,43 @@ typedef struct {
 } ngx_http_log_main_conf_t;
 
 
+#if (NGX_THREADS)
+
+/*
+ * the buffer of an "async" log is a ring: the worker formats entries
+ * at head, and a thread pool task writes out everything up to head and
+ * moves tail; each counter is changed by one side only
+ *
+ * the task writes to the descriptor the file had when the task was posted;
+ * if the file is flushed before reopen while the task runs, the file gets
+ * a copy of the descriptor, and the task completion handler closes the
+ * original
+ */
+
+typedef struct {
+    ngx_open_file_t            *file;
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *task;
+    ngx_fd_t                    fd;
+
+    ngx_atomic_t                head;
+    ngx_atomic_t                tail;
+    ngx_atomic_t                active;
+
+    /* set by the thread, reported by the worker */
+    ngx_err_t                   err;
+    size_t                      lost;
+
+    ngx_uint_t                  dropped;
+    time_t                      dropped_time;
+
+    unsigned                    drop:1;
+    unsigned                    detached:1;
+} ngx_http_log_async_t;
+
+#endif
+
+
 typedef struct {
     u_char                     *start;
     u_char                     *pos;
@@ -52,6 +89,10 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+
+#if (NGX_THREADS)
+    ngx_http_log_async_t       *async;
+#endif
 } ngx_http_log_buf_t;
 
 
@@ -106,6 +147,20 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+#if (NGX_THREADS)
+static void ngx_http_log_async_write(ngx_http_request_t *r,
+    ngx_http_log_t *log, ngx_http_log_buf_t *buffer, size_t len);
+static void ngx_http_log_async_post(ngx_http_log_buf_t *buffer);
+static void ngx_http_log_async_flush(ngx_http_log_buf_t *buffer,
+    ngx_log_t *log);
+static void ngx_http_log_async_thread(void *data, ngx_log_t *log);
+static void ngx_http_log_async_drain(ngx_http_log_buf_t *buffer, ngx_fd_t fd,
+    ngx_log_t *log);
+static void ngx_http_log_async_handler(ngx_event_t *ev);
+static void ngx_http_log_async_report(ngx_http_log_buf_t *buffer,
+    ngx_log_t *log);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -316,6 +371,13 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         if (buffer) {
 
+#if (NGX_THREADS)
+            if (buffer->async) {
+                ngx_http_log_async_write(r, &log[l], buffer, len);
+                continue;
+            }
+#endif
+
             if (len > (size_t) (buffer->last - buffer->pos)) {
 
                 ngx_http_log_write(r, &log[l], buffer->start,
@@ -715,6 +777,13 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 
     buffer = file->data;
 
+#if (NGX_THREADS)
+    if (buffer->async) {
+        ngx_http_log_async_flush(buffer, log);
+        return;
+    }
+#endif
+
     len = buffer->pos - buffer->start;
 
     if (len == 0) {
@@ -753,13 +822,398 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 static void
 ngx_http_log_flush_handler(ngx_event_t *ev)
 {
+#if (NGX_THREADS)
+    ngx_open_file_t     *file;
+    ngx_http_log_buf_t  *buffer;
+#endif
+
     ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "http log buffer flush handler");
 
+#if (NGX_THREADS)
+    file = ev->data;
+    buffer = file->data;
+
+    if (buffer->async) {
+        ngx_http_log_async_post(buffer);
+        return;
+    }
+#endif
+
     ngx_http_log_flush(ev->data, ev->log);
 }
 
 
+#if (NGX_THREADS)
+
+static void
+ngx_http_log_async_write(ngx_http_request_t *r, ngx_http_log_t *log,
+    ngx_http_log_buf_t *buffer, size_t len)
+{
+    u_char                *line, *p, *start;
+    size_t                 size, pos, n;
+    ngx_uint_t             i;
+    ngx_atomic_uint_t      head;
+    ngx_http_log_op_t     *op;
+    ngx_http_log_async_t  *async;
+
+    async = buffer->async;
+    size = buffer->last - buffer->start;
+
+    if (len > size - (async->head - async->tail)) {
+
+        ngx_http_log_async_post(buffer);
+
+        if (async->drop) {
+            async->dropped++;
+            return;
+        }
+
+        if (async->active) {
+
+            /*
+             * the thread is busy writing out the ring, so the entry is
+             * written here, ahead of the entries still in the ring
+             */
+
+            goto alloc_line;
+        }
+
+        /*
+         * the thread is not running, and the entries added since
+         * it finished are written out here
+         */
+
+        ngx_http_log_async_drain(buffer, async->file->fd, r->connection->log);
+        ngx_http_log_async_report(buffer, r->connection->log);
+
+        if (len > size) {
+            goto alloc_line;
+        }
+    }
+
+    head = async->head;
+    pos = head % size;
+    op = log->format->ops->elts;
+
+    if (len <= size - pos) {
+
+        /* the common case, the entry is formatted in place */
+
+        start = buffer->start + pos;
+        p = start;
+
+        for (i = 0; i < log->format->ops->nelts; i++) {
+            p = op[i].run(r, p, &op[i]);
+        }
+
+        ngx_linefeed(p);
+
+        n = p - start;
+
+    } else {
+
+        line = ngx_pnalloc(r->pool, len);
+        if (line == NULL) {
+            return;
+        }
+
+        p = line;
+
+        for (i = 0; i < log->format->ops->nelts; i++) {
+            p = op[i].run(r, p, &op[i]);
+        }
+
+        ngx_linefeed(p);
+
+        n = p - line;
+
+        if (n <= size - pos) {
+            ngx_memcpy(buffer->start + pos, line, n);
+
+        } else {
+            ngx_memcpy(buffer->start + pos, line, size - pos);
+            ngx_memcpy(buffer->start, line + size - pos, n - (size - pos));
+        }
+    }
+
+    ngx_memory_barrier();
+
+    async->head = head + n;
+
+    if (async->head - async->tail >= size / 4) {
+        ngx_http_log_async_post(buffer);
+
+    } else if (buffer->event && !buffer->event->timer_set) {
+        ngx_add_timer(buffer->event, buffer->flush);
+    }
+
+    return;
+
+alloc_line:
+
+    /* an entry that does not fit the ring is written synchronously */
+
+    line = ngx_pnalloc(r->pool, len);
+    if (line == NULL) {
+        return;
+    }
+
+    p = line;
+    op = log->format->ops->elts;
+
+    for (i = 0; i < log->format->ops->nelts; i++) {
+        p = op[i].run(r, p, &op[i]);
+    }
+
+    ngx_linefeed(p);
+
+    ngx_http_log_write(r, log, line, p - line);
+}
+
+
+static void
+ngx_http_log_async_post(ngx_http_log_buf_t *buffer)
+{
+    ngx_http_log_async_t  *async;
+
+    async = buffer->async;
+
+    if (async->task->event.active || async->head == async->tail) {
+        return;
+    }
+
+    async->active = 1;
+    async->fd = async->file->fd;
+
+    if (ngx_thread_task_post(async->thread_pool, async->task) != NGX_OK) {
+        async->active = 0;
+
+        /* try again later, "block" falls back to writing in the worker */
+
+        if (buffer->event && !buffer->event->timer_set) {
+            ngx_add_timer(buffer->event, buffer->flush);
+        }
+
+        return;
+    }
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+}
+
+
+static void
+ngx_http_log_async_flush(ngx_http_log_buf_t *buffer, ngx_log_t *log)
+{
+    ngx_fd_t               fd;
+    ngx_http_log_async_t  *async;
+
+    async = buffer->async;
+
+    if (async->active) {
+
+        /*
+         * the file descriptor may be closed after return, e.g., on reopen,
+         * so the file gets a copy and the thread keeps the original;
+         * the thread writes out the rest of the ring, and the completion
+         * handler closes the original
+         */
+
+        if (async->detached) {
+            return;
+        }
+
+        fd = dup(async->fd);
+
+        if (fd != NGX_INVALID_FILE) {
+            async->file->fd = fd;
+            async->detached = 1;
+            return;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "dup() \"%s\" failed", async->file->name.data);
+
+        /* the last resort */
+
+        while (async->active) {
+            ngx_sched_yield();
+        }
+    }
+
+    ngx_http_log_async_drain(buffer, async->file->fd, log);
+    ngx_http_log_async_report(buffer, log);
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+}
+
+
+static void
+ngx_http_log_async_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_log_buf_t  *buffer = data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "http log thread handler");
+
+    ngx_http_log_async_drain(buffer, buffer->async->fd, log);
+
+    ngx_memory_barrier();
+
+    buffer->async->active = 0;
+}
+
+
+static void
+ngx_http_log_async_drain(ngx_http_log_buf_t *buffer, ngx_fd_t fd,
+    ngx_log_t *log)
+{
+    size_t                 size, pos, len;
+    ssize_t                n;
+    ngx_uint_t             niov;
+    struct iovec           iov[2];
+    ngx_atomic_uint_t      head, tail;
+    ngx_http_log_async_t  *async;
+#if (NGX_ZLIB)
+    ngx_uint_t             i;
+#endif
+
+    async = buffer->async;
+    size = buffer->last - buffer->start;
+
+    for ( ;; ) {
+
+        head = async->head;
+        tail = async->tail;
+
+        if (head == tail) {
+            return;
+        }
+
+        ngx_memory_barrier();
+
+        len = head - tail;
+        pos = tail % size;
+
+        iov[0].iov_base = buffer->start + pos;
+        iov[0].iov_len = ngx_min(len, size - pos);
+        niov = 1;
+
+        if (len > size - pos) {
+            iov[1].iov_base = buffer->start;
+            iov[1].iov_len = len - (size - pos);
+            niov = 2;
+        }
+
+#if (NGX_ZLIB)
+        if (buffer->gzip) {
+            n = len;
+
+            for (i = 0; i < niov; i++) {
+                if (ngx_http_log_gzip(fd, iov[i].iov_base,
+                                      iov[i].iov_len, buffer->gzip, log)
+                    == -1)
+                {
+                    n = -1;
+                    break;
+                }
+            }
+
+        } else {
+            n = writev(fd, iov, niov);
+        }
+#else
+        n = writev(fd, iov, niov);
+#endif
+
+        if (n == -1) {
+            async->err = ngx_errno;
+            async->lost += len;
+
+        } else if ((size_t) n != len) {
+            async->lost += len - n;
+        }
+
+        ngx_memory_barrier();
+
+        async->tail = head;
+    }
+}
+
+
+static void
+ngx_http_log_async_handler(ngx_event_t *ev)
+{
+    size_t                 size, pending;
+    ngx_http_log_buf_t    *buffer;
+    ngx_http_log_async_t  *async;
+
+    buffer = ev->data;
+    async = buffer->async;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http log thread done");
+
+    if (async->detached) {
+
+        /* the file was flushed while the thread ran, see above */
+
+        if (ngx_close_file(async->fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed",
+                          async->file->name.data);
+        }
+
+        async->detached = 0;
+    }
+
+    ngx_http_log_async_report(buffer, ev->log);
+
+    size = buffer->last - buffer->start;
+    pending = async->head - async->tail;
+
+    if (pending >= size / 4) {
+        ngx_http_log_async_post(buffer);
+
+    } else if (pending && buffer->event && !buffer->event->timer_set) {
+        ngx_add_timer(buffer->event, buffer->flush);
+    }
+}
+
+
+static void
+ngx_http_log_async_report(ngx_http_log_buf_t *buffer, ngx_log_t *log)
+{
+    ngx_http_log_async_t  *async;
+
+    async = buffer->async;
+
+    if (async->lost) {
+        ngx_log_error(NGX_LOG_ALERT, log, async->err,
+                      "%s to \"%s\" failed, %uz bytes lost",
+                      buffer->gzip ? ngx_write_fd_n : "writev()",
+                      async->file->name.data, async->lost);
+
+        async->err = 0;
+        async->lost = 0;
+    }
+
+    if (async->dropped && async->dropped_time != ngx_time()) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "%ui entries dropped, access_log \"%s\" is full",
+                      async->dropped, async->file->name.data);
+
+        async->dropped = 0;
+        async->dropped_time = ngx_time();
+    }
+}
+
+#endif
+
+
 static u_char *
 ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
@@ -1202,6 +1656,12 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_main_conf_t          *lmcf;
     ngx_http_script_compile_t          sc;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_THREADS)
+    ngx_int_t                          drop;
+    ngx_thread_pool_t                 *tp;
+    ngx_thread_task_t                 *task;
+    ngx_http_log_async_t              *async;
+#endif
 
     value = cf->args->elts;
 
@@ -1315,6 +1775,10 @@ process_formats:
     size = 0;
     flush = 0;
     gzip = 0;
+#if (NGX_THREADS)
+    drop = NGX_CONF_UNSET;
+    tp = NULL;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1381,6 +1845,58 @@ process_formats:
 #endif
         }
 
+        if (ngx_strncmp(value[i].data, "async", 5) == 0
+            && (value[i].len == 5 || value[i].data[5] == '='))
+        {
+#if (NGX_THREADS)
+            if (size == 0) {
+                size = 64 * 1024;
+            }
+
+            if (value[i].len == 5) {
+                tp = ngx_thread_pool_add(cf, NULL);
+
+            } else {
+                s.len = value[i].len - 6;
+                s.data = value[i].data + 6;
+
+                tp = ngx_thread_pool_add(cf, &s);
+            }
+
+            if (tp == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"async\" is unsupported on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+#if (NGX_THREADS)
+        if (ngx_strncmp(value[i].data, "overflow=", 9) == 0) {
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            if (ngx_strcmp(s.data, "block") == 0) {
+                drop = 0;
+
+            } else if (ngx_strcmp(s.data, "drop") == 0) {
+                drop = 1;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid overflow \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+#endif
+
         if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
             s.len = value[i].len - 3;
             s.data = value[i].data + 3;
@@ -1416,6 +1932,28 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_THREADS)
+
+    if (tp) {
+        if (drop == NGX_CONF_UNSET) {
+            drop = 0;
+        }
+
+        /* otherwise entries wait until a quarter of the ring is used */
+
+        if (flush == 0) {
+            flush = 1000;
+        }
+
+    } else if (drop != NGX_CONF_UNSET) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"overflow\" requires \"async\" "
+                           "for access_log \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+#endif
+
     if (size) {
 
         if (log->script) {
@@ -1435,7 +1973,12 @@ process_formats:
 
             if (buffer->last - buffer->start != size
                 || buffer->flush != flush
-                || buffer->gzip != gzip)
+                || buffer->gzip != gzip
+#if (NGX_THREADS)
+                || (buffer->async ? buffer->async->thread_pool : NULL) != tp
+                || (tp && buffer->async->drop != (ngx_uint_t) drop)
+#endif
+               )
             {
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                    "access_log \"%V\" already defined "
@@ -1476,6 +2019,33 @@ process_formats:
 
         buffer->gzip = gzip;
 
+#if (NGX_THREADS)
+        if (tp) {
+            async = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_async_t));
+            if (async == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            task = ngx_thread_task_alloc(cf->pool, 0);
+            if (task == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            task->ctx = buffer;
+            task->handler = ngx_http_log_async_thread;
+            task->event.data = buffer;
+            task->event.handler = ngx_http_log_async_handler;
+            task->event.log = &cf->cycle->new_log;
+
+            async->file = log->file;
+            async->thread_pool = tp;
+            async->task = task;
+            async->drop = drop;
+
+            buffer->async = async;
+        }
+#endif
+
         log->file->flush = ngx_http_log_flush;
         log->file->data = buffer;
     }
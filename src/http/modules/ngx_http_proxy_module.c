@@ -12,6 +12,9 @@
 
 typedef struct {
     ngx_array_t                    caches;  /* ngx_http_file_cache_t * */
+#if (NGX_HTTP_V2)
+    ngx_flag_t                     http2;
+#endif
 } ngx_http_proxy_main_conf_t;
 
 
@@ -165,6 +168,7 @@ static ngx_int_t ngx_http_proxy_rewrite(ngx_http_request_t *r,
 
 static ngx_int_t ngx_http_proxy_add_variables(ngx_conf_t *cf);
 static void *ngx_http_proxy_create_main_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_http_proxy_init_module(ngx_cycle_t *cycle);
 static void *ngx_http_proxy_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
@@ -245,6 +249,9 @@ static ngx_conf_bitmask_t  ngx_http_proxy_ssl_protocols[] = {
 static ngx_conf_enum_t  ngx_http_proxy_http_version[] = {
     { ngx_string("1.0"), NGX_HTTP_VERSION_10 },
     { ngx_string("1.1"), NGX_HTTP_VERSION_11 },
+#if (NGX_HTTP_V2)
+    { ngx_string("2"), NGX_HTTP_VERSION_20 },
+#endif
     { ngx_null_string, 0 }
 };
 
@@ -742,7 +749,7 @@ ngx_module_t  ngx_http_proxy_module = {
     ngx_http_proxy_commands,               /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
-    NULL,                                  /* init module */
+    ngx_http_proxy_init_module,            /* init module */
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
@@ -881,6 +888,10 @@ ngx_http_proxy_handler(ngx_http_request_t *r)
 
     u->conf = &plcf->upstream;
 
+#if (NGX_HTTP_V2)
+    u->http2 = (plcf->http_version == NGX_HTTP_VERSION_20);
+#endif
+
 #if (NGX_HTTP_CACHE)
     pmcf = ngx_http_get_module_main_conf(r, ngx_http_proxy_module);
 
@@ -922,7 +933,7 @@ ngx_http_proxy_handler(ngx_http_request_t *r)
     if (!plcf->upstream.request_buffering
         && plcf->body_values == NULL && plcf->upstream.pass_request_body
         && (!r->headers_in.chunked
-            || plcf->http_version == NGX_HTTP_VERSION_11))
+            || plcf->http_version >= NGX_HTTP_VERSION_11))
     {
         r->request_body_no_buffering = 1;
     }
@@ -1353,7 +1364,7 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
 
     u->uri.len = b->last - u->uri.data;
 
-    if (plcf->http_version == NGX_HTTP_VERSION_11) {
+    if (plcf->http_version >= NGX_HTTP_VERSION_11) {
         b->last = ngx_cpymem(b->last, ngx_http_proxy_version_11,
                              sizeof(ngx_http_proxy_version_11) - 1);
 
@@ -1474,7 +1485,9 @@ ngx_http_proxy_create_request(ngx_http_request_t *r)
 
         u->request_bufs = cl;
 
-        if (ctx->internal_chunked) {
+        /* HTTP/2 frames the body itself, the chunked encoding is not used */
+
+        if (ctx->internal_chunked && !u->http2) {
             u->output.output_filter = ngx_http_proxy_body_output_filter;
             u->output.filter_ctx = r;
         }
@@ -1762,15 +1775,19 @@ ngx_http_proxy_process_status_line(ngx_http_request_t *r)
 
     u->headers_in.status_n = ctx->status.code;
 
-    len = ctx->status.end - ctx->status.start;
-    u->headers_in.status_line.len = len;
+    /* HTTP/2 responses have no reason phrase, the standard one is used */
 
-    u->headers_in.status_line.data = ngx_pnalloc(r->pool, len);
-    if (u->headers_in.status_line.data == NULL) {
-        return NGX_ERROR;
-    }
+    if (!u->http2) {
+        len = ctx->status.end - ctx->status.start;
+        u->headers_in.status_line.len = len;
 
-    ngx_memcpy(u->headers_in.status_line.data, ctx->status.start, len);
+        u->headers_in.status_line.data = ngx_pnalloc(r->pool, len);
+        if (u->headers_in.status_line.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(u->headers_in.status_line.data, ctx->status.start, len);
+    }
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http proxy status %ui \"%V\"",
@@ -2808,6 +2825,23 @@ ngx_http_proxy_create_main_conf(ngx_conf_t *cf)
 }
 
 
+static ngx_int_t
+ngx_http_proxy_init_module(ngx_cycle_t *cycle)
+{
+#if (NGX_HTTP_V2)
+    ngx_http_proxy_main_conf_t  *pmcf;
+
+    pmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_proxy_module);
+
+    if (pmcf && pmcf->http2) {
+        return ngx_http_v2_upstream_init(cycle);
+    }
+#endif
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
 {
@@ -2943,6 +2977,9 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_core_loc_conf_t   *clcf;
     ngx_http_proxy_rewrite_t   *pr;
     ngx_http_script_compile_t   sc;
+#if (NGX_HTTP_V2)
+    ngx_http_proxy_main_conf_t *pmcf;
+#endif
 
 #if (NGX_HTTP_CACHE)
 
@@ -3313,6 +3350,13 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
                               NGX_HTTP_VERSION_10);
 
+#if (NGX_HTTP_V2)
+    if (conf->http_version == NGX_HTTP_VERSION_20) {
+        pmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_proxy_module);
+        pmcf->http2 = 1;
+    }
+#endif
+
     ngx_conf_merge_uint_value(conf->headers_hash_max_size,
                               prev->headers_hash_max_size, 512);
 
@@ -0,0 +1,1035 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_CHECK_TCP        1
+#define NGX_HTTP_UPSTREAM_CHECK_HTTP       2
+
+#define NGX_HTTP_UPSTREAM_CHECK_HTTP_2XX   0x0004
+#define NGX_HTTP_UPSTREAM_CHECK_HTTP_3XX   0x0008
+#define NGX_HTTP_UPSTREAM_CHECK_HTTP_4XX   0x0010
+#define NGX_HTTP_UPSTREAM_CHECK_HTTP_5XX   0x0020
+
+#define NGX_HTTP_UPSTREAM_CHECK_BUFFER     256
+
+
+typedef struct {
+    ngx_uint_t                          type;
+    ngx_msec_t                          interval;
+    ngx_msec_t                          timeout;
+    ngx_uint_t                          rise;
+    ngx_uint_t                          fall;
+    in_port_t                           port;
+    ngx_str_t                           send;
+    ngx_uint_t                          expect;
+} ngx_http_upstream_check_srv_conf_t;
+
+
+typedef struct {
+    ngx_event_t                         timer;
+    ngx_log_t                           log;
+    ngx_peer_connection_t               pc;
+    ngx_str_t                          *upstream;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_check_srv_conf_t *conf;
+    ngx_buf_t                          *buffer;
+    size_t                              sent;
+} ngx_http_upstream_check_peer_t;
+
+
+static ngx_int_t ngx_http_upstream_check_add_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_srv_conf_t *uscf,
+    ngx_http_upstream_check_srv_conf_t *ccf);
+static void ngx_http_upstream_check_begin(ngx_event_t *ev);
+static void ngx_http_upstream_check_send_handler(ngx_event_t *wev);
+static void ngx_http_upstream_check_recv_handler(ngx_event_t *rev);
+static ngx_int_t ngx_http_upstream_check_test_connect(ngx_connection_t *c);
+static u_char *ngx_http_upstream_check_log_error(ngx_log_t *log, u_char *buf,
+    size_t len);
+static ngx_uint_t ngx_http_upstream_check_parse_status(ngx_buf_t *b);
+static void ngx_http_upstream_check_done(ngx_http_upstream_check_peer_t *cp,
+    ngx_uint_t alive);
+
+static ngx_int_t ngx_http_upstream_check_status_handler(ngx_http_request_t *r);
+static u_char *ngx_http_upstream_check_status_peers(u_char *p,
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t json);
+
+static ngx_int_t ngx_http_upstream_check_init_process(ngx_cycle_t *cycle);
+static void *ngx_http_upstream_check_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_upstream_check_status(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+
+
+static ngx_conf_bitmask_t  ngx_http_upstream_check_expect_masks[] = {
+    { ngx_string("http_2xx"), NGX_HTTP_UPSTREAM_CHECK_HTTP_2XX },
+    { ngx_string("http_3xx"), NGX_HTTP_UPSTREAM_CHECK_HTTP_3XX },
+    { ngx_string("http_4xx"), NGX_HTTP_UPSTREAM_CHECK_HTTP_4XX },
+    { ngx_string("http_5xx"), NGX_HTTP_UPSTREAM_CHECK_HTTP_5XX },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_command_t  ngx_http_upstream_check_commands[] = {
+
+    { ngx_string("check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_ANY,
+      ngx_http_upstream_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("check_http_send"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_check_srv_conf_t, send),
+      NULL },
+
+    { ngx_string("check_http_expect_alive"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      ngx_conf_set_bitmask_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_check_srv_conf_t, expect),
+      &ngx_http_upstream_check_expect_masks },
+
+    { ngx_string("upstream_check_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_check_status,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_check_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_check_create_conf,   /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_check_module_ctx,   /* module context */
+    ngx_http_upstream_check_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_check_init_process,  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_http_upstream_check_default_send =
+    ngx_string("GET / HTTP/1.0" CRLF CRLF);
+
+
+static ngx_int_t
+ngx_http_upstream_check_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ccf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->peer.data == NULL) {
+            continue;
+        }
+
+        ccf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                              ngx_http_upstream_check_module);
+
+        if (ccf->type == 0) {
+            continue;
+        }
+
+        if (ngx_http_upstream_check_add_peers(cycle, uscfp[i], ccf)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_add_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_check_srv_conf_t *ccf)
+{
+    u_char                          *p;
+    ngx_str_t                       *name;
+    struct sockaddr                 *sockaddr;
+    ngx_http_upstream_rr_peer_t     *peer;
+    ngx_http_upstream_rr_peers_t    *peers;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    if (ccf->send.len == 0) {
+        ccf->send = ngx_http_upstream_check_default_send;
+    }
+
+    if (ccf->expect == 0) {
+        ccf->expect = NGX_HTTP_UPSTREAM_CHECK_HTTP_2XX
+                      |NGX_HTTP_UPSTREAM_CHECK_HTTP_3XX;
+    }
+
+    for (peers = uscf->peer.data; peers; peers = peers->next) {
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+
+            if (peer->down) {
+                continue;
+            }
+
+            cp = ngx_pcalloc(cycle->pool,
+                             sizeof(ngx_http_upstream_check_peer_t));
+            if (cp == NULL) {
+                return NGX_ERROR;
+            }
+
+            cp->log = *cycle->log;
+            cp->log.handler = ngx_http_upstream_check_log_error;
+            cp->log.data = cp;
+
+            cp->upstream = &uscf->host;
+            cp->peers = peers;
+            cp->peer = peer;
+            cp->conf = ccf;
+
+            cp->pc.sockaddr = peer->sockaddr;
+            cp->pc.socklen = peer->socklen;
+            cp->pc.name = &peer->name;
+            cp->pc.get = ngx_event_get_peer;
+            cp->pc.log = &cp->log;
+            cp->pc.log_error = NGX_ERROR_ERR;
+
+            if (ccf->port) {
+                sockaddr = ngx_palloc(cycle->pool, peer->socklen);
+                name = ngx_palloc(cycle->pool, sizeof(ngx_str_t));
+                p = ngx_pnalloc(cycle->pool, NGX_SOCKADDR_STRLEN);
+
+                if (sockaddr == NULL || name == NULL || p == NULL) {
+                    return NGX_ERROR;
+                }
+
+                ngx_memcpy(sockaddr, peer->sockaddr, peer->socklen);
+                ngx_inet_set_port(sockaddr, ccf->port);
+
+                name->len = ngx_sock_ntop(sockaddr, peer->socklen, p,
+                                          NGX_SOCKADDR_STRLEN, 1);
+                name->data = p;
+
+                cp->pc.sockaddr = sockaddr;
+                cp->pc.name = name;
+            }
+
+            if (ccf->type == NGX_HTTP_UPSTREAM_CHECK_HTTP) {
+                cp->buffer = ngx_create_temp_buf(cycle->pool,
+                                              NGX_HTTP_UPSTREAM_CHECK_BUFFER);
+                if (cp->buffer == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            cp->timer.handler = ngx_http_upstream_check_begin;
+            cp->timer.data = cp;
+            cp->timer.log = &cp->log;
+            cp->timer.cancelable = 1;
+
+            /* spread the first checks of the workers over the interval */
+
+            ngx_add_timer(&cp->timer, ngx_random() % ccf->interval);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_check_begin(ngx_event_t *ev)
+{
+    ngx_int_t                        rc;
+    ngx_msec_int_t                   elapsed;
+    ngx_connection_t                *c;
+    ngx_http_upstream_rr_peer_t     *peer;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    cp = ev->data;
+    peer = cp->peer;
+
+    /*
+     * with a zone every worker arms the timer, but only the one that
+     * finds the last check an interval old checks the peer
+     */
+
+    ngx_http_upstream_rr_peer_lock(cp->peers, peer);
+
+    elapsed = (ngx_msec_int_t) (ngx_current_msec - peer->check_time);
+
+    if (peer->check_time
+        && elapsed >= 0
+        && elapsed < (ngx_msec_int_t) cp->conf->interval)
+    {
+        ngx_http_upstream_rr_peer_unlock(cp->peers, peer);
+
+        ngx_add_timer(ev, cp->conf->interval - elapsed);
+        return;
+    }
+
+    peer->check_time = ngx_current_msec;
+
+    ngx_http_upstream_rr_peer_unlock(cp->peers, peer);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "upstream check %V", cp->pc.name);
+
+    cp->sent = 0;
+
+    if (cp->buffer) {
+        cp->buffer->pos = cp->buffer->start;
+        cp->buffer->last = cp->buffer->start;
+    }
+
+    rc = ngx_event_connect_peer(&cp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_check_done(cp, 0);
+        return;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN */
+
+    c = cp->pc.connection;
+
+    c->data = cp;
+    c->read->handler = ngx_http_upstream_check_recv_handler;
+    c->write->handler = ngx_http_upstream_check_send_handler;
+
+    /* the read timer limits the whole check */
+
+    ngx_add_timer(c->read, cp->conf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_check_send_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_send_handler(ngx_event_t *wev)
+{
+    ssize_t                          n;
+    ngx_str_t                       *send;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    c = wev->data;
+    cp = c->data;
+
+    if (ngx_http_upstream_check_test_connect(c) != NGX_OK) {
+        ngx_http_upstream_check_done(cp, 0);
+        return;
+    }
+
+    if (cp->conf->type == NGX_HTTP_UPSTREAM_CHECK_TCP) {
+        ngx_http_upstream_check_done(cp, 1);
+        return;
+    }
+
+    send = &cp->conf->send;
+
+    while (cp->sent < send->len) {
+
+        n = c->send(c, send->data + cp->sent, send->len - cp->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_done(cp, 0);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_check_done(cp, 0);
+            }
+
+            return;
+        }
+
+        cp->sent += n;
+    }
+
+    wev->handler = ngx_http_empty_handler;
+}
+
+
+static void
+ngx_http_upstream_check_recv_handler(ngx_event_t *rev)
+{
+    ssize_t                          n;
+    ngx_buf_t                       *b;
+    ngx_uint_t                       status;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    c = rev->data;
+    cp = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "upstream check timed out");
+        ngx_http_upstream_check_done(cp, 0);
+        return;
+    }
+
+    if (cp->conf->type == NGX_HTTP_UPSTREAM_CHECK_TCP
+        || cp->sent < cp->conf->send.len)
+    {
+        return;
+    }
+
+    b = cp->buffer;
+
+    for ( ;; ) {
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_check_done(cp, 0);
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR || n == 0) {
+            break;
+        }
+
+        b->last += n;
+
+        if (b->last == b->end || ngx_strlchr(b->pos, b->last, LF)) {
+            break;
+        }
+    }
+
+    status = ngx_http_upstream_check_parse_status(b);
+
+    if (status == 0) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "upstream check got no valid status line");
+        ngx_http_upstream_check_done(cp, 0);
+        return;
+    }
+
+    if (!(cp->conf->expect & (1 << (status / 100)))) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "upstream check got status %ui", status);
+        ngx_http_upstream_check_done(cp, 0);
+        return;
+    }
+
+    ngx_http_upstream_check_done(cp, 1);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_upstream_check_log_error(ngx_log_t *log, u_char *buf, size_t len)
+{
+    ngx_http_upstream_check_peer_t  *cp;
+
+    cp = log->data;
+
+    return ngx_snprintf(buf, len, " while checking %V in upstream \"%V\"",
+                        cp->pc.name, cp->upstream);
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_check_parse_status(ngx_buf_t *b)
+{
+    u_char     *p;
+    ngx_int_t   status;
+
+    /* "HTTP/1.1 200 OK" */
+
+    p = b->pos;
+
+    if (b->last - p < 12 || ngx_strncmp(p, "HTTP/", 5) != 0) {
+        return 0;
+    }
+
+    for (p += 5; p < b->last && *p != ' '; p++) { /* void */ }
+
+    if (b->last - p < 4) {
+        return 0;
+    }
+
+    status = ngx_atoi(p + 1, 3);
+
+    if (status < 100 || status > 599) {
+        return 0;
+    }
+
+    return status;
+}
+
+
+static void
+ngx_http_upstream_check_done(ngx_http_upstream_check_peer_t *cp,
+    ngx_uint_t alive)
+{
+    ngx_uint_t                    changed;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    if (cp->pc.connection) {
+        ngx_close_connection(cp->pc.connection);
+        cp->pc.connection = NULL;
+    }
+
+    peer = cp->peer;
+
+    changed = 0;
+
+    ngx_http_upstream_rr_peer_lock(cp->peers, peer);
+
+    if (alive) {
+        peer->check_fall = 0;
+        peer->check_rise++;
+
+        if ((peer->down & NGX_HTTP_UPSTREAM_RR_CHECK_DOWN)
+            && peer->check_rise >= cp->conf->rise)
+        {
+            peer->down &= ~NGX_HTTP_UPSTREAM_RR_CHECK_DOWN;
+            peer->fails = 0;
+            changed = 1;
+        }
+
+    } else {
+        peer->check_rise = 0;
+        peer->check_fall++;
+
+        if (!(peer->down & NGX_HTTP_UPSTREAM_RR_CHECK_DOWN)
+            && peer->check_fall >= cp->conf->fall)
+        {
+            peer->down |= NGX_HTTP_UPSTREAM_RR_CHECK_DOWN;
+            changed = 1;
+        }
+    }
+
+    ngx_http_upstream_rr_peer_unlock(cp->peers, peer);
+
+    if (changed) {
+        ngx_log_error(NGX_LOG_WARN, &cp->log, 0, "upstream server is %s",
+                      alive ? "up" : "down");
+    }
+
+    if (!ngx_exiting) {
+        ngx_add_timer(&cp->timer, cp->conf->interval);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_status_handler(ngx_http_request_t *r)
+{
+    size_t                               size;
+    ngx_int_t                            rc;
+    ngx_buf_t                           *b;
+    ngx_str_t                            format;
+    ngx_uint_t                           i, json, first;
+    ngx_chain_t                          out;
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ccf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    json = 0;
+
+    if (ngx_http_arg(r, (u_char *) "format", 6, &format) == NGX_OK
+        && format.len == 4
+        && ngx_strncmp(format.data, "json", 4) == 0)
+    {
+        json = 1;
+    }
+
+    if (json) {
+        ngx_str_set(&r->headers_out.content_type, "application/json");
+
+    } else {
+        ngx_str_set(&r->headers_out.content_type, "text/plain");
+    }
+
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+    uscfp = umcf->upstreams.elts;
+
+    /* names and the number of peers do not change, the values are bounded */
+
+    size = sizeof("{\"upstreams\":[]}" CRLF);
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->peer.data == NULL) {
+            continue;
+        }
+
+        ccf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                              ngx_http_upstream_check_module);
+
+        if (ccf->type == 0) {
+            continue;
+        }
+
+        size += sizeof(",{\"name\":\"\",\"type\":\"http\",\"interval\":,"
+                       "\"timeout\":,\"rise\":,\"fall\":,\"peers\":[]}")
+                + 2 * uscfp[i]->host.len
+                + ngx_escape_json(NULL, uscfp[i]->host.data,
+                                  uscfp[i]->host.len)
+                + 4 * NGX_INT_T_LEN;
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+            for (peer = peers->peer; peer; peer = peer->next) {
+                size += sizeof(",{\"server\":\"\",\"backup\":false,"
+                               "\"status\":\"disabled\",\"rise\":,"
+                               "\"fall\":,\"checked\":}" CRLF)
+                        + 2 * peer->name.len
+                        + ngx_escape_json(NULL, peer->name.data,
+                                          peer->name.len)
+                        + 3 * NGX_INT_T_LEN;
+            }
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    if (json) {
+        b->last = ngx_cpymem(b->last, "{\"upstreams\":[",
+                             sizeof("{\"upstreams\":[") - 1);
+    }
+
+    first = 1;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->peer.data == NULL) {
+            continue;
+        }
+
+        ccf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                              ngx_http_upstream_check_module);
+
+        if (ccf->type == 0) {
+            continue;
+        }
+
+        if (json) {
+            if (!first) {
+                *b->last++ = ',';
+            }
+
+            b->last = ngx_cpymem(b->last, "{\"name\":\"",
+                                 sizeof("{\"name\":\"") - 1);
+            b->last = (u_char *) ngx_escape_json(b->last, uscfp[i]->host.data,
+                                                 uscfp[i]->host.len);
+            b->last = ngx_sprintf(b->last,
+                                  "\",\"type\":\"%s\",\"interval\":%M,"
+                                  "\"timeout\":%M,\"rise\":%ui,\"fall\":%ui,"
+                                  "\"peers\":[",
+                                  ccf->type == NGX_HTTP_UPSTREAM_CHECK_HTTP
+                                  ? "http" : "tcp",
+                                  ccf->interval, ccf->timeout,
+                                  ccf->rise, ccf->fall);
+
+        } else {
+            b->last = ngx_sprintf(b->last,
+                                  "upstream %V: %s, interval %Mms, "
+                                  "timeout %Mms, rise %ui, fall %ui" CRLF,
+                                  &uscfp[i]->host,
+                                  ccf->type == NGX_HTTP_UPSTREAM_CHECK_HTTP
+                                  ? "http" : "tcp",
+                                  ccf->interval, ccf->timeout,
+                                  ccf->rise, ccf->fall);
+        }
+
+        b->last = ngx_http_upstream_check_status_peers(b->last,
+                                                   uscfp[i]->peer.data, json);
+
+        if (json) {
+            *b->last++ = ']';
+            *b->last++ = '}';
+        }
+
+        first = 0;
+    }
+
+    if (json) {
+        b->last = ngx_cpymem(b->last, "]}" CRLF, sizeof("]}" CRLF) - 1);
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static u_char *
+ngx_http_upstream_check_status_peers(u_char *p,
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t json)
+{
+    char                          *status;
+    ngx_uint_t                     backup, first;
+    ngx_msec_int_t                 checked;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *primary;
+
+    primary = peers;
+    first = 1;
+
+    for ( /* void */ ; peers; peers = peers->next) {
+
+        backup = (peers != primary);
+
+        ngx_http_upstream_rr_peers_rlock(peers);
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+
+            ngx_http_upstream_rr_peer_lock(peers, peer);
+
+            if (peer->down & ~NGX_HTTP_UPSTREAM_RR_CHECK_DOWN) {
+                status = "disabled";
+
+            } else if (peer->down) {
+                status = "down";
+
+            } else {
+                status = "up";
+            }
+
+            checked = (ngx_msec_int_t) (ngx_current_msec - peer->check_time);
+
+            if (checked < 0) {
+                checked = 0;
+            }
+
+            if (json) {
+                if (!first) {
+                    *p++ = ',';
+                }
+
+                p = ngx_cpymem(p, "{\"server\":\"",
+                               sizeof("{\"server\":\"") - 1);
+                p = (u_char *) ngx_escape_json(p, peer->name.data,
+                                               peer->name.len);
+                p = ngx_sprintf(p, "\",\"backup\":%s,\"status\":\"%s\","
+                                "\"rise\":%ui,\"fall\":%ui,\"checked\":",
+                                backup ? "true" : "false", status,
+                                peer->check_rise, peer->check_fall);
+
+                if (peer->check_time == 0) {
+                    p = ngx_cpymem(p, "null}", sizeof("null}") - 1);
+
+                } else {
+                    p = ngx_sprintf(p, "%M}", (ngx_msec_t) checked);
+                }
+
+            } else {
+                p = ngx_sprintf(p, "    %V%s %s, rise %ui, fall %ui",
+                                &peer->name, backup ? " backup" : "",
+                                status, peer->check_rise, peer->check_fall);
+
+                if (peer->check_time == 0) {
+                    p = ngx_cpymem(p, ", not checked" CRLF,
+                                   sizeof(", not checked" CRLF) - 1);
+
+                } else {
+                    p = ngx_sprintf(p, ", checked %Mms ago" CRLF,
+                                    (ngx_msec_t) checked);
+                }
+            }
+
+            ngx_http_upstream_rr_peer_unlock(peers, peer);
+
+            first = 0;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+    }
+
+    return p;
+}
+
+
+static void *
+ngx_http_upstream_check_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_check_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_check_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->type = 0;
+     *     conf->port = 0;
+     *     conf->send = { 0, NULL };
+     *     conf->expect = 0;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_check_srv_conf_t  *ccf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_msec_t   msec;
+    ngx_uint_t   i;
+
+    if (ccf->type) {
+        return "is duplicate";
+    }
+
+    ccf->type = NGX_HTTP_UPSTREAM_CHECK_TCP;
+    ccf->interval = 5000;
+    ccf->timeout = 1000;
+    ccf->rise = 2;
+    ccf->fall = 3;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0
+            || ngx_strncmp(value[i].data, "timeout=", 8) == 0)
+        {
+            n = (value[i].data[0] == 'i') ? 9 : 8;
+
+            s.len = value[i].len - n;
+            s.data = value[i].data + n;
+
+            msec = ngx_parse_time(&s, 0);
+
+            if (msec == (ngx_msec_t) NGX_ERROR || msec == 0) {
+                goto invalid;
+            }
+
+            if (n == 9) {
+                ccf->interval = msec;
+
+            } else {
+                ccf->timeout = msec;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "rise=", 5) == 0) {
+
+            n = ngx_atoi(value[i].data + 5, value[i].len - 5);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ccf->rise = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fall=", 5) == 0) {
+
+            n = ngx_atoi(value[i].data + 5, value[i].len - 5);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ccf->fall = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "port=", 5) == 0) {
+
+            n = ngx_atoi(value[i].data + 5, value[i].len - 5);
+
+            if (n < 1 || n > 65535) {
+                goto invalid;
+            }
+
+            ccf->port = (in_port_t) n;
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=tcp") == 0) {
+            ccf->type = NGX_HTTP_UPSTREAM_CHECK_TCP;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=http") == 0) {
+            ccf->type = NGX_HTTP_UPSTREAM_CHECK_HTTP;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_upstream_check_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_check_status_handler;
+
+    return NGX_CONF_OK;
+}
@@ -0,0 +1,519 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_msec_t                          decay;
+    ngx_msec_t                          penalty;
+} ngx_http_upstream_ewma_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t    rrp;
+    ngx_http_upstream_ewma_srv_conf_t  *conf;
+    uint64_t                            start;
+} ngx_http_upstream_ewma_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_ewma_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_ewma_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_ewma_pick(
+    ngx_http_upstream_rr_peer_data_t *rrp, time_t now,
+    ngx_http_upstream_rr_peer_t *skip, ngx_uint_t *index);
+static uint64_t ngx_http_upstream_ewma_cost(ngx_http_upstream_rr_peer_t *peer,
+    uint64_t now, uint64_t decay);
+static uint64_t ngx_http_upstream_ewma_decay(uint64_t value, uint64_t elapsed,
+    uint64_t decay);
+static uint64_t ngx_http_upstream_ewma_now(void);
+
+static void *ngx_http_upstream_ewma_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_ewma(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_ewma_commands[] = {
+
+    { ngx_string("ewma"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE12,
+      ngx_http_upstream_ewma,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_ewma_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_ewma_create_conf,    /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_ewma_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_ewma_module_ctx,    /* module context */
+    ngx_http_upstream_ewma_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_ewma(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init ewma");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_ewma_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init ewma peer");
+
+    ep = ngx_palloc(r->pool, sizeof(ngx_http_upstream_ewma_peer_data_t));
+    if (ep == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &ep->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ep->conf = ngx_http_conf_upstream_srv_conf(us,
+                                               ngx_http_upstream_ewma_module);
+    ep->start = 0;
+
+    r->upstream->peer.get = ngx_http_upstream_get_ewma_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_ewma_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_ewma_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep = data;
+
+    time_t                             now;
+    uint64_t                           usec, decay, cost, best_cost;
+    uintptr_t                          m;
+    ngx_int_t                          rc;
+    ngx_uint_t                         i, n, p;
+    ngx_http_upstream_rr_peer_t       *peer, *best;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_data_t  *rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get ewma peer, try: %ui", pc->tries);
+
+    rrp = &ep->rrp;
+
+    usec = ngx_http_upstream_ewma_now();
+    ep->start = usec;
+
+    if (rrp->peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+    decay = (uint64_t) ep->conf->decay * 1000;
+
+    peers = rrp->peers;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    /*
+     * power of two choices: of two peers picked at random in proportion
+     * to their weights, take the one with the lower latency multiplied by
+     * the number of requests in flight
+     */
+
+    best = ngx_http_upstream_ewma_pick(rrp, now, NULL, &p);
+
+    if (best == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, no peer found");
+
+        goto failed;
+    }
+
+    peer = ngx_http_upstream_ewma_pick(rrp, now, best, &i);
+
+    if (peer) {
+        best_cost = ngx_http_upstream_ewma_cost(best, usec, decay);
+        cost = ngx_http_upstream_ewma_cost(peer, usec, decay);
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, cost %uL:%ui %uL:%ui",
+                       best_cost, best->weight, cost, peer->weight);
+
+        if (cost * best->weight < best_cost * peer->weight) {
+            best = peer;
+            p = i;
+        }
+    }
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    best->conns++;
+
+    rrp->current = best;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, backup servers");
+
+        rrp->peers = peers->next;
+
+        n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
+                / (8 * sizeof(uintptr_t));
+
+        for (i = 0; i < n; i++) {
+            rrp->tried[i] = 0;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        rc = ngx_http_upstream_get_ewma_peer(pc, ep);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+
+        ngx_http_upstream_rr_peers_wlock(peers);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_http_upstream_free_ewma_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep = data;
+
+    uint64_t                      usec, rtt, decay, elapsed;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    peer = ep->rrp.current;
+
+    usec = ngx_http_upstream_ewma_now();
+
+    rtt = usec > ep->start ? usec - ep->start : 0;
+
+    if ((state & NGX_PEER_FAILED)
+        && rtt < (uint64_t) ep->conf->penalty * 1000)
+    {
+        rtt = (uint64_t) ep->conf->penalty * 1000;
+    }
+
+    decay = (uint64_t) ep->conf->decay * 1000;
+
+    ngx_http_upstream_rr_peers_rlock(ep->rrp.peers);
+    ngx_http_upstream_rr_peer_lock(ep->rrp.peers, peer);
+
+    /*
+     * peak EWMA: a response slower than the average replaces it at once,
+     * faster ones move it with a weight that grows with the time since
+     * the previous response
+     */
+
+    if (rtt >= peer->ewma) {
+        peer->ewma = rtt;
+
+    } else {
+        elapsed = usec > peer->ewma_time ? usec - peer->ewma_time : 0;
+
+        peer->ewma = rtt + ngx_http_upstream_ewma_decay(peer->ewma - rtt,
+                                                        elapsed, decay);
+    }
+
+    peer->ewma_time = usec;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free ewma peer %p rtt:%uL ewma:%uL",
+                   peer, rtt, peer->ewma);
+
+    ngx_http_upstream_rr_peer_unlock(ep->rrp.peers, peer);
+    ngx_http_upstream_rr_peers_unlock(ep->rrp.peers);
+
+    ngx_http_upstream_free_round_robin_peer(pc, &ep->rrp, state);
+}
+
+
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_ewma_pick(ngx_http_upstream_rr_peer_data_t *rrp, time_t now,
+    ngx_http_upstream_rr_peer_t *skip, ngx_uint_t *index)
+{
+    uintptr_t                      m;
+    ngx_uint_t                     i, k, n, x;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = rrp->peers;
+
+    x = ngx_random() % peers->total_weight;
+
+    for (peer = peers->peer, i = 0;
+         peer->next && x >= (ngx_uint_t) peer->weight;
+         peer = peer->next, i++)
+    {
+        x -= peer->weight;
+    }
+
+    /* an unavailable peer passes the choice to the next one */
+
+    for (k = 0; k < peers->number; k++) {
+
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (peer != skip
+            && !(rrp->tried[n] & m)
+            && !peer->down
+            && !(peer->max_fails
+                 && peer->fails >= peer->max_fails
+                 && now - peer->checked <= peer->fail_timeout)
+            && !(peer->max_conns && peer->conns >= peer->max_conns))
+        {
+            *index = i;
+            return peer;
+        }
+
+        peer = peer->next;
+        i++;
+
+        if (peer == NULL) {
+            peer = peers->peer;
+            i = 0;
+        }
+    }
+
+    return NULL;
+}
+
+
+static uint64_t
+ngx_http_upstream_ewma_cost(ngx_http_upstream_rr_peer_t *peer, uint64_t now,
+    uint64_t decay)
+{
+    uint64_t  ewma;
+
+    /*
+     * without responses the latency decays towards zero, so that a peer
+     * once penalized or slow is tried again after a while
+     */
+
+    ewma = ngx_http_upstream_ewma_decay(peer->ewma,
+                                        now > peer->ewma_time
+                                        ? now - peer->ewma_time : 0,
+                                        decay);
+
+    return (ewma + 1) * (peer->conns + 1);
+}
+
+
+static uint64_t
+ngx_http_upstream_ewma_decay(uint64_t value, uint64_t elapsed, uint64_t decay)
+{
+    uint64_t  half, n;
+
+    /*
+     * value * e^(-elapsed / decay): halved every decay * ln 2,
+     * linearly between the halvings
+     */
+
+    half = decay * 693 / 1000;
+
+    if (half == 0) {
+        return 0;
+    }
+
+    n = elapsed / half;
+
+    if (n >= 64) {
+        return 0;
+    }
+
+    value >>= n;
+
+    return value - value * (elapsed % half) / (2 * half);
+}
+
+
+static uint64_t
+ngx_http_upstream_ewma_now(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static void *
+ngx_http_upstream_ewma_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_ewma_srv_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool, sizeof(ngx_http_upstream_ewma_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->decay = 10000;
+    conf->penalty = 1000;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_ewma(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_ewma_srv_conf_t  *ecf = conf;
+
+    ngx_str_t                     *value, s;
+    ngx_msec_t                     msec;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "decay=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            msec = ngx_parse_time(&s, 0);
+
+            if (msec == (ngx_msec_t) NGX_ERROR || msec == 0
+                || msec > 3600000)
+            {
+                goto invalid;
+            }
+
+            ecf->decay = msec;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "penalty=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            msec = ngx_parse_time(&s, 0);
+
+            if (msec == (ngx_msec_t) NGX_ERROR || msec > 3600000) {
+                goto invalid;
+            }
+
+            ecf->penalty = msec;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_ewma;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_CONNS
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
@@ -9,6 +9,37 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_X86_SIMD && !(NGX_WIN32))
+
+#include <immintrin.h>
+
+
+/*
+ * a set of stop bytes: as a string for SSE4.2 and as low and high nibble
+ * masks for AVX2, a byte is in the set if lo[byte & 0xf] & hi[byte >> 4]
+ */
+
+typedef struct {
+    u_char  set[16];
+    u_char  lo[16];
+    u_char  hi[16];
+    int     len;
+} ngx_http_parse_stop_t;
+
+
+static ngx_inline u_char *ngx_http_parse_skip(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop);
+static u_char *ngx_http_parse_skip_sse42(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop) __attribute__((target("sse4.2")));
+static u_char *ngx_http_parse_skip_avx2(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop) __attribute__((target("avx2")));
+
+#else
+
+#define ngx_http_parse_skip(p, last, stop)  (p)
+
+#endif
+
 
 static uint32_t  usual[] = {
     0xffffdbfe, /* 1111 1111 1111 1111  1101 1011 1111 1110 */
@@ -98,6 +129,115 @@ static uint32_t  usual[] = {
 #endif
 
 
+#if (NGX_HAVE_X86_SIMD && !(NGX_WIN32))
+
+/*
+ * the bytes that are not "usual" in URI and the bytes that end a header
+ * value: runs of other bytes are skipped with SSE4.2 or AVX2 if available,
+ * the byte found and the tail shorter than a vector go to the state machine
+ */
+
+static ngx_http_parse_stop_t  uri_stop = {
+    { '\0', ' ', '#', '%', '+', '.', '/', '?', CR, LF },
+
+    /* 0: "\0 "  3: "#"  5: "%"  a: LF  b: "+"  d: CR  e: "."  f: "/?" */
+    { 3, 0, 0, 2, 0, 2, 0, 0, 0, 0, 1, 2, 0, 1, 2, 6 },
+
+    /* 0: "\0" CR LF  2: " #%+./"  3: "?" */
+    { 1, 0, 2, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+
+    10
+};
+
+static ngx_http_parse_stop_t  value_stop = {
+    { '\0', ' ', CR, LF },
+    { 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0 },
+    { 1, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    4
+};
+
+
+static ngx_inline u_char *
+ngx_http_parse_skip(u_char *p, u_char *last, ngx_http_parse_stop_t *stop)
+{
+    if (ngx_cpu_avx2 && last - p >= 32) {
+        return ngx_http_parse_skip_avx2(p, last, stop);
+    }
+
+    if (ngx_cpu_sse42 && last - p >= 16) {
+        return ngx_http_parse_skip_sse42(p, last, stop);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_parse_skip_sse42(u_char *p, u_char *last,
+    ngx_http_parse_stop_t *stop)
+{
+    int      i;
+    __m128i  set, v;
+
+    set = _mm_loadu_si128((__m128i *) stop->set);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        i = _mm_cmpestri(set, stop->len, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY
+                         |_SIDD_LEAST_SIGNIFICANT);
+
+        if (i != 16) {
+            return p + i;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_parse_skip_avx2(u_char *p, u_char *last, ngx_http_parse_stop_t *stop)
+{
+    uint32_t  mask;
+    __m256i   lo, hi, nibble, v, m;
+
+    lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) stop->lo));
+    hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) stop->hi));
+    nibble = _mm256_set1_epi8(0x0f);
+
+    while (last - p >= 32) {
+        v = _mm256_loadu_si256((__m256i *) p);
+
+        m = _mm256_and_si256(
+                _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)),
+                _mm256_shuffle_epi8(hi, _mm256_and_si256(
+                                            _mm256_srli_epi16(v, 4), nibble)));
+
+        mask = ~_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+
+        if (mask) {
+            p += __builtin_ctz(mask);
+            break;
+        }
+
+        p += 32;
+    }
+
+    /* gcc does not always emit it, and the callers run SSE code */
+
+    _mm256_zeroupper();
+
+    return p;
+}
+
+#endif
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
@@ -541,6 +681,7 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_check_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+                p = ngx_http_parse_skip(p + 1, b->last, &uri_stop) - 1;
                 break;
             }
 
@@ -627,6 +768,7 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+                p = ngx_http_parse_skip(p + 1, b->last, &uri_stop) - 1;
                 break;
             }
 
@@ -1026,6 +1168,9 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 goto done;
             case '\0':
                 return NGX_HTTP_PARSE_INVALID_HEADER;
+            default:
+                p = ngx_http_parse_skip(p + 1, b->last, &value_stop) - 1;
+                break;
             }
             break;
 
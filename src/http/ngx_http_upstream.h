@@ -389,6 +389,7 @@ struct ngx_http_upstream_s {
     unsigned                         request_sent:1;
     unsigned                         request_body_sent:1;
     unsigned                         header_sent:1;
+    unsigned                         http2:1;
 };
 
 
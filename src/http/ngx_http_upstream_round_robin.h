@@ -40,6 +40,13 @@ struct ngx_http_upstream_rr_peer_s {
 
     ngx_uint_t                      down;
 
+    uint64_t                        ewma;
+    uint64_t                        ewma_time;
+
+    ngx_msec_t                      check_time;
+    ngx_uint_t                      check_rise;
+    ngx_uint_t                      check_fall;
+
 #if (NGX_HTTP_SSL || NGX_COMPAT)
     void                           *ssl_session;
     int                             ssl_session_len;
@@ -56,6 +63,10 @@ struct ngx_http_upstream_rr_peer_s {
 };
 
 
+/* set in peer->down by active health checks, "down" in the config sets 1 */
+#define NGX_HTTP_UPSTREAM_RR_CHECK_DOWN  0x02
+
+
 typedef struct ngx_http_upstream_rr_peers_s  ngx_http_upstream_rr_peers_t;
 
 struct ngx_http_upstream_rr_peers_s {
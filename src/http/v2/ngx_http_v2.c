@@ -249,6 +249,12 @@ ngx_http_v2_init(ngx_event_t *rev)
 
     h2scf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_v2_module);
 
+    h2c->hpack_enc.limit = h2scf->encoder_table_size;
+    h2c->hpack_enc.size = ngx_min(h2scf->encoder_table_size,
+                                  NGX_HTTP_V2_DEFAULT_TABLE_SIZE);
+    h2c->hpack_enc.free = h2c->hpack_enc.size;
+    h2c->hpack_enc.update = h2c->hpack_enc.size;
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -1988,6 +1994,11 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         switch (id) {
 
+        case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
+
+            ngx_http_v2_table_encoder_size(h2c, value);
+            break;
+
         case NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING:
 
             if (value > NGX_HTTP_V2_MAX_WINDOW) {
@@ -2829,6 +2840,17 @@ ngx_http_v2_create_stream(ngx_http_v2_connection_t *h2c)
         return NULL;
     }
 
+#if (NGX_HTTP_SSL)
+    if (fc->ssl) {
+        /*
+         * with kernel TLS, SSL_sendfile() would leave each DATA frame
+         * header in a TLS record of its own
+         */
+
+        r->main_filter_need_in_memory = 1;
+    }
+#endif
+
     ngx_str_set(&r->http_protocol, "HTTP/2.0");
 
     r->http_version = NGX_HTTP_VERSION_20;
@@ -24,6 +24,9 @@
 #define NGX_HTTP_V2_MAX_FIELD                                                 \
     (127 + (1 << (NGX_HTTP_V2_INT_OCTETS - 1) * 7) - 1)
 
+#define NGX_HTTP_V2_DEFAULT_TABLE_SIZE   4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
+
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
 
 /* frame types */
@@ -110,6 +113,29 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    ngx_uint_t                       hash;
+    ngx_http_v2_header_t             header;
+} ngx_http_v2_hpack_entry_t;
+
+
+typedef struct {
+    ngx_http_v2_hpack_entry_t       *entries;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    size_t                           limit;
+    size_t                           size;
+    size_t                           free;
+    size_t                           update;
+    u_char                          *storage;
+    u_char                          *pos;
+    u_char                          *end;
+} ngx_http_v2_hpack_enc_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -127,6 +153,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
 
@@ -288,6 +315,24 @@ ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
+ngx_uint_t ngx_http_v2_table_lookup(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t *name_index);
+ngx_int_t ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value);
+void ngx_http_v2_table_encoder_size(ngx_http_v2_connection_t *h2c,
+    size_t size);
+
+u_char *ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp,
+    ngx_uint_t indexing);
+ngx_uint_t ngx_http_v2_is_volatile(ngx_str_t *name);
+u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
+    ngx_uint_t value);
+
+ngx_int_t ngx_http_v2_upstream_init(ngx_cycle_t *cycle);
+ngx_int_t ngx_http_v2_upstream_connect(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+
 
 ngx_int_t ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
@@ -23,7 +23,6 @@
     (ngx_http_v2_integer_octets(sizeof(h) - 1) + sizeof(h) - 1)
 
 #define ngx_http_v2_indexed(i)      (128 + (i))
-#define ngx_http_v2_inc_indexed(i)  (64 + (i))
 
 #define ngx_http_v2_write_name(dst, src, len, tmp)                            \
     ngx_http_v2_string_encode(dst, src, len, tmp, 1)
@@ -55,8 +54,6 @@
 
 static u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
-static u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
-    ngx_uint_t value);
 static ngx_http_v2_out_frame_t *ngx_http_v2_create_headers_frame(
     ngx_http_request_t *r, u_char *pos, u_char *end, ngx_uint_t fin);
 static ngx_http_v2_out_frame_t *ngx_http_v2_create_trailers_frame(
@@ -127,12 +124,39 @@ ngx_module_t  ngx_http_v2_filter_module = {
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 
 
+static ngx_str_t  ngx_http_v2_status_name = ngx_string(":status");
+static ngx_str_t  ngx_http_v2_server_name = ngx_string("server");
+static ngx_str_t  ngx_http_v2_content_type_name = ngx_string("content-type");
+#if (NGX_HTTP_GZIP)
+static ngx_str_t  ngx_http_v2_vary_name = ngx_string("vary");
+static ngx_str_t  ngx_http_v2_accept_encoding = ngx_string("Accept-Encoding");
+#endif
+
+
+/*
+ * headers whose values change from response to response are not worth
+ * a place in the dynamic table
+ */
+
+static ngx_str_t  ngx_http_v2_volatile_headers[] = {
+    ngx_string("age"),
+    ngx_string("content-length"),
+    ngx_string("content-range"),
+    ngx_string("date"),
+    ngx_string("etag"),
+    ngx_string("expires"),
+    ngx_string("last-modified"),
+    ngx_string("location"),
+    ngx_null_string
+};
+
+
 static ngx_int_t
 ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
-    u_char                     status, *pos, *start, *p, *tmp;
-    size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
+    u_char                     status, *pos, *start, *p, *tmp, *low;
+    size_t                     len, tmp_len, low_len;
+    ngx_str_t                  host, location, server, value;
     ngx_uint_t                 i, port;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
@@ -143,19 +167,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
-
-    static const u_char nginx[5] = "\x84\xaa\x63\x55\xe7";
-#if (NGX_HTTP_GZIP)
-    static const u_char accept_encoding[12] =
-        "\x8b\x84\x84\x2d\x69\x5b\x05\x44\x3c\x86\xaa\x6f";
-#endif
-
-    static size_t nginx_ver_len = ngx_http_v2_literal_size(NGINX_VER);
-    static u_char nginx_ver[ngx_http_v2_literal_size(NGINX_VER)];
-
-    static size_t nginx_ver_build_len =
-                                  ngx_http_v2_literal_size(NGINX_VER_BUILD);
-    static u_char nginx_ver_build[ngx_http_v2_literal_size(NGINX_VER_BUILD)];
+    u_char                     code[NGX_INT_T_LEN];
 
     if (!r->stream) {
         return ngx_http_next_header_filter(r);
@@ -238,7 +250,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     h2c = r->stream->connection;
 
-    len = h2c->table_update ? 1 : 0;
+    len = h2c->table_update ? 2 * NGX_HTTP_V2_INT_OCTETS : 0;
 
     len += status ? 1 : 1 + ngx_http_v2_literal_size("418");
 
@@ -247,18 +259,22 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (r->headers_out.server == NULL) {
 
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            len += 1 + nginx_ver_len;
+            ngx_str_set(&server, NGINX_VER);
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            len += 1 + nginx_ver_build_len;
+            ngx_str_set(&server, NGINX_VER_BUILD);
 
         } else {
-            len += 1 + sizeof(nginx);
+            ngx_str_set(&server, "nginx");
         }
+
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + server.len;
     }
 
+    /* headers sent without indexing need two octets for the name index */
+
     if (r->headers_out.date == NULL) {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += 2 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.content_type.len) {
@@ -274,13 +290,13 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (r->headers_out.content_length == NULL
         && r->headers_out.content_length_n >= 0)
     {
-        len += 1 + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
+        len += 2 + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += 2 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -358,15 +374,16 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
         r->headers_out.location->hash = 0;
 
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
+        len += 2 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
     }
 
     tmp_len = len;
+    low_len = 0;
 
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
         if (clcf->gzip_vary) {
-            len += 1 + sizeof(accept_encoding);
+            len += 1 + NGX_HTTP_V2_INT_OCTETS + ngx_http_v2_accept_encoding.len;
 
         } else {
             r->gzip_vary = 0;
@@ -417,21 +434,38 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         if (header[i].value.len > tmp_len) {
             tmp_len = header[i].value.len;
         }
+
+        if (header[i].key.len > low_len) {
+            low_len = header[i].key.len;
+        }
     }
 
     tmp = ngx_palloc(r->pool, tmp_len);
+    low = ngx_pnalloc(r->pool, low_len);
     pos = ngx_pnalloc(r->pool, len);
 
-    if (pos == NULL || tmp == NULL) {
+    if (pos == NULL || tmp == NULL || low == NULL) {
         return NGX_ERROR;
     }
 
     start = pos;
 
     if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 table size update: %uz min:%uz",
+                       h2c->hpack_enc.size, h2c->hpack_enc.update);
+
+        if (h2c->hpack_enc.update < h2c->hpack_enc.size) {
+            *pos = 32;
+            pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                        h2c->hpack_enc.update);
+        }
+
+        *pos = 32;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                    h2c->hpack_enc.size);
+
+        h2c->hpack_enc.update = h2c->hpack_enc.size;
         h2c->table_update = 0;
     }
 
@@ -443,52 +477,21 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         *pos++ = status;
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
-        pos = ngx_sprintf(pos, "%03ui", r->headers_out.status);
+        value.data = code;
+        value.len = ngx_sprintf(code, "%03ui", r->headers_out.status) - code;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                       &ngx_http_v2_status_name, &value,
+                                       tmp, 1);
     }
 
     if (r->headers_out.server == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"server: %V\"", &server);
 
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER);
-
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER_BUILD);
-
-        } else {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: nginx\"");
-        }
-
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
-
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            if (nginx_ver[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver, (u_char *) NGINX_VER,
-                                            sizeof(NGINX_VER) - 1, tmp);
-                nginx_ver_len = p - nginx_ver;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
-
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            if (nginx_ver_build[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver_build,
-                                            (u_char *) NGINX_VER_BUILD,
-                                            sizeof(NGINX_VER_BUILD) - 1, tmp);
-                nginx_ver_build_len = p - nginx_ver_build;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
-
-        } else {
-            pos = ngx_cpymem(pos, nginx, sizeof(nginx));
-        }
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                       &ngx_http_v2_server_name, &server,
+                                       tmp, 1);
     }
 
     if (r->headers_out.date == NULL) {
@@ -496,13 +499,15 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4),
+                                    NGX_HTTP_V2_DATE_INDEX);
+
         pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
                                       ngx_cached_http_time.len, tmp);
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
@@ -533,8 +538,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_TYPE_INDEX,
+                                       &ngx_http_v2_content_type_name,
+                                       &r->headers_out.content_type, tmp, 1);
     }
 
     if (r->headers_out.content_length == NULL
@@ -544,7 +551,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4),
+                                    NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
 
         p = pos;
         pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
@@ -554,7 +563,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4),
+                                    NGX_HTTP_V2_LAST_MODIFIED_INDEX);
 
         ngx_http_time(pos, r->headers_out.last_modified_time);
         len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
@@ -575,9 +586,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_LOCATION_INDEX,
+                                       NULL, &r->headers_out.location->value,
+                                       tmp, 0);
     }
 
 #if (NGX_HTTP_GZIP)
@@ -585,8 +596,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                       &ngx_http_v2_vary_name,
+                                       &ngx_http_v2_accept_encoding, tmp, 1);
     }
 #endif
 
@@ -609,27 +621,29 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             continue;
         }
 
-#if (NGX_DEBUG)
-        if (fc->log->log_level & NGX_LOG_DEBUG_HTTP) {
-            ngx_strlow(tmp, header[i].key.data, header[i].key.len);
-
-            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"%*s: %V\"",
-                           header[i].key.len, tmp, &header[i].value);
-        }
-#endif
+        value.len = header[i].key.len;
+        value.data = low;
 
-        *pos++ = 0;
+        ngx_strlow(low, header[i].key.data, header[i].key.len);
 
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"%V: %V\"",
+                       &value, &header[i].value);
 
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &value, &header[i].value,
+                                       tmp, !ngx_http_v2_is_volatile(&value));
     }
 
     frame = ngx_http_v2_create_headers_frame(r, start, pos, r->header_only);
     if (frame == NULL) {
+
+        /*
+         * the dynamic table already has the entries of the lost block,
+         * so the client could not decode any later headers
+         */
+
+        h2c->connection->error = 1;
+
         return NGX_ERROR;
     }
 
@@ -751,6 +765,12 @@ ngx_http_v2_create_trailers_frame(ngx_http_request_t *r)
         }
 #endif
 
+        /*
+         * trailers are queued along with the data frames and may pass
+         * HEADERS frames of other streams, so they never use the dynamic
+         * table
+         */
+
         *pos++ = 0;
 
         pos = ngx_http_v2_write_name(pos, header[i].key.data,
@@ -764,6 +784,58 @@ ngx_http_v2_create_trailers_frame(ngx_http_request_t *r)
 }
 
 
+u_char *
+ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp,
+    ngx_uint_t indexing)
+{
+    ngx_uint_t  full;
+
+    if (indexing) {
+        full = ngx_http_v2_table_lookup(h2c, name, value, &index);
+
+        if (full) {
+            *pos = 128;
+            return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), full);
+        }
+
+        indexing = (ngx_http_v2_table_insert(h2c, name, value) == NGX_OK);
+    }
+
+    if (indexing) {
+        *pos = 64;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), index);
+
+    } else {
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+    }
+
+    if (index == 0) {
+        pos = ngx_http_v2_write_name(pos, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+}
+
+
+ngx_uint_t
+ngx_http_v2_is_volatile(ngx_str_t *name)
+{
+    ngx_str_t  *h;
+
+    for (h = ngx_http_v2_volatile_headers; h->len; h++) {
+        if (h->len == name->len
+            && ngx_strncmp(h->data, name->data, name->len) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
 static u_char *
 ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len, u_char *tmp,
     ngx_uint_t lower)
@@ -790,7 +862,7 @@ ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len, u_char *tmp,
 }
 
 
-static u_char *
+u_char *
 ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
 {
     if (value < prefix) {
@@ -13,8 +13,14 @@
 #define NGX_HTTP_V2_TABLE_SIZE  4096
 
 
+#define ngx_http_v2_table_entry_size(h)                                       \
+    (32 + (h)->name.len + (h)->value.len)
+
+
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
+static ngx_uint_t ngx_http_v2_table_hash(ngx_str_t *name, ngx_str_t *value);
+static void ngx_http_v2_table_evict(ngx_http_v2_connection_t *h2c);
 
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
@@ -347,3 +353,240 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+/*
+ * The encoder table mirrors the client's decoder table for the response
+ * headers.  Names and values are kept contiguous in a ring of twice the
+ * table size, so that an entry never wraps: the space skipped at the end
+ * of the ring is always smaller than the entry that caused the skip.
+ */
+
+ngx_uint_t
+ngx_http_v2_table_lookup(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value, ngx_uint_t *name_index)
+{
+    ngx_uint_t                  i, n, hash;
+    ngx_http_v2_header_t       *header;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    enc = &h2c->hpack_enc;
+
+    hash = ngx_http_v2_table_hash(name, value);
+
+    for (n = enc->added; n != enc->deleted; n--) {
+        entry = &enc->entries[(n - 1) % enc->allocated];
+        header = &entry->header;
+
+        if (header->name.len != name->len
+            || ngx_strncmp(header->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        i = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1 + enc->added - n;
+
+        if (entry->hash == hash
+            && header->value.len == value->len
+            && ngx_strncmp(header->value.data, value->data, value->len) == 0)
+        {
+            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                           "http2 table hit: %ui \"%V: %V\"",
+                           i, name, value);
+            return i;
+        }
+
+        if (*name_index == 0) {
+            *name_index = i;
+        }
+    }
+
+    if (*name_index) {
+        return 0;
+    }
+
+    for (i = 0; i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES; i++) {
+        header = &ngx_http_v2_static_table[i];
+
+        if (header->name.len != name->len
+            || ngx_strncmp(header->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (header->value.len == value->len
+            && ngx_strncmp(header->value.data, value->data, value->len) == 0)
+        {
+            return i + 1;
+        }
+
+        if (*name_index == 0) {
+            *name_index = i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+ngx_int_t
+ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    u_char                     *tail;
+    size_t                      size, len;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    enc = &h2c->hpack_enc;
+
+    len = name->len + value->len;
+    size = 32 + len;
+
+    /*
+     * an entry that takes more than a quarter of the table would flush
+     * most of it, so it is sent without indexing instead
+     */
+
+    if (size > enc->size / 4) {
+        return NGX_DECLINED;
+    }
+
+    if (enc->entries == NULL) {
+        enc->allocated = enc->limit / 32;
+
+        enc->entries = ngx_palloc(h2c->connection->pool,
+                                  sizeof(ngx_http_v2_hpack_entry_t)
+                                  * enc->allocated);
+        if (enc->entries == NULL) {
+            return NGX_ERROR;
+        }
+
+        enc->storage = ngx_pnalloc(h2c->connection->pool, 2 * enc->limit);
+        if (enc->storage == NULL) {
+            return NGX_ERROR;
+        }
+
+        enc->pos = enc->storage;
+        enc->end = enc->storage + 2 * enc->limit;
+    }
+
+    while (size > enc->free) {
+        ngx_http_v2_table_evict(h2c);
+    }
+
+    for ( ;; ) {
+
+        if (enc->added == enc->deleted) {
+            enc->pos = enc->storage;
+            break;
+        }
+
+        tail = enc->entries[enc->deleted % enc->allocated].header.name.data;
+
+        if (enc->pos >= tail) {
+
+            if ((size_t) (enc->end - enc->pos) >= len) {
+                break;
+            }
+
+            if ((size_t) (tail - enc->storage) >= len) {
+                enc->pos = enc->storage;
+                break;
+            }
+
+        } else if ((size_t) (tail - enc->pos) >= len) {
+            break;
+        }
+
+        ngx_http_v2_table_evict(h2c);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table insert: \"%V: %V\"", name, value);
+
+    entry = &enc->entries[enc->added++ % enc->allocated];
+
+    entry->hash = ngx_http_v2_table_hash(name, value);
+
+    entry->header.name.len = name->len;
+    entry->header.name.data = enc->pos;
+    enc->pos = ngx_cpymem(enc->pos, name->data, name->len);
+
+    entry->header.value.len = value->len;
+    entry->header.value.data = enc->pos;
+    enc->pos = ngx_cpymem(enc->pos, value->data, value->len);
+
+    enc->free -= size;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v2_table_encoder_size(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    size_t                    used;
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    if (size > enc->limit) {
+        size = enc->limit;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 encoder table size: %uz was:%uz", size, enc->size);
+
+    if (size == enc->size) {
+        return;
+    }
+
+    used = enc->size - enc->free;
+
+    while (used > size) {
+        used -= ngx_http_v2_table_entry_size(
+                    &enc->entries[enc->deleted % enc->allocated].header);
+        enc->deleted++;
+    }
+
+    enc->size = size;
+    enc->free = size - used;
+
+    /* the smallest size since the last update is signalled as well */
+
+    if (size < enc->update) {
+        enc->update = size;
+    }
+
+    h2c->table_update = 1;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_table_hash(ngx_str_t *name, ngx_str_t *value)
+{
+    ngx_uint_t  i, hash;
+
+    hash = ngx_hash_key(name->data, name->len);
+
+    for (i = 0; i < value->len; i++) {
+        hash = ngx_hash(hash, value->data[i]);
+    }
+
+    return hash;
+}
+
+
+static void
+ngx_http_v2_table_evict(ngx_http_v2_connection_t *h2c)
+{
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    enc = &h2c->hpack_enc;
+
+    entry = &enc->entries[enc->deleted++ % enc->allocated];
+    enc->free += ngx_http_v2_table_entry_size(&entry->header);
+}
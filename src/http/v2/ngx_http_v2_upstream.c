@@ -0,0 +1,3726 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * HTTP/2 to upstream servers, "proxy_http_version 2".
+ *
+ * Requests to a peer are multiplexed as streams over a few connections
+ * ("sessions") kept per worker.  The upstream module still works with an
+ * ngx_connection_t per request: every stream has a fake connection whose
+ * send_chain() converts the HTTP/1.1 request created by the proxy module
+ * into HEADERS and DATA frames, and whose recv() returns the response
+ * header as HTTP/1.1 text followed by the payload of the DATA frames.
+ *
+ * The session reports its errors to all its streams, and streams which the
+ * peer did not process, as told by GOAWAY or REFUSED_STREAM, are moved to
+ * another session.  The events of the fake connections are marked active
+ * and are only posted, which needs an event method with edge-triggered
+ * notifications.
+ */
+
+
+/* errors */
+#define NGX_HTTP_V2_NO_ERROR                     0x0
+#define NGX_HTTP_V2_PROTOCOL_ERROR               0x1
+#define NGX_HTTP_V2_INTERNAL_ERROR               0x2
+#define NGX_HTTP_V2_FLOW_CTRL_ERROR              0x3
+#define NGX_HTTP_V2_SIZE_ERROR                   0x6
+#define NGX_HTTP_V2_REFUSED_STREAM               0x7
+#define NGX_HTTP_V2_CANCEL                       0x8
+#define NGX_HTTP_V2_COMP_ERROR                   0x9
+
+/* frame sizes */
+#define NGX_HTTP_V2_RST_STREAM_SIZE              4
+#define NGX_HTTP_V2_PING_SIZE                    8
+#define NGX_HTTP_V2_GOAWAY_SIZE                  8
+#define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
+#define NGX_HTTP_V2_PRIORITY_SIZE                5
+
+#define NGX_HTTP_V2_SETTINGS_PARAM_SIZE          6
+
+/* settings fields */
+#define NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING    0x1
+#define NGX_HTTP_V2_ENABLE_PUSH_SETTING          0x2
+#define NGX_HTTP_V2_MAX_STREAMS_SETTING          0x3
+#define NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING     0x4
+#define NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING       0x5
+
+#define NGX_HTTP_V2_DEFAULT_FRAME_SIZE           (1 << 14)
+#define NGX_HTTP_V2_MAX_SID                      0x7fffffff
+
+#define NGX_HTTP_V2_PREFACE                                                   \
+    "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+#define NGX_HTTP_V2_UPSTREAM_MAX_STREAMS         128
+#define NGX_HTTP_V2_UPSTREAM_WINDOW              (256 * 1024)
+#define NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE         16384
+#define NGX_HTTP_V2_UPSTREAM_OUTPUT_LIMIT        (128 * 1024)
+#define NGX_HTTP_V2_UPSTREAM_HEADERS_LIMIT       65536
+#define NGX_HTTP_V2_UPSTREAM_IDLE_TIMEOUT        60000
+/* moves of a stream away from sessions that processed nothing */
+#define NGX_HTTP_V2_UPSTREAM_RETRIES             3
+
+
+typedef struct ngx_http_v2_upstream_session_s  ngx_http_v2_upstream_session_t;
+
+
+typedef struct {
+    /* the fake connection comes first, recv() and send_chain() cast it */
+    ngx_connection_t                  connection;
+    ngx_event_t                       read;
+    ngx_event_t                       write;
+
+    ngx_http_v2_upstream_session_t   *session;
+    ngx_pool_t                       *pool;
+    ngx_queue_t                       queue;
+
+    ngx_uint_t                        sid;
+
+    ssize_t                           send_window;
+    size_t                            recv_window;
+    size_t                            recv_unacked;
+
+    /* -1 if the request body ends with the last buffer */
+    off_t                             body_rest;
+    ngx_buf_t                        *header;
+
+    ngx_chain_t                      *in;
+    ngx_chain_t                      *in_last;
+    ngx_chain_t                      *free;
+
+    /* the response header text, it is not flow controlled */
+    size_t                            text;
+
+    ngx_uint_t                        reset_code;
+
+    unsigned                          retries:2;
+    unsigned                          admitted:1;
+    unsigned                          header_done:1;
+    unsigned                          headers_sent:1;
+    unsigned                          body_sent:1;
+    unsigned                          response:1;
+    unsigned                          in_closed:1;
+    unsigned                          out_closed:1;
+    unsigned                          blocked:1;
+    unsigned                          done:1;
+    unsigned                          error:1;
+    unsigned                          reset:1;
+    unsigned                          unprocessed:1;
+    unsigned                          logged:1;
+} ngx_http_v2_upstream_stream_t;
+
+
+typedef struct {
+    void                             *data;
+    ngx_event_free_peer_pt            free;
+    ngx_http_v2_upstream_stream_t    *stream;
+} ngx_http_v2_upstream_peer_data_t;
+
+
+struct ngx_http_v2_upstream_session_s {
+    /* windows, frame size, HPACK tables and the header decoding pool */
+    ngx_http_v2_connection_t          h2c;
+
+    ngx_peer_connection_t             peer;
+    ngx_connection_t                 *connection;
+    ngx_pool_t                       *pool;
+    ngx_log_t                         log;
+    ngx_str_t                         name;
+
+    ngx_str_t                         ssl_name;
+
+#if (NGX_HTTP_SSL)
+    ngx_ssl_t                        *ssl;
+    ngx_flag_t                        ssl_verify;
+#endif
+
+    ngx_queue_t                       queue;
+    ngx_queue_t                       streams;
+    ngx_queue_t                       waiting;
+
+    ngx_uint_t                        refs;
+    ngx_uint_t                        active;
+    ngx_uint_t                        max_streams;
+    ngx_uint_t                        next_sid;
+
+    ngx_msec_t                        connect_timeout;
+
+    ngx_buf_t                        *in;
+
+    u_char                           *hblock;
+    size_t                            hblock_len;
+    ngx_uint_t                        hblock_sid;
+
+    ngx_chain_t                      *out;
+    ngx_chain_t                      *out_last;
+    ngx_chain_t                      *free;
+    size_t                            out_size;
+
+    unsigned                          linked:1;
+    unsigned                          connected:1;
+    unsigned                          ready:1;
+    unsigned                          error:1;
+    unsigned                          processed:1;
+    unsigned                          hblock_end_stream:1;
+};
+
+
+static ngx_http_v2_upstream_session_t *ngx_http_v2_upstream_get_session(
+    ngx_http_upstream_t *u, ngx_str_t *ssl_name);
+static ngx_http_v2_upstream_session_t *ngx_http_v2_upstream_create_session(
+    ngx_http_upstream_t *u, ngx_str_t *ssl_name, ngx_int_t *rc);
+static ngx_http_v2_upstream_stream_t *ngx_http_v2_upstream_create_stream(
+    ngx_http_v2_upstream_session_t *s, ngx_http_request_t *r);
+static void ngx_http_v2_upstream_attach(ngx_http_v2_upstream_session_t *s,
+    ngx_http_v2_upstream_stream_t *st);
+static ngx_int_t ngx_http_v2_upstream_retry(ngx_http_v2_upstream_stream_t *st);
+static void ngx_http_v2_upstream_free_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static void ngx_http_v2_upstream_release(ngx_http_v2_upstream_stream_t *st);
+static void ngx_http_v2_upstream_idle(ngx_http_v2_upstream_session_t *s);
+
+static void ngx_http_v2_upstream_connect_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_v2_upstream_test_connect(ngx_connection_t *c);
+#if (NGX_HTTP_SSL)
+static ngx_int_t ngx_http_v2_upstream_ssl_init(
+    ngx_http_v2_upstream_session_t *s);
+static void ngx_http_v2_upstream_ssl_handshake(ngx_connection_t *c);
+#endif
+static void ngx_http_v2_upstream_connected(ngx_http_v2_upstream_session_t *s);
+static void ngx_http_v2_upstream_read_handler(ngx_event_t *rev);
+static void ngx_http_v2_upstream_write_handler(ngx_event_t *wev);
+static void ngx_http_v2_upstream_empty_handler(ngx_event_t *ev);
+static void ngx_http_v2_upstream_fail(ngx_http_v2_upstream_session_t *s);
+static void ngx_http_v2_upstream_close(ngx_http_v2_upstream_session_t *s);
+static u_char *ngx_http_v2_upstream_log_error(ngx_log_t *log, u_char *buf,
+    size_t len);
+
+static ngx_int_t ngx_http_v2_upstream_process(
+    ngx_http_v2_upstream_session_t *s);
+static ngx_int_t ngx_http_v2_upstream_state_data(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t flags, ngx_uint_t sid,
+    u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_upstream_state_headers(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t type, ngx_uint_t flags,
+    ngx_uint_t sid, u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_upstream_state_rst_stream(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t sid, u_char *pos,
+    size_t len);
+static ngx_int_t ngx_http_v2_upstream_state_settings(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t flags, ngx_uint_t sid,
+    u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_upstream_state_ping(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t flags, ngx_uint_t sid,
+    u_char *pos, size_t len);
+static ngx_int_t ngx_http_v2_upstream_state_goaway(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t sid, u_char *pos,
+    size_t len);
+static ngx_int_t ngx_http_v2_upstream_state_window_update(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t sid, u_char *pos,
+    size_t len);
+
+static ngx_int_t ngx_http_v2_upstream_process_headers(
+    ngx_http_v2_upstream_session_t *s);
+static ngx_int_t ngx_http_v2_upstream_decode(ngx_http_v2_upstream_session_t *s,
+    u_char *pos, u_char *end, ngx_array_t *headers);
+static ngx_int_t ngx_http_v2_upstream_parse_int(u_char **pos, u_char *end,
+    ngx_uint_t prefix);
+static ngx_int_t ngx_http_v2_upstream_parse_string(
+    ngx_http_v2_upstream_session_t *s, u_char **pos, u_char *end,
+    ngx_str_t *str);
+static ngx_int_t ngx_http_v2_upstream_response(
+    ngx_http_v2_upstream_stream_t *st, ngx_array_t *headers);
+
+static ssize_t ngx_http_v2_upstream_recv(ngx_connection_t *fc, u_char *buf,
+    size_t size);
+static ssize_t ngx_http_v2_upstream_recv_chain(ngx_connection_t *fc,
+    ngx_chain_t *cl, off_t limit);
+static ngx_chain_t *ngx_http_v2_upstream_send_chain(ngx_connection_t *fc,
+    ngx_chain_t *in, off_t limit);
+static ngx_int_t ngx_http_v2_upstream_read_header(
+    ngx_http_v2_upstream_stream_t *st, ngx_buf_t *b);
+static ngx_int_t ngx_http_v2_upstream_create_headers(
+    ngx_http_v2_upstream_stream_t *st);
+
+static ngx_int_t ngx_http_v2_upstream_append(ngx_http_v2_upstream_stream_t *st,
+    u_char *p, size_t len);
+static void ngx_http_v2_upstream_close_input(ngx_http_v2_upstream_stream_t *st);
+static void ngx_http_v2_upstream_stream_error(
+    ngx_http_v2_upstream_stream_t *st, ngx_uint_t code);
+static void ngx_http_v2_upstream_stream_done(ngx_http_v2_upstream_stream_t *st);
+static void ngx_http_v2_upstream_log_stream_error(
+    ngx_http_v2_upstream_stream_t *st);
+static void ngx_http_v2_upstream_post_read(ngx_http_v2_upstream_stream_t *st);
+static void ngx_http_v2_upstream_post_write(ngx_http_v2_upstream_stream_t *st);
+static ngx_http_v2_upstream_stream_t *ngx_http_v2_upstream_find_stream(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t sid);
+static void ngx_http_v2_upstream_schedule(ngx_http_v2_upstream_session_t *s);
+static void ngx_http_v2_upstream_admit(ngx_http_v2_upstream_stream_t *st);
+static void ngx_http_v2_upstream_unblock(ngx_http_v2_upstream_session_t *s);
+
+static ngx_int_t ngx_http_v2_upstream_write(ngx_http_v2_upstream_session_t *s,
+    u_char *data, size_t len);
+static ngx_int_t ngx_http_v2_upstream_frame(ngx_http_v2_upstream_session_t *s,
+    size_t len, ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_v2_upstream_send_settings(
+    ngx_http_v2_upstream_session_t *s);
+static ngx_int_t ngx_http_v2_upstream_send_window_update(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t sid, size_t window);
+static ngx_int_t ngx_http_v2_upstream_send_rst_stream(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t sid, ngx_uint_t status);
+static ngx_int_t ngx_http_v2_upstream_send_goaway(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t status);
+static ngx_int_t ngx_http_v2_upstream_connection_error(
+    ngx_http_v2_upstream_session_t *s, ngx_uint_t status);
+static ngx_int_t ngx_http_v2_upstream_send(ngx_http_v2_upstream_session_t *s);
+static void ngx_http_v2_upstream_post_send(ngx_http_v2_upstream_session_t *s);
+
+
+static ngx_queue_t  ngx_http_v2_upstream_sessions;
+
+
+ngx_int_t
+ngx_http_v2_upstream_init(ngx_cycle_t *cycle)
+{
+    ngx_event_conf_t  *ecf;
+
+    /*
+     * the stream events are only posted, so the event method has to report
+     * a connection once per change, as it does with NGX_USE_CLEAR_EVENT
+     */
+
+    ecf = ngx_event_get_conf(cycle->conf_ctx, ngx_event_core_module);
+
+#if (NGX_HAVE_CLEAR_EVENT)
+    if (ngx_strcmp(ecf->name, "epoll") == 0
+        || ngx_strcmp(ecf->name, "kqueue") == 0)
+    {
+        return NGX_OK;
+    }
+#endif
+
+#if (NGX_HAVE_IOURING)
+    if (ngx_strcmp(ecf->name, "io_uring") == 0) {
+        return NGX_OK;
+    }
+#endif
+
+    ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                  "\"proxy_http_version 2\" requires the epoll, kqueue "
+                  "or io_uring event method, not \"%s\"", ecf->name);
+
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_http_v2_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_int_t                          rc;
+    ngx_str_t                          ssl_name;
+    ngx_peer_connection_t             *pc;
+    ngx_http_v2_upstream_stream_t     *st;
+    ngx_http_v2_upstream_session_t    *s;
+    ngx_http_v2_upstream_peer_data_t  *pd;
+#if (NGX_HTTP_SSL)
+    u_char                            *p, *last;
+#endif
+
+    if (ngx_http_v2_upstream_sessions.prev == NULL) {
+        ngx_queue_init(&ngx_http_v2_upstream_sessions);
+    }
+
+    pc = &u->peer;
+
+    if (pc->free != ngx_http_v2_upstream_free_peer) {
+        pd = ngx_pcalloc(r->pool, sizeof(ngx_http_v2_upstream_peer_data_t));
+        if (pd == NULL) {
+            return NGX_ERROR;
+        }
+
+        pd->data = pc->data;
+        pd->free = pc->free;
+
+        pc->data = pd;
+        pc->free = ngx_http_v2_upstream_free_peer;
+
+    } else {
+        pd = pc->data;
+    }
+
+    pc->connection = NULL;
+    pc->cached = 0;
+
+    rc = pc->get(pc, pd->data);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_str_null(&ssl_name);
+
+#if (NGX_HTTP_SSL)
+
+    if (u->ssl) {
+        if (u->conf->ssl_name) {
+            if (ngx_http_complex_value(r, u->conf->ssl_name, &ssl_name)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+        } else {
+            ssl_name = u->ssl_name;
+        }
+
+        /* the name may contain a port, as in ngx_http_upstream_ssl_name() */
+
+        p = ssl_name.data;
+        last = ssl_name.data + ssl_name.len;
+
+        if (ssl_name.len && *p == '[') {
+            p = ngx_strlchr(p, last, ']');
+
+            if (p == NULL) {
+                p = ssl_name.data;
+            }
+        }
+
+        p = ngx_strlchr(p, last, ':');
+
+        if (p != NULL) {
+            ssl_name.len = p - ssl_name.data;
+        }
+    }
+
+#endif
+
+    s = ngx_http_v2_upstream_get_session(u, &ssl_name);
+
+    if (s == NULL) {
+        s = ngx_http_v2_upstream_create_session(u, &ssl_name, &rc);
+
+        if (s == NULL) {
+            return rc;
+        }
+    }
+
+    st = ngx_http_v2_upstream_create_stream(s, r);
+    if (st == NULL) {
+        if (s->refs == 0 && !s->connected) {
+            ngx_http_v2_upstream_close(s);
+        }
+
+        return NGX_ERROR;
+    }
+
+    pd->stream = st;
+    pc->connection = &st->connection;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http2 upstream stream %p session %p streams:%ui",
+                   st, s, s->refs);
+
+    if (st->admitted) {
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_http_v2_upstream_session_t *
+ngx_http_v2_upstream_get_session(ngx_http_upstream_t *u, ngx_str_t *ssl_name)
+{
+    ngx_queue_t                     *q;
+    ngx_addr_t                      *local;
+    ngx_http_v2_upstream_session_t  *s;
+
+    local = u->peer.local;
+
+    for (q = ngx_queue_head(&ngx_http_v2_upstream_sessions);
+         q != ngx_queue_sentinel(&ngx_http_v2_upstream_sessions);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_http_v2_upstream_session_t, queue);
+
+        if (s->refs >= s->max_streams
+            || ngx_cmp_sockaddr(s->peer.sockaddr, s->peer.socklen,
+                                u->peer.sockaddr, u->peer.socklen, 1)
+               != NGX_OK)
+        {
+            continue;
+        }
+
+        if ((local == NULL) != (s->peer.local == NULL)) {
+            continue;
+        }
+
+        if (local
+            && ngx_cmp_sockaddr(s->peer.local->sockaddr,
+                                s->peer.local->socklen,
+                                local->sockaddr, local->socklen, 1)
+               != NGX_OK)
+        {
+            continue;
+        }
+
+#if (NGX_HTTP_SSL)
+
+        if (s->ssl != (u->ssl ? u->conf->ssl : NULL)) {
+            continue;
+        }
+
+        if (s->ssl
+            && (s->ssl_verify != u->conf->ssl_verify
+                || s->ssl_name.len != ssl_name->len
+                || ngx_strncmp(s->ssl_name.data, ssl_name->data,
+                               ssl_name->len)
+                   != 0))
+        {
+            continue;
+        }
+
+#endif
+
+        return s;
+    }
+
+    return NULL;
+}
+
+
+static ngx_http_v2_upstream_session_t *
+ngx_http_v2_upstream_create_session(ngx_http_upstream_t *u,
+    ngx_str_t *ssl_name, ngx_int_t *rc)
+{
+    ngx_pool_t                      *pool;
+    ngx_addr_t                      *local;
+    ngx_connection_t                *c;
+    ngx_http_v2_connection_t        *h2c;
+    ngx_http_v2_upstream_session_t  *s;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        *rc = NGX_ERROR;
+        return NULL;
+    }
+
+    s = ngx_pcalloc(pool, sizeof(ngx_http_v2_upstream_session_t));
+    if (s == NULL) {
+        goto failed;
+    }
+
+    s->pool = pool;
+
+    s->log = *ngx_cycle->log;
+    s->log.handler = ngx_http_v2_upstream_log_error;
+    s->log.data = s;
+    s->log.action = "connecting to upstream";
+
+    pool->log = &s->log;
+
+    s->name.len = u->peer.name->len;
+    s->name.data = ngx_pstrdup(pool, u->peer.name);
+    if (s->name.data == NULL) {
+        goto failed;
+    }
+
+    s->peer.sockaddr = ngx_palloc(pool, u->peer.socklen);
+    if (s->peer.sockaddr == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(s->peer.sockaddr, u->peer.sockaddr, u->peer.socklen);
+    s->peer.socklen = u->peer.socklen;
+    s->peer.name = &s->name;
+    s->peer.get = ngx_event_get_peer;
+    s->peer.log = &s->log;
+    s->peer.log_error = u->peer.log_error;
+    s->peer.rcvbuf = u->peer.rcvbuf;
+    s->peer.tries = 1;
+
+#if (NGX_HAVE_TRANSPARENT_PROXY)
+    s->peer.transparent = u->peer.transparent;
+#endif
+
+    if (u->peer.local) {
+        local = ngx_palloc(pool, sizeof(ngx_addr_t));
+        if (local == NULL) {
+            goto failed;
+        }
+
+        local->sockaddr = ngx_palloc(pool, u->peer.local->socklen);
+        if (local->sockaddr == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(local->sockaddr, u->peer.local->sockaddr,
+                   u->peer.local->socklen);
+        local->socklen = u->peer.local->socklen;
+        ngx_str_null(&local->name);
+
+        s->peer.local = local;
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (u->ssl) {
+        s->ssl = u->conf->ssl;
+        s->ssl_verify = u->conf->ssl_verify;
+
+        /* null-terminated for SSL_set_tlsext_host_name() */
+
+        s->ssl_name.len = ssl_name->len;
+        s->ssl_name.data = ngx_pnalloc(pool, ssl_name->len + 1);
+        if (s->ssl_name.data == NULL) {
+            goto failed;
+        }
+
+        ngx_cpystrn(s->ssl_name.data, ssl_name->data, ssl_name->len + 1);
+    }
+
+#endif
+
+    s->in = ngx_create_temp_buf(pool, 2 * (NGX_HTTP_V2_FRAME_HEADER_SIZE
+                                           + NGX_HTTP_V2_DEFAULT_FRAME_SIZE));
+    if (s->in == NULL) {
+        goto failed;
+    }
+
+    ngx_queue_init(&s->streams);
+    ngx_queue_init(&s->waiting);
+
+    s->max_streams = NGX_HTTP_V2_UPSTREAM_MAX_STREAMS;
+    s->next_sid = 1;
+    s->connect_timeout = u->conf->connect_timeout;
+
+    h2c = &s->h2c;
+
+    h2c->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    h2c->recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    h2c->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    h2c->frame_size = NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
+
+    h2c->hpack_enc.limit = NGX_HTTP_V2_DEFAULT_TABLE_SIZE;
+    h2c->hpack_enc.size = NGX_HTTP_V2_DEFAULT_TABLE_SIZE;
+    h2c->hpack_enc.free = NGX_HTTP_V2_DEFAULT_TABLE_SIZE;
+    h2c->hpack_enc.update = NGX_HTTP_V2_DEFAULT_TABLE_SIZE;
+
+    h2c->state.pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &s->log);
+    if (h2c->state.pool == NULL) {
+        goto failed;
+    }
+
+    *rc = ngx_event_connect_peer(&s->peer);
+
+    if (*rc == NGX_ERROR || *rc == NGX_BUSY || *rc == NGX_DECLINED) {
+        ngx_destroy_pool(h2c->state.pool);
+        ngx_destroy_pool(pool);
+
+        if (*rc == NGX_BUSY) {
+            *rc = NGX_DECLINED;
+        }
+
+        return NULL;
+    }
+
+    c = s->peer.connection;
+
+    c->data = s;
+    c->pool = pool;
+    c->log = &s->log;
+    c->read->log = &s->log;
+    c->write->log = &s->log;
+    c->sendfile = 0;
+
+    h2c->connection = c;
+    s->connection = c;
+
+    c->read->handler = ngx_http_v2_upstream_read_handler;
+    c->write->handler = ngx_http_v2_upstream_connect_handler;
+
+    ngx_queue_insert_tail(&ngx_http_v2_upstream_sessions, &s->queue);
+    s->linked = 1;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &s->log, 0,
+                   "http2 upstream session %p to %V", s, &s->name);
+
+    if (ngx_http_v2_upstream_write(s, (u_char *) NGX_HTTP_V2_PREFACE,
+                                   sizeof(NGX_HTTP_V2_PREFACE) - 1)
+        != NGX_OK
+        || ngx_http_v2_upstream_send_settings(s) != NGX_OK
+        || ngx_http_v2_upstream_send_window_update(s, 0,
+                                                   NGX_HTTP_V2_MAX_WINDOW
+                                                   - NGX_HTTP_V2_DEFAULT_WINDOW)
+           != NGX_OK)
+    {
+        ngx_http_v2_upstream_close(s);
+        *rc = NGX_ERROR;
+        return NULL;
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (s->ssl && ngx_http_v2_upstream_ssl_init(s) != NGX_OK) {
+        ngx_http_v2_upstream_close(s);
+        *rc = NGX_ERROR;
+        return NULL;
+    }
+
+#endif
+
+    if (*rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, s->connect_timeout);
+
+    } else {
+
+        /* connected already, the handler runs after the stream is created */
+
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+
+    return s;
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    *rc = NGX_ERROR;
+
+    return NULL;
+}
+
+
+static ngx_http_v2_upstream_stream_t *
+ngx_http_v2_upstream_create_stream(ngx_http_v2_upstream_session_t *s,
+    ngx_http_request_t *r)
+{
+    ngx_pool_t                     *pool;
+    ngx_connection_t               *fc;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    pool = ngx_create_pool(1024, r->connection->log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    st = ngx_pcalloc(pool, sizeof(ngx_http_v2_upstream_stream_t));
+    if (st == NULL) {
+        ngx_destroy_pool(pool);
+        return NULL;
+    }
+
+    st->pool = pool;
+
+    fc = &st->connection;
+
+    fc->read = &st->read;
+    fc->write = &st->write;
+    fc->pool = pool;
+    fc->log = r->connection->log;
+
+    fc->recv = ngx_http_v2_upstream_recv;
+    fc->recv_chain = ngx_http_v2_upstream_recv_chain;
+    fc->send_chain = ngx_http_v2_upstream_send_chain;
+
+    fc->sendfile = 0;
+    fc->sndlowat = 1;
+    fc->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+    fc->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+
+    st->read.data = fc;
+    st->read.log = fc->log;
+    st->read.active = 1;
+
+    st->write.data = fc;
+    st->write.log = fc->log;
+    st->write.write = 1;
+    st->write.active = 1;
+    st->write.ready = 1;
+
+    ngx_http_v2_upstream_attach(s, st);
+
+    return st;
+}
+
+
+static void
+ngx_http_v2_upstream_attach(ngx_http_v2_upstream_session_t *s,
+    ngx_http_v2_upstream_stream_t *st)
+{
+    ngx_connection_t  *c, *fc;
+
+    c = s->connection;
+    fc = &st->connection;
+
+    st->session = s;
+    st->send_window = s->h2c.init_window;
+    st->recv_window = NGX_HTTP_V2_UPSTREAM_WINDOW;
+
+    fc->fd = c->fd;
+    fc->number = c->number;
+
+#if (NGX_HTTP_SSL)
+    fc->ssl = c->ssl;
+#endif
+
+    if (s->refs++ == 0) {
+        c->idle = 0;
+        ngx_reusable_connection(c, 0);
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+    }
+
+    if (s->ready && s->active < s->max_streams) {
+        st->admitted = 1;
+        s->active++;
+        ngx_queue_insert_tail(&s->streams, &st->queue);
+
+    } else {
+        ngx_queue_insert_tail(&s->waiting, &st->queue);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_retry(ngx_http_v2_upstream_stream_t *st)
+{
+    ngx_int_t                        rc;
+    ngx_http_request_t              *r;
+    ngx_http_v2_upstream_session_t  *s, *old;
+
+    /*
+     * a stream refused by the peer, or not processed before GOAWAY,
+     * is moved to another session unless a part of the body is gone;
+     * this is always safe, and the number of moves is only limited for
+     * sessions that processed no stream at all, e.g., a peer sending
+     * GOAWAY right after the preface, as otherwise the request would
+     * bounce between new connections until it times out
+     */
+
+    if (st->response || st->body_sent || st->done) {
+        return NGX_DECLINED;
+    }
+
+    old = st->session;
+    r = st->connection.data;
+
+    if (!old->processed) {
+
+        if (st->retries == NGX_HTTP_V2_UPSTREAM_RETRIES) {
+            st->unprocessed = 1;
+            return NGX_DECLINED;
+        }
+
+        st->retries++;
+    }
+
+    s = ngx_http_v2_upstream_get_session(r->upstream, &old->ssl_name);
+
+    if (s == NULL) {
+        s = ngx_http_v2_upstream_create_session(r->upstream, &old->ssl_name,
+                                                &rc);
+        if (s == NULL) {
+            return NGX_DECLINED;
+        }
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, st->connection.log, 0,
+                   "http2 upstream retry stream %p sid:%ui "
+                   "session %p to %p", st, st->sid, old, s);
+
+    if (st->admitted) {
+        old->active--;
+    }
+
+    ngx_queue_remove(&st->queue);
+
+    st->sid = 0;
+    st->recv_unacked = 0;
+    st->admitted = 0;
+    st->headers_sent = 0;
+    st->out_closed = 0;
+    st->blocked = 0;
+
+    /* the session is closed by the read handler or becomes idle */
+
+    if (--old->refs == 0 && !old->h2c.goaway && !old->error) {
+        ngx_http_v2_upstream_idle(old);
+    }
+
+    ngx_http_v2_upstream_attach(s, st);
+
+    if (st->admitted) {
+        ngx_http_v2_upstream_admit(st);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_upstream_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_v2_upstream_peer_data_t  *pd = data;
+
+    if (pd->stream) {
+        ngx_http_v2_upstream_release(pd->stream);
+
+        pd->stream = NULL;
+        pc->connection = NULL;
+    }
+
+    pd->free(pc, pd->data, state);
+}
+
+
+static void
+ngx_http_v2_upstream_release(ngx_http_v2_upstream_stream_t *st)
+{
+    ngx_connection_t                *fc;
+    ngx_http_v2_upstream_session_t  *s;
+
+    s = st->session;
+    fc = &st->connection;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, &s->log, 0,
+                   "http2 upstream release stream %p sid:%ui done:%ui",
+                   st, st->sid, (ngx_uint_t) st->done);
+
+    if (st->admitted && !st->done) {
+
+        if (st->sid && !s->error) {
+            (void) ngx_http_v2_upstream_send_rst_stream(s, st->sid,
+                                                        NGX_HTTP_V2_CANCEL);
+            ngx_http_v2_upstream_post_send(s);
+        }
+
+        ngx_http_v2_upstream_stream_done(st);
+    }
+
+    ngx_queue_remove(&st->queue);
+
+    if (fc->read->timer_set) {
+        ngx_del_timer(fc->read);
+    }
+
+    if (fc->write->timer_set) {
+        ngx_del_timer(fc->write);
+    }
+
+    if (fc->read->posted) {
+        ngx_delete_posted_event(fc->read);
+    }
+
+    if (fc->write->posted) {
+        ngx_delete_posted_event(fc->write);
+    }
+
+    ngx_destroy_pool(st->pool);
+
+    if (--s->refs) {
+        return;
+    }
+
+    if (s->error || s->h2c.goaway || ngx_exiting || ngx_terminate) {
+        ngx_http_v2_upstream_close(s);
+        return;
+    }
+
+    ngx_http_v2_upstream_idle(s);
+}
+
+
+static void
+ngx_http_v2_upstream_idle(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_connection_t  *c;
+
+    c = s->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 upstream session %p idle", s);
+
+    c->idle = 1;
+    ngx_reusable_connection(c, 1);
+
+    c->read->cancelable = 1;
+    ngx_add_timer(c->read, NGX_HTTP_V2_UPSTREAM_IDLE_TIMEOUT);
+}
+
+
+static void
+ngx_http_v2_upstream_connect_handler(ngx_event_t *wev)
+{
+    ngx_connection_t                *c;
+    ngx_http_v2_upstream_session_t  *s;
+
+    c = wev->data;
+    s = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream timed out");
+        ngx_http_v2_upstream_fail(s);
+        return;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    if (ngx_http_v2_upstream_test_connect(c) != NGX_OK) {
+        ngx_http_v2_upstream_fail(s);
+        return;
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (s->ssl) {
+        ngx_http_v2_upstream_ssl_handshake(c);
+        return;
+    }
+
+#endif
+
+    ngx_http_v2_upstream_connected(s);
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        /*
+         * BSDs and Linux return 0 and set a pending error in err
+         * Solaris returns -1 and sets errno
+         */
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HTTP_SSL)
+
+static ngx_int_t
+ngx_http_v2_upstream_ssl_init(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_connection_t  *c;
+
+    c = s->connection;
+
+    if (ngx_ssl_create_connection(s->ssl, c, NGX_SSL_BUFFER|NGX_SSL_CLIENT)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+
+    if (SSL_set_alpn_protos(c->ssl->connection,
+                            (u_char *) NGX_HTTP_V2_ALPN_ADVERTISE,
+                            sizeof(NGX_HTTP_V2_ALPN_ADVERTISE) - 1)
+        != 0)
+    {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0, "SSL_set_alpn_protos() failed");
+        return NGX_ERROR;
+    }
+
+#endif
+
+#ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
+
+    /* as per RFC 6066, literal IPv4 and IPv6 addresses are not permitted */
+
+    if (s->ssl_name.len
+        && s->ssl_name.data[0] != '['
+        && ngx_inet_addr(s->ssl_name.data, s->ssl_name.len) == INADDR_NONE
+        && SSL_set_tlsext_host_name(c->ssl->connection,
+                                    (char *) s->ssl_name.data)
+           == 0)
+    {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_set_tlsext_host_name(\"%s\") failed",
+                      s->ssl_name.data);
+        return NGX_ERROR;
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_upstream_ssl_handshake(ngx_connection_t *c)
+{
+    long                             rc;
+    ngx_http_v2_upstream_session_t  *s;
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+    unsigned int                     len;
+    const unsigned char             *data;
+#endif
+
+    s = c->data;
+
+    if (!c->ssl->handshaked) {
+
+        if (c->ssl->handler == NULL) {
+            c->log->action = "SSL handshaking to upstream";
+
+            rc = ngx_ssl_handshake(c);
+
+            if (rc == NGX_AGAIN) {
+                if (!c->write->timer_set) {
+                    ngx_add_timer(c->write, s->connect_timeout);
+                }
+
+                c->ssl->handler = ngx_http_v2_upstream_ssl_handshake;
+                return;
+            }
+
+            if (rc == NGX_OK) {
+                ngx_http_v2_upstream_ssl_handshake(c);
+                return;
+            }
+        }
+
+        if (c->write->timedout) {
+            ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                          "upstream timed out");
+        }
+
+        ngx_http_v2_upstream_fail(s);
+        return;
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (s->ssl_verify) {
+        rc = SSL_get_verify_result(c->ssl->connection);
+
+        if (rc != X509_V_OK) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream SSL certificate verify error: (%l:%s)",
+                          rc, X509_verify_cert_error_string(rc));
+            ngx_http_v2_upstream_fail(s);
+            return;
+        }
+
+        if (ngx_ssl_check_host(c, &s->ssl_name) != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream SSL certificate does not match \"%V\"",
+                          &s->ssl_name);
+            ngx_http_v2_upstream_fail(s);
+            return;
+        }
+    }
+
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+
+    SSL_get0_alpn_selected(c->ssl->connection, &data, &len);
+
+    if (len != 2 || ngx_strncmp(data, "h2", 2) != 0) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "upstream did not negotiate HTTP/2 with ALPN");
+        ngx_http_v2_upstream_fail(s);
+        return;
+    }
+
+#endif
+
+    c->sendfile = 0;
+
+    ngx_http_v2_upstream_connected(s);
+}
+
+#endif
+
+
+static void
+ngx_http_v2_upstream_connected(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_connection_t  *c;
+
+    c = s->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 upstream session %p connected", s);
+
+    s->connected = 1;
+    c->log->action = NULL;
+
+    /* the requests affected by an error of the connection log it */
+
+    c->log_error = NGX_ERROR_INFO;
+
+    c->read->handler = ngx_http_v2_upstream_read_handler;
+    c->write->handler = ngx_http_v2_upstream_write_handler;
+
+    if (ngx_http_v2_upstream_send(s) != NGX_OK) {
+        ngx_http_v2_upstream_fail(s);
+        return;
+    }
+
+    /* the peer settings may have arrived while connecting */
+
+    if (c->read->ready) {
+        ngx_http_v2_upstream_read_handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_read_handler(ngx_event_t *rev)
+{
+    ssize_t                          n;
+    ngx_buf_t                       *b;
+    ngx_connection_t                *c;
+    ngx_http_v2_upstream_session_t  *s;
+
+    c = rev->data;
+    s = c->data;
+
+    if (rev->timedout || c->close) {
+        rev->timedout = 0;
+
+        if (s->refs == 0) {
+            ngx_http_v2_upstream_close(s);
+            return;
+        }
+
+        /* shutting down, the streams are completed first */
+
+        s->h2c.goaway = 1;
+
+        if (s->linked) {
+            ngx_queue_remove(&s->queue);
+            s->linked = 0;
+        }
+
+        return;
+    }
+
+    if (!s->connected) {
+        return;
+    }
+
+    b = s->in;
+
+    do {
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+
+            if (s->refs == 0) {
+                ngx_http_v2_upstream_close(s);
+                return;
+            }
+
+            if (n == 0) {
+                ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                              "upstream closed connection");
+            }
+
+            ngx_http_v2_upstream_fail(s);
+            return;
+        }
+
+        b->last += n;
+
+        if (ngx_http_v2_upstream_process(s) != NGX_OK) {
+            ngx_http_v2_upstream_fail(s);
+            return;
+        }
+
+        /* all streams were moved after GOAWAY */
+
+        if (s->refs == 0 && s->h2c.goaway) {
+            ngx_http_v2_upstream_close(s);
+            return;
+        }
+
+    } while (rev->ready);
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_v2_upstream_fail(s);
+        return;
+    }
+
+    if (ngx_http_v2_upstream_send(s) != NGX_OK) {
+        ngx_http_v2_upstream_fail(s);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t                *c;
+    ngx_http_v2_upstream_session_t  *s;
+
+    c = wev->data;
+    s = c->data;
+
+    if (ngx_http_v2_upstream_send(s) != NGX_OK) {
+        ngx_http_v2_upstream_fail(s);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_empty_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http2 upstream empty handler");
+
+    return;
+}
+
+
+static void
+ngx_http_v2_upstream_fail(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_queue_t                    *q, *next;
+    ngx_connection_t               *c;
+    ngx_http_request_t             *r;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    c = s->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 upstream session %p failed, streams:%ui",
+                   s, s->refs);
+
+    if (s->refs == 0) {
+        ngx_http_v2_upstream_close(s);
+        return;
+    }
+
+    s->error = 1;
+
+    if (s->linked) {
+        ngx_queue_remove(&s->queue);
+        s->linked = 0;
+    }
+
+    /*
+     * the socket is kept open until the last stream is released,
+     * the fake connections still refer to it
+     */
+
+    c->read->handler = ngx_http_v2_upstream_empty_handler;
+    c->write->handler = ngx_http_v2_upstream_empty_handler;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (c->write->posted) {
+        ngx_delete_posted_event(c->write);
+    }
+
+    /*
+     * the streams without response on a connection that worked go to
+     * another one, as ngx_http_upstream_next() would retry them; a failed
+     * connect is left to the upstream module instead
+     */
+
+    for (q = ngx_queue_head(&s->streams);
+         q != ngx_queue_sentinel(&s->streams);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        r = st->connection.data;
+
+        if (s->ready
+            && (st->sid == 0
+                || !(r->method & (NGX_HTTP_POST|NGX_HTTP_LOCK|NGX_HTTP_PATCH))
+                || (r->upstream->conf->next_upstream
+                    & NGX_HTTP_UPSTREAM_FT_NON_IDEMPOTENT))
+            && ngx_http_v2_upstream_retry(st) == NGX_OK)
+        {
+            continue;
+        }
+
+        st->error = 1;
+        ngx_http_v2_upstream_post_read(st);
+        ngx_http_v2_upstream_post_write(st);
+    }
+
+    for (q = ngx_queue_head(&s->waiting);
+         q != ngx_queue_sentinel(&s->waiting);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        if (s->ready && ngx_http_v2_upstream_retry(st) == NGX_OK) {
+            continue;
+        }
+
+        st->error = 1;
+        ngx_http_v2_upstream_post_read(st);
+        ngx_http_v2_upstream_post_write(st);
+    }
+
+    if (s->refs == 0) {
+        ngx_http_v2_upstream_close(s);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_close(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_connection_t  *c;
+
+    c = s->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 upstream close session %p", s);
+
+    if (s->linked) {
+        ngx_queue_remove(&s->queue);
+        s->linked = 0;
+    }
+
+    if (s->connected && !s->error) {
+        if (ngx_http_v2_upstream_send_goaway(s, NGX_HTTP_V2_NO_ERROR)
+            == NGX_OK)
+        {
+            (void) ngx_http_v2_upstream_send(s);
+        }
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        (void) ngx_ssl_shutdown(c);
+    }
+
+#endif
+
+    ngx_close_connection(c);
+
+    ngx_destroy_pool(s->h2c.state.pool);
+    ngx_destroy_pool(s->pool);
+}
+
+
+static u_char *
+ngx_http_v2_upstream_log_error(ngx_log_t *log, u_char *buf, size_t len)
+{
+    u_char                          *p;
+    ngx_http_v2_upstream_session_t  *s;
+
+    s = log->data;
+
+    p = buf;
+
+    if (log->action) {
+        p = ngx_snprintf(buf, len, " while %s", log->action);
+        len -= p - buf;
+        buf = p;
+    }
+
+    return ngx_snprintf(buf, len, ", http2 upstream: \"%V\"", &s->name);
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_process(ngx_http_v2_upstream_session_t *s)
+{
+    u_char      *p;
+    size_t       len, rest;
+    uint32_t     head;
+    ngx_int_t    rc;
+    ngx_buf_t   *b;
+    ngx_uint_t   type, flags, sid;
+
+    b = s->in;
+
+    while (b->last - b->pos >= NGX_HTTP_V2_FRAME_HEADER_SIZE) {
+
+        p = b->pos;
+
+        head = ngx_http_v2_parse_uint32(p);
+
+        len = ngx_http_v2_parse_length(head);
+        type = ngx_http_v2_parse_type(head);
+        flags = p[4];
+        sid = ngx_http_v2_parse_sid(&p[5]);
+
+        if (len > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+            ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                          "upstream sent too large frame: %uz", len);
+            return ngx_http_v2_upstream_connection_error(s,
+                                                     NGX_HTTP_V2_SIZE_ERROR);
+        }
+
+        if ((size_t) (b->last - p) < NGX_HTTP_V2_FRAME_HEADER_SIZE + len) {
+            break;
+        }
+
+        p += NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, s->connection->log, 0,
+                       "http2 upstream frame type:%ui f:%Xi l:%uz sid:%ui",
+                       type, flags, len, sid);
+
+        if (s->hblock_sid && type != NGX_HTTP_V2_CONTINUATION_FRAME) {
+            ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                          "upstream sent frame of type %ui "
+                          "instead of CONTINUATION", type);
+            return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+        }
+
+        switch (type) {
+
+        case NGX_HTTP_V2_DATA_FRAME:
+            rc = ngx_http_v2_upstream_state_data(s, flags, sid, p, len);
+            break;
+
+        case NGX_HTTP_V2_HEADERS_FRAME:
+        case NGX_HTTP_V2_CONTINUATION_FRAME:
+            rc = ngx_http_v2_upstream_state_headers(s, type, flags, sid, p,
+                                                    len);
+            break;
+
+        case NGX_HTTP_V2_RST_STREAM_FRAME:
+            rc = ngx_http_v2_upstream_state_rst_stream(s, sid, p, len);
+            break;
+
+        case NGX_HTTP_V2_SETTINGS_FRAME:
+            rc = ngx_http_v2_upstream_state_settings(s, flags, sid, p, len);
+            break;
+
+        case NGX_HTTP_V2_PUSH_PROMISE_FRAME:
+            ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                          "upstream sent PUSH_PROMISE though push "
+                          "is disabled");
+            rc = ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+            break;
+
+        case NGX_HTTP_V2_PING_FRAME:
+            rc = ngx_http_v2_upstream_state_ping(s, flags, sid, p, len);
+            break;
+
+        case NGX_HTTP_V2_GOAWAY_FRAME:
+            rc = ngx_http_v2_upstream_state_goaway(s, sid, p, len);
+            break;
+
+        case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+            rc = ngx_http_v2_upstream_state_window_update(s, sid, p, len);
+            break;
+
+        default: /* PRIORITY and unknown frames */
+            rc = NGX_OK;
+        }
+
+        if (rc != NGX_OK) {
+            return rc;
+        }
+
+        b->pos = p + len;
+    }
+
+    rest = b->last - b->pos;
+
+    if (rest == 0) {
+        b->pos = b->start;
+        b->last = b->start;
+
+    } else if ((size_t) (b->end - b->pos)
+               < NGX_HTTP_V2_FRAME_HEADER_SIZE + NGX_HTTP_V2_DEFAULT_FRAME_SIZE)
+    {
+        ngx_memmove(b->start, b->pos, rest);
+        b->pos = b->start;
+        b->last = b->start + rest;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_state_data(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t flags, ngx_uint_t sid, u_char *pos, size_t len)
+{
+    size_t                          size, padding;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (sid == 0) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent DATA frame with incorrect identifier");
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    size = len;
+    padding = 0;
+
+    if (flags & NGX_HTTP_V2_PADDED_FLAG) {
+
+        if (len == 0 || (size_t) *pos >= len) {
+            ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                          "upstream sent padded DATA frame "
+                          "with incorrect length: %uz", len);
+            return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+        }
+
+        padding = *pos++;
+        size = len - 1 - padding;
+    }
+
+    if (len > s->h2c.recv_window) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream violated connection flow control: "
+                      "received DATA frame length %uz, available window %uz",
+                      len, s->h2c.recv_window);
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_FLOW_CTRL_ERROR);
+    }
+
+    s->h2c.recv_window -= len;
+
+    if (s->h2c.recv_window < NGX_HTTP_V2_MAX_WINDOW / 4) {
+        if (ngx_http_v2_upstream_send_window_update(s, 0,
+                                                    NGX_HTTP_V2_MAX_WINDOW
+                                                    - s->h2c.recv_window)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        s->h2c.recv_window = NGX_HTTP_V2_MAX_WINDOW;
+    }
+
+    st = ngx_http_v2_upstream_find_stream(s, sid);
+
+    if (st == NULL || st->done || st->in_closed) {
+        /* cancelled or reset stream */
+        return NGX_OK;
+    }
+
+    if (!st->response) {
+        ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                      "upstream sent DATA frame before response header");
+        ngx_http_v2_upstream_stream_error(st, NGX_HTTP_V2_PROTOCOL_ERROR);
+        return NGX_OK;
+    }
+
+    if (len > st->recv_window) {
+        ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                      "upstream violated stream flow control: "
+                      "received DATA frame length %uz, available window %uz",
+                      len, st->recv_window);
+        ngx_http_v2_upstream_stream_error(st, NGX_HTTP_V2_FLOW_CTRL_ERROR);
+        return NGX_OK;
+    }
+
+    st->recv_window -= len;
+    st->recv_unacked += len - size;
+
+    if (size && ngx_http_v2_upstream_append(st, pos, size) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (flags & NGX_HTTP_V2_END_STREAM_FLAG) {
+        ngx_http_v2_upstream_close_input(st);
+    }
+
+    ngx_http_v2_upstream_post_read(st);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_state_headers(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid, u_char *pos,
+    size_t len)
+{
+    size_t  padding;
+
+    if (type == NGX_HTTP_V2_HEADERS_FRAME) {
+
+        if (sid == 0) {
+            ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                          "upstream sent HEADERS frame "
+                          "with incorrect identifier");
+            return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+        }
+
+        if (flags & NGX_HTTP_V2_PADDED_FLAG) {
+
+            if (len == 0 || (size_t) *pos >= len) {
+                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                              "upstream sent padded HEADERS frame "
+                              "with incorrect length: %uz", len);
+                return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+            }
+
+            padding = *pos++;
+            len -= 1 + padding;
+        }
+
+        if (flags & NGX_HTTP_V2_PRIORITY_FLAG) {
+
+            if (len < NGX_HTTP_V2_PRIORITY_SIZE) {
+                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                              "upstream sent HEADERS frame "
+                              "with incorrect length: %uz", len);
+                return ngx_http_v2_upstream_connection_error(s,
+                                                     NGX_HTTP_V2_SIZE_ERROR);
+            }
+
+            pos += NGX_HTTP_V2_PRIORITY_SIZE;
+            len -= NGX_HTTP_V2_PRIORITY_SIZE;
+        }
+
+        s->hblock_sid = sid;
+        s->hblock_len = 0;
+        s->hblock_end_stream = (flags & NGX_HTTP_V2_END_STREAM_FLAG) ? 1 : 0;
+
+    } else if (s->hblock_sid == 0 || sid != s->hblock_sid) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent unexpected CONTINUATION frame");
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    if (s->hblock_len + len > NGX_HTTP_V2_UPSTREAM_HEADERS_LIMIT) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent too large header block");
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_INTERNAL_ERROR);
+    }
+
+    if (s->hblock == NULL) {
+        s->hblock = ngx_pnalloc(s->pool, NGX_HTTP_V2_UPSTREAM_HEADERS_LIMIT);
+        if (s->hblock == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_memcpy(s->hblock + s->hblock_len, pos, len);
+    s->hblock_len += len;
+
+    if (!(flags & NGX_HTTP_V2_END_HEADERS_FLAG)) {
+        return NGX_OK;
+    }
+
+    return ngx_http_v2_upstream_process_headers(s);
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_state_rst_stream(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t sid, u_char *pos, size_t len)
+{
+    ngx_uint_t                      status;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (len != NGX_HTTP_V2_RST_STREAM_SIZE || sid == 0) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent incorrect RST_STREAM frame");
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    status = ngx_http_v2_parse_uint32(pos);
+
+    st = ngx_http_v2_upstream_find_stream(s, sid);
+
+    if (st == NULL || st->done) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, st->connection.log, 0,
+                   "http2 upstream RST_STREAM sid:%ui status:%ui",
+                   sid, status);
+
+    if (status == NGX_HTTP_V2_NO_ERROR && st->in_closed) {
+
+        /* the response is complete, the rest of the body is not needed */
+
+        st->out_closed = 1;
+
+    } else if (status == NGX_HTTP_V2_REFUSED_STREAM
+               && ngx_http_v2_upstream_retry(st) == NGX_OK)
+    {
+        return NGX_OK;
+
+    } else {
+        st->error = 1;
+        st->reset = 1;
+        st->reset_code = status;
+    }
+
+    ngx_http_v2_upstream_stream_done(st);
+
+    ngx_http_v2_upstream_post_read(st);
+    ngx_http_v2_upstream_post_write(st);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_state_settings(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t flags, ngx_uint_t sid, u_char *pos, size_t len)
+{
+    ssize_t                         window_delta;
+    ngx_uint_t                      id, value;
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (sid != 0) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent SETTINGS frame "
+                      "with incorrect identifier");
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    if (flags & NGX_HTTP_V2_ACK_FLAG) {
+
+        if (len != 0) {
+            ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                          "upstream sent SETTINGS frame with the ACK flag "
+                          "and nonzero length");
+            return ngx_http_v2_upstream_connection_error(s,
+                                                     NGX_HTTP_V2_SIZE_ERROR);
+        }
+
+        return NGX_OK;
+    }
+
+    if (len % NGX_HTTP_V2_SETTINGS_PARAM_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent SETTINGS frame with incorrect "
+                      "length %uz", len);
+        return ngx_http_v2_upstream_connection_error(s,
+                                                     NGX_HTTP_V2_SIZE_ERROR);
+    }
+
+    window_delta = 0;
+
+    for ( /* void */ ; len; len -= NGX_HTTP_V2_SETTINGS_PARAM_SIZE) {
+
+        id = ngx_http_v2_parse_uint16(pos);
+        value = ngx_http_v2_parse_uint32(&pos[2]);
+
+        pos += NGX_HTTP_V2_SETTINGS_PARAM_SIZE;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, s->connection->log, 0,
+                       "http2 upstream setting %ui:%ui", id, value);
+
+        switch (id) {
+
+        case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
+            ngx_http_v2_table_encoder_size(&s->h2c, value);
+            break;
+
+        case NGX_HTTP_V2_MAX_STREAMS_SETTING:
+            s->max_streams = ngx_min(value, NGX_HTTP_V2_UPSTREAM_MAX_STREAMS);
+            break;
+
+        case NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING:
+
+            if (value > NGX_HTTP_V2_MAX_WINDOW) {
+                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                              "upstream sent SETTINGS frame with incorrect "
+                              "INITIAL_WINDOW_SIZE value %ui", value);
+                return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_FLOW_CTRL_ERROR);
+            }
+
+            window_delta += value - s->h2c.init_window;
+            s->h2c.init_window = value;
+            break;
+
+        case NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING:
+
+            if (value > NGX_HTTP_V2_MAX_FRAME_SIZE
+                || value < NGX_HTTP_V2_DEFAULT_FRAME_SIZE)
+            {
+                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                              "upstream sent SETTINGS frame with incorrect "
+                              "MAX_FRAME_SIZE value %ui", value);
+                return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+            }
+
+            s->h2c.frame_size = value;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (window_delta) {
+        for (q = ngx_queue_head(&s->streams);
+             q != ngx_queue_sentinel(&s->streams);
+             q = ngx_queue_next(q))
+        {
+            st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+            st->send_window += window_delta;
+        }
+
+        for (q = ngx_queue_head(&s->waiting);
+             q != ngx_queue_sentinel(&s->waiting);
+             q = ngx_queue_next(q))
+        {
+            st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+            st->send_window += window_delta;
+        }
+    }
+
+    if (ngx_http_v2_upstream_frame(s, 0, NGX_HTTP_V2_SETTINGS_FRAME,
+                                   NGX_HTTP_V2_ACK_FLAG, 0)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (!s->ready) {
+        s->ready = 1;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, s->connection->log, 0,
+                       "http2 upstream session %p ready, max streams:%ui",
+                       s, s->max_streams);
+    }
+
+    ngx_http_v2_upstream_schedule(s);
+    ngx_http_v2_upstream_unblock(s);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_state_ping(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t flags, ngx_uint_t sid, u_char *pos, size_t len)
+{
+    if (len != NGX_HTTP_V2_PING_SIZE || sid != 0) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent incorrect PING frame");
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    if (flags & NGX_HTTP_V2_ACK_FLAG) {
+        return NGX_OK;
+    }
+
+    if (ngx_http_v2_upstream_frame(s, NGX_HTTP_V2_PING_SIZE,
+                                   NGX_HTTP_V2_PING_FRAME,
+                                   NGX_HTTP_V2_ACK_FLAG, 0)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_v2_upstream_write(s, pos, NGX_HTTP_V2_PING_SIZE);
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_state_goaway(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t sid, u_char *pos, size_t len)
+{
+    ngx_uint_t                      last_sid, status;
+    ngx_queue_t                    *q, *next;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (len < NGX_HTTP_V2_GOAWAY_SIZE || sid != 0) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent incorrect GOAWAY frame");
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    last_sid = ngx_http_v2_parse_sid(pos);
+    status = ngx_http_v2_parse_uint32(&pos[4]);
+
+    if (status != NGX_HTTP_V2_NO_ERROR) {
+        ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
+                      "upstream sent GOAWAY with error %ui", status);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, s->connection->log, 0,
+                   "http2 upstream GOAWAY last sid:%ui status:%ui",
+                   last_sid, status);
+
+    s->h2c.goaway = 1;
+
+    if (last_sid) {
+        s->processed = 1;
+    }
+
+    if (s->linked) {
+        ngx_queue_remove(&s->queue);
+        s->linked = 0;
+    }
+
+    /* the streams not processed by the peer are moved to another session */
+
+    for (q = ngx_queue_head(&s->streams);
+         q != ngx_queue_sentinel(&s->streams);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        if (st->done || (st->sid && st->sid <= last_sid)) {
+            continue;
+        }
+
+        if (ngx_http_v2_upstream_retry(st) == NGX_OK) {
+            continue;
+        }
+
+        st->error = 1;
+        ngx_http_v2_upstream_stream_done(st);
+        ngx_http_v2_upstream_post_read(st);
+        ngx_http_v2_upstream_post_write(st);
+    }
+
+    for (q = ngx_queue_head(&s->waiting);
+         q != ngx_queue_sentinel(&s->waiting);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        if (ngx_http_v2_upstream_retry(st) == NGX_OK) {
+            continue;
+        }
+
+        st->error = 1;
+        ngx_http_v2_upstream_post_read(st);
+        ngx_http_v2_upstream_post_write(st);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_state_window_update(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t sid, u_char *pos, size_t len)
+{
+    size_t                          window;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (len != NGX_HTTP_V2_WINDOW_UPDATE_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent WINDOW_UPDATE frame "
+                      "with incorrect length %uz", len);
+        return ngx_http_v2_upstream_connection_error(s,
+                                                     NGX_HTTP_V2_SIZE_ERROR);
+    }
+
+    window = ngx_http_v2_parse_window(pos);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, s->connection->log, 0,
+                   "http2 upstream WINDOW_UPDATE sid:%ui window:%uz",
+                   sid, window);
+
+    if (sid) {
+        st = ngx_http_v2_upstream_find_stream(s, sid);
+
+        if (st == NULL || st->done) {
+            return NGX_OK;
+        }
+
+        if (window == 0
+            || window > (size_t) (NGX_HTTP_V2_MAX_WINDOW - st->send_window))
+        {
+            ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                          "upstream sent incorrect WINDOW_UPDATE "
+                          "for stream %ui: %uz", sid, window);
+            ngx_http_v2_upstream_stream_error(st,
+                                              NGX_HTTP_V2_FLOW_CTRL_ERROR);
+            return NGX_OK;
+        }
+
+        st->send_window += window;
+
+        if (st->blocked && st->send_window > 0 && s->h2c.send_window) {
+            st->blocked = 0;
+            ngx_http_v2_upstream_post_write(st);
+        }
+
+        return NGX_OK;
+    }
+
+    if (window == 0 || window > NGX_HTTP_V2_MAX_WINDOW - s->h2c.send_window) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "upstream sent incorrect WINDOW_UPDATE "
+                      "for connection: %uz", window);
+        return ngx_http_v2_upstream_connection_error(s,
+                                                 NGX_HTTP_V2_FLOW_CTRL_ERROR);
+    }
+
+    s->h2c.send_window += window;
+
+    ngx_http_v2_upstream_unblock(s);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_process_headers(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_int_t                       rc;
+    ngx_uint_t                      sid, end_stream;
+    ngx_array_t                     headers;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    sid = s->hblock_sid;
+    end_stream = s->hblock_end_stream;
+
+    s->hblock_sid = 0;
+
+    /* the block is always decoded to keep the HPACK table in sync */
+
+    if (ngx_array_init(&headers, s->h2c.state.pool, 16,
+                       sizeof(ngx_http_v2_header_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_v2_upstream_decode(s, s->hblock, s->hblock + s->hblock_len,
+                                     &headers);
+
+    if (rc != NGX_OK) {
+        ngx_reset_pool(s->h2c.state.pool);
+
+        if (rc == NGX_DECLINED) {
+            ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                          "upstream sent invalid header block encoding");
+            return ngx_http_v2_upstream_connection_error(s,
+                                                     NGX_HTTP_V2_COMP_ERROR);
+        }
+
+        return NGX_ERROR;
+    }
+
+    st = ngx_http_v2_upstream_find_stream(s, sid);
+
+    if (st == NULL || st->done || st->in_closed) {
+        ngx_reset_pool(s->h2c.state.pool);
+        return NGX_OK;
+    }
+
+    if (!st->response) {
+        rc = ngx_http_v2_upstream_response(st, &headers);
+
+        if (rc == NGX_ERROR) {
+            ngx_reset_pool(s->h2c.state.pool);
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            ngx_http_v2_upstream_stream_error(st, NGX_HTTP_V2_PROTOCOL_ERROR);
+            ngx_reset_pool(s->h2c.state.pool);
+            return NGX_OK;
+        }
+
+        if (rc == NGX_AGAIN && end_stream) {
+
+            /* an informational response cannot end the stream */
+
+            ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                          "upstream sent informational response "
+                          "with END_STREAM flag");
+            ngx_http_v2_upstream_stream_error(st, NGX_HTTP_V2_PROTOCOL_ERROR);
+            ngx_reset_pool(s->h2c.state.pool);
+            return NGX_OK;
+        }
+    }
+
+    /* trailers are not passed */
+
+    ngx_reset_pool(s->h2c.state.pool);
+
+    if (end_stream) {
+        ngx_http_v2_upstream_close_input(st);
+    }
+
+    ngx_http_v2_upstream_post_read(st);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_decode(ngx_http_v2_upstream_session_t *s, u_char *pos,
+    u_char *end, ngx_array_t *headers)
+{
+    u_char                     ch;
+    ngx_int_t                  value;
+    ngx_uint_t                 indexed, add, prefix;
+    ngx_http_v2_header_t      *h, header;
+    ngx_http_v2_connection_t  *h2c;
+
+    h2c = &s->h2c;
+
+    while (pos < end) {
+
+        ch = *pos;
+
+        indexed = 0;
+        add = 0;
+
+        if (ch >= (1 << 7)) {
+            /* indexed header field */
+            indexed = 1;
+            prefix = 7;
+
+        } else if (ch >= (1 << 6)) {
+            /* literal header field with incremental indexing */
+            add = 1;
+            prefix = 6;
+
+        } else if (ch >= (1 << 5)) {
+            /* dynamic table size update */
+
+            value = ngx_http_v2_upstream_parse_int(&pos, end, 5);
+
+            if (value < 0
+                || ngx_http_v2_table_size(h2c, value) != NGX_OK)
+            {
+                return NGX_DECLINED;
+            }
+
+            continue;
+
+        } else {
+            /* literal header field without indexing */
+            prefix = 4;
+        }
+
+        value = ngx_http_v2_upstream_parse_int(&pos, end, prefix);
+
+        if (value < 0) {
+            return NGX_DECLINED;
+        }
+
+        if (indexed) {
+            if (ngx_http_v2_get_indexed_header(h2c, value, 0) != NGX_OK) {
+                return NGX_DECLINED;
+            }
+
+            header = h2c->state.header;
+
+        } else {
+
+            if (value) {
+                if (ngx_http_v2_get_indexed_header(h2c, value, 1) != NGX_OK) {
+                    return NGX_DECLINED;
+                }
+
+                header.name = h2c->state.header.name;
+
+            } else if (ngx_http_v2_upstream_parse_string(s, &pos, end,
+                                                         &header.name)
+                       != NGX_OK)
+            {
+                return NGX_DECLINED;
+            }
+
+            if (ngx_http_v2_upstream_parse_string(s, &pos, end, &header.value)
+                != NGX_OK)
+            {
+                return NGX_DECLINED;
+            }
+
+            if (add && ngx_http_v2_add_header(h2c, &header) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        h = ngx_array_push(headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        *h = header;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, s->connection->log, 0,
+                       "http2 upstream header: \"%V: %V\"",
+                       &header.name, &header.value);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_parse_int(u_char **pos, u_char *end, ngx_uint_t prefix)
+{
+    u_char      *start, *p;
+    ngx_uint_t   value, octet, shift;
+
+    p = *pos;
+
+    prefix = ngx_http_v2_prefix(prefix);
+    value = *p++ & prefix;
+
+    if (value != prefix) {
+        *pos = p;
+        return value;
+    }
+
+    start = p;
+
+    if (end - start > NGX_HTTP_V2_INT_OCTETS) {
+        end = start + NGX_HTTP_V2_INT_OCTETS;
+    }
+
+    for (shift = 0; p != end; shift += 7) {
+        octet = *p++;
+
+        value += (octet & 0x7f) << shift;
+
+        if (octet < 128) {
+            *pos = p;
+            return value;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_parse_string(ngx_http_v2_upstream_session_t *s,
+    u_char **pos, u_char *end, ngx_str_t *str)
+{
+    u_char     *p, *dst, state;
+    ngx_int_t   len;
+    ngx_uint_t  huff;
+
+    p = *pos;
+
+    if (p == end) {
+        return NGX_ERROR;
+    }
+
+    huff = *p >> 7;
+
+    len = ngx_http_v2_upstream_parse_int(&p, end, 7);
+
+    if (len < 0 || end - p < len) {
+        return NGX_ERROR;
+    }
+
+    if (huff) {
+        dst = ngx_pnalloc(s->h2c.state.pool, len * 8 / 5 + 1);
+        if (dst == NULL) {
+            return NGX_ERROR;
+        }
+
+        str->data = dst;
+        state = 0;
+
+        if (ngx_http_v2_huff_decode(&state, p, len, &dst, 1,
+                                    s->connection->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        str->len = dst - str->data;
+
+    } else {
+        str->data = p;
+        str->len = len;
+    }
+
+    *pos = p + len;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_response(ngx_http_v2_upstream_stream_t *st,
+    ngx_array_t *headers)
+{
+    u_char                *p, *start, ch;
+    size_t                 len;
+    ngx_int_t              status;
+    ngx_str_t             *name;
+    ngx_uint_t             i, k;
+    ngx_http_v2_header_t  *h;
+
+    static ngx_str_t  skip[] = {
+        ngx_string("connection"),
+        ngx_string("keep-alive"),
+        ngx_string("proxy-connection"),
+        ngx_string("transfer-encoding"),
+        ngx_string("upgrade"),
+        ngx_null_string
+    };
+
+    h = headers->elts;
+
+    status = NGX_ERROR;
+    len = sizeof("HTTP/1.1 000" CRLF CRLF) - 1;
+
+    for (i = 0; i < headers->nelts; i++) {
+
+        if (h[i].name.len == 0) {
+            goto invalid;
+        }
+
+        for (k = 0; k < h[i].name.len; k++) {
+            ch = h[i].name.data[k];
+
+            if ((ch >= 'A' && ch <= 'Z') || ch <= ' ' || ch == 0x7f
+                || (ch == ':' && k != 0))
+            {
+                goto invalid;
+            }
+        }
+
+        for (k = 0; k < h[i].value.len; k++) {
+            ch = h[i].value.data[k];
+
+            if (ch == '\0' || ch == CR || ch == LF) {
+                goto invalid;
+            }
+        }
+
+        if (h[i].name.data[0] == ':') {
+
+            if (h[i].name.len == sizeof(":status") - 1
+                && ngx_strncmp(h[i].name.data, ":status",
+                               sizeof(":status") - 1) == 0)
+            {
+                if (h[i].value.len != 3) {
+                    goto invalid;
+                }
+
+                status = ngx_atoi(h[i].value.data, 3);
+
+                /* there is no protocol switch in HTTP/2 */
+
+                if (status < 100 || status == NGX_HTTP_SWITCHING_PROTOCOLS) {
+                    goto invalid;
+                }
+            }
+
+            continue;
+        }
+
+        len += h[i].name.len + sizeof(": ") - 1
+               + h[i].value.len + sizeof(CRLF) - 1;
+    }
+
+    if (status == NGX_ERROR) {
+        goto invalid;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, st->connection.log, 0,
+                   "http2 upstream response status: %i", status);
+
+    if (status < 200) {
+        return NGX_AGAIN;
+    }
+
+    start = ngx_pnalloc(st->session->h2c.state.pool, len);
+    if (start == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_sprintf(start, "HTTP/1.1 %03i" CRLF, status);
+
+    for (i = 0; i < headers->nelts; i++) {
+
+        if (h[i].name.data[0] == ':') {
+            continue;
+        }
+
+        for (name = skip; name->len; name++) {
+            if (h[i].name.len == name->len
+                && ngx_strncmp(h[i].name.data, name->data, name->len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (name->len) {
+            continue;
+        }
+
+        p = ngx_cpymem(p, h[i].name.data, h[i].name.len);
+        *p++ = ':'; *p++ = ' ';
+        p = ngx_cpymem(p, h[i].value.data, h[i].value.len);
+        *p++ = CR; *p++ = LF;
+    }
+
+    *p++ = CR; *p++ = LF;
+
+    st->response = 1;
+    st->text = p - start;
+
+    st->session->processed = 1;
+
+    if (ngx_http_v2_upstream_append(st, start, p - start) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                  "upstream sent invalid response header");
+
+    return NGX_DECLINED;
+}
+
+
+static ssize_t
+ngx_http_v2_upstream_recv(ngx_connection_t *fc, u_char *buf, size_t size)
+{
+    size_t                           n, text, rest;
+    ngx_buf_t                       *b;
+    ngx_chain_t                     *cl;
+    ngx_event_t                     *rev;
+    ngx_http_v2_upstream_stream_t   *st;
+    ngx_http_v2_upstream_session_t  *s;
+
+    st = (ngx_http_v2_upstream_stream_t *) fc;
+    s = st->session;
+    rev = fc->read;
+
+    n = 0;
+
+    while (st->in && n < size) {
+        cl = st->in;
+        b = cl->buf;
+
+        rest = ngx_min((size_t) (b->last - b->pos), size - n);
+
+        buf = ngx_cpymem(buf, b->pos, rest);
+        b->pos += rest;
+        n += rest;
+
+        if (b->pos == b->last) {
+            st->in = cl->next;
+
+            if (st->in == NULL) {
+                st->in_last = NULL;
+            }
+
+            b->pos = b->start;
+            b->last = b->start;
+
+            cl->next = st->free;
+            st->free = cl;
+        }
+    }
+
+    if (n) {
+        text = ngx_min(n, st->text);
+        st->text -= text;
+        st->recv_unacked += n - text;
+
+        if (st->recv_unacked >= NGX_HTTP_V2_UPSTREAM_WINDOW / 4
+            && !st->in_closed && !st->done && !s->error)
+        {
+            if (ngx_http_v2_upstream_send_window_update(s, st->sid,
+                                                        st->recv_unacked)
+                != NGX_OK)
+            {
+                rev->error = 1;
+                return NGX_ERROR;
+            }
+
+            st->recv_window += st->recv_unacked;
+            st->recv_unacked = 0;
+
+            ngx_http_v2_upstream_post_send(s);
+        }
+
+        rev->ready = (st->in || st->in_closed || st->error) ? 1 : 0;
+
+        return n;
+    }
+
+    rev->ready = 0;
+
+    if (st->in_closed) {
+        rev->eof = 1;
+        return 0;
+    }
+
+    if (st->error || s->error) {
+
+        ngx_http_v2_upstream_log_stream_error(st);
+
+        rev->error = 1;
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_v2_upstream_recv_chain(ngx_connection_t *fc, ngx_chain_t *cl,
+    off_t limit)
+{
+    size_t      size;
+    ssize_t     n, total;
+    ngx_buf_t  *b;
+
+    total = 0;
+
+    for ( /* void */ ; cl; cl = cl->next) {
+
+        b = cl->buf;
+        size = b->end - b->last;
+
+        if (limit && (off_t) (total + size) > limit) {
+            size = (size_t) (limit - total);
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        /* like ngx_readv_chain(), the caller moves b->last */
+
+        n = ngx_http_v2_upstream_recv(fc, b->last, size);
+
+        if (n <= 0) {
+            return total ? total : n;
+        }
+
+        total += n;
+
+        if ((size_t) n < size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ngx_chain_t *
+ngx_http_v2_upstream_send_chain(ngx_connection_t *fc, ngx_chain_t *in,
+    off_t limit)
+{
+    off_t                            size;
+    size_t                           window;
+    ngx_buf_t                       *b;
+    ngx_uint_t                       fin;
+    ngx_http_v2_upstream_stream_t   *st;
+    ngx_http_v2_upstream_session_t  *s;
+
+    st = (ngx_http_v2_upstream_stream_t *) fc;
+    s = st->session;
+
+    if (st->error || s->error) {
+
+        ngx_http_v2_upstream_log_stream_error(st);
+
+        fc->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (!st->admitted) {
+        /* the stream waits for a slot, see ngx_http_v2_upstream_schedule() */
+
+        fc->write->ready = 0;
+        fc->buffered = 1;
+
+        return in;
+    }
+
+    for ( /* void */ ; in; in = in->next) {
+
+        b = in->buf;
+
+        if (st->out_closed) {
+            b->pos = b->last;
+            continue;
+        }
+
+        if (!st->headers_sent) {
+
+            if (ngx_buf_special(b)) {
+                continue;
+            }
+
+            if (ngx_http_v2_upstream_read_header(st, b) != NGX_OK) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (!st->headers_sent) {
+                continue;
+            }
+        }
+
+        while (b->pos < b->last) {
+
+            if (st->body_rest == 0) {
+                /* more than Content-Length */
+                b->pos = b->last;
+                break;
+            }
+
+            window = ngx_min(s->h2c.send_window, s->h2c.frame_size);
+
+            if (st->send_window <= 0
+                || window == 0
+                || s->out_size >= NGX_HTTP_V2_UPSTREAM_OUTPUT_LIMIT)
+            {
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                               "http2 upstream stream sid:%ui blocked",
+                               st->sid);
+
+                st->blocked = 1;
+                fc->write->ready = 0;
+                fc->buffered = 1;
+
+                ngx_http_v2_upstream_post_send(s);
+
+                return in;
+            }
+
+            size = b->last - b->pos;
+
+            if (st->body_rest > 0 && size > st->body_rest) {
+                size = st->body_rest;
+            }
+
+            if (size > (off_t) window) {
+                size = window;
+            }
+
+            if (size > st->send_window) {
+                size = st->send_window;
+            }
+
+            if (st->body_rest > 0) {
+                st->body_rest -= size;
+            }
+
+            fin = (st->body_rest == 0
+                   || (st->body_rest < 0 && b->last_buf
+                       && b->pos + size == b->last));
+
+            if (ngx_http_v2_upstream_frame(s, (size_t) size,
+                                           NGX_HTTP_V2_DATA_FRAME,
+                                           fin ? NGX_HTTP_V2_END_STREAM_FLAG
+                                               : NGX_HTTP_V2_NO_FLAG,
+                                           st->sid)
+                    != NGX_OK
+                || ngx_http_v2_upstream_write(s, b->pos, (size_t) size)
+                   != NGX_OK)
+            {
+                return NGX_CHAIN_ERROR;
+            }
+
+            b->pos += size;
+            fc->sent += size;
+            st->body_sent = 1;
+
+            s->h2c.send_window -= size;
+            st->send_window -= size;
+
+            if (fin) {
+                st->out_closed = 1;
+            }
+        }
+
+        if (b->last_buf && !st->out_closed) {
+
+            if (ngx_http_v2_upstream_frame(s, 0, NGX_HTTP_V2_DATA_FRAME,
+                                           NGX_HTTP_V2_END_STREAM_FLAG,
+                                           st->sid)
+                != NGX_OK)
+            {
+                return NGX_CHAIN_ERROR;
+            }
+
+            st->body_sent = 1;
+            st->out_closed = 1;
+        }
+
+        if (st->out_closed && st->in_closed) {
+            ngx_http_v2_upstream_stream_done(st);
+        }
+    }
+
+    ngx_http_v2_upstream_post_send(s);
+
+    /*
+     * the end of the body is signalled with END_STREAM, so the last empty
+     * buffer must reach us; ngx_chain_writer() skips an empty chain unless
+     * the connection has buffered data
+     */
+
+    fc->buffered = st->out_closed ? 0 : 1;
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_read_header(ngx_http_v2_upstream_stream_t *st,
+    ngx_buf_t *b)
+{
+    u_char     *p;
+    size_t      size, n;
+    ngx_buf_t  *h;
+
+    h = st->header;
+    size = b->last - b->pos;
+
+    if (h == NULL || (size_t) (h->end - h->last) < size) {
+        n = ngx_max(2 * (h ? (size_t) (h->end - h->start) : 0),
+                    size + (h ? (size_t) (h->last - h->start) : 0));
+
+        h = ngx_create_temp_buf(st->pool, ngx_max(n, 1024));
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (st->header) {
+            h->last = ngx_cpymem(h->last, st->header->pos,
+                                 st->header->last - st->header->pos);
+        }
+
+        st->header = h;
+    }
+
+    p = h->last;
+    h->last = ngx_cpymem(h->last, b->pos, size);
+    b->pos = b->last;
+
+    /* the previous data may end with a part of the terminator */
+
+    p = (p - h->pos > 3) ? p - 3 : h->pos;
+
+    p = ngx_strlcasestrn(p, h->last, (u_char *) CRLF CRLF,
+                         sizeof(CRLF CRLF) - 1 - 1);
+
+    if (p == NULL) {
+        return NGX_OK;
+    }
+
+    /* the bytes after the header are the body, they are returned */
+
+    p += sizeof(CRLF CRLF) - 1;
+
+    b->pos -= h->last - p;
+    h->last = p;
+
+    st->header_done = 1;
+
+    return ngx_http_v2_upstream_create_headers(st);
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_create_headers(ngx_http_v2_upstream_stream_t *st)
+{
+    u_char                          *p, *end, *eol, *colon, *pos, *start,
+                                    *tmp, type, flags;
+    size_t                           len, rest, tmp_len;
+    ngx_str_t                        method, path, authority, name, value,
+                                     scheme;
+    ngx_uint_t                       i, skip, indexing;
+    ngx_array_t                      headers;
+    ngx_table_elt_t                 *h;
+    ngx_http_v2_connection_t        *h2c;
+    ngx_http_v2_upstream_session_t  *s;
+
+    static ngx_str_t  method_name = ngx_string(":method");
+    static ngx_str_t  scheme_name = ngx_string(":scheme");
+    static ngx_str_t  authority_name = ngx_string(":authority");
+    static ngx_str_t  path_name = ngx_string(":path");
+
+    s = st->session;
+    h2c = &s->h2c;
+
+    p = st->header->pos;
+    end = st->header->last;
+
+    /* request line: "METHOD URI HTTP/1.1" */
+
+    eol = ngx_strlchr(p, end, LF);
+    if (eol == NULL) {
+        goto invalid;
+    }
+
+    method.data = p;
+    p = ngx_strlchr(p, eol, ' ');
+    if (p == NULL) {
+        goto invalid;
+    }
+
+    method.len = p - method.data;
+
+    path.data = p + 1;
+
+    for (p = eol; p > path.data && *p != ' '; p--) { /* void */ }
+
+    if (p == path.data) {
+        goto invalid;
+    }
+
+    path.len = p - path.data;
+
+    ngx_str_null(&authority);
+
+    if (ngx_array_init(&headers, st->pool, 16, sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    st->body_rest = 0;
+
+    len = 2 * NGX_HTTP_V2_INT_OCTETS;
+    tmp_len = path.len;
+
+    for (p = eol + 1; p < end; p = eol + 1) {
+
+        eol = ngx_strlchr(p, end, LF);
+        if (eol == NULL) {
+            goto invalid;
+        }
+
+        if (eol - p <= 1) {
+            /* the empty line */
+            break;
+        }
+
+        colon = ngx_strlchr(p, eol, ':');
+        if (colon == NULL || colon == p) {
+            goto invalid;
+        }
+
+        name.len = colon - p;
+        name.data = ngx_pnalloc(st->pool, name.len);
+        if (name.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_strlow(name.data, p, name.len);
+
+        for (p = colon + 1; p < eol && (*p == ' ' || *p == '\t'); p++) {
+            /* void */
+        }
+
+        value.data = p;
+
+        for (p = eol; p > value.data; p--) {
+            if (p[-1] != CR && p[-1] != ' ' && p[-1] != '\t') {
+                break;
+            }
+        }
+
+        value.len = p - value.data;
+
+        skip = 0;
+
+        switch (name.len) {
+
+        case 2:
+            skip = (ngx_strncmp(name.data, "te", 2) == 0
+                    && (value.len != sizeof("trailers") - 1
+                        || ngx_strncasecmp(value.data, (u_char *) "trailers",
+                                           sizeof("trailers") - 1)
+                           != 0));
+            break;
+
+        case 4:
+            if (ngx_strncmp(name.data, "host", 4) == 0) {
+                authority = value;
+                skip = 1;
+            }
+
+            break;
+
+        case 7:
+            skip = (ngx_strncmp(name.data, "upgrade", 7) == 0);
+            break;
+
+        case 10:
+            skip = (ngx_strncmp(name.data, "connection", 10) == 0
+                    || ngx_strncmp(name.data, "keep-alive", 10) == 0);
+            break;
+
+        case 14:
+            if (ngx_strncmp(name.data, "content-length", 14) == 0) {
+                st->body_rest = ngx_atoof(value.data, value.len);
+
+                if (st->body_rest == NGX_ERROR) {
+                    goto invalid;
+                }
+            }
+
+            break;
+
+        case 16:
+            skip = (ngx_strncmp(name.data, "proxy-connection", 16) == 0);
+            break;
+
+        case 17:
+            if (ngx_strncmp(name.data, "transfer-encoding", 17) == 0) {
+
+                /* an unbuffered body of unknown length */
+
+                if (st->body_rest == 0) {
+                    st->body_rest = -1;
+                }
+
+                skip = 1;
+            }
+
+            break;
+        }
+
+        if (skip) {
+            continue;
+        }
+
+        h = ngx_array_push(&headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->key = name;
+        h->value = value;
+
+        len += 1 + 2 * NGX_HTTP_V2_INT_OCTETS + name.len + value.len;
+        tmp_len = ngx_max(tmp_len, ngx_max(name.len, value.len));
+    }
+
+#if (NGX_HTTP_SSL)
+    if (s->ssl) {
+        ngx_str_set(&scheme, "https");
+
+    } else
+#endif
+    {
+        ngx_str_set(&scheme, "http");
+    }
+
+    len += 4 * (1 + 2 * NGX_HTTP_V2_INT_OCTETS) + method_name.len + method.len
+           + scheme_name.len + scheme.len + authority_name.len + authority.len
+           + path_name.len + path.len;
+
+    tmp_len = ngx_max(tmp_len, ngx_max(method.len, authority.len));
+
+    start = ngx_pnalloc(st->pool, len);
+    tmp = ngx_pnalloc(st->pool, tmp_len);
+
+    if (start == NULL || tmp == NULL) {
+        return NGX_ERROR;
+    }
+
+    pos = start;
+
+    if (h2c->table_update) {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, st->connection.log, 0,
+                       "http2 upstream table size update: %uz min:%uz",
+                       h2c->hpack_enc.size, h2c->hpack_enc.update);
+
+        if (h2c->hpack_enc.update < h2c->hpack_enc.size) {
+            *pos = 32;
+            pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                        h2c->hpack_enc.update);
+        }
+
+        *pos = 32;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                    h2c->hpack_enc.size);
+
+        h2c->hpack_enc.update = h2c->hpack_enc.size;
+        h2c->table_update = 0;
+    }
+
+    pos = ngx_http_v2_write_header(h2c, pos, 0, &method_name, &method, tmp, 1);
+    pos = ngx_http_v2_write_header(h2c, pos, 0, &scheme_name, &scheme, tmp, 1);
+
+    if (authority.len) {
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &authority_name,
+                                       &authority, tmp, 1);
+    }
+
+    /* ":path" is index 4 of the static table, the value is not indexed */
+
+    pos = ngx_http_v2_write_header(h2c, pos, 4, &path_name, &path, tmp, 0);
+
+    h = headers.elts;
+
+    for (i = 0; i < headers.nelts; i++) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, st->connection.log, 0,
+                       "http2 upstream output header: \"%V: %V\"",
+                       &h[i].key, &h[i].value);
+
+        indexing = !ngx_http_v2_is_volatile(&h[i].key);
+
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &h[i].key, &h[i].value,
+                                       tmp, indexing);
+    }
+
+    st->sid = s->next_sid;
+    s->next_sid += 2;
+
+    if (s->next_sid > NGX_HTTP_V2_MAX_SID) {
+
+        /* the identifiers are exhausted, new streams go to a new session */
+
+        s->h2c.goaway = 1;
+
+        if (s->linked) {
+            ngx_queue_remove(&s->queue);
+            s->linked = 0;
+        }
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_HTTP, st->connection.log, 0,
+                   "http2 upstream request sid:%ui \"%V %V\" body:%O",
+                   st->sid, &method, &path, st->body_rest);
+
+    type = NGX_HTTP_V2_HEADERS_FRAME;
+    flags = (st->body_rest == 0) ? NGX_HTTP_V2_END_STREAM_FLAG
+                                 : NGX_HTTP_V2_NO_FLAG;
+
+    p = start;
+
+    for ( ;; ) {
+        rest = pos - p;
+
+        if (rest > s->h2c.frame_size) {
+            rest = s->h2c.frame_size;
+
+        } else {
+            flags |= NGX_HTTP_V2_END_HEADERS_FLAG;
+        }
+
+        if (ngx_http_v2_upstream_frame(s, rest, type, flags, st->sid)
+            != NGX_OK
+            || ngx_http_v2_upstream_write(s, p, rest) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        p += rest;
+
+        if (p == pos) {
+            break;
+        }
+
+        type = NGX_HTTP_V2_CONTINUATION_FRAME;
+        flags = NGX_HTTP_V2_NO_FLAG;
+    }
+
+    st->headers_sent = 1;
+
+    if (st->body_rest == 0) {
+        st->out_closed = 1;
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ALERT, st->connection.log, 0,
+                  "cannot convert request header to HTTP/2");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_append(ngx_http_v2_upstream_stream_t *st, u_char *p,
+    size_t len)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    while (len) {
+        cl = st->in_last;
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+
+            if (st->free) {
+                cl = st->free;
+                st->free = cl->next;
+
+            } else {
+                cl = ngx_alloc_chain_link(st->pool);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                cl->buf = ngx_create_temp_buf(st->pool,
+                                              NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE);
+                if (cl->buf == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            cl->next = NULL;
+
+            if (st->in_last) {
+                st->in_last->next = cl;
+
+            } else {
+                st->in = cl;
+            }
+
+            st->in_last = cl;
+        }
+
+        b = cl->buf;
+
+        n = ngx_min(len, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, p, n);
+
+        p += n;
+        len -= n;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_upstream_close_input(ngx_http_v2_upstream_stream_t *st)
+{
+    st->in_closed = 1;
+
+    if (st->out_closed) {
+        ngx_http_v2_upstream_stream_done(st);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_stream_error(ngx_http_v2_upstream_stream_t *st,
+    ngx_uint_t code)
+{
+    (void) ngx_http_v2_upstream_send_rst_stream(st->session, st->sid, code);
+
+    st->error = 1;
+
+    ngx_http_v2_upstream_stream_done(st);
+
+    ngx_http_v2_upstream_post_read(st);
+    ngx_http_v2_upstream_post_write(st);
+}
+
+
+static void
+ngx_http_v2_upstream_stream_done(ngx_http_v2_upstream_stream_t *st)
+{
+    ngx_http_v2_upstream_session_t  *s;
+
+    if (st->done || !st->admitted) {
+        return;
+    }
+
+    s = st->session;
+
+    st->done = 1;
+    s->active--;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, &s->log, 0,
+                   "http2 upstream stream %p sid:%ui done, active:%ui",
+                   st, st->sid, s->active);
+
+    ngx_http_v2_upstream_schedule(s);
+}
+
+
+static void
+ngx_http_v2_upstream_log_stream_error(ngx_http_v2_upstream_stream_t *st)
+{
+    ngx_http_v2_upstream_session_t  *s;
+
+    /* protocol errors of a stream are logged when found */
+
+    if (st->logged) {
+        return;
+    }
+
+    st->logged = 1;
+
+    s = st->session;
+
+    if (st->unprocessed) {
+        ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                      "upstream did not process request on %d HTTP/2 "
+                      "connections in a row", NGX_HTTP_V2_UPSTREAM_RETRIES + 1);
+
+    } else if (st->reset) {
+        ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                      "upstream reset stream with error %ui",
+                      st->reset_code);
+
+    } else if (s->error) {
+        ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                      "upstream HTTP/2 connection failed");
+
+    } else if (s->h2c.goaway && !st->response) {
+        ngx_log_error(NGX_LOG_ERR, st->connection.log, 0,
+                      "upstream closed HTTP/2 connection "
+                      "before processing request");
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_post_read(ngx_http_v2_upstream_stream_t *st)
+{
+    st->read.ready = 1;
+
+    if (!st->read.posted) {
+        ngx_post_event(&st->read, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_post_write(ngx_http_v2_upstream_stream_t *st)
+{
+    st->write.ready = 1;
+
+    if (!st->write.posted) {
+        ngx_post_event(&st->write, &ngx_posted_events);
+    }
+}
+
+
+static ngx_http_v2_upstream_stream_t *
+ngx_http_v2_upstream_find_stream(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t sid)
+{
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    for (q = ngx_queue_head(&s->streams);
+         q != ngx_queue_sentinel(&s->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        if (st->sid == sid) {
+            return st;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_v2_upstream_schedule(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    while (s->ready
+           && !s->h2c.goaway
+           && !s->error
+           && s->active < s->max_streams
+           && !ngx_queue_empty(&s->waiting))
+    {
+        q = ngx_queue_head(&s->waiting);
+        ngx_queue_remove(q);
+
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        st->admitted = 1;
+        s->active++;
+
+        ngx_queue_insert_tail(&s->streams, &st->queue);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &s->log, 0,
+                       "http2 upstream stream %p admitted, active:%ui",
+                       st, s->active);
+
+        ngx_http_v2_upstream_admit(st);
+    }
+}
+
+
+static void
+ngx_http_v2_upstream_admit(ngx_http_v2_upstream_stream_t *st)
+{
+    /* the header of a stream moved from another session is sent again */
+
+    if (st->header_done && !st->headers_sent) {
+
+        if (ngx_http_v2_upstream_create_headers(st) != NGX_OK) {
+            st->error = 1;
+            ngx_http_v2_upstream_post_read(st);
+
+        } else {
+            ngx_http_v2_upstream_post_send(st->session);
+        }
+    }
+
+    ngx_http_v2_upstream_post_write(st);
+}
+
+
+static void
+ngx_http_v2_upstream_unblock(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_queue_t                    *q;
+    ngx_http_v2_upstream_stream_t  *st;
+
+    if (s->h2c.send_window == 0
+        || s->out_size >= NGX_HTTP_V2_UPSTREAM_OUTPUT_LIMIT)
+    {
+        return;
+    }
+
+    for (q = ngx_queue_head(&s->streams);
+         q != ngx_queue_sentinel(&s->streams);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_http_v2_upstream_stream_t, queue);
+
+        if (st->blocked && st->send_window > 0) {
+            st->blocked = 0;
+            ngx_http_v2_upstream_post_write(st);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_write(ngx_http_v2_upstream_session_t *s, u_char *data,
+    size_t len)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    while (len) {
+        cl = s->out_last;
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+
+            if (s->free) {
+                cl = s->free;
+                s->free = cl->next;
+
+            } else {
+                cl = ngx_alloc_chain_link(s->pool);
+                if (cl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                cl->buf = ngx_create_temp_buf(s->pool,
+                                              NGX_HTTP_V2_UPSTREAM_BUFFER_SIZE);
+                if (cl->buf == NULL) {
+                    return NGX_ERROR;
+                }
+
+                /* frames are not held in the SSL buffer */
+
+                cl->buf->flush = 1;
+            }
+
+            cl->next = NULL;
+
+            if (s->out_last) {
+                s->out_last->next = cl;
+
+            } else {
+                s->out = cl;
+            }
+
+            s->out_last = cl;
+        }
+
+        b = cl->buf;
+
+        n = ngx_min(len, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, data, n);
+
+        data += n;
+        len -= n;
+        s->out_size += n;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_frame(ngx_http_v2_upstream_session_t *s, size_t len,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid)
+{
+    u_char  head[NGX_HTTP_V2_FRAME_HEADER_SIZE], *p;
+
+    p = ngx_http_v2_write_uint32(head, len << 8 | type);
+    *p++ = (u_char) flags;
+    (void) ngx_http_v2_write_sid(p, sid);
+
+    return ngx_http_v2_upstream_write(s, head, NGX_HTTP_V2_FRAME_HEADER_SIZE);
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_send_settings(ngx_http_v2_upstream_session_t *s)
+{
+    u_char  buf[2 * NGX_HTTP_V2_SETTINGS_PARAM_SIZE], *p;
+
+    p = ngx_http_v2_write_uint16(buf, NGX_HTTP_V2_ENABLE_PUSH_SETTING);
+    p = ngx_http_v2_write_uint32(p, 0);
+
+    p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING);
+    p = ngx_http_v2_write_uint32(p, NGX_HTTP_V2_UPSTREAM_WINDOW);
+
+    if (ngx_http_v2_upstream_frame(s, sizeof(buf), NGX_HTTP_V2_SETTINGS_FRAME,
+                                   NGX_HTTP_V2_NO_FLAG, 0)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_v2_upstream_write(s, buf, sizeof(buf));
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_send_window_update(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t sid, size_t window)
+{
+    u_char  buf[NGX_HTTP_V2_WINDOW_UPDATE_SIZE];
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &s->log, 0,
+                   "http2 upstream send WINDOW_UPDATE sid:%ui window:%uz",
+                   sid, window);
+
+    (void) ngx_http_v2_write_uint32(buf, window);
+
+    if (ngx_http_v2_upstream_frame(s, sizeof(buf),
+                                   NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                   NGX_HTTP_V2_NO_FLAG, sid)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_v2_upstream_write(s, buf, sizeof(buf));
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_send_rst_stream(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t sid, ngx_uint_t status)
+{
+    u_char  buf[NGX_HTTP_V2_RST_STREAM_SIZE];
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &s->log, 0,
+                   "http2 upstream send RST_STREAM sid:%ui status:%ui",
+                   sid, status);
+
+    (void) ngx_http_v2_write_uint32(buf, status);
+
+    if (ngx_http_v2_upstream_frame(s, sizeof(buf),
+                                   NGX_HTTP_V2_RST_STREAM_FRAME,
+                                   NGX_HTTP_V2_NO_FLAG, sid)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_v2_upstream_write(s, buf, sizeof(buf));
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_send_goaway(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t status)
+{
+    u_char  buf[NGX_HTTP_V2_GOAWAY_SIZE], *p;
+
+    /* no streams are initiated by the peer */
+
+    p = ngx_http_v2_write_sid(buf, 0);
+    (void) ngx_http_v2_write_uint32(p, status);
+
+    if (ngx_http_v2_upstream_frame(s, sizeof(buf), NGX_HTTP_V2_GOAWAY_FRAME,
+                                   NGX_HTTP_V2_NO_FLAG, 0)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_v2_upstream_write(s, buf, sizeof(buf));
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_connection_error(ngx_http_v2_upstream_session_t *s,
+    ngx_uint_t status)
+{
+    if (ngx_http_v2_upstream_send_goaway(s, status) == NGX_OK) {
+        (void) ngx_http_v2_upstream_send(s);
+    }
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_v2_upstream_send(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_chain_t       *cl, *ln, *chain;
+    ngx_connection_t  *c;
+
+    c = s->connection;
+
+    if (!s->connected || c->error || (s->out == NULL && !c->buffered)) {
+        return NGX_OK;
+    }
+
+    chain = c->send_chain(c, s->out, 0);
+
+    if (chain == NGX_CHAIN_ERROR) {
+        c->error = 1;
+        return NGX_ERROR;
+    }
+
+    for (cl = s->out; cl && cl != chain; /* void */) {
+        ln = cl;
+        cl = cl->next;
+
+        ln->buf->pos = ln->buf->start;
+        ln->buf->last = ln->buf->start;
+
+        ln->next = s->free;
+        s->free = ln;
+    }
+
+    s->out = chain;
+    s->out_size = 0;
+
+    if (chain == NULL) {
+        s->out_last = NULL;
+
+    } else {
+        for (cl = chain; cl; cl = cl->next) {
+            s->out_size += cl->buf->last - cl->buf->pos;
+        }
+    }
+
+    if ((s->out || c->buffered)
+        && ngx_handle_write_event(c->write, 0) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_http_v2_upstream_unblock(s);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_upstream_post_send(ngx_http_v2_upstream_session_t *s)
+{
+    ngx_connection_t  *c;
+
+    c = s->connection;
+
+    if (s->connected && !s->error && !c->write->posted) {
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+}
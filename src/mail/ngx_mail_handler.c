@@ -41,6 +41,14 @@ ngx_mail_init_connection(ngx_connection_t *c)
 #endif
 
 
+    /*
+     * STARTTLS hands the socket over to OpenSSL, so the client data must
+     * not be taken in advance by a multishot io_uring recv
+     */
+
+    c->recv = ngx_os_io.recv;
+    c->recv_chain = ngx_os_io.recv_chain;
+
     /* find the server configuration for the address:port */
 
     port = c->listening->servers;
@@ -13,6 +13,13 @@
 extern int            ngx_eventfd;
 extern aio_context_t  ngx_aio_ctx;
 
+#if (NGX_HAVE_IOURING)
+extern ngx_uint_t     ngx_iouring_aio;
+
+ngx_int_t ngx_iouring_aio_read(ngx_event_aio_t *aio, u_char *buf, size_t size,
+    off_t offset);
+#endif
+
 
 static void ngx_file_aio_event_handler(ngx_event_t *ev);
 
@@ -93,6 +100,24 @@ ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
         return NGX_ERROR;
     }
 
+    ev->handler = ngx_file_aio_event_handler;
+
+#if (NGX_HAVE_IOURING)
+
+    if (ngx_iouring_aio) {
+        if (ngx_iouring_aio_read(aio, buf, size, offset) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ev->active = 1;
+        ev->ready = 0;
+        ev->complete = 0;
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
     ngx_memzero(&aio->aiocb, sizeof(struct iocb));
 
     aio->aiocb.aio_data = (uint64_t) (uintptr_t) ev;
@@ -104,8 +129,6 @@ ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
     aio->aiocb.aio_flags = IOCB_FLAG_RESFD;
     aio->aiocb.aio_resfd = ngx_eventfd;
 
-    ev->handler = ngx_file_aio_event_handler;
-
     piocb[0] = &aio->aiocb;
 
     if (io_submit(ngx_aio_ctx, 1, piocb) == 1) {
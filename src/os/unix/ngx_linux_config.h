@@ -89,9 +89,17 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IOURING)
+#include <linux/io_uring.h>
+#endif
+
+
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
+#if (NGX_HAVE_INOTIFY)
+#include <sys/inotify.h>
+#endif
 #include <sys/syscall.h>
 #if (NGX_HAVE_FILE_AIO)
 #include <linux/aio_abi.h>
@@ -11,12 +11,17 @@
 #include <ngx_channel.h>
 
 
+/* how long the master waits for the workers to save their state */
+#define NGX_SAVE_TIMEOUT  1000
+
+
 static void ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n,
     ngx_int_t type);
 static void ngx_start_cache_manager_processes(ngx_cycle_t *cycle,
     ngx_uint_t respawn);
 static void ngx_pass_open_channel(ngx_cycle_t *cycle, ngx_channel_t *ch);
 static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo);
+static void ngx_save_worker_processes(ngx_cycle_t *cycle);
 static ngx_uint_t ngx_reap_children(ngx_cycle_t *cycle);
 static void ngx_master_process_exit(ngx_cycle_t *cycle);
 static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data);
@@ -240,6 +245,11 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
             ngx_cycle = cycle;
             ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx,
                                                    ngx_core_module);
+
+            if (cycle->save_handler) {
+                ngx_save_worker_processes(cycle);
+            }
+
             ngx_start_worker_processes(cycle, ccf->worker_processes,
                                        NGX_PROCESS_JUST_RESPAWN);
             ngx_start_cache_manager_processes(cycle, 1);
@@ -553,6 +563,79 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
 }
 
 
+static void
+ngx_save_worker_processes(ngx_cycle_t *cycle)
+{
+#if !(NGX_BROKEN_SCM_RIGHTS)
+
+    ngx_int_t      i, n, k, pending[NGX_MAX_PROCESSES];
+    ngx_msec_t     wait;
+    ngx_channel_t  ch;
+
+    n = 0;
+
+    for (i = 0; i < ngx_last_process; i++) {
+
+        if (ngx_processes[i].pid == -1
+            || ngx_processes[i].exiting
+            || ngx_processes[i].exited
+            || ngx_processes[i].detached
+            || ngx_processes[i].channel[0] == -1)
+        {
+            continue;
+        }
+
+        /* a reply to a previous request that was not waited for */
+
+        while (ngx_read_channel(ngx_processes[i].channel[0], &ch,
+                                sizeof(ngx_channel_t), cycle->log)
+               == NGX_OK)
+        {
+            /* void */
+        }
+
+        ngx_memzero(&ch, sizeof(ngx_channel_t));
+        ch.command = NGX_CMD_SAVE;
+        ch.fd = -1;
+
+        if (ngx_write_channel(ngx_processes[i].channel[0],
+                              &ch, sizeof(ngx_channel_t), cycle->log)
+            == NGX_OK)
+        {
+            pending[n++] = i;
+        }
+    }
+
+    /* the processes answer on the same channel once they are done */
+
+    for (wait = 0; n && wait < NGX_SAVE_TIMEOUT; wait += 10) {
+
+        ngx_msleep(10);
+
+        for (k = 0; k < n; /* void */) {
+
+            if (ngx_read_channel(ngx_processes[pending[k]].channel[0], &ch,
+                                 sizeof(ngx_channel_t), cycle->log)
+                == NGX_AGAIN)
+            {
+                k++;
+                continue;
+            }
+
+            pending[k] = pending[--n];
+        }
+    }
+
+    if (n) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "%i processes did not save their state in %M ms",
+                      n, (ngx_msec_t) NGX_SAVE_TIMEOUT);
+    }
+
+#endif
+}
+
+
 static ngx_uint_t
 ngx_reap_children(ngx_cycle_t *cycle)
 {
@@ -1061,6 +1144,15 @@ ngx_channel_handler(ngx_event_t *ev)
             ngx_reopen = 1;
             break;
 
+        case NGX_CMD_SAVE:
+
+            if (ngx_cycle->save_handler) {
+                ngx_cycle->save_handler((ngx_cycle_t *) ngx_cycle);
+            }
+
+            ngx_write_channel(c->fd, &ch, sizeof(ngx_channel_t), ev->log);
+            break;
+
         case NGX_CMD_OPEN_CHANNEL:
 
             ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,